@@ -0,0 +1,1319 @@
+﻿//-----------------------------------------------------------------------------
+// File : main.cpp
+// Desc : Micro Benchmark Entry Point.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcBench.h>
+#include <rtcBvh.h>
+#include <rtcDevice.h>
+#include <rtcFrameWriter.h>
+#include <rtcHitSort.h>
+#include <rtcLog.h>
+#include <rtcOpacityMask.h>
+#include <rtcPngLoader.h>
+#include <rtcRandom.h>
+#include <rtcSceneBench.h>
+#include <rtcTonemap.h>
+#include <fpng.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <rtcNewDelete.h>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t kImageWidth      = 1920;
+constexpr uint32_t kImageHeight     = 1080;
+constexpr uint32_t kGridSize        = 224;              // 頂点数. 三角形数は 2 * 223^2 = 99458.
+constexpr uint32_t kSliverCount     = 4096;             // 細長い斜めの三角形の数. 空間分割が効く形状.
+constexpr float    kSliverBudget    = 4.0f;             // 細長い三角形の複製参照数の上限 (三角形数との比).
+constexpr uint32_t kRayCount        = 4096;             // 2のべき乗.
+constexpr uint32_t kRayMask         = kRayCount - 1;
+constexpr size_t   kHashBytes       = 4 * 1024 * 1024;
+constexpr uint32_t kDescriptorBatch = 256;
+constexpr uint32_t kStreamBandRows  = 16;               // ストリーミングエンコードで一度に渡す行数.
+constexpr uint32_t kPngBatchCount   = 8;                // バッチ展開の枚数.
+constexpr uint32_t kFrameWriteCount = 16;               // 1 反復で書き出すフレーム数.
+constexpr char     kFrameWriteDir[] = "bench_frames";   // フレーム書き出しの出力先です.
+constexpr uint32_t kAlphaSize       = 512;              // アルファテクスチャの解像度.
+constexpr uint32_t kAlphaCells      = 8;                // アルファテクスチャに並べる葉の数 (kAlphaCells^2 枚).
+constexpr uint32_t kOpacityGrid     = 32;               // アルファテストするメッシュの分割数. 三角形数は 2 * 32^2 = 2048.
+constexpr uint32_t kHitInstances    = 256;              // ウェーブフロントのインスタンス数.
+constexpr uint32_t kHitMaterials    = 64;               // ウェーブフロントのマテリアル数.
+constexpr uint32_t kHitPrimitives   = 4096;             // インスタンスあたりのプリミティブ数.
+constexpr uint32_t kHitTileSize     = 8;                // 同じインスタンスが写るピクセルのタイル幅.
+constexpr uint32_t kMaterialTable   = 16384;            // マテリアルごとのテーブルの要素数 (64KB). 全体で L2 に収まらない大きさ.
+
+///////////////////////////////////////////////////////////////////////////////
+// MESH_SHAPE enum
+///////////////////////////////////////////////////////////////////////////////
+enum MESH_SHAPE
+{
+    MESH_SHAPE_GRID,        // 波打つ格子です.
+    MESH_SHAPE_SLIVERS,     // 対角方向に伸びた細長い三角形です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ImageFixture structure
+///////////////////////////////////////////////////////////////////////////////
+struct ImageFixture
+{
+    std::vector<rtc::float3>    Hdr;
+    std::vector<uint8_t>        Ldr;
+    std::vector<uint8_t>        Png;
+    std::vector<uint8_t>        Decoded;
+    std::vector<uint8_t>        Bytes;
+    std::vector<uint8_t>        Band;       // ストリーミングエンコード用の kStreamBandRows 行分のバッファです.
+    std::vector<uint8_t>        Stream;     // ストリーミングエンコードの出力先です.
+    std::vector<uint8_t>        PngGeneral; // fdEC チャンクを外して汎用パスで展開させる PNG です.
+    std::vector<uint8_t>        Textures;   // バッチ展開の出力先です (kPngBatchCount 枚分).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PngBatchCase structure
+///////////////////////////////////////////////////////////////////////////////
+struct PngBatchCase
+{
+    ImageFixture*   pImage      = nullptr;
+    bool            General     = false;    // 汎用パスの PNG を使うかどうか.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ChecksumCase structure
+///////////////////////////////////////////////////////////////////////////////
+struct ChecksumCase
+{
+    ImageFixture*   pImage      = nullptr;
+    uint32_t        SimdLevel   = fpng::FPNG_SIMD_SCALAR;   // fpng::FPNG_SIMD_XXX.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameWriteCase structure
+///////////////////////////////////////////////////////////////////////////////
+struct FrameWriteCase
+{
+    ImageFixture*       pImage      = nullptr;
+    rtc::FrameWriter*   pWriter     = nullptr;  // nullptr なら fopen / fwrite で書き出します.
+    uint64_t            Counter     = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// MeshFixture structure
+///////////////////////////////////////////////////////////////////////////////
+struct MeshFixture
+{
+    std::vector<rtc::float3>    Positions;
+    std::vector<uint32_t>       Indices;
+    rtc::BvhBuildDesc           Desc;
+    rtc::Bvh                    Bvh;
+    rtc::Bvh8                   Bvh8;
+    std::vector<rtc::BvhRay>    Rays;           // メッシュに向かうレイです.
+    std::vector<rtc::float3>    InvDirs;        // Rays の逆数方向です.
+    std::vector<rtc::BvhRay>    TriangleRays;   // Bvh8 の三角形 i の重心に向かうレイです.
+    uint32_t                    Cursor = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// OpacityFixture structure
+///////////////////////////////////////////////////////////////////////////////
+struct OpacityFixture
+{
+    std::vector<rtc::float2>    TexCoords;
+    std::vector<uint32_t>       Indices;
+    std::vector<uint8_t>        Alpha;          // 葉を並べたアルファテクスチャです.
+    rtc::AlphaImage             Image;
+    rtc::OpacityMask            Mask;
+    std::vector<uint32_t>       HitTriangles;   // 任意ヒットを呼び出す三角形番号です.
+    std::vector<rtc::float2>    HitBarycentrics;// 任意ヒットを呼び出す重心座標です.
+    rtc::AnyHitStats            LastStats;      // 最後の反復の任意ヒット統計です.
+    uint32_t                    Cursor = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// WavefrontFixture structure
+///////////////////////////////////////////////////////////////////////////////
+struct WavefrontFixture
+{
+    std::vector<rtc::HitRecord> Hits;           // レイ順のヒットです.
+    std::vector<uint32_t>       MaterialIds;    // インスタンスごとのマテリアル番号です.
+    std::vector<float>          Tables;         // マテリアルごとに kMaterialTable 個のテーブルです.
+    std::vector<float>          Output;         // レイごとのシェーディング結果です.
+    rtc::HitSorter              Sorter;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// HitSortCase structure
+///////////////////////////////////////////////////////////////////////////////
+struct HitSortCase
+{
+    WavefrontFixture*   pWavefront  = nullptr;
+    bool                Sort        = false;
+    rtc::HitSortStats   LastStats;              // 最後の反復の統計です.
+};
+
+//-----------------------------------------------------------------------------
+//      テスト画像を生成します.
+//-----------------------------------------------------------------------------
+void CreateImage(ImageFixture& fixture)
+{
+    rtc::Random random(1, 2, 3);
+
+    fixture.Hdr.resize(size_t(kImageWidth) * kImageHeight);
+    for(auto y=0u; y<kImageHeight; ++y)
+    {
+        for(auto x=0u; x<kImageWidth; ++x)
+        {
+            auto u = float(x) / float(kImageWidth);
+            auto v = float(y) / float(kImageHeight);
+
+            // なめらかなグラデーションに少しノイズを乗せて, レンダリング結果に近い圧縮率にする.
+            auto pattern = 0.5f + 0.5f * sinf(u * 20.0f) * cosf(v * 20.0f);
+            auto noise   = random.GetAsF32() * 0.05f;
+            fixture.Hdr[size_t(y) * kImageWidth + x] = rtc::float3(u * 4.0f + noise, v * 4.0f + noise, pattern * 2.0f + noise);
+        }
+    }
+
+    rtc::TonemapDesc desc;
+    fixture.Ldr.resize(size_t(kImageWidth) * kImageHeight * desc.Channels);
+    rtc::Tonemap(desc, fixture.Hdr.data(), kImageWidth, kImageHeight, fixture.Ldr.data());
+
+    fpng::fpng_encode_image_to_memory(fixture.Ldr.data(), kImageWidth, kImageHeight, 3, fixture.Png);
+
+    // fpng の識別チャンク (IHDR の直後) を外したものは fpng 以外の PNG として扱われます.
+    const size_t kIhdrEnd = 8 + 25;
+    auto fdecSize = 12 + ((size_t(fixture.Png[kIhdrEnd + 2]) << 8) | fixture.Png[kIhdrEnd + 3]);
+    fixture.PngGeneral.assign(fixture.Png.begin(), fixture.Png.begin() + kIhdrEnd);
+    fixture.PngGeneral.insert(fixture.PngGeneral.end(), fixture.Png.begin() + kIhdrEnd + fdecSize, fixture.Png.end());
+
+    fixture.Decoded .resize(size_t(kImageWidth) * kImageHeight * 3);
+    fixture.Textures.resize(size_t(kImageWidth) * kImageHeight * 3 * kPngBatchCount);
+    fixture.Band.resize(size_t(kStreamBandRows) * kImageWidth * desc.Channels);
+    fixture.Stream.reserve(fixture.Png.size());
+
+    fixture.Bytes.resize(kHashBytes);
+    for(auto& item : fixture.Bytes)
+    { item = uint8_t(random.GetAsU32()); }
+}
+
+//-----------------------------------------------------------------------------
+//      波打つ格子を生成します.
+//-----------------------------------------------------------------------------
+void CreateGrid(MeshFixture& fixture)
+{
+    auto& positions = fixture.Positions;
+    auto& indices   = fixture.Indices;
+
+    positions.reserve(kGridSize * kGridSize);
+    for(auto z=0u; z<kGridSize; ++z)
+    {
+        for(auto x=0u; x<kGridSize; ++x)
+        {
+            auto px = float(x) / float(kGridSize - 1) * 2.0f - 1.0f;
+            auto pz = float(z) / float(kGridSize - 1) * 2.0f - 1.0f;
+            positions.push_back(rtc::float3(px, 0.1f * sinf(px * 8.0f) * cosf(pz * 8.0f), pz));
+        }
+    }
+
+    indices.reserve((kGridSize - 1) * (kGridSize - 1) * 6);
+    for(auto z=0u; z<kGridSize - 1; ++z)
+    {
+        for(auto x=0u; x<kGridSize - 1; ++x)
+        {
+            auto i0 = z * kGridSize + x;
+            auto i1 = i0 + 1;
+            auto i2 = i0 + kGridSize;
+            auto i3 = i2 + 1;
+            indices.push_back(i0); indices.push_back(i2); indices.push_back(i1);
+            indices.push_back(i1); indices.push_back(i2); indices.push_back(i3);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      対角方向に伸びた細長い三角形を生成します. AABB が大きく重なるので空間分割が効きます.
+//-----------------------------------------------------------------------------
+void CreateSlivers(MeshFixture& fixture)
+{
+    auto& positions = fixture.Positions;
+    auto& indices   = fixture.Indices;
+
+    rtc::Random random(1, 2, 3);
+
+    positions.reserve(kSliverCount * 3);
+    indices  .reserve(kSliverCount * 3);
+    for(auto i=0u; i<kSliverCount; ++i)
+    {
+        // (-1, -1) - (1, 1) の対角線に沿って, 直交方向にずらして並べる.
+        auto offset = random.GetAsF32() * 2.0f - 1.0f;
+        auto start  = random.GetAsF32() * 0.5f - 1.0f;
+        auto length = 1.0f + random.GetAsF32() * 0.5f;
+        auto height = random.GetAsF32() * 0.4f - 0.2f;
+        auto width  = 0.002f + random.GetAsF32() * 0.004f;
+
+        auto p0 = rtc::float3(start + offset, height, start - offset);
+        auto p1 = rtc::float3(start + length + offset, height, start + length - offset);
+        auto p2 = rtc::float3(start + offset + width, height + width, start - offset - width);
+
+        auto base = uint32_t(positions.size());
+        positions.push_back(p0);
+        positions.push_back(p1);
+        positions.push_back(p2);
+        indices.push_back(base + 0);
+        indices.push_back(base + 1);
+        indices.push_back(base + 2);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      テストメッシュと BVH を生成します. spatialSplits が true なら SBVH で構築します.
+//-----------------------------------------------------------------------------
+bool CreateMesh(MeshFixture& fixture, MESH_SHAPE shape, bool spatialSplits)
+{
+    if (shape == MESH_SHAPE_SLIVERS)
+    { CreateSlivers(fixture); }
+    else
+    { CreateGrid(fixture); }
+
+    auto& positions = fixture.Positions;
+    auto& indices   = fixture.Indices;
+
+    auto& desc = fixture.Desc;
+    desc.pPositions     = positions.data();
+    desc.pIndices       = indices.data();
+    desc.VertexCount    = uint32_t(positions.size());
+    desc.TriangleCount  = uint32_t(indices.size() / 3);
+    desc.ThreadCount    = 1;    // 計測を安定させるためシングルスレッドで構築.
+    desc.EnableSpatialSplits = spatialSplits;
+
+    // 細長い三角形は何度も分割しないと締まらないので, 既定の上限では足りない.
+    if (shape == MESH_SHAPE_SLIVERS)
+    { desc.SpatialSplitBudget = kSliverBudget; }
+
+    if (!fixture.Bvh.Build(desc))
+    {
+        RTC_ELOG("Error : Bvh::Build() Failed.");
+        return false;
+    }
+
+    if (!fixture.Bvh8.Build(fixture.Bvh))
+    {
+        RTC_ELOG("Error : Bvh8::Build() Failed.");
+        return false;
+    }
+
+    rtc::Random random(4, 5, 6);
+
+    fixture.Rays   .resize(kRayCount);
+    fixture.InvDirs.resize(kRayCount);
+    for(auto i=0u; i<kRayCount; ++i)
+    {
+        auto& ray = fixture.Rays[i];
+        ray.Origin    = rtc::float3(random.GetAsF32() * 2.0f - 1.0f, 1.0f, random.GetAsF32() * 2.0f - 1.0f);
+        ray.Direction = rtc::Normalize(rtc::float3(random.GetAsF32() * 0.6f - 0.3f, -1.0f, random.GetAsF32() * 0.6f - 0.3f));
+        ray.TMin      = 0.0f;
+        ray.TMax      = FLT_MAX;
+        fixture.InvDirs[i] = rtc::CalcInvDir(ray.Direction);
+    }
+
+    fixture.TriangleRays.resize(kRayCount);
+    for(auto i=0u; i<kRayCount; ++i)
+    {
+        auto& tri    = fixture.Bvh8.GetTriangles()[i % fixture.Bvh8.GetTriangleCount()];
+        auto  center = tri.V0 + (tri.E1 + tri.E2) * (1.0f / 3.0f);
+
+        auto& ray = fixture.TriangleRays[i];
+        ray.Origin    = fixture.Rays[i].Origin;
+        ray.Direction = rtc::Normalize(center - ray.Origin);
+        ray.TMin      = 0.0f;
+        ray.TMax      = FLT_MAX;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      アルファテストするメッシュとオパシティマスクを生成します.
+//-----------------------------------------------------------------------------
+bool CreateOpacity(OpacityFixture& fixture)
+{
+    // 葉の代わりに円を格子状に並べる. 円の内側が不透明.
+    fixture.Alpha.resize(size_t(kAlphaSize) * kAlphaSize);
+    auto cellSize = float(kAlphaSize) / float(kAlphaCells);
+    for(auto y=0u; y<kAlphaSize; ++y)
+    {
+        for(auto x=0u; x<kAlphaSize; ++x)
+        {
+            auto cx = fmodf(float(x) + 0.5f, cellSize) / cellSize - 0.5f;
+            auto cy = fmodf(float(y) + 0.5f, cellSize) / cellSize - 0.5f;
+            fixture.Alpha[size_t(y) * kAlphaSize + x] = (cx * cx + cy * cy < 0.16f) ? 255 : 0;
+        }
+    }
+
+    fixture.Image.Width   = kAlphaSize;
+    fixture.Image.Height  = kAlphaSize;
+    fixture.Image.pPixels = fixture.Alpha.data();
+
+    auto& texcoords = fixture.TexCoords;
+    auto& indices   = fixture.Indices;
+    for(auto y=0u; y<=kOpacityGrid; ++y)
+    {
+        for(auto x=0u; x<=kOpacityGrid; ++x)
+        { texcoords.push_back(rtc::float2(float(x) / float(kOpacityGrid), float(y) / float(kOpacityGrid))); }
+    }
+
+    for(auto y=0u; y<kOpacityGrid; ++y)
+    {
+        for(auto x=0u; x<kOpacityGrid; ++x)
+        {
+            auto i0 = y * (kOpacityGrid + 1) + x;
+            auto i1 = i0 + 1;
+            auto i2 = i0 + kOpacityGrid + 1;
+            auto i3 = i2 + 1;
+            indices.push_back(i0); indices.push_back(i2); indices.push_back(i1);
+            indices.push_back(i1); indices.push_back(i2); indices.push_back(i3);
+        }
+    }
+
+    rtc::OpacityMaskDesc desc;
+    desc.pTexCoords    = texcoords.data();
+    desc.pIndices      = indices.data();
+    desc.TriangleCount = uint32_t(indices.size() / 3);
+    desc.Alpha         = fixture.Image;
+
+    if (!fixture.Mask.Build(desc))
+    {
+        RTC_ELOG("Error : OpacityMask::Build() Failed.");
+        return false;
+    }
+
+    rtc::Random random(7, 8, 9);
+    fixture.HitTriangles   .resize(kRayCount);
+    fixture.HitBarycentrics.resize(kRayCount);
+    for(auto i=0u; i<kRayCount; ++i)
+    {
+        auto u = random.GetAsF32();
+        auto v = random.GetAsF32();
+        if (u + v > 1.0f)
+        { u = 1.0f - u; v = 1.0f - v; }
+
+        fixture.HitTriangles   [i] = random.GetAsU32() % desc.TriangleCount;
+        fixture.HitBarycentrics[i] = rtc::float2(u, v);
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      アルファテストのコールバックです. 最近傍のテクセルを参照します.
+//-----------------------------------------------------------------------------
+bool AlphaTest(void* pUser, uint32_t triangleIndex, const rtc::float2& barycentrics)
+{
+    auto& fixture = *static_cast<const OpacityFixture*>(pUser);
+    auto& uv0 = fixture.TexCoords[fixture.Indices[triangleIndex * 3 + 0]];
+    auto& uv1 = fixture.TexCoords[fixture.Indices[triangleIndex * 3 + 1]];
+    auto& uv2 = fixture.TexCoords[fixture.Indices[triangleIndex * 3 + 2]];
+    auto  uv  = uv0 * (1.0f - barycentrics.x - barycentrics.y) + uv1 * barycentrics.x + uv2 * barycentrics.y;
+
+    auto x = int(floorf(uv.x * float(kAlphaSize)));
+    auto y = int(floorf(uv.y * float(kAlphaSize)));
+    return fixture.Image.Fetch(x, y) >= fixture.Image.Cutoff;
+}
+
+//-----------------------------------------------------------------------------
+//      マルチマテリアルのウェーブフロントを生成します.
+//      タイルごとにインスタンスを選び, 5% 程度をミスにします.
+//-----------------------------------------------------------------------------
+bool CreateWavefront(WavefrontFixture& fixture)
+{
+    rtc::HitSortDesc desc;
+    desc.Capacity    = kImageWidth * kImageHeight;
+    desc.ThreadCount = 1;   // 計測を安定させるためシングルスレッドでシェーディング.
+
+    if (!fixture.Sorter.Init(desc))
+    {
+        RTC_ELOG("Error : HitSorter::Init() Failed.");
+        return false;
+    }
+
+    rtc::Random random(10, 11, 12);
+
+    fixture.MaterialIds.resize(kHitInstances);
+    for(auto& id : fixture.MaterialIds)
+    { id = random.GetAsU32() % kHitMaterials; }
+
+    fixture.Tables.resize(size_t(kHitMaterials) * kMaterialTable);
+    for(auto& value : fixture.Tables)
+    { value = random.GetAsF32(); }
+
+    auto tilesX = (kImageWidth + kHitTileSize - 1) / kHitTileSize;
+    auto tilesY = (kImageHeight + kHitTileSize - 1) / kHitTileSize;
+    std::vector<uint32_t> tileInstances(size_t(tilesX) * tilesY);
+    for(auto& id : tileInstances)
+    { id = (random.GetAsF32() < 0.05f) ? UINT32_MAX : random.GetAsU32() % kHitInstances; }
+
+    fixture.Hits  .resize(desc.Capacity);
+    fixture.Output.resize(desc.Capacity);
+    for(auto y=0u; y<kImageHeight; ++y)
+    {
+        for(auto x=0u; x<kImageWidth; ++x)
+        {
+            auto  index = y * kImageWidth + x;
+            auto& hit   = fixture.Hits[index];
+            hit.InstanceId   = tileInstances[(y / kHitTileSize) * tilesX + (x / kHitTileSize)];
+            hit.PrimitiveId  = random.GetAsU32() % kHitPrimitives;
+            hit.Barycentrics = rtc::float2(random.GetAsF32() * 0.5f, random.GetAsF32() * 0.5f);
+            hit.RayIndex     = index;
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      ウェーブフロントのシェーディング関数です. マテリアルのテーブルを参照します.
+//-----------------------------------------------------------------------------
+void ShadeWavefront(void* pUser, uint32_t materialId, const rtc::HitRecord* pHits, uint32_t count)
+{
+    auto& fixture = *static_cast<WavefrontFixture*>(pUser);
+    if (materialId == UINT32_MAX)
+    {
+        for(auto i=0u; i<count; ++i)
+        { fixture.Output[pHits[i].RayIndex] = 0.0f; }
+        return;
+    }
+
+    auto table = fixture.Tables.data() + size_t(materialId) * kMaterialTable;
+    for(auto i=0u; i<count; ++i)
+    {
+        auto& hit = pHits[i];
+        auto  t0  = table[(hit.PrimitiveId * 4 + 0) & (kMaterialTable - 1)];
+        auto  t1  = table[(hit.PrimitiveId * 4 + 1) & (kMaterialTable - 1)];
+        auto  t2  = table[(hit.PrimitiveId * 4 + 2) & (kMaterialTable - 1)];
+        fixture.Output[hit.RayIndex] = t0 * (1.0f - hit.Barycentrics.x - hit.Barycentrics.y) + t1 * hit.Barycentrics.x + t2 * hit.Barycentrics.y;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      ディスクリプタを1つ確保して解放します.
+//-----------------------------------------------------------------------------
+void BenchDescriptorAllocFree(uint64_t iterations, void*)
+{
+    auto pDevice = rtc::Device::Instance();
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        auto handle = pDevice->AllocDescriptorHandle(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+        rtc::DoNotOptimize(handle);
+        pDevice->FreeDescriptorHandle(handle);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      ディスクリプタをまとめて確保してから解放します.
+//-----------------------------------------------------------------------------
+void BenchDescriptorBatch(uint64_t iterations, void*)
+{
+    auto pDevice = rtc::Device::Instance();
+    rtc::DescriptorHandle handles[kDescriptorBatch];
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        for(auto j=0u; j<kDescriptorBatch; ++j)
+        { handles[j] = pDevice->AllocDescriptorHandle(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV); }
+        rtc::ClobberMemory();
+        for(auto j=0u; j<kDescriptorBatch; ++j)
+        { pDevice->FreeDescriptorHandle(handles[j]); }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      PNG エンコードです.
+//-----------------------------------------------------------------------------
+void BenchFpngEncode(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<ImageFixture*>(pUser);
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        fpng::fpng_encode_image_to_memory(fixture.Ldr.data(), kImageWidth, kImageHeight, 3, fixture.Png);
+        rtc::DoNotOptimize(fixture.Png.front());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      ストリーミングエンコーダの出力先です.
+//-----------------------------------------------------------------------------
+bool WriteStream(const void* pData, size_t size, uint64_t offset, void* pUser)
+{
+    auto& stream = *static_cast<std::vector<uint8_t>*>(pUser);
+    if (offset + size > stream.size())
+    { stream.resize(size_t(offset + size)); }
+    memcpy(stream.data() + offset, pData, size);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      行単位の PNG ストリーミングエンコードです.
+//-----------------------------------------------------------------------------
+void BenchFpngStreamEncode(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<ImageFixture*>(pUser);
+    auto  pitch   = size_t(kImageWidth) * 3;
+
+    fpng::fpng_stream_encoder encoder;
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        fixture.Stream.clear();
+        encoder.begin(kImageWidth, kImageHeight, 3, WriteStream, &fixture.Stream);
+        for(auto y=0u; y<kImageHeight; y+=kStreamBandRows)
+        {
+            auto rows = std::min(kStreamBandRows, kImageHeight - y);
+            encoder.push_rows(fixture.Ldr.data() + y * pitch, rows);
+        }
+        encoder.finish();
+        rtc::DoNotOptimize(fixture.Stream.front());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      全画面をトーンマップしてから PNG エンコードします.
+//-----------------------------------------------------------------------------
+void BenchTonemapPngStaged(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<ImageFixture*>(pUser);
+
+    rtc::TonemapDesc desc;
+    desc.ThreadCount = 1;
+
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        rtc::Tonemap(desc, fixture.Hdr.data(), kImageWidth, kImageHeight, fixture.Ldr.data());
+        fpng::fpng_encode_image_to_memory(fixture.Ldr.data(), kImageWidth, kImageHeight, 3, fixture.Png);
+        rtc::DoNotOptimize(fixture.Png.front());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      kStreamBandRows 行ずつトーンマップしながら PNG エンコードします.
+//-----------------------------------------------------------------------------
+void BenchTonemapPngStream(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<ImageFixture*>(pUser);
+    auto  pitch   = size_t(kImageWidth) * 3;
+
+    rtc::TonemapDesc desc;
+    desc.ThreadCount = 1;
+
+    fpng::fpng_stream_encoder encoder;
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        fixture.Stream.clear();
+        encoder.begin(kImageWidth, kImageHeight, 3, WriteStream, &fixture.Stream);
+        for(auto y=0u; y<kImageHeight; y+=kStreamBandRows)
+        {
+            auto rows = std::min(kStreamBandRows, kImageHeight - y);
+            for(auto r=0u; r<rows; ++r)
+            { rtc::TonemapRow(desc, fixture.Hdr.data() + size_t(y + r) * kImageWidth, kImageWidth, fixture.Band.data() + r * pitch); }
+            encoder.push_rows(fixture.Band.data(), rows);
+        }
+        encoder.finish();
+        rtc::DoNotOptimize(fixture.Stream.front());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      PNG デコードです.
+//-----------------------------------------------------------------------------
+void BenchFpngDecode(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<ImageFixture*>(pUser);
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        uint32_t w = 0, h = 0, channels = 0;
+        fpng::fpng_decode_memory(fixture.Png.data(), uint32_t(fixture.Png.size()), fixture.Decoded, w, h, channels, 3);
+        rtc::DoNotOptimize(fixture.Decoded.front());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      fpng 以外の PNG として汎用パスで展開します.
+//-----------------------------------------------------------------------------
+void BenchPngDecodeGeneral(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<ImageFixture*>(pUser);
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        rtc::DecodePng(fixture.PngGeneral.data(), fixture.PngGeneral.size(), 3, fixture.Decoded.data(), 0, fixture.Decoded.size());
+        rtc::DoNotOptimize(fixture.Decoded.front());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      kPngBatchCount 枚を並列に展開します.
+//-----------------------------------------------------------------------------
+void BenchPngBatchDecode(uint64_t iterations, void* pUser)
+{
+    auto& item    = *static_cast<PngBatchCase*>(pUser);
+    auto& fixture = *item.pImage;
+    auto& png     = item.General ? fixture.PngGeneral : fixture.Png;
+    auto  size    = size_t(kImageWidth) * kImageHeight * 3;
+
+    rtc::PngBatchItem items[kPngBatchCount];
+    rtc::PngBatchDesc desc;
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        for(auto j=0u; j<kPngBatchCount; ++j)
+        {
+            items[j]          = rtc::PngBatchItem();
+            items[j].pData    = png.data();
+            items[j].DataSize = png.size();
+            items[j].Channels = 3;
+            items[j].pDst     = fixture.Textures.data() + size * j;
+            items[j].DstSize  = size;
+        }
+        rtc::DecodePngBatch(desc, items, kPngBatchCount);
+        rtc::DoNotOptimize(fixture.Textures.front());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      kFrameWriteCount 枚の PNG を書き出して完了まで待ちます.
+//-----------------------------------------------------------------------------
+void BenchFrameWrite(uint64_t iterations, void* pUser)
+{
+    auto& item = *static_cast<FrameWriteCase*>(pUser);
+    auto& png  = item.pImage->Png;
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        for(auto j=0u; j<kFrameWriteCount; ++j)
+        {
+            char path[256];
+            sprintf_s(path, "%s/frame_%04llu.png", kFrameWriteDir, static_cast<unsigned long long>(item.Counter++ % 256));
+
+            if (item.pWriter != nullptr)
+            {
+                item.pWriter->Submit(path, png.data(), png.size());
+                continue;
+            }
+
+            FILE* pFile = nullptr;
+            if (fopen_s(&pFile, path, "wb") == 0 && pFile != nullptr)
+            {
+                fwrite(png.data(), 1, png.size(), pFile);
+                fclose(pFile);
+            }
+        }
+
+        if (item.pWriter != nullptr)
+        { item.pWriter->Flush(); }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      CRC-32 です.
+//-----------------------------------------------------------------------------
+void BenchCrc32(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<ImageFixture*>(pUser);
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        auto crc = fpng::fpng_crc32(fixture.Bytes.data(), fixture.Bytes.size());
+        rtc::DoNotOptimize(crc);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      Adler-32 です.
+//-----------------------------------------------------------------------------
+void BenchAdler32(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<ImageFixture*>(pUser);
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        auto adler = fpng::fpng_adler32(fixture.Bytes.data(), fixture.Bytes.size());
+        rtc::DoNotOptimize(adler);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      SIMD レベルを指定した CRC-32 です.
+//-----------------------------------------------------------------------------
+void BenchCrc32Simd(uint64_t iterations, void* pUser)
+{
+    auto& item  = *static_cast<ChecksumCase*>(pUser);
+    auto& bytes = item.pImage->Bytes;
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        auto crc = fpng::fpng_crc32_simd(item.SimdLevel, bytes.data(), bytes.size());
+        rtc::DoNotOptimize(crc);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      SIMD レベルを指定した Adler-32 です.
+//-----------------------------------------------------------------------------
+void BenchAdler32Simd(uint64_t iterations, void* pUser)
+{
+    auto& item  = *static_cast<ChecksumCase*>(pUser);
+    auto& bytes = item.pImage->Bytes;
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        auto adler = fpng::fpng_adler32_simd(item.SimdLevel, bytes.data(), bytes.size());
+        rtc::DoNotOptimize(adler);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      トーンマップです.
+//-----------------------------------------------------------------------------
+void BenchTonemap(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<ImageFixture*>(pUser);
+
+    rtc::TonemapDesc desc;
+    desc.ThreadCount = 1;
+
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        rtc::Tonemap(desc, fixture.Hdr.data(), kImageWidth, kImageHeight, fixture.Ldr.data());
+        rtc::DoNotOptimize(fixture.Ldr.front());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      BVH 構築です.
+//-----------------------------------------------------------------------------
+void BenchBvhBuild(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<MeshFixture*>(pUser);
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        rtc::Bvh bvh;
+        bvh.Build(fixture.Desc);
+        rtc::DoNotOptimize(bvh.GetNodeCount());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      8分木への変換です.
+//-----------------------------------------------------------------------------
+void BenchBvh8Build(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<MeshFixture*>(pUser);
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        rtc::Bvh8 bvh8;
+        bvh8.Build(fixture.Bvh);
+        rtc::DoNotOptimize(bvh8.GetNodeCount());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      レイとボックスの交差判定です.
+//-----------------------------------------------------------------------------
+void BenchRayBox(uint64_t iterations, void* pUser)
+{
+    auto& fixture   = *static_cast<MeshFixture*>(pUser);
+    auto  pNodes    = fixture.Bvh.GetNodes();
+    auto  nodeCount = fixture.Bvh.GetNodeCount();
+    auto  cursor    = fixture.Cursor;
+
+    uint32_t hits = 0;
+    for(auto i=0ull; i<iterations; ++i, ++cursor)
+    {
+        auto& ray  = fixture.Rays[cursor & kRayMask];
+        auto& node = pNodes[cursor % nodeCount];
+
+        float tnear;
+        hits += rtc::IntersectBox(node.Bounds.Min, node.Bounds.Max, ray.Origin, fixture.InvDirs[cursor & kRayMask], ray.TMin, ray.TMax, tnear) ? 1 : 0;
+    }
+
+    fixture.Cursor = cursor;
+    rtc::DoNotOptimize(hits);
+}
+
+//-----------------------------------------------------------------------------
+//      レイと三角形の交差判定です.
+//-----------------------------------------------------------------------------
+void BenchRayTriangle(uint64_t iterations, void* pUser)
+{
+    auto& fixture   = *static_cast<MeshFixture*>(pUser);
+    auto  pTris     = fixture.Bvh8.GetTriangles();
+    auto  triCount  = fixture.Bvh8.GetTriangleCount();
+    auto  cursor    = fixture.Cursor;
+
+    uint32_t hits = 0;
+    for(auto i=0ull; i<iterations; ++i, ++cursor)
+    {
+        auto  index = cursor & kRayMask;
+        auto& ray   = fixture.TriangleRays[index];
+        auto& tri   = pTris[index % triCount];
+
+        float t, u, v;
+        hits += rtc::IntersectTriangle(ray, tri.V0, tri.E1, tri.E2, ray.TMax, t, u, v) ? 1 : 0;
+    }
+
+    fixture.Cursor = cursor;
+    rtc::DoNotOptimize(hits);
+}
+
+//-----------------------------------------------------------------------------
+//      2分木の走査です.
+//-----------------------------------------------------------------------------
+void BenchBvhTraverse(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<MeshFixture*>(pUser);
+    auto  cursor  = fixture.Cursor;
+
+    uint32_t hits = 0;
+    for(auto i=0ull; i<iterations; ++i, ++cursor)
+    {
+        rtc::BvhHit hit;
+        hits += fixture.Bvh.Intersect(fixture.Rays[cursor & kRayMask], hit) ? 1 : 0;
+    }
+
+    fixture.Cursor = cursor;
+    rtc::DoNotOptimize(hits);
+}
+
+//-----------------------------------------------------------------------------
+//      8分木の走査です.
+//-----------------------------------------------------------------------------
+void BenchBvh8Traverse(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<MeshFixture*>(pUser);
+    auto  cursor  = fixture.Cursor;
+
+    uint32_t hits = 0;
+    for(auto i=0ull; i<iterations; ++i, ++cursor)
+    {
+        rtc::BvhHit hit;
+        hits += fixture.Bvh8.Intersect(fixture.Rays[cursor & kRayMask], hit) ? 1 : 0;
+    }
+
+    fixture.Cursor = cursor;
+    rtc::DoNotOptimize(hits);
+}
+
+//-----------------------------------------------------------------------------
+//      オパシティマスクを使った任意ヒットです. 1 反復を1フレームとして統計を取り出します.
+//-----------------------------------------------------------------------------
+void BenchOpacityAnyHit(uint64_t iterations, void* pUser)
+{
+    auto& fixture = *static_cast<OpacityFixture*>(pUser);
+    auto  cursor  = fixture.Cursor;
+
+    uint32_t hits = 0;
+    for(auto i=0ull; i<iterations; ++i, ++cursor)
+    {
+        auto index = cursor & kRayMask;
+        hits += fixture.Mask.AnyHit(fixture.HitTriangles[index], fixture.HitBarycentrics[index], AlphaTest, &fixture) ? 1 : 0;
+    }
+
+    fixture.Cursor    = cursor;
+    fixture.LastStats = fixture.Mask.ResetAnyHitStats();
+    rtc::DoNotOptimize(hits);
+}
+
+//-----------------------------------------------------------------------------
+//      ウェーブフロントのヒットをマテリアル順に並べ替えて (または並べ替えずに) シェーディングします.
+//-----------------------------------------------------------------------------
+void BenchHitSort(uint64_t iterations, void* pUser)
+{
+    auto& item    = *static_cast<HitSortCase*>(pUser);
+    auto& fixture = *item.pWavefront;
+
+    for(auto i=0ull; i<iterations; ++i)
+    {
+        item.LastStats = fixture.Sorter.Execute(
+            fixture.Hits.data(),
+            uint32_t(fixture.Hits.size()),
+            fixture.MaterialIds.data(),
+            kHitInstances,
+            item.Sort,
+            ShadeWavefront,
+            &fixture);
+    }
+
+    rtc::DoNotOptimize(fixture.Output[0]);
+}
+
+//-----------------------------------------------------------------------------
+//      名前が一致する計測結果を探します.
+//-----------------------------------------------------------------------------
+const rtc::BenchResult* FindResult(const std::vector<rtc::BenchResult>& results, const char* name)
+{
+    for(auto& item : results)
+    {
+        if (item.Name == name)
+        { return &item; }
+    }
+
+    return nullptr;
+}
+
+//-----------------------------------------------------------------------------
+//      オブジェクト分割と空間分割の BVH をメッシュごとに比較して表示します.
+//      traverseNames は (2分木, SBVH 2分木, 8分木, SBVH 8分木) の走査ケース名です.
+//-----------------------------------------------------------------------------
+void PrintSplitCompare
+(
+    const char*                             meshName,
+    const MeshFixture&                      object,
+    const MeshFixture&                      spatial,
+    const char* const                       traverseNames[4],
+    const std::vector<rtc::BenchResult>&    results
+)
+{
+    auto& objectStats  = object .Bvh.GetStats();
+    auto& spatialStats = spatial.Bvh.GetStats();
+    printf("%-8s : object split SAH %.2f, spatial split SAH %.2f (%u splits, %u duplicated refs, %.1f%%)\n",
+        meshName,
+        objectStats.SahCost,
+        spatialStats.SahCost,
+        spatialStats.SpatialSplits,
+        spatialStats.DuplicatedRefs,
+        double(spatialStats.DuplicatedRefs) * 100.0 / double(std::max(spatial.Desc.TriangleCount, 1u)));
+
+    const char* widths[] = { "binary", "bvh8" };
+    for(auto i=0; i<2; ++i)
+    {
+        auto pObject  = FindResult(results, traverseNames[i * 2 + 0]);
+        auto pSpatial = FindResult(results, traverseNames[i * 2 + 1]);
+        if (pObject == nullptr || pSpatial == nullptr)
+        { continue; }
+
+        printf("  %-6s : traverse object %9.2f ns, spatial %9.2f ns (object / spatial %.2fx)\n",
+            widths[i],
+            pObject->MedianNs,
+            pSpatial->MedianNs,
+            (pSpatial->MedianNs > 0.0) ? pObject->MedianNs / pSpatial->MedianNs : 0.0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      使い方を表示します.
+//-----------------------------------------------------------------------------
+void PrintUsage()
+{
+    printf("usage: rtcBench [--filter name] [--out result.json] [--reps N] [--min-time msec] [--warmup msec] [--cpu index]\n");
+    printf("       rtcBench --scenes [--filter name] [--out result.json] [--width W] [--height H] [--budget msec] [--max-spp N]\n");
+    printf("                [--seed N] [--target-psnr dB] [--min-psnr dB] [--min-ssim value] [--threads N]\n");
+    printf("                [--ref-dir dir] [--ref-spp N] [--make-reference]\n");
+    printf("       rtcBench --compare base.json current.json [--threshold percent]\n");
+    printf("  --cpu -1 disables thread pinning. --compare returns 1 when any case regressed.\n");
+    printf("  --scenes returns 1 when the final image of any scene is below --min-psnr / --min-ssim.\n");
+}
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+//      メインエントリーポイントです.
+//-----------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    rtc::BenchDesc      desc;
+    rtc::SceneBenchDesc sceneDesc;
+    bool        sceneMode   = false;
+    const char* pOutput     = nullptr;
+    const char* pBasePath   = nullptr;
+    const char* pCurrPath   = nullptr;
+    double      threshold   = 5.0;
+
+    for(auto i=1; i<argc; ++i)
+    {
+        auto hasValue = (i + 1 < argc);
+        if      (strcmp(argv[i], "--filter")    == 0 && hasValue) { desc.pFilter       = argv[++i]; }
+        else if (strcmp(argv[i], "--out")       == 0 && hasValue) { pOutput            = argv[++i]; }
+        else if (strcmp(argv[i], "--reps")      == 0 && hasValue) { desc.Repetitions   = uint32_t(atoi(argv[++i])); }
+        else if (strcmp(argv[i], "--min-time")  == 0 && hasValue) { desc.MinSampleMsec = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--warmup")    == 0 && hasValue) { desc.WarmupMsec    = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--cpu")       == 0 && hasValue) { desc.PinCpu        = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "--threshold") == 0 && hasValue) { threshold          = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--scenes")    == 0)             { sceneMode          = true; }
+        else if (strcmp(argv[i], "--width")     == 0 && hasValue) { sceneDesc.Width        = uint32_t(atoi(argv[++i])); }
+        else if (strcmp(argv[i], "--height")    == 0 && hasValue) { sceneDesc.Height       = uint32_t(atoi(argv[++i])); }
+        else if (strcmp(argv[i], "--budget")    == 0 && hasValue) { sceneDesc.BudgetMsec   = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--max-spp")   == 0 && hasValue) { sceneDesc.MaxPasses    = uint32_t(atoi(argv[++i])); }
+        else if (strcmp(argv[i], "--seed")      == 0 && hasValue) { sceneDesc.Seed         = uint32_t(atoi(argv[++i])); }
+        else if (strcmp(argv[i], "--target-psnr") == 0 && hasValue) { sceneDesc.TargetPsnr = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--min-psnr")  == 0 && hasValue) { sceneDesc.MinPsnr      = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--min-ssim")  == 0 && hasValue) { sceneDesc.MinSsim      = atof(argv[++i]); }
+        else if (strcmp(argv[i], "--threads")   == 0 && hasValue) { sceneDesc.ThreadCount  = uint32_t(atoi(argv[++i])); }
+        else if (strcmp(argv[i], "--ref-dir")   == 0 && hasValue) { sceneDesc.pReferenceDir = argv[++i]; }
+        else if (strcmp(argv[i], "--ref-spp")   == 0 && hasValue) { sceneDesc.ReferenceSpp = uint32_t(atoi(argv[++i])); }
+        else if (strcmp(argv[i], "--make-reference") == 0)        { sceneDesc.MakeReference = true; }
+        else if (strcmp(argv[i], "--compare")   == 0 && i + 2 < argc)
+        {
+            pBasePath = argv[++i];
+            pCurrPath = argv[++i];
+        }
+        else
+        {
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    rtc::Logger::Init();
+
+    // 比較モード.
+    if (pBasePath != nullptr)
+    {
+        std::vector<rtc::BenchResult> base;
+        std::vector<rtc::BenchResult> current;
+        if (!rtc::BenchSuite::ReadJson(pBasePath, base) || !rtc::BenchSuite::ReadJson(pCurrPath, current))
+        {
+            rtc::Logger::Term();
+            return 2;
+        }
+
+        auto regressions = rtc::BenchSuite::Compare(base, current, threshold);
+        rtc::Logger::Term();
+        return (regressions > 0) ? 1 : 0;
+    }
+
+    // 参照シーンの描画と画質評価.
+    if (sceneMode)
+    {
+        sceneDesc.pFilter = desc.pFilter;
+
+        std::vector<rtc::SceneBenchResult> scenes;
+        std::vector<rtc::LightBenchResult> lights;
+        auto ret = (rtc::RunSceneBench(sceneDesc, scenes) && rtc::RunLightBench(sceneDesc, lights)) ? 0 : 2;
+        if (ret == 0)
+        {
+            for(auto& item : scenes)
+            {
+                if (!item.Passed)
+                { ret = 1; }
+            }
+
+            if (pOutput != nullptr && !rtc::WriteSceneBenchJson(pOutput, sceneDesc, scenes))
+            { ret = 2; }
+        }
+
+        rtc::Logger::Term();
+        return ret;
+    }
+
+    fpng::fpng_init();
+
+    ImageFixture image;
+    MeshFixture  mesh;
+    CreateImage(image);
+    if (!CreateMesh(mesh, MESH_SHAPE_GRID, false))
+    {
+        rtc::Logger::Term();
+        return 2;
+    }
+
+    // 空間分割の比較用. 対象のケースが無ければ構築しない.
+    const char* sbvhNames[] = {
+        "sbvh_build_100k", "sbvh8_build_100k", "sbvh_traverse", "sbvh8_traverse",
+    };
+    const char* sliverNames[] = {
+        "bvh_build_slivers", "bvh8_build_slivers", "sbvh_build_slivers", "sbvh8_build_slivers",
+        "bvh_traverse_slivers", "sbvh_traverse_slivers", "bvh8_traverse_slivers", "sbvh8_traverse_slivers",
+    };
+    auto useSbvh    = false;
+    auto useSlivers = false;
+    for(auto name : sbvhNames)
+    { useSbvh |= rtc::BenchSuite::IsEnabled(name, desc.pFilter); }
+    for(auto name : sliverNames)
+    { useSlivers |= rtc::BenchSuite::IsEnabled(name, desc.pFilter); }
+
+    MeshFixture sbvhGrid;
+    MeshFixture sliverObject;
+    MeshFixture sliverSpatial;
+    if ((useSbvh && !CreateMesh(sbvhGrid, MESH_SHAPE_GRID, true))
+     || (useSlivers && (!CreateMesh(sliverObject, MESH_SHAPE_SLIVERS, false) || !CreateMesh(sliverSpatial, MESH_SHAPE_SLIVERS, true))))
+    {
+        rtc::Logger::Term();
+        return 2;
+    }
+
+    rtc::BenchSuite suite;
+
+    // ディスクリプタのケースだけ D3D12 デバイスが必要.
+    auto useDevice = rtc::BenchSuite::IsEnabled("descriptor_alloc_free", desc.pFilter)
+                  || rtc::BenchSuite::IsEnabled("descriptor_alloc_free_x256", desc.pFilter);
+    if (useDevice)
+    {
+        rtc::DeviceDesc deviceDesc;
+        if (rtc::Device::Init(deviceDesc))
+        {
+            suite.Add("descriptor_alloc_free",      BenchDescriptorAllocFree, nullptr);
+            suite.Add("descriptor_alloc_free_x256", BenchDescriptorBatch,     nullptr);
+        }
+        else
+        {
+            RTC_ELOG("Error : Device::Init() Failed. descriptor cases are skipped.");
+            useDevice = false;
+        }
+    }
+
+    auto pixelCount = uint64_t(kImageWidth) * kImageHeight;
+    suite.Add("fpng_encode_rgb_1080p",  BenchFpngEncode,    &image, pixelCount * 3);
+    suite.Add("fpng_decode_rgb_1080p",  BenchFpngDecode,    &image, pixelCount * 3);
+    suite.Add("fpng_stream_encode_rgb_1080p", BenchFpngStreamEncode, &image, pixelCount * 3);
+    suite.Add("tonemap_png_staged_1080p",     BenchTonemapPngStaged, &image, pixelCount * sizeof(rtc::float3));
+    suite.Add("tonemap_png_stream_1080p",     BenchTonemapPngStream, &image, pixelCount * sizeof(rtc::float3));
+    suite.Add("png_decode_general_rgb_1080p", BenchPngDecodeGeneral, &image, pixelCount * 3);
+
+    PngBatchCase pngBatches[] = {
+        { &image, false },
+        { &image, true },
+    };
+    suite.Add("png_batch_decode_fpng_1080p_x8",    BenchPngBatchDecode, &pngBatches[0], pixelCount * 3 * kPngBatchCount);
+    suite.Add("png_batch_decode_general_1080p_x8", BenchPngBatchDecode, &pngBatches[1], pixelCount * 3 * kPngBatchCount);
+
+    // 書き出し先が作れない場合はフレーム書き出しのケースを省きます.
+    rtc::FrameWriter poolWriter;
+    rtc::FrameWriter uringWriter;
+    FrameWriteCase   frameWrites[3];
+    if (CreateDirectoryA(kFrameWriteDir, nullptr) || GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        auto frameBytes = uint64_t(image.Png.size()) * kFrameWriteCount;
+
+        frameWrites[0].pImage = &image;
+        suite.Add("frame_write_blocking_1080p_x16", BenchFrameWrite, &frameWrites[0], frameBytes);
+
+        rtc::FrameWriterDesc writerDesc;
+        writerDesc.Backend = rtc::FRAME_WRITER_BACKEND_THREAD_POOL;
+        if (poolWriter.Init(writerDesc))
+        {
+            frameWrites[1].pImage  = &image;
+            frameWrites[1].pWriter = &poolWriter;
+            suite.Add("frame_write_pool_1080p_x16", BenchFrameWrite, &frameWrites[1], frameBytes);
+        }
+
+        writerDesc.Backend = rtc::FRAME_WRITER_BACKEND_IO_URING;
+        if (rtc::FrameWriter::IsSupported(writerDesc.Backend) && uringWriter.Init(writerDesc))
+        {
+            frameWrites[2].pImage  = &image;
+            frameWrites[2].pWriter = &uringWriter;
+            suite.Add("frame_write_uring_1080p_x16", BenchFrameWrite, &frameWrites[2], frameBytes);
+        }
+    }
+    suite.Add("fpng_crc32_4mb",         BenchCrc32,         &image, kHashBytes);
+    suite.Add("fpng_adler32_4mb",       BenchAdler32,       &image, kHashBytes);
+
+    // CPU が対応している SIMD レベルごとのチェックサムです.
+    ChecksumCase checksums[] = {
+        { &image, fpng::FPNG_SIMD_SCALAR },
+        { &image, fpng::FPNG_SIMD_SSE41 },
+        { &image, fpng::FPNG_SIMD_AVX2 },
+        { &image, fpng::FPNG_SIMD_AVX512 },
+    };
+    const bool hasCrc32[] = {
+        true,
+        fpng::fpng_cpu_supports_sse41(),
+        fpng::fpng_cpu_supports_avx2()   && fpng::fpng_cpu_supports_vpclmulqdq(),
+        fpng::fpng_cpu_supports_avx512() && fpng::fpng_cpu_supports_vpclmulqdq(),
+    };
+    const bool hasAdler32[] = {
+        true,
+        fpng::fpng_cpu_supports_sse41(),
+        fpng::fpng_cpu_supports_avx2(),
+        fpng::fpng_cpu_supports_avx512(),
+    };
+    const char* crc32Names[]   = { "fpng_crc32_4mb_scalar",   "fpng_crc32_4mb_sse41",   "fpng_crc32_4mb_avx2",   "fpng_crc32_4mb_avx512" };
+    const char* adler32Names[] = { "fpng_adler32_4mb_scalar", "fpng_adler32_4mb_sse41", "fpng_adler32_4mb_avx2", "fpng_adler32_4mb_avx512" };
+    for(auto i=0; i<4; ++i)
+    {
+        if (hasCrc32[i])
+        { suite.Add(crc32Names[i], BenchCrc32Simd, &checksums[i], kHashBytes); }
+        if (hasAdler32[i])
+        { suite.Add(adler32Names[i], BenchAdler32Simd, &checksums[i], kHashBytes); }
+    }
+
+    suite.Add("tonemap_1080p",          BenchTonemap,       &image, pixelCount * sizeof(rtc::float3));
+    suite.Add("bvh_build_100k",         BenchBvhBuild,      &mesh);
+    suite.Add("bvh8_build_100k",        BenchBvh8Build,     &mesh);
+    suite.Add("ray_box",                BenchRayBox,        &mesh);
+    suite.Add("ray_triangle",           BenchRayTriangle,   &mesh);
+    suite.Add("bvh_traverse",           BenchBvhTraverse,   &mesh);
+    suite.Add("bvh8_traverse",          BenchBvh8Traverse,  &mesh);
+
+    if (useSbvh)
+    {
+        suite.Add(sbvhNames[0],             BenchBvhBuild,      &sbvhGrid);
+        suite.Add(sbvhNames[1],             BenchBvh8Build,     &sbvhGrid);
+        suite.Add(sbvhNames[2],             BenchBvhTraverse,   &sbvhGrid);
+        suite.Add(sbvhNames[3],             BenchBvh8Traverse,  &sbvhGrid);
+    }
+    if (useSlivers)
+    {
+        suite.Add(sliverNames[0],           BenchBvhBuild,      &sliverObject);
+        suite.Add(sliverNames[1],           BenchBvh8Build,     &sliverObject);
+        suite.Add(sliverNames[2],           BenchBvhBuild,      &sliverSpatial);
+        suite.Add(sliverNames[3],           BenchBvh8Build,     &sliverSpatial);
+        suite.Add(sliverNames[4],           BenchBvhTraverse,   &sliverObject);
+        suite.Add(sliverNames[5],           BenchBvhTraverse,   &sliverSpatial);
+        suite.Add(sliverNames[6],           BenchBvh8Traverse,  &sliverObject);
+        suite.Add(sliverNames[7],           BenchBvh8Traverse,  &sliverSpatial);
+    }
+
+    OpacityFixture opacity;
+    if (rtc::BenchSuite::IsEnabled("opacity_anyhit", desc.pFilter) && CreateOpacity(opacity))
+    { suite.Add("opacity_anyhit", BenchOpacityAnyHit, &opacity); }
+
+    // ソートの有無で同じウェーブフロントをシェーディングします.
+    WavefrontFixture wavefront;
+    HitSortCase      hitSorts[] = {
+        { &wavefront, true },
+        { &wavefront, false },
+    };
+    const char* hitSortNames[] = { "hitsort_sorted_1080p", "hitsort_unsorted_1080p" };
+    auto useWavefront = rtc::BenchSuite::IsEnabled(hitSortNames[0], desc.pFilter)
+                     || rtc::BenchSuite::IsEnabled(hitSortNames[1], desc.pFilter);
+    if (useWavefront && CreateWavefront(wavefront))
+    {
+        suite.Add(hitSortNames[0], BenchHitSort, &hitSorts[0], pixelCount * sizeof(rtc::HitRecord));
+        suite.Add(hitSortNames[1], BenchHitSort, &hitSorts[1], pixelCount * sizeof(rtc::HitRecord));
+    }
+
+    std::vector<rtc::BenchResult> results;
+    suite.Run(desc, results);
+
+    poolWriter .Term();
+    uringWriter.Term();
+    poolWriter .GetStats().Print();
+    uringWriter.GetStats().Print();
+    if (opacity.LastStats.Invocations > 0)
+    { opacity.LastStats.Print("opacity_anyhit"); }
+
+    const char* gridTraverseNames[]   = { "bvh_traverse", sbvhNames[2], "bvh8_traverse", sbvhNames[3] };
+    const char* sliverTraverseNames[] = { sliverNames[4], sliverNames[5], sliverNames[6], sliverNames[7] };
+    if (useSbvh)
+    { PrintSplitCompare("grid", mesh, sbvhGrid, gridTraverseNames, results); }
+    if (useSlivers)
+    { PrintSplitCompare("slivers", sliverObject, sliverSpatial, sliverTraverseNames, results); }
+
+    for(auto i=0; i<2; ++i)
+    {
+        auto& stats = hitSorts[i].LastStats;
+        if (stats.HitCount == 0)
+        { continue; }
+
+        printf("%-24s : sort = %8.3f ms, shade = %8.3f ms, batches = %u, radix passes = %u\n",
+            hitSortNames[i], stats.SortMsec, stats.ShadeMsec, stats.BatchCount, stats.RadixPasses);
+    }
+
+    auto ret = 0;
+    if (pOutput != nullptr && !rtc::BenchSuite::WriteJson(pOutput, desc, results))
+    { ret = 2; }
+
+    if (useDevice)
+    { rtc::Device::Term(); }
+
+    rtc::Logger::Term();
+    return ret;
+}
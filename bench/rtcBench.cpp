@@ -0,0 +1,497 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcBench.cpp
+// Desc : Micro Benchmark Harness.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcBench.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint64_t  kMaxIterations  = 1ull << 40;
+constexpr double    kMadScale       = 3.0;      // 退行と判定する MAD の倍率.
+
+//-----------------------------------------------------------------------------
+//      iterations 回実行した時間(ナノ秒)を計測します.
+//-----------------------------------------------------------------------------
+double Measure(const rtc::BenchCase& item, uint64_t iterations)
+{
+    rtc::Timer timer;
+    timer.Start();
+    item.pFunc(iterations, item.pUser);
+    timer.End();
+    return timer.GetElapsedUsec() * 1000.0;
+}
+
+//-----------------------------------------------------------------------------
+//      1サンプルが minNs 以上になる実行回数を求めます.
+//-----------------------------------------------------------------------------
+uint64_t Calibrate(const rtc::BenchCase& item, double minNs)
+{
+    uint64_t iterations = 1;
+    for(;;)
+    {
+        auto elapsed = Measure(item, iterations);
+        if (elapsed >= minNs || iterations >= kMaxIterations)
+        { break; }
+
+        // 短すぎる計測は誤差が大きいので最大 10 倍ずつ伸ばす.
+        auto scale = (elapsed > 0.0) ? std::min(minNs * 1.2 / elapsed, 10.0) : 10.0;
+        iterations = std::max(iterations + 1, uint64_t(double(iterations) * scale));
+    }
+    return iterations;
+}
+
+//-----------------------------------------------------------------------------
+//      中央値を求めます(values は並べ替えられます).
+//-----------------------------------------------------------------------------
+double Median(std::vector<double>& values)
+{
+    if (values.empty())
+    { return 0.0; }
+
+    std::sort(values.begin(), values.end());
+    auto half = values.size() / 2;
+    return (values.size() & 1) ? values[half] : (values[half - 1] + values[half]) * 0.5;
+}
+
+//-----------------------------------------------------------------------------
+//      JSON 文字列として出力します.
+//-----------------------------------------------------------------------------
+void WriteJsonString(FILE* pFile, const std::string& value)
+{
+    fputc('"', pFile);
+    for(auto c : value)
+    {
+        if (c == '"' || c == '\\')
+        { fputc('\\', pFile); }
+        fputc(c, pFile);
+    }
+    fputc('"', pFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// JsonReader class (WriteJson() が出力した形式だけを読み込みます)
+///////////////////////////////////////////////////////////////////////////////
+class JsonReader
+{
+public:
+    explicit JsonReader(const std::string& text)
+    : m_Text(text)
+    { /* DO_NOTHING */ }
+
+    bool Read(std::vector<rtc::BenchResult>& results)
+    {
+        auto pos = m_Text.find("\"benchmarks\"");
+        if (pos == std::string::npos)
+        { return false; }
+
+        m_Pos = m_Text.find('[', pos);
+        if (m_Pos == std::string::npos)
+        { return false; }
+        m_Pos++;
+
+        for(;;)
+        {
+            SkipSpace();
+            if (m_Pos >= m_Text.size())
+            { return false; }
+
+            auto c = m_Text[m_Pos];
+            if (c == ']')
+            { return true; }
+            if (c == ',')
+            { m_Pos++; continue; }
+            if (c != '{')
+            { return false; }
+
+            m_Pos++;
+            rtc::BenchResult result;
+            if (!ReadObject(result))
+            { return false; }
+            results.push_back(result);
+        }
+    }
+
+private:
+    const std::string&  m_Text;
+    size_t              m_Pos = 0;
+
+    void SkipSpace()
+    {
+        while (m_Pos < m_Text.size() && isspace(uint8_t(m_Text[m_Pos])))
+        { m_Pos++; }
+    }
+
+    bool ReadString(std::string& value)
+    {
+        SkipSpace();
+        if (m_Pos >= m_Text.size() || m_Text[m_Pos] != '"')
+        { return false; }
+        m_Pos++;
+
+        value.clear();
+        while (m_Pos < m_Text.size() && m_Text[m_Pos] != '"')
+        {
+            if (m_Text[m_Pos] == '\\' && m_Pos + 1 < m_Text.size())
+            { m_Pos++; }
+            value.push_back(m_Text[m_Pos++]);
+        }
+        m_Pos++;
+        return m_Pos <= m_Text.size();
+    }
+
+    bool ReadNumber(double& value)
+    {
+        SkipSpace();
+        auto pBegin = m_Text.c_str() + m_Pos;
+        char* pEnd = nullptr;
+        value = strtod(pBegin, &pEnd);
+        if (pEnd == pBegin)
+        { return false; }
+        m_Pos += size_t(pEnd - pBegin);
+        return true;
+    }
+
+    bool ReadObject(rtc::BenchResult& result)
+    {
+        for(;;)
+        {
+            SkipSpace();
+            if (m_Pos >= m_Text.size())
+            { return false; }
+            if (m_Text[m_Pos] == '}')
+            { m_Pos++; return !result.Name.empty(); }
+            if (m_Text[m_Pos] == ',')
+            { m_Pos++; continue; }
+
+            std::string key;
+            if (!ReadString(key))
+            { return false; }
+
+            SkipSpace();
+            if (m_Pos >= m_Text.size() || m_Text[m_Pos] != ':')
+            { return false; }
+            m_Pos++;
+
+            if (key == "name")
+            {
+                if (!ReadString(result.Name))
+                { return false; }
+                continue;
+            }
+
+            double value = 0.0;
+            if (!ReadNumber(value))
+            { return false; }
+
+            if      (key == "median_ns")        { result.MedianNs     = value; }
+            else if (key == "mad_ns")           { result.MadNs        = value; }
+            else if (key == "min_ns")           { result.MinNs        = value; }
+            else if (key == "mean_ns")          { result.MeanNs       = value; }
+            else if (key == "iterations")       { result.Iterations   = uint64_t(value); }
+            else if (key == "repetitions")      { result.Repetitions  = uint32_t(value); }
+            else if (key == "bytes_per_iter")   { result.BytesPerIter = uint64_t(value); }
+        }
+    }
+};
+
+//-----------------------------------------------------------------------------
+//      名前で結果を探します.
+//-----------------------------------------------------------------------------
+const rtc::BenchResult* Find(const std::vector<rtc::BenchResult>& results, const std::string& name)
+{
+    for(auto& item : results)
+    {
+        if (item.Name == name)
+        { return &item; }
+    }
+    return nullptr;
+}
+
+//-----------------------------------------------------------------------------
+//      時間を読みやすい単位で文字列にします.
+//-----------------------------------------------------------------------------
+void FormatTime(double ns, char* buffer, size_t size)
+{
+    if      (ns < 1e3) { snprintf(buffer, size, "%.2f ns", ns); }
+    else if (ns < 1e6) { snprintf(buffer, size, "%.2f us", ns * 1e-3); }
+    else if (ns < 1e9) { snprintf(buffer, size, "%.2f ms", ns * 1e-6); }
+    else               { snprintf(buffer, size, "%.2f s",  ns * 1e-9); }
+}
+
+} // namespace
+
+
+namespace rtc {
+
+volatile uint8_t g_BenchSink = 0;
+
+//-----------------------------------------------------------------------------
+//      ケースを登録します.
+//-----------------------------------------------------------------------------
+void BenchSuite::Add(const char* name, BenchFunc pFunc, void* pUser, uint64_t bytesPerIter)
+{
+    BenchCase item;
+    item.Name           = name;
+    item.pFunc          = pFunc;
+    item.pUser          = pUser;
+    item.BytesPerIter   = bytesPerIter;
+    m_Cases.push_back(item);
+}
+
+//-----------------------------------------------------------------------------
+//      ケース名がフィルタに一致するかどうか.
+//-----------------------------------------------------------------------------
+bool BenchSuite::IsEnabled(const char* name, const char* pFilter)
+{
+    if (pFilter == nullptr || pFilter[0] == '\0')
+    { return true; }
+    return strstr(name, pFilter) != nullptr;
+}
+
+//-----------------------------------------------------------------------------
+//      登録したケースを計測します.
+//-----------------------------------------------------------------------------
+void BenchSuite::Run(const BenchDesc& desc, std::vector<BenchResult>& results) const
+{
+    if (desc.PinCpu >= 0 && !PinCurrentThread(desc.PinCpu))
+    { RTC_ELOG("Error : PinCurrentThread() Failed. cpu = %d", desc.PinCpu); }
+
+    auto repetitions = std::max(desc.Repetitions, 1u);
+    auto minNs       = desc.MinSampleMsec * 1e6;
+
+    std::vector<double> samples;
+    std::vector<double> deviations;
+    samples   .reserve(repetitions);
+    deviations.reserve(repetitions);
+
+    for(auto& item : m_Cases)
+    {
+        if (!IsEnabled(item.Name.c_str(), desc.pFilter))
+        { continue; }
+
+        // キャッシュ, 分岐予測, クロックを温める.
+        {
+            Timer timer;
+            timer.Start();
+            do
+            {
+                item.pFunc(1, item.pUser);
+                timer.End();
+            }
+            while (timer.GetElapsedMsec() < desc.WarmupMsec);
+        }
+
+        auto iterations = Calibrate(item, minNs);
+
+        samples.clear();
+        for(auto i=0u; i<repetitions; ++i)
+        { samples.push_back(Measure(item, iterations) / double(iterations)); }
+
+        BenchResult result;
+        result.Name         = item.Name;
+        result.Iterations   = iterations;
+        result.Repetitions  = repetitions;
+        result.BytesPerIter = item.BytesPerIter;
+
+        double sum = 0.0;
+        for(auto value : samples)
+        { sum += value; }
+        result.MeanNs = sum / double(samples.size());
+
+        result.MedianNs = Median(samples);
+        result.MinNs    = samples.front();
+
+        deviations.clear();
+        for(auto value : samples)
+        { deviations.push_back(fabs(value - result.MedianNs)); }
+        result.MadNs = Median(deviations);
+
+        Print(result);
+        results.push_back(result);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      結果を表示します.
+//-----------------------------------------------------------------------------
+void BenchSuite::Print(const BenchResult& result)
+{
+    char median[32];
+    char mad   [32];
+    FormatTime(result.MedianNs, median, sizeof(median));
+    FormatTime(result.MadNs,    mad,    sizeof(mad));
+
+    if (result.BytesPerIter > 0 && result.MedianNs > 0.0)
+    {
+        auto mbps = double(result.BytesPerIter) / result.MedianNs * 1e3;
+        printf("%-32s %12s +/- %-12s %10.1f MB/s  (%llu x %u)\n",
+            result.Name.c_str(), median, mad, mbps,
+            static_cast<unsigned long long>(result.Iterations), result.Repetitions);
+    }
+    else
+    {
+        printf("%-32s %12s +/- %-12s %15s  (%llu x %u)\n",
+            result.Name.c_str(), median, mad, "",
+            static_cast<unsigned long long>(result.Iterations), result.Repetitions);
+    }
+    fflush(stdout);
+}
+
+//-----------------------------------------------------------------------------
+//      結果を JSON で出力します.
+//-----------------------------------------------------------------------------
+bool BenchSuite::WriteJson(const char* path, const BenchDesc& desc, const std::vector<BenchResult>& results)
+{
+    FILE* pFile = nullptr;
+    auto err = fopen_s(&pFile, path, "w");
+    if (err != 0 || pFile == nullptr)
+    {
+        RTC_ELOG("Error : File Open Failed. path = %s", path);
+        return false;
+    }
+
+    fprintf(pFile, "{\n");
+    fprintf(pFile, "  \"version\": 1,\n");
+    fprintf(pFile, "  \"repetitions\": %u,\n", desc.Repetitions);
+    fprintf(pFile, "  \"min_sample_ms\": %.3f,\n", desc.MinSampleMsec);
+    fprintf(pFile, "  \"pin_cpu\": %d,\n", desc.PinCpu);
+    WriteJsonResults(pFile, results);
+    fprintf(pFile, "}\n");
+
+    fclose(pFile);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      "benchmarks" 配列を出力します.
+//-----------------------------------------------------------------------------
+void BenchSuite::WriteJsonResults(FILE* pFile, const std::vector<BenchResult>& results)
+{
+    fprintf(pFile, "  \"benchmarks\": [\n");
+    for(size_t i=0; i<results.size(); ++i)
+    {
+        auto& item = results[i];
+        fprintf(pFile, "    { \"name\": ");
+        WriteJsonString(pFile, item.Name);
+        fprintf(pFile, ", \"median_ns\": %.3f, \"mad_ns\": %.3f, \"min_ns\": %.3f, \"mean_ns\": %.3f, \"iterations\": %llu, \"repetitions\": %u, \"bytes_per_iter\": %llu }%s\n",
+            item.MedianNs, item.MadNs, item.MinNs, item.MeanNs,
+            static_cast<unsigned long long>(item.Iterations), item.Repetitions,
+            static_cast<unsigned long long>(item.BytesPerIter),
+            (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(pFile, "  ]\n");
+}
+
+//-----------------------------------------------------------------------------
+//      WriteJson() で出力した結果を読み込みます.
+//-----------------------------------------------------------------------------
+bool BenchSuite::ReadJson(const char* path, std::vector<BenchResult>& results)
+{
+    FILE* pFile = nullptr;
+    auto err = fopen_s(&pFile, path, "rb");
+    if (err != 0 || pFile == nullptr)
+    {
+        RTC_ELOG("Error : File Open Failed. path = %s", path);
+        return false;
+    }
+
+    std::string text;
+    char buffer[4096];
+    size_t size = 0;
+    while ((size = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+    { text.append(buffer, size); }
+    fclose(pFile);
+
+    JsonReader reader(text);
+    if (!reader.Read(results))
+    {
+        RTC_ELOG("Error : Invalid Benchmark Json. path = %s", path);
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      2つの結果を比較します.
+//-----------------------------------------------------------------------------
+uint32_t BenchSuite::Compare(const std::vector<BenchResult>& base, const std::vector<BenchResult>& current, double thresholdPct)
+{
+    uint32_t regressions = 0;
+
+    printf("%-32s %12s %12s %9s  %s\n", "name", "base", "current", "delta", "status");
+    for(auto& item : current)
+    {
+        char time[32];
+        FormatTime(item.MedianNs, time, sizeof(time));
+
+        auto pBase = Find(base, item.Name);
+        if (pBase == nullptr || pBase->MedianNs <= 0.0)
+        {
+            printf("%-32s %12s %12s %9s  %s\n", item.Name.c_str(), "-", time, "-", "new");
+            continue;
+        }
+
+        char baseTime[32];
+        FormatTime(pBase->MedianNs, baseTime, sizeof(baseTime));
+
+        auto diff  = item.MedianNs - pBase->MedianNs;
+        auto delta = diff / pBase->MedianNs * 100.0;
+        auto noise = kMadScale * std::max(pBase->MadNs, item.MadNs);
+
+        const char* status = "ok";
+        if (delta > thresholdPct && diff > noise)
+        {
+            status = "REGRESSION";
+            regressions++;
+        }
+        else if (delta < -thresholdPct && -diff > noise)
+        { status = "improved"; }
+
+        printf("%-32s %12s %12s %+8.2f%%  %s\n", item.Name.c_str(), baseTime, time, delta, status);
+    }
+
+    for(auto& item : base)
+    {
+        if (Find(current, item.Name) == nullptr)
+        { printf("%-32s %12s %12s %9s  %s\n", item.Name.c_str(), "", "-", "-", "missing"); }
+    }
+
+    printf("%u regression(s), threshold = %.2f%%\n", regressions, thresholdPct);
+    fflush(stdout);
+    return regressions;
+}
+
+//-----------------------------------------------------------------------------
+//      計測スレッドを指定 CPU に固定し, 優先度を上げます.
+//-----------------------------------------------------------------------------
+bool PinCurrentThread(int cpu)
+{
+    if (cpu < 0 || cpu >= int(sizeof(DWORD_PTR) * 8))
+    { return false; }
+
+    // 他プロセスからの割り込みを減らす.
+    SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+    auto mask = DWORD_PTR(1) << cpu;
+    return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+}
+
+} // namespace rtc
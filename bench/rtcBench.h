@@ -0,0 +1,123 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcBench.h
+// Desc : Micro Benchmark Harness.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcTypedef.h>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+// Type Definitions
+//-----------------------------------------------------------------------------
+//! iterations 回だけ計測対象を実行するコールバックです.
+typedef void (*BenchFunc)(uint64_t iterations, void* pUser);
+
+///////////////////////////////////////////////////////////////////////////////
+// BenchCase structure
+///////////////////////////////////////////////////////////////////////////////
+struct BenchCase
+{
+    std::string     Name;                   //!< ケース名です.
+    BenchFunc       pFunc           = nullptr;  //!< 計測対象です.
+    void*           pUser           = nullptr;  //!< コールバックに渡すユーザーデータです.
+    uint64_t        BytesPerIter    = 0;    //!< 1回あたりの処理バイト数です(スループット表示用).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// BenchResult structure
+///////////////////////////////////////////////////////////////////////////////
+struct BenchResult
+{
+    std::string     Name;                   //!< ケース名です.
+    double          MedianNs        = 0.0;  //!< 1回あたりの時間の中央値(ナノ秒)です.
+    double          MadNs           = 0.0;  //!< 中央絶対偏差(ナノ秒)です.
+    double          MinNs           = 0.0;  //!< 最小値(ナノ秒)です.
+    double          MeanNs          = 0.0;  //!< 平均値(ナノ秒)です.
+    uint64_t        Iterations      = 0;    //!< 1サンプルあたりの実行回数です.
+    uint32_t        Repetitions     = 0;    //!< サンプル数です.
+    uint64_t        BytesPerIter    = 0;    //!< 1回あたりの処理バイト数です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// BenchDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct BenchDesc
+{
+    const char*     pFilter         = nullptr;  //!< 名前にこの文字列を含むケースだけを実行します.
+    uint32_t        Repetitions     = 15;       //!< サンプル数です.
+    double          MinSampleMsec   = 10.0;     //!< 1サンプルの最小計測時間(ミリ秒)です.
+    double          WarmupMsec      = 100.0;    //!< ウォームアップ時間(ミリ秒)です.
+    int             PinCpu          = 0;        //!< 計測スレッドを固定する論理 CPU 番号です. 負値なら固定しません.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// BenchSuite class
+///////////////////////////////////////////////////////////////////////////////
+class BenchSuite
+{
+public:
+    void Add(const char* name, BenchFunc pFunc, void* pUser, uint64_t bytesPerIter = 0);
+
+    //! 登録したケースを計測します. 結果は登録順です.
+    void Run(const BenchDesc& desc, std::vector<BenchResult>& results) const;
+
+    //! ケース名がフィルタに一致するかどうか.
+    static bool IsEnabled(const char* name, const char* pFilter);
+
+    static bool WriteJson(const char* path, const BenchDesc& desc, const std::vector<BenchResult>& results);
+    static bool ReadJson (const char* path, std::vector<BenchResult>& results);
+
+    //! "benchmarks" 配列を出力します. 呼び出し側でオブジェクトの途中に書き込む場合に使います.
+    static void WriteJsonResults(FILE* pFile, const std::vector<BenchResult>& results);
+
+    //-------------------------------------------------------------------------
+    //! @brief      2つの結果を比較して表示します.
+    //!
+    //! @param[in]      base            基準の結果です.
+    //! @param[in]      current         比較する結果です.
+    //! @param[in]      thresholdPct    中央値の増加率がこれ(パーセント)を超え, かつ MAD の 3 倍より大きければ退行とみなします.
+    //! @return     退行したケース数を返却します.
+    //-------------------------------------------------------------------------
+    static uint32_t Compare(const std::vector<BenchResult>& base, const std::vector<BenchResult>& current, double thresholdPct);
+
+    static void Print(const BenchResult& result);
+
+private:
+    std::vector<BenchCase>  m_Cases;
+};
+
+//-----------------------------------------------------------------------------
+//! @brief      計測スレッドを指定 CPU に固定し, 優先度を上げます.
+//-----------------------------------------------------------------------------
+bool PinCurrentThread(int cpu);
+
+extern volatile uint8_t g_BenchSink;
+
+//-----------------------------------------------------------------------------
+//! @brief      値が最適化で消されないようにします.
+//-----------------------------------------------------------------------------
+template<typename T>
+inline void DoNotOptimize(const T& value)
+{
+    g_BenchSink = *reinterpret_cast<const volatile uint8_t*>(&value);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+//-----------------------------------------------------------------------------
+//! @brief      メモリへの書き込みが最適化で消されないようにします.
+//-----------------------------------------------------------------------------
+inline void ClobberMemory()
+{ std::atomic_signal_fence(std::memory_order_seq_cst); }
+
+} // namespace rtc
@@ -0,0 +1,960 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcSceneBench.cpp
+// Desc : Reference Scene Render Benchmark.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcSceneBench.h>
+#include <rtcBvh.h>
+#include <rtcLightBvh.h>
+#include <rtcPathGuiding.h>
+#include <rtcPathTracer.h>
+#include <rtcReSTIR.h>
+#include <rtcSceneParams.h>
+#include <rtcRandom.h>
+#include <rtcSimd.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <cstdio>
+#include <memory>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t kReferenceChunkSpp   = 16;           // 参照画像を1回の Render() で描くサンプル数.
+constexpr uint32_t kReferenceSeedBase   = 0x08000000;   // 参照画像の FrameIndex. 計測側のシードと重ならないようにする.
+constexpr double   kCurveGrowth         = 1.25;         // 画質曲線を記録するサンプル数の間隔.
+constexpr uint32_t kRouletteTuneSpp     = 4;            // ロシアンルーレットの閾値を選ぶ際のサンプル数.
+constexpr uint32_t kRouletteTuneSeed    = 0x04000000;   // 閾値選択の FrameIndex. 計測側や参照画像のシードと重ならないようにする.
+constexpr uint32_t kLightGrid           = 32;           // 多数ライトのシーンに並べる面光源の数 (kLightGrid^2 枚, 三角形はその2倍).
+constexpr size_t   kMaxEvaluatePoints   = 4096;         // ライト選択の分散を評価する点の上限.
+constexpr uint32_t kReSTIRFrames        = 8;            // 時間方向の履歴を溜めるために ReSTIR を実行するフレーム数.
+constexpr float    kShadowRayOffset     = 1e-3f;        // シャドウレイの始点のオフセットと終点の手前で止める割合.
+
+///////////////////////////////////////////////////////////////////////////////
+// SceneMaterial structure
+///////////////////////////////////////////////////////////////////////////////
+struct SceneMaterial
+{
+    rtc::float3     Albedo;
+    rtc::float3     Emission;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// BenchScene structure
+///////////////////////////////////////////////////////////////////////////////
+struct BenchScene
+{
+    const char*                 Name        = nullptr;
+    std::vector<rtc::float3>    Positions;
+    std::vector<uint32_t>       Indices;
+    std::vector<uint32_t>       MaterialIds;    // 三角形ごとのマテリアル番号です.
+    std::vector<rtc::float3>    Normals;        // 三角形ごとの幾何法線です.
+    std::vector<SceneMaterial>  Materials;
+    rtc::Bvh                    Bvh;
+    rtc::Bvh8                   Bvh8;
+    rtc::float3                 Eye;
+    rtc::float3                 Target;
+    float                       FovY        = 0.7f;
+    bool                        HasSky      = false;
+    rtc::float3                 SunDir      = rtc::float3(0.0f, 1.0f, 0.0f);
+
+    //-------------------------------------------------------------------------
+    //      マテリアルを追加します.
+    //-------------------------------------------------------------------------
+    uint32_t AddMaterial(const rtc::float3& albedo, const rtc::float3& emission = rtc::float3(0.0f))
+    {
+        Materials.push_back({ albedo, emission });
+        return uint32_t(Materials.size() - 1);
+    }
+
+    //-------------------------------------------------------------------------
+    //      四角形を追加します (p0, p1, p2, p3 の順に外周を巡ります).
+    //-------------------------------------------------------------------------
+    void AddQuad(const rtc::float3& p0, const rtc::float3& p1, const rtc::float3& p2, const rtc::float3& p3, uint32_t material)
+    {
+        auto base = uint32_t(Positions.size());
+        Positions.push_back(p0);
+        Positions.push_back(p1);
+        Positions.push_back(p2);
+        Positions.push_back(p3);
+
+        uint32_t indices[6] = { base, base + 1, base + 2, base, base + 2, base + 3 };
+        Indices.insert(Indices.end(), indices, indices + 6);
+        MaterialIds.push_back(material);
+        MaterialIds.push_back(material);
+    }
+
+    //-------------------------------------------------------------------------
+    //      Y 軸回りに回転した直方体を追加します.
+    //-------------------------------------------------------------------------
+    void AddBox(const rtc::float3& center, const rtc::float3& halfSize, float angleY, uint32_t material)
+    {
+        auto c = cosf(angleY);
+        auto s = sinf(angleY);
+        auto corner = [&](float sx, float sy, float sz)
+        {
+            auto x = sx * halfSize.x;
+            auto z = sz * halfSize.z;
+            return center + rtc::float3(c * x + s * z, sy * halfSize.y, -s * x + c * z);
+        };
+
+        auto p000 = corner(-1, -1, -1); auto p100 = corner( 1, -1, -1);
+        auto p010 = corner(-1,  1, -1); auto p110 = corner( 1,  1, -1);
+        auto p001 = corner(-1, -1,  1); auto p101 = corner( 1, -1,  1);
+        auto p011 = corner(-1,  1,  1); auto p111 = corner( 1,  1,  1);
+
+        AddQuad(p001, p101, p111, p011, material);  // +Z
+        AddQuad(p100, p000, p010, p110, material);  // -Z
+        AddQuad(p101, p100, p110, p111, material);  // +X
+        AddQuad(p000, p001, p011, p010, material);  // -X
+        AddQuad(p011, p111, p110, p010, material);  // +Y
+        AddQuad(p000, p100, p101, p001, material);  // -Y
+    }
+
+    //-------------------------------------------------------------------------
+    //      BVH と三角形ごとの法線を構築します.
+    //-------------------------------------------------------------------------
+    bool Build()
+    {
+        auto triangleCount = uint32_t(Indices.size() / 3);
+
+        Normals.resize(triangleCount);
+        for(auto i=0u; i<triangleCount; ++i)
+        {
+            auto& p0 = Positions[Indices[i * 3 + 0]];
+            auto& p1 = Positions[Indices[i * 3 + 1]];
+            auto& p2 = Positions[Indices[i * 3 + 2]];
+            Normals[i] = rtc::Normalize(rtc::Cross(p1 - p0, p2 - p0));
+        }
+
+        rtc::BvhBuildDesc desc;
+        desc.pPositions     = Positions.data();
+        desc.pIndices       = Indices.data();
+        desc.VertexCount    = uint32_t(Positions.size());
+        desc.TriangleCount  = triangleCount;
+
+        return Bvh.Build(desc) && Bvh8.Build(Bvh);
+    }
+};
+
+//-----------------------------------------------------------------------------
+//      コーネルボックスです. 天井の小さな光源だけで照らされます.
+//-----------------------------------------------------------------------------
+void CreateCornellBox(BenchScene& scene)
+{
+    scene.Name   = "cornell";
+    scene.Eye    = rtc::float3(0.0f, 0.0f, 3.4f);
+    scene.Target = rtc::float3(0.0f, 0.0f, 0.0f);
+    scene.FovY   = 0.75f;
+
+    auto white = scene.AddMaterial(rtc::float3(0.73f, 0.73f, 0.73f));
+    auto red   = scene.AddMaterial(rtc::float3(0.65f, 0.05f, 0.05f));
+    auto green = scene.AddMaterial(rtc::float3(0.12f, 0.45f, 0.15f));
+    auto light = scene.AddMaterial(rtc::float3(0.0f), rtc::float3(6.0f, 4.5f, 2.0f));
+
+    scene.AddQuad(rtc::float3(-1, -1,  1), rtc::float3( 1, -1,  1), rtc::float3( 1, -1, -1), rtc::float3(-1, -1, -1), white);  // 床.
+    scene.AddQuad(rtc::float3(-1,  1, -1), rtc::float3( 1,  1, -1), rtc::float3( 1,  1,  1), rtc::float3(-1,  1,  1), white);  // 天井.
+    scene.AddQuad(rtc::float3(-1, -1, -1), rtc::float3( 1, -1, -1), rtc::float3( 1,  1, -1), rtc::float3(-1,  1, -1), white);  // 奥.
+    scene.AddQuad(rtc::float3(-1, -1,  1), rtc::float3(-1, -1, -1), rtc::float3(-1,  1, -1), rtc::float3(-1,  1,  1), red);    // 左.
+    scene.AddQuad(rtc::float3( 1, -1, -1), rtc::float3( 1, -1,  1), rtc::float3( 1,  1,  1), rtc::float3( 1,  1, -1), green);  // 右.
+
+    scene.AddQuad(
+        rtc::float3(-0.4f, 0.995f, -0.4f), rtc::float3(0.4f, 0.995f, -0.4f),
+        rtc::float3( 0.4f, 0.995f,  0.4f), rtc::float3(-0.4f, 0.995f, 0.4f), light);
+
+    scene.AddBox(rtc::float3( 0.33f, -0.7f,  0.3f), rtc::float3(0.3f, 0.3f, 0.3f), -0.3f, white);
+    scene.AddBox(rtc::float3(-0.33f, -0.4f, -0.3f), rtc::float3(0.3f, 0.6f, 0.3f),  0.3f, white);
+}
+
+//-----------------------------------------------------------------------------
+//      空で照らされた起伏のある地形です.
+//-----------------------------------------------------------------------------
+void CreateTerrain(BenchScene& scene)
+{
+    constexpr uint32_t kGrid = 128;
+
+    scene.Name   = "terrain";
+    scene.Eye    = rtc::float3(0.0f, 2.5f, 6.0f);
+    scene.Target = rtc::float3(0.0f, 0.0f, 0.0f);
+    scene.FovY   = 0.9f;
+    scene.HasSky = true;
+    scene.SunDir = rtc::Normalize(rtc::float3(0.4f, 0.6f, -0.3f));
+
+    auto ground = scene.AddMaterial(rtc::float3(0.5f, 0.45f, 0.4f));
+
+    for(auto z=0u; z<kGrid; ++z)
+    {
+        for(auto x=0u; x<kGrid; ++x)
+        {
+            auto px = (float(x) / float(kGrid - 1) * 2.0f - 1.0f) * 4.0f;
+            auto pz = (float(z) / float(kGrid - 1) * 2.0f - 1.0f) * 4.0f;
+            auto py = 0.4f * sinf(1.3f * px) * cosf(1.1f * pz) + 0.15f * sinf(3.7f * px + 1.0f) * sinf(2.9f * pz);
+            scene.Positions.push_back(rtc::float3(px, py, pz));
+        }
+    }
+
+    for(auto z=0u; z<kGrid - 1; ++z)
+    {
+        for(auto x=0u; x<kGrid - 1; ++x)
+        {
+            auto i0 = z * kGrid + x;
+            auto i1 = i0 + 1;
+            auto i2 = i0 + kGrid;
+            auto i3 = i2 + 1;
+            uint32_t indices[6] = { i0, i2, i1, i1, i2, i3 };
+            scene.Indices.insert(scene.Indices.end(), indices, indices + 6);
+            scene.MaterialIds.push_back(ground);
+            scene.MaterialIds.push_back(ground);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      低い太陽に照らされた柱の並びです. 遮蔽と間接光が多いシーンです.
+//-----------------------------------------------------------------------------
+void CreatePillars(BenchScene& scene)
+{
+    scene.Name   = "pillars";
+    scene.Eye    = rtc::float3(6.0f, 4.0f, 6.0f);
+    scene.Target = rtc::float3(0.0f, 1.0f, 0.0f);
+    scene.FovY   = 0.8f;
+    scene.HasSky = true;
+    scene.SunDir = rtc::Normalize(rtc::float3(-0.7f, 0.25f, -0.4f));
+
+    auto ground = scene.AddMaterial(rtc::float3(0.6f, 0.6f, 0.6f));
+    auto stone  = scene.AddMaterial(rtc::float3(0.7f, 0.55f, 0.4f));
+
+    scene.AddQuad(rtc::float3(-6, 0,  6), rtc::float3(6, 0,  6), rtc::float3(6, 0, -6), rtc::float3(-6, 0, -6), ground);
+
+    for(auto z=0; z<5; ++z)
+    {
+        for(auto x=0; x<5; ++x)
+        {
+            auto height = 0.5f + 0.4f * float((x * 7 + z * 3) % 5);
+            scene.AddBox(
+                rtc::float3(float(x - 2) * 1.6f, height, float(z - 2) * 1.6f),
+                rtc::float3(0.35f, height, 0.35f),
+                0.2f * float(x - z),
+                stone);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      柱の並びの上に強さの異なる小さな面光源を多数並べたシーンです.
+//      ライトは BVH に含めないので遮蔽物にはなりません.
+//-----------------------------------------------------------------------------
+void CreateManyLights(BenchScene& scene, std::vector<rtc::EmissiveTriangle>& lights)
+{
+    CreatePillars(scene);
+    scene.Name   = "manylights";
+    scene.HasSky = false;
+
+    rtc::Random random(7, 8, 9);
+    const auto half = 0.08f;
+
+    lights.clear();
+    lights.reserve(kLightGrid * kLightGrid * 2);
+    for(auto z=0u; z<kLightGrid; ++z)
+    {
+        for(auto x=0u; x<kLightGrid; ++x)
+        {
+            auto cx = ((float(x) + 0.5f) / float(kLightGrid) * 2.0f - 1.0f) * 5.5f;
+            auto cz = ((float(z) + 0.5f) / float(kLightGrid) * 2.0f - 1.0f) * 5.5f;
+            auto cy = 4.5f + random.GetAsF32();
+
+            // 強さは 2^-2 から 2^6 まで対数的にばらつかせ, 一様選択との差が出るようにする.
+            auto power = exp2f(random.GetAsF32() * 8.0f - 2.0f);
+            auto color = rtc::float3(0.5f + 0.5f * random.GetAsF32(), 0.5f + 0.5f * random.GetAsF32(), 0.5f + 0.5f * random.GetAsF32());
+
+            // 下向きに発光する四角形.
+            rtc::float3 p0(cx - half, cy, cz - half);
+            rtc::float3 p1(cx + half, cy, cz - half);
+            rtc::float3 p2(cx + half, cy, cz + half);
+            rtc::float3 p3(cx - half, cy, cz + half);
+
+            rtc::EmissiveTriangle tri = {};
+            tri.Emission    = color * power;
+            tri.InstanceId  = 0;
+            tri.TwoSided    = false;
+
+            tri.Position[0] = p0; tri.Position[1] = p1; tri.Position[2] = p2;
+            tri.PrimitiveId = uint32_t(lights.size());
+            lights.push_back(tri);
+
+            tri.Position[0] = p0; tri.Position[1] = p2; tri.Position[2] = p3;
+            tri.PrimitiveId = uint32_t(lights.size());
+            lights.push_back(tri);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      遮蔽判定のコールバックです. target まで遮るものが無ければ true を返します.
+//-----------------------------------------------------------------------------
+bool IsVisible(void* pUser, const rtc::float3& position, const rtc::float3& normal, const rtc::float3& target)
+{
+    auto& scene = *static_cast<const BenchScene*>(pUser);
+
+    auto origin = position + normal * kShadowRayOffset;
+    auto dir    = target - origin;
+    auto dist   = rtc::Length(dir);
+    if (!(dist > 0.0f))
+    { return false; }
+
+    // 終点は光源上なので, 光源自身に当たらないよう手前で止める.
+    rtc::BvhRay ray;
+    ray.Origin    = origin;
+    ray.TMin      = 0.0f;
+    ray.Direction = dir / dist;
+    ray.TMax      = dist * (1.0f - kShadowRayOffset);
+
+    rtc::BvhHit hit;
+    return !scene.Bvh8.Intersect(ray, hit);
+}
+
+//-----------------------------------------------------------------------------
+//      交差判定のコールバックです.
+//-----------------------------------------------------------------------------
+bool IntersectScene(void* pUser, const rtc::float3& origin, const rtc::float3& dir, rtc::PathVertex& hit)
+{
+    auto& scene = *static_cast<const BenchScene*>(pUser);
+
+    rtc::BvhRay ray;
+    ray.Origin    = origin;
+    ray.TMin      = 0.0f;
+    ray.Direction = dir;
+    ray.TMax      = FLT_MAX;
+
+    rtc::BvhHit result;
+    if (!scene.Bvh8.Intersect(ray, result))
+    { return false; }
+
+    auto& material = scene.Materials[scene.MaterialIds[result.PrimitiveId]];
+    hit.Position = origin + dir * result.T;
+    hit.Normal   = scene.Normals[result.PrimitiveId];
+    hit.Albedo   = material.Albedo;
+    hit.Emission = material.Emission;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      環境光のコールバックです. 空のグラデーションと太陽です.
+//-----------------------------------------------------------------------------
+rtc::float3 SampleSky(void* pUser, const rtc::float3& dir)
+{
+    auto& scene = *static_cast<const BenchScene*>(pUser);
+    if (!scene.HasSky)
+    { return rtc::float3(0.0f); }
+
+    auto t       = rtc::Saturate(dir.y);
+    auto horizon = rtc::float3(0.9f, 0.85f, 0.8f);
+    auto zenith  = rtc::float3(0.25f, 0.45f, 0.9f);
+    auto sun     = powf(std::max(rtc::Dot(dir, scene.SunDir), 0.0f), 64.0f) * 6.0f;
+    return rtc::Lerp(horizon, zenith, t) + rtc::float3(sun, sun * 0.9f, sun * 0.7f);
+}
+
+//-----------------------------------------------------------------------------
+//      カメラの逆ビュー行列を求めます (右手系, -Z 前方).
+//-----------------------------------------------------------------------------
+rtc::float4x4 CreateInvLookAt(const rtc::float3& eye, const rtc::float3& target)
+{
+    auto f = rtc::Normalize(target - eye);
+    auto r = rtc::Normalize(rtc::Cross(f, rtc::float3(0.0f, 1.0f, 0.0f)));
+    auto u = rtc::Cross(r, f);
+
+    return rtc::float4x4(
+        rtc::float4(r.x, u.x, -f.x, eye.x),
+        rtc::float4(r.y, u.y, -f.y, eye.y),
+        rtc::float4(r.z, u.z, -f.z, eye.z),
+        rtc::float4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+//-----------------------------------------------------------------------------
+//      ピクセル中心の一次レイを生成します. PathTracer::TracePath() と同じ規約です.
+//-----------------------------------------------------------------------------
+void GeneratePrimaryRay
+(
+    const rtc::SceneBenchDesc&  desc,
+    const rtc::float4x4&        invView,
+    const rtc::float4x4&        invProj,
+    uint32_t                    x,
+    uint32_t                    y,
+    rtc::BvhRay&                ray,
+    float&                      viewScale
+)
+{
+    auto px = (float(x) + 0.5f) / float(desc.Width);
+    auto py = (float(y) + 0.5f) / float(desc.Height);
+    auto clip = rtc::float4(px * 2.0f - 1.0f, (1.0f - py) * 2.0f - 1.0f, 1.0f, 1.0f);
+
+    auto target   = rtc::Mul(invProj, clip);
+    auto viewDir  = rtc::Normalize(rtc::float3(target.x, target.y, target.z) / target.w);
+    auto worldDir = rtc::Mul(invView, rtc::float4(viewDir, 0.0f));
+    auto worldPos = rtc::Mul(invView, rtc::float4(0.0f, 0.0f, 0.0f, 1.0f));
+
+    ray.Origin    = rtc::float3(worldPos.x, worldPos.y, worldPos.z);
+    ray.Direction = rtc::Normalize(rtc::float3(worldDir.x, worldDir.y, worldDir.z));
+    ray.TMin      = 0.0f;
+    ray.TMax      = FLT_MAX;
+
+    // ヒット距離にこれを掛けるとビュー空間の深度になる.
+    viewScale = -viewDir.z;
+}
+
+//-----------------------------------------------------------------------------
+//      参照画像のパスを求めます.
+//-----------------------------------------------------------------------------
+std::string GetReferencePath(const rtc::SceneBenchDesc& desc, const char* name)
+{
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "%s/%s_%ux%u.pfm", desc.pReferenceDir, name, desc.Width, desc.Height);
+    return buffer;
+}
+
+//-----------------------------------------------------------------------------
+//      参照画像を描画します.
+//-----------------------------------------------------------------------------
+void RenderReference
+(
+    const rtc::SceneBenchDesc&  desc,
+    rtc::PathTracer&            tracer,
+    rtc::PathTracerFrame        frame,
+    std::vector<rtc::float3>&   reference
+)
+{
+    auto pixelCount = size_t(desc.Width) * desc.Height;
+    auto chunkCount = std::max((desc.ReferenceSpp + kReferenceChunkSpp - 1) / kReferenceChunkSpp, 1u);
+
+    std::vector<rtc::float3> chunk(pixelCount);
+    reference.assign(pixelCount, rtc::float3(0.0f));
+
+    frame.SamplesPerPixel = kReferenceChunkSpp;
+    for(auto i=0u; i<chunkCount; ++i)
+    {
+        frame.FrameIndex = kReferenceSeedBase + i;
+        tracer.Render(frame, chunk.data());
+        for(size_t j=0; j<pixelCount; ++j)
+        { reference[j] += chunk[j]; }
+    }
+
+    auto scale = 1.0f / float(chunkCount);
+    for(auto& item : reference)
+    { item *= scale; }
+}
+
+//-----------------------------------------------------------------------------
+//      1シーンを計測します. guided が true ならパスガイドを学習しながら描画します.
+//-----------------------------------------------------------------------------
+bool RunScene(const rtc::SceneBenchDesc& desc, BenchScene& scene, bool guided, rtc::SceneBenchResult& result)
+{
+    result.Name = scene.Name;
+    if (guided)
+    { result.Name += "_guided"; }
+
+    rtc::PathTracerDesc tracerDesc;
+    tracerDesc.Width       = desc.Width;
+    tracerDesc.Height      = desc.Height;
+    tracerDesc.MaxBounce   = desc.MaxBounce;
+    tracerDesc.ThreadCount = desc.ThreadCount;
+
+    rtc::PathTracer tracer;
+    if (!tracer.Init(tracerDesc))
+    {
+        RTC_ELOG("Error : PathTracer::Init() Failed.");
+        return false;
+    }
+
+    auto aspect = float(desc.Width) / float(desc.Height);
+    auto proj   = rtc::CreatePerspectiveFovRH(scene.FovY, aspect, 0.1f, 1000.0f, rtc::float2(0.0f, 0.0f));
+
+    rtc::PathTracerFrame frame;
+    frame.InvView     = CreateInvLookAt(scene.Eye, scene.Target);
+    frame.InvProj     = rtc::InverseProjectionSimd(proj);
+    frame.Intersect   = IntersectScene;
+    frame.Environment = SampleSky;
+    frame.pUser       = &scene;
+
+    // 参照画像. ガイドありの計測はガイドなしで保存した画像を読み込む.
+    auto path = GetReferencePath(desc, scene.Name);
+    std::vector<rtc::float3> reference;
+    if (desc.MakeReference && !guided)
+    {
+        RenderReference(desc, tracer, frame, reference);
+        if (!rtc::SaveImagePfm(path.c_str(), reference.data(), desc.Width, desc.Height))
+        { return false; }
+        printf("%-12s reference saved : %s (%u spp)\n", scene.Name, path.c_str(), desc.ReferenceSpp);
+    }
+    else
+    {
+        uint32_t w = 0, h = 0;
+        if (!rtc::LoadImagePfm(path.c_str(), reference, w, h) || w != desc.Width || h != desc.Height)
+        {
+            RTC_ELOG("Error : Reference Not Found. path = %s (run with --make-reference)", path.c_str());
+            return false;
+        }
+    }
+
+    // ロシアンルーレットの閾値はシーンごとに効率で選ぶ. 計測時間には含めない.
+    {
+        auto tuneFrame = frame;
+        tuneFrame.FrameIndex      = kRouletteTuneSeed;
+        tuneFrame.SamplesPerPixel = kRouletteTuneSpp;
+        tracer.OptimizeRoulette(tuneFrame, nullptr, 0);
+    }
+
+    // パスガイドは最初のイテレーションで学習する. イテレーション i は 2^i パスで, 更新時間も計測時間に含める.
+    rtc::PathGuiding guiding;
+    uint32_t         iterationEnd = 1;
+    if (guided)
+    {
+        rtc::PathGuidingDesc guidingDesc;
+        for(auto& position : scene.Positions)
+        { guidingDesc.SceneBounds.Merge(position); }
+
+        if (!guiding.Init(guidingDesc))
+        {
+            RTC_ELOG("Error : PathGuiding::Init() Failed. scene = %s", scene.Name);
+            return false;
+        }
+        frame.pGuiding = &guiding;
+    }
+
+    rtc::ImageQualityDesc qualityDesc;
+    qualityDesc.Width  = desc.Width;
+    qualityDesc.Height = desc.Height;
+
+    auto pixelCount = size_t(desc.Width) * desc.Height;
+    std::vector<rtc::float3> sample(pixelCount);
+    std::vector<rtc::float3> sum   (pixelCount, rtc::float3(0.0f));
+    std::vector<rtc::float3> image (pixelCount);
+
+    // 同じシードなら同じパスの画像は実行ごとに一致する. 時間だけが変動する.
+    frame.SamplesPerPixel = 1;
+
+    double   elapsed   = 0.0;
+    double   prevMsec  = 0.0;
+    double   prevPsnr  = 0.0;
+    double   nextCurve = 1.0;
+    uint32_t spp       = 0;
+
+    for(auto pass=0u; pass<desc.MaxPasses; ++pass)
+    {
+        frame.FrameIndex = desc.Seed * desc.MaxPasses + pass;
+        auto stats = tracer.Render(frame, sample.data());
+
+        elapsed          += stats.ElapsedMsec;
+        result.TotalRays += stats.TotalRays;
+        spp++;
+
+        if (guided && guiding.IsTraining() && spp == iterationEnd)
+        {
+            rtc::Timer timer;
+            timer.Start();
+            guiding.EndIteration();
+            timer.End();
+
+            elapsed      += timer.GetElapsedMsec();
+            iterationEnd += 1u << guiding.GetStats().Iteration;
+        }
+
+        auto invSpp = 1.0f / float(spp);
+        for(size_t i=0; i<pixelCount; ++i)
+        {
+            sum  [i] += sample[i];
+            image[i]  = sum[i] * invSpp;
+        }
+
+        auto last = (elapsed >= desc.BudgetMsec) || (pass + 1 == desc.MaxPasses);
+
+        // 到達時間は PSNR だけを毎パス評価して線形補間する.
+        if (result.TimeToQualityMsec < 0.0)
+        {
+            auto psnr = rtc::CalcImagePsnr(qualityDesc, image.data(), reference.data());
+            if (psnr >= desc.TargetPsnr)
+            {
+                auto t = (psnr > prevPsnr && spp > 1) ? (desc.TargetPsnr - prevPsnr) / (psnr - prevPsnr) : 1.0;
+                result.TimeToQualityMsec = prevMsec + (elapsed - prevMsec) * std::min(std::max(t, 0.0), 1.0);
+            }
+            prevPsnr = psnr;
+            prevMsec = elapsed;
+        }
+
+        // 曲線はサンプル数の等比間隔で記録する.
+        if (double(spp) >= nextCurve || last)
+        {
+            rtc::SceneQualitySample point;
+            point.Spp     = spp;
+            point.Msec    = elapsed;
+            point.Quality = rtc::CalcImageQuality(qualityDesc, image.data(), reference.data());
+            result.Curve.push_back(point);
+
+            nextCurve = std::max(nextCurve * kCurveGrowth, double(spp + 1));
+        }
+
+        if (last)
+        { break; }
+    }
+
+    auto& quality = result.GetFinal().Quality;
+    result.Passed = (desc.MinPsnr <= 0.0 || quality.Psnr >= desc.MinPsnr)
+                 && (desc.MinSsim <= 0.0 || quality.Ssim >= desc.MinSsim);
+
+    printf("%-16s %5u spp %10.1f ms  PSNR %6.2f dB  SSIM %.4f  dE %6.3f (p99 %6.3f)  to %.1f dB: ",
+        result.Name.c_str(), spp, elapsed, quality.Psnr, quality.Ssim, quality.DeltaE, quality.DeltaEP99, desc.TargetPsnr);
+    if (result.TimeToQualityMsec >= 0.0)
+    { printf("%.1f ms", result.TimeToQualityMsec); }
+    else
+    { printf("not reached"); }
+    printf("%s\n", result.Passed ? "" : "  FAILED");
+    fflush(stdout);
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      多数ライトのシーンを計測します.
+//-----------------------------------------------------------------------------
+bool RunLightScene(const rtc::SceneBenchDesc& desc, rtc::LightBenchResult& result)
+{
+    std::unique_ptr<BenchScene> scene(new BenchScene());
+    std::vector<rtc::EmissiveTriangle> emissives;
+    CreateManyLights(*scene, emissives);
+
+    result.Name = scene->Name;
+
+    if (!scene->Build())
+    {
+        RTC_ELOG("Error : Scene Build Failed. scene = %s", scene->Name);
+        return false;
+    }
+
+    rtc::LightBvh lights;
+    if (!lights.Build(emissives.data(), uint32_t(emissives.size())))
+    {
+        RTC_ELOG("Error : LightBvh::Build() Failed. scene = %s", scene->Name);
+        return false;
+    }
+    result.LightCount = lights.GetLightCount();
+
+    auto aspect  = float(desc.Width) / float(desc.Height);
+    auto proj    = rtc::CreatePerspectiveFovRH(scene->FovY, aspect, 0.1f, 1000.0f, rtc::float2(0.0f, 0.0f));
+    auto invView = CreateInvLookAt(scene->Eye, scene->Target);
+    auto invProj = rtc::InverseProjectionSimd(proj);
+
+    // ピクセル中心の一次レイのヒットをサーフェイスにする.
+    auto pixelCount = size_t(desc.Width) * desc.Height;
+    std::vector<rtc::ReSTIRSurface> surfaces(pixelCount);
+    for(size_t i=0; i<pixelCount; ++i)
+    {
+        rtc::BvhRay ray;
+        float       viewScale;
+        GeneratePrimaryRay(desc, invView, invProj, uint32_t(i % desc.Width), uint32_t(i / desc.Width), ray, viewScale);
+
+        auto& surface = surfaces[i];
+        surface.Valid = false;
+
+        rtc::BvhHit hit;
+        if (!scene->Bvh8.Intersect(ray, hit))
+        { continue; }
+
+        auto normal = scene->Normals[hit.PrimitiveId];
+        if (rtc::Dot(normal, ray.Direction) > 0.0f)
+        { normal = -normal; }
+
+        surface.Position  = ray.Origin + ray.Direction * hit.T;
+        surface.Normal    = normal;
+        surface.Albedo    = scene->Materials[scene->MaterialIds[hit.PrimitiveId]].Albedo;
+        surface.ViewDepth = hit.T * viewScale;
+        surface.Valid     = true;
+    }
+
+    // ライト選択の分散を評価する. 点数が多い場合は間引く.
+    std::vector<rtc::float3> positions;
+    std::vector<rtc::float3> normals;
+    auto stride = std::max<size_t>(pixelCount / kMaxEvaluatePoints, 1);
+    for(size_t i=0; i<pixelCount; i+=stride)
+    {
+        if (!surfaces[i].Valid)
+        { continue; }
+
+        positions.push_back(surfaces[i].Position);
+        normals  .push_back(surfaces[i].Normal);
+    }
+
+    auto selection = lights.Evaluate(positions.data(), normals.data(), positions.size());
+    result.PointCount      = selection.PointCount;
+    result.VarianceBvh     = selection.VarianceBvh;
+    result.VarianceUniform = selection.VarianceUniform;
+
+    printf("%-16s %5u lights, %zu points  selection variance : light BVH %.4e, uniform %.4e (%.2fx lower)\n",
+        scene->Name, result.LightCount, result.PointCount,
+        result.VarianceBvh, result.VarianceUniform,
+        (result.VarianceBvh > 0.0) ? result.VarianceUniform / result.VarianceBvh : 0.0);
+    fflush(stdout);
+
+    rtc::ReSTIRDesc restirDesc;
+    restirDesc.Width       = desc.Width;
+    restirDesc.Height      = desc.Height;
+    restirDesc.ThreadCount = desc.ThreadCount;
+
+    rtc::ReSTIR restir;
+    if (!restir.Init(restirDesc, &lights))
+    {
+        RTC_ELOG("Error : ReSTIR::Init() Failed.");
+        return false;
+    }
+
+    // 静止カメラなので前フレームも同じサーフェイスと行列を使う.
+    rtc::ReSTIRFrame frame;
+    frame.pSurfaces     = surfaces.data();
+    frame.pPrevSurfaces = surfaces.data();
+    frame.PrevView      = rtc::InverseAffineSimd(invView);
+    frame.PrevProj      = proj;
+    frame.Visibility    = IsVisible;
+    frame.pUser         = scene.get();
+
+    // 参照画像は NEE を多数サンプル平均して作る.
+    auto path = GetReferencePath(desc, scene->Name);
+    std::vector<rtc::float3> reference;
+    if (desc.MakeReference)
+    {
+        auto chunkCount = std::max((desc.ReferenceSpp + kReferenceChunkSpp - 1) / kReferenceChunkSpp, 1u);
+
+        std::vector<rtc::float3> chunk(pixelCount);
+        reference.assign(pixelCount, rtc::float3(0.0f));
+        for(auto i=0u; i<chunkCount; ++i)
+        {
+            frame.FrameIndex = kReferenceSeedBase + i;
+            restir.ExecuteNEE(frame, kReferenceChunkSpp, chunk.data());
+            for(size_t j=0; j<pixelCount; ++j)
+            { reference[j] += chunk[j]; }
+        }
+
+        auto scale = 1.0f / float(chunkCount);
+        for(auto& item : reference)
+        { item *= scale; }
+
+        if (!rtc::SaveImagePfm(path.c_str(), reference.data(), desc.Width, desc.Height))
+        { return false; }
+        printf("%-12s reference saved : %s (%u spp)\n", scene->Name, path.c_str(), desc.ReferenceSpp);
+    }
+    else
+    {
+        uint32_t w = 0, h = 0;
+        if (!rtc::LoadImagePfm(path.c_str(), reference, w, h) || w != desc.Width || h != desc.Height)
+        {
+            RTC_ELOG("Error : Reference Not Found. path = %s (run with --make-reference)", path.c_str());
+            return false;
+        }
+    }
+
+    std::vector<rtc::float3> image(pixelCount);
+
+    // ReSTIR は時間方向の履歴が溜まった最終フレームを評価する. 時間は1フレームの平均.
+    double restirMsec = 0.0;
+    for(auto i=0u; i<kReSTIRFrames; ++i)
+    {
+        frame.FrameIndex = desc.Seed * kReSTIRFrames + i;
+        restirMsec += restir.Execute(frame, image.data()).ElapsedMsec;
+    }
+    result.ReSTIRMsec = restirMsec / double(kReSTIRFrames);
+    result.ReSTIRMse  = rtc::ReSTIR::CalcMeanSquaredError(image.data(), reference.data(), pixelCount);
+
+    // NEE は1サンプルの時間から, ReSTIR の1フレームと同じ時間に収まるサンプル数を決める.
+    frame.FrameIndex = desc.Seed;
+    restir.ExecuteNEE(frame, 1, image.data());
+    auto pilotMsec = restir.ExecuteNEE(frame, 1, image.data()).ElapsedMsec;
+    result.NeeSpp  = uint32_t(std::max(result.ReSTIRMsec / std::max(pilotMsec, 1e-3) + 0.5, 1.0));
+
+    result.NeeMsec = restir.ExecuteNEE(frame, result.NeeSpp, image.data()).ElapsedMsec;
+    result.NeeMse  = rtc::ReSTIR::CalcMeanSquaredError(image.data(), reference.data(), pixelCount);
+
+    printf("%-16s equal time : ReSTIR %.2f ms MSE %.4e, NEE %u spp %.2f ms MSE %.4e (NEE / ReSTIR MSE %.2fx)\n",
+        scene->Name,
+        result.ReSTIRMsec, result.ReSTIRMse,
+        result.NeeSpp, result.NeeMsec, result.NeeMse,
+        (result.ReSTIRMse > 0.0) ? result.NeeMse / result.ReSTIRMse : 0.0);
+    fflush(stdout);
+
+    return true;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+//      多数ライトのシーンを計測します.
+//-----------------------------------------------------------------------------
+bool RunLightBench(const SceneBenchDesc& desc, std::vector<LightBenchResult>& results)
+{
+    if (desc.Width == 0 || desc.Height == 0)
+    { return false; }
+
+    if (!BenchSuite::IsEnabled("manylights", desc.pFilter))
+    { return true; }
+
+    LightBenchResult result;
+    if (!RunLightScene(desc, result))
+    { return false; }
+
+    results.push_back(result);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      組み込みシーンを計測します.
+//-----------------------------------------------------------------------------
+bool RunSceneBench(const SceneBenchDesc& desc, std::vector<SceneBenchResult>& results)
+{
+    if (desc.Width == 0 || desc.Height == 0 || desc.MaxPasses == 0)
+    { return false; }
+
+    if (desc.MakeReference && !CreateDirectoryA(desc.pReferenceDir, nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        RTC_ELOG("Error : CreateDirectory() Failed. path = %s", desc.pReferenceDir);
+        return false;
+    }
+
+    typedef void (*CreateFunc)(BenchScene&);
+    static const CreateFunc kScenes[] = {
+        CreateCornellBox,
+        CreateTerrain,
+        CreatePillars,
+    };
+
+    for(auto pCreate : kScenes)
+    {
+        // BVH はシーンごとに構築して解放する.
+        std::unique_ptr<BenchScene> scene(new BenchScene());
+        pCreate(*scene);
+
+        if (!BenchSuite::IsEnabled(scene->Name, desc.pFilter))
+        { continue; }
+
+        if (!scene->Build())
+        {
+            RTC_ELOG("Error : Scene Build Failed. scene = %s", scene->Name);
+            return false;
+        }
+
+        // 同じ予算でガイドなしとガイドありを描画し, 最終画質を比べる.
+        SceneBenchResult unguided;
+        SceneBenchResult guided;
+        if (!RunScene(desc, *scene, false, unguided)
+         || !RunScene(desc, *scene, true,  guided))
+        { return false; }
+
+        auto& base = unguided.GetFinal();
+        auto& test = guided  .GetFinal();
+        printf("%-16s guided vs unguided : PSNR %+.2f dB, MSE x %.3f (%u / %u spp in %.1f / %.1f ms)\n",
+            scene->Name,
+            test.Quality.Psnr - base.Quality.Psnr,
+            pow(10.0, (base.Quality.Psnr - test.Quality.Psnr) / 10.0),
+            test.Spp, base.Spp, test.Msec, base.Msec);
+        fflush(stdout);
+
+        results.push_back(unguided);
+        results.push_back(guided);
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      比較用の計測値に変換します.
+//-----------------------------------------------------------------------------
+void ToBenchResults(const std::vector<SceneBenchResult>& scenes, std::vector<BenchResult>& results)
+{
+    for(auto& item : scenes)
+    {
+        auto& point = item.GetFinal();
+
+        // 画像は決定的なので, パスあたりの時間は同じ画質での速度として比較できる.
+        BenchResult perSpp;
+        perSpp.Name         = "scene_" + item.Name + "_ns_per_spp";
+        perSpp.MedianNs     = point.Msec * 1e6 / double(point.Spp);
+        perSpp.MinNs        = perSpp.MedianNs;
+        perSpp.MeanNs       = perSpp.MedianNs;
+        perSpp.Iterations   = point.Spp;
+        perSpp.Repetitions  = 1;
+        results.push_back(perSpp);
+
+        if (item.TimeToQualityMsec >= 0.0)
+        {
+            BenchResult ttq;
+            ttq.Name        = "scene_" + item.Name + "_time_to_psnr";
+            ttq.MedianNs    = item.TimeToQualityMsec * 1e6;
+            ttq.MinNs       = ttq.MedianNs;
+            ttq.MeanNs      = ttq.MedianNs;
+            ttq.Iterations  = 1;
+            ttq.Repetitions = 1;
+            results.push_back(ttq);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      結果を JSON で出力します.
+//-----------------------------------------------------------------------------
+bool WriteSceneBenchJson(const char* path, const SceneBenchDesc& desc, const std::vector<SceneBenchResult>& results)
+{
+    FILE* pFile = nullptr;
+    auto err = fopen_s(&pFile, path, "w");
+    if (err != 0 || pFile == nullptr)
+    {
+        RTC_ELOG("Error : File Open Failed. path = %s", path);
+        return false;
+    }
+
+    fprintf(pFile, "{\n");
+    fprintf(pFile, "  \"version\": 1,\n");
+    fprintf(pFile, "  \"width\": %u,\n", desc.Width);
+    fprintf(pFile, "  \"height\": %u,\n", desc.Height);
+    fprintf(pFile, "  \"seed\": %u,\n", desc.Seed);
+    fprintf(pFile, "  \"budget_ms\": %.3f,\n", desc.BudgetMsec);
+    fprintf(pFile, "  \"target_psnr\": %.3f,\n", desc.TargetPsnr);
+    fprintf(pFile, "  \"scenes\": [\n");
+    for(size_t i=0; i<results.size(); ++i)
+    {
+        auto& item = results[i];
+        auto& last = item.GetFinal();
+        fprintf(pFile, "    {\n");
+        fprintf(pFile, "      \"name\": \"%s\",\n", item.Name.c_str());
+        fprintf(pFile, "      \"passed\": %s,\n", item.Passed ? "true" : "false");
+        fprintf(pFile, "      \"spp\": %u,\n", last.Spp);
+        fprintf(pFile, "      \"render_ms\": %.3f,\n", last.Msec);
+        fprintf(pFile, "      \"rays\": %llu,\n", static_cast<unsigned long long>(item.TotalRays));
+        fprintf(pFile, "      \"time_to_psnr_ms\": %.3f,\n", item.TimeToQualityMsec);
+        fprintf(pFile, "      \"curve\": [\n");
+        for(size_t j=0; j<item.Curve.size(); ++j)
+        {
+            auto& point = item.Curve[j];
+            fprintf(pFile, "        { \"spp\": %u, \"ms\": %.3f, \"psnr\": %.4f, \"ssim\": %.6f, \"delta_e\": %.4f, \"delta_e_p99\": %.4f }%s\n",
+                point.Spp, point.Msec, point.Quality.Psnr, point.Quality.Ssim, point.Quality.DeltaE, point.Quality.DeltaEP99,
+                (j + 1 < item.Curve.size()) ? "," : "");
+        }
+        fprintf(pFile, "      ]\n");
+        fprintf(pFile, "    }%s\n", (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(pFile, "  ],\n");
+
+    std::vector<BenchResult> benchmarks;
+    ToBenchResults(results, benchmarks);
+    BenchSuite::WriteJsonResults(pFile, benchmarks);
+    fprintf(pFile, "}\n");
+
+    fclose(pFile);
+    return true;
+}
+
+} // namespace rtc
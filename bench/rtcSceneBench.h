@@ -0,0 +1,107 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcSceneBench.h
+// Desc : Reference Scene Render Benchmark.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcBench.h>
+#include <rtcImageQuality.h>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// SceneBenchDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct SceneBenchDesc
+{
+    uint32_t        Width           = 320;      //!< 横幅です.
+    uint32_t        Height          = 180;      //!< 縦幅です.
+    uint32_t        Seed            = 0;        //!< 乱数のシードです. FrameIndex = Seed * MaxPasses + パス番号.
+    uint32_t        MaxPasses       = 1024;     //!< 最大パス数です(1パス = 1spp).
+    double          BudgetMsec      = 5000.0;   //!< シーンごとの描画時間の予算(ミリ秒)です.
+    uint32_t        MaxBounce       = 8;        //!< 最大バウンス数です.
+    uint32_t        ReferenceSpp    = 4096;     //!< 参照画像のサンプル数です.
+    double          TargetPsnr      = 30.0;     //!< 到達時間を計測する PSNR(dB) です.
+    double          MinPsnr         = 0.0;      //!< 予算内の最終 PSNR がこれを下回ると失敗にします (0 なら判定しません).
+    double          MinSsim         = 0.0;      //!< 予算内の最終 SSIM がこれを下回ると失敗にします (0 なら判定しません).
+    const char*     pReferenceDir   = "../res/references";  //!< 参照画像 (PFM) のディレクトリです.
+    const char*     pFilter         = nullptr;  //!< 名前にこの文字列を含むシーンだけを実行します.
+    bool            MakeReference   = false;    //!< 参照画像を生成して保存します.
+    uint32_t        ThreadCount     = 0;        //!< ワーカースレッド数です(0ならハードウェアスレッド数).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// SceneQualitySample structure
+///////////////////////////////////////////////////////////////////////////////
+struct SceneQualitySample
+{
+    uint32_t        Spp         = 0;    //!< 累積サンプル数です.
+    double          Msec        = 0.0;  //!< 累積描画時間(ミリ秒)です.
+    ImageQuality    Quality;            //!< 参照画像との比較結果です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// SceneBenchResult structure
+///////////////////////////////////////////////////////////////////////////////
+struct SceneBenchResult
+{
+    std::string                     Name;                       //!< シーン名です.
+    std::vector<SceneQualitySample> Curve;                      //!< 画質と時間の曲線です.
+    double                          TimeToQualityMsec = -1.0;   //!< TargetPsnr に到達した時間です. 未到達なら負値.
+    uint64_t                        TotalRays   = 0;            //!< 発行したレイ数です.
+    bool                            Passed      = true;         //!< 画質判定を通過したかどうか.
+
+    const SceneQualitySample& GetFinal() const { return Curve.back(); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// LightBenchResult structure
+///////////////////////////////////////////////////////////////////////////////
+struct LightBenchResult
+{
+    std::string     Name;                       //!< シーン名です.
+    uint32_t        LightCount      = 0;        //!< 発光三角形の数です.
+    size_t          PointCount      = 0;        //!< 選択の分散を評価した点の数です.
+    double          VarianceBvh     = 0.0;      //!< ライト BVH による選択の平均分散です.
+    double          VarianceUniform = 0.0;      //!< 一様選択の平均分散です.
+    double          ReSTIRMsec      = 0.0;      //!< ReSTIR の1フレームあたりの時間(ミリ秒)です.
+    double          ReSTIRMse       = 0.0;      //!< ReSTIR の最終フレームの参照画像に対する平均二乗誤差です.
+    uint32_t        NeeSpp          = 0;        //!< ReSTIR と同じ時間に収まる NEE のサンプル数です.
+    double          NeeMsec         = 0.0;      //!< NEE の時間(ミリ秒)です.
+    double          NeeMse          = 0.0;      //!< NEE の参照画像に対する平均二乗誤差です.
+};
+
+//-----------------------------------------------------------------------------
+//! @brief      組み込みシーンを描画して参照画像と比較します.
+//!
+//! @param[in]      desc        設定です.
+//! @param[out]     results     シーンごとの結果です.
+//! @return     参照画像の読み込みや生成に失敗した場合は false を返却します.
+//-----------------------------------------------------------------------------
+bool RunSceneBench(const SceneBenchDesc& desc, std::vector<SceneBenchResult>& results);
+
+//-----------------------------------------------------------------------------
+//! @brief      多数のライトを持つシーンで直接光のライト選択と, 同じ時間での ReSTIR と NEE の誤差を評価します.
+//!
+//! @param[in]      desc        設定です. 参照画像は ReferenceSpp の NEE で生成します.
+//! @param[out]     results     シーンごとの結果です.
+//! @return     構築や参照画像の読み込みに失敗した場合は false を返却します.
+//-----------------------------------------------------------------------------
+bool RunLightBench(const SceneBenchDesc& desc, std::vector<LightBenchResult>& results);
+
+//-----------------------------------------------------------------------------
+//! @brief      結果を JSON で出力します. "benchmarks" は BenchSuite::Compare() で比較できます.
+//-----------------------------------------------------------------------------
+bool WriteSceneBenchJson(const char* path, const SceneBenchDesc& desc, const std::vector<SceneBenchResult>& results);
+
+//-----------------------------------------------------------------------------
+//! @brief      比較用の計測値に変換します (到達時間とパスあたりの時間).
+//-----------------------------------------------------------------------------
+void ToBenchResults(const std::vector<SceneBenchResult>& scenes, std::vector<BenchResult>& results);
+
+} // namespace rtc
@@ -7,10 +7,13 @@
 //
 // Optional config macros:
 // FPNG_NO_SSE - Set to 1 to completely disable SSE usage, even on x86/x64. By default, on x86/x64 it's enabled.
+// FPNG_NO_AVX2 - Set to 1 to disable the AVX2/VPCLMULQDQ checksum paths (for compilers without AVX2/VPCLMULQDQ intrinsics). Defaults to 0.
+// FPNG_NO_AVX512 - Set to 1 to disable the AVX-512 checksum paths (for compilers without AVX-512 intrinsics). Defaults to 0.
 // FPNG_DISABLE_DECODE_CRC32_CHECKS - Set to 1 to disable PNG chunk CRC-32 tests, for improved fuzzing. Defaults to 0.
 // FPNG_USE_UNALIGNED_LOADS - Set to 1 to indicate it's OK to read/write unaligned 32-bit/64-bit values. Defaults to 0, unless x86/x64.
 //
 // With gcc/clang on x86, compile with -msse4.1 -mpclmul -fno-strict-aliasing
+// The AVX2/AVX-512 paths use per-function target attributes on gcc/clang and are only called if the CPU supports them, so no extra flags are needed.
 // Only tested with -fno-strict-aliasing (which the Linux kernel uses, and MSVC's default).
 //
 #include "fpng.h"
@@ -33,6 +36,14 @@
 	#define FPNG_X86_OR_X64_CPU (0)
 #endif
 
+#ifndef FPNG_NO_AVX2
+	#define FPNG_NO_AVX2 (0)
+#endif
+
+#ifndef FPNG_NO_AVX512
+	#define FPNG_NO_AVX512 (0)
+#endif
+
 #if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE
 	#ifdef _MSC_VER
 		#include <intrin.h>
@@ -41,6 +52,16 @@
 	#include <emmintrin.h>		// SSE2
 	#include <smmintrin.h>		// SSE4.1
 	#include <wmmintrin.h>		// pclmul
+	#if !FPNG_NO_AVX2 || !FPNG_NO_AVX512
+		#include <immintrin.h>	// AVX2, AVX-512, VPCLMULQDQ
+	#endif
+#endif
+
+// Enables instruction sets for a single function on gcc/clang. MSVC allows any intrinsic without flags.
+#if defined(__GNUC__) || defined(__clang__)
+	#define FPNG_TARGET(x) __attribute__((target(x)))
+#else
+	#define FPNG_TARGET(x)
 #endif
 
 #ifndef FPNG_NO_STDIO
@@ -252,25 +273,21 @@ namespace fpng
 	// See Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction":
 	// https://www.intel.com/content/dam/www/public/us/en/documents/white-papers/fast-crc-computation-generic-polynomials-pclmulqdq-paper.pdf
 	// Requires PCLMUL and SSE 4.1. This function skips Step 1 (fold by 4) for simplicity/less code.
-	static uint32_t crc32_pclmul(const uint8_t* p, size_t size, uint32_t crc)
-	{
-		assert(size >= 16);
-
-		// See page 22 (bit reflected constants for gzip)
+	// See page 22 (bit reflected constants for gzip)
 #ifdef _MSC_VER
-		static const uint64_t __declspec(align(16)) 
+	static const uint64_t __declspec(align(16)) 
 #else
-		static const uint64_t __attribute__((aligned(16)))
+	static const uint64_t __attribute__((aligned(16)))
 #endif
-			s_u[2] = { 0x1DB710641, 0x1F7011641 }, s_k5k0[2] = { 0x163CD6124, 0 }, s_k3k4[2] = { 0x1751997D0, 0xCCAA009E };
-
-		// Load first 16 bytes, apply initial CRC32
-		__m128i b = _mm_xor_si128(_mm_cvtsi32_si128(~crc), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+		s_u[2] = { 0x1DB710641, 0x1F7011641 }, s_k5k0[2] = { 0x163CD6124, 0 }, s_k3k4[2] = { 0x1751997D0, 0xCCAA009E };
 
+	// b holds the folded CRC state of all data before p. size must be a multiple of 16.
+	static uint32_t crc32_pclmul_reduce(__m128i b, const uint8_t* p, size_t size)
+	{
 		// We're skipping directly to Step 2 page 12 - iteratively folding by 1 (by 4 is overkill for our needs)
 		const __m128i k3k4 = _mm_load_si128(reinterpret_cast<const __m128i*>(s_k3k4));
 
-		for (size -= 16, p += 16; size >= 16; size -= 16, p += 16)
+		for (; size >= 16; size -= 16, p += 16)
 			b = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(b, k3k4, 17), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p))), _mm_clmulepi64_si128(b, k3k4, 0));
 
 		// Final stages: fold to 64-bits, 32-bit Barrett reduction
@@ -280,16 +297,91 @@ namespace fpng
 		return ~_mm_extract_epi32(_mm_xor_si128(b, _mm_clmulepi64_si128(_mm_and_si128(_mm_clmulepi64_si128(_mm_and_si128(b, z), u, 16), z), u, 0)), 1);
 	}
 
-	static uint32_t crc32_sse41_simd(const unsigned char* buf, size_t len, uint32_t prev_crc32)
+	static uint32_t crc32_pclmul(const uint8_t* p, size_t size, uint32_t crc)
 	{
-		if (len < 16)
-			return crc32_slice_by_4(buf, len, prev_crc32);
+		assert(size >= 16);
 
-		uint32_t simd_len = len & ~15;
-		uint32_t c = crc32_pclmul(buf, simd_len, prev_crc32);
-		return crc32_slice_by_4(buf + simd_len, len - simd_len, c);
+		// Load first 16 bytes, apply initial CRC32
+		__m128i b = _mm_xor_si128(_mm_cvtsi32_si128(~crc), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+		return crc32_pclmul_reduce(b, p + 16, size - 16);
+	}
+
+#if !FPNG_NO_AVX2
+	// Step 1 of the paper (fold by 4) on 256-bit registers: 4 ymm accumulators fold 128 bytes per iteration, 1024 bits apart.
+	// The 8 resulting 128-bit lanes are then folded by 1 in stream order, and the rest goes through crc32_pclmul_reduce().
+	// Requires AVX2 and VPCLMULQDQ. size must be a multiple of 16 and >= 128.
+	FPNG_TARGET("avx2,pclmul,vpclmulqdq")
+	static uint32_t crc32_vpclmul_avx2(const uint8_t* p, size_t size, uint32_t crc)
+	{
+		assert(size >= 128);
+
+		// x^(1024+32) mod P, x^(1024-32) mod P (bit reflected, shifted left by 1) in each 128-bit lane
+		const __m256i k = _mm256_setr_epi64x(0x1E88EF372, 0x14A7FE880, 0x1E88EF372, 0x14A7FE880);
+
+		__m256i x0 = _mm256_xor_si256(_mm256_setr_epi32((int)~crc, 0, 0, 0, 0, 0, 0, 0), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+		__m256i x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+		__m256i x2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 64));
+		__m256i x3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 96));
+
+		for (size -= 128, p += 128; size >= 128; size -= 128, p += 128)
+		{
+			x0 = _mm256_xor_si256(_mm256_xor_si256(_mm256_clmulepi64_epi128(x0, k, 0x00), _mm256_clmulepi64_epi128(x0, k, 0x11)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+			x1 = _mm256_xor_si256(_mm256_xor_si256(_mm256_clmulepi64_epi128(x1, k, 0x00), _mm256_clmulepi64_epi128(x1, k, 0x11)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32)));
+			x2 = _mm256_xor_si256(_mm256_xor_si256(_mm256_clmulepi64_epi128(x2, k, 0x00), _mm256_clmulepi64_epi128(x2, k, 0x11)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 64)));
+			x3 = _mm256_xor_si256(_mm256_xor_si256(_mm256_clmulepi64_epi128(x3, k, 0x00), _mm256_clmulepi64_epi128(x3, k, 0x11)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 96)));
+		}
+
+		const __m128i k3k4 = _mm_load_si128(reinterpret_cast<const __m128i*>(s_k3k4));
+		const __m256i x[4] = { x0, x1, x2, x3 };
+
+		__m128i b = _mm256_castsi256_si128(x0);
+		for (uint32_t i = 1; i < 8; i++)
+		{
+			const __m128i l = (i & 1) ? _mm256_extracti128_si256(x[i >> 1], 1) : _mm256_castsi256_si128(x[i >> 1]);
+			b = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(b, k3k4, 17), l), _mm_clmulepi64_si128(b, k3k4, 0));
+		}
+
+		return crc32_pclmul_reduce(b, p, size);
+	}
+#endif
+
+#if !FPNG_NO_AVX512
+	// Same as crc32_vpclmul_avx2(), but with 4 zmm accumulators folding 256 bytes per iteration, 2048 bits apart.
+	// Requires AVX-512 F and VPCLMULQDQ. size must be a multiple of 16 and >= 256.
+	FPNG_TARGET("avx512f,pclmul,vpclmulqdq")
+	static uint32_t crc32_vpclmul_avx512(const uint8_t* p, size_t size, uint32_t crc)
+	{
+		assert(size >= 256);
+
+		// x^(2048+32) mod P, x^(2048-32) mod P (bit reflected, shifted left by 1) in each 128-bit lane
+		const __m512i k = _mm512_set_epi64(0x1322D1430, 0x11542778A, 0x1322D1430, 0x11542778A, 0x1322D1430, 0x11542778A, 0x1322D1430, 0x11542778A);
+
+		__m512i x0 = _mm512_xor_si512(_mm512_inserti32x4(_mm512_setzero_si512(), _mm_cvtsi32_si128((int)~crc), 0), _mm512_loadu_si512(p));
+		__m512i x1 = _mm512_loadu_si512(p + 64);
+		__m512i x2 = _mm512_loadu_si512(p + 128);
+		__m512i x3 = _mm512_loadu_si512(p + 192);
+
+		// 0x96 = a ^ b ^ c
+		for (size -= 256, p += 256; size >= 256; size -= 256, p += 256)
+		{
+			x0 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x0, k, 0x00), _mm512_clmulepi64_epi128(x0, k, 0x11), _mm512_loadu_si512(p), 0x96);
+			x1 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x1, k, 0x00), _mm512_clmulepi64_epi128(x1, k, 0x11), _mm512_loadu_si512(p + 64), 0x96);
+			x2 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x2, k, 0x00), _mm512_clmulepi64_epi128(x2, k, 0x11), _mm512_loadu_si512(p + 128), 0x96);
+			x3 = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x3, k, 0x00), _mm512_clmulepi64_epi128(x3, k, 0x11), _mm512_loadu_si512(p + 192), 0x96);
+		}
+
+		const __m128i k3k4 = _mm_load_si128(reinterpret_cast<const __m128i*>(s_k3k4));
+		__m128i l[16];
+		_mm512_storeu_si512(l, x0); _mm512_storeu_si512(l + 4, x1); _mm512_storeu_si512(l + 8, x2); _mm512_storeu_si512(l + 12, x3);
+
+		__m128i b = l[0];
+		for (uint32_t i = 1; i < 16; i++)
+			b = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(b, k3k4, 17), l[i]), _mm_clmulepi64_si128(b, k3k4, 0));
+
+		return crc32_pclmul_reduce(b, p, size);
 	}
 #endif
+#endif
 
 #if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
 
@@ -311,11 +403,24 @@ namespace fpng
 	}
 #endif
 
+	// Returns XCR0 (which register states the OS saves). Only valid if CPUID.1:ECX.OSXSAVE is set.
+	static uint64_t do_xgetbv()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		uint32_t eax = 0, edx = 0;
+		__asm__ __volatile__("xgetbv;" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((uint64_t)edx << 32) | eax;
+#endif
+	}
+
 	struct cpu_info
 	{
 		cpu_info() { memset(this, 0, sizeof(*this)); }
 
 		bool m_initialized, m_has_fpu, m_has_mmx, m_has_sse, m_has_sse2, m_has_sse3, m_has_ssse3, m_has_sse41, m_has_sse42, m_has_avx, m_has_avx2, m_has_pclmulqdq;
+		bool m_has_osxsave, m_has_avx512f, m_has_avx512bw, m_has_avx512vl, m_has_vpclmulqdq, m_os_saves_ymm, m_os_saves_zmm;
 				
 		void init()
 		{
@@ -341,6 +446,14 @@ namespace fpng
 				extract_x86_flags(regs[2], regs[3]);
 			}
 
+			if (m_has_osxsave)
+			{
+				// XCR0: SSE (bit 1), AVX (bit 2), opmask/ZMM_Hi256/Hi16_ZMM (bits 5-7)
+				const uint64_t xcr0 = do_xgetbv();
+				m_os_saves_ymm = (xcr0 & 0x6) == 0x6;
+				m_os_saves_zmm = (xcr0 & 0xE6) == 0xE6;
+			}
+
 			if (max_eax >= 7U)
 			{
 #ifdef _MSC_VER
@@ -348,7 +461,7 @@ namespace fpng
 #else
 				do_cpuid(7, 0, (uint32_t*)regs);
 #endif
-				extract_x86_extended_flags(regs[1]);
+				extract_x86_extended_flags(regs[1], regs[2]);
 			}
 
 			m_initialized = true;
@@ -356,16 +469,24 @@ namespace fpng
 
 		bool can_use_sse41() const { return m_has_sse && m_has_sse2 && m_has_sse3 && m_has_ssse3 && m_has_sse41; }
 		bool can_use_pclmul() const	{ return m_has_pclmulqdq && can_use_sse41(); }
+		bool can_use_avx2() const { return !FPNG_NO_AVX2 && m_has_avx && m_has_avx2 && m_os_saves_ymm && can_use_sse41(); }
+		bool can_use_avx512() const { return !FPNG_NO_AVX512 && m_has_avx512f && m_has_avx512bw && m_has_avx512vl && m_os_saves_zmm && can_use_avx2(); }
+		bool can_use_vpclmul_avx2() const { return m_has_vpclmulqdq && can_use_pclmul() && can_use_avx2(); }
+		bool can_use_vpclmul_avx512() const { return m_has_vpclmulqdq && can_use_pclmul() && can_use_avx512(); }
 
 	private:
 		void extract_x86_flags(uint32_t ecx, uint32_t edx)
 		{
 			m_has_fpu = (edx & (1 << 0)) != 0;	m_has_mmx = (edx & (1 << 23)) != 0;	m_has_sse = (edx & (1 << 25)) != 0; m_has_sse2 = (edx & (1 << 26)) != 0;
 			m_has_sse3 = (ecx & (1 << 0)) != 0; m_has_ssse3 = (ecx & (1 << 9)) != 0; m_has_sse41 = (ecx & (1 << 19)) != 0; m_has_sse42 = (ecx & (1 << 20)) != 0;
-			m_has_pclmulqdq = (ecx & (1 << 1)) != 0; m_has_avx = (ecx & (1 << 28)) != 0;
+			m_has_pclmulqdq = (ecx & (1 << 1)) != 0; m_has_avx = (ecx & (1 << 28)) != 0; m_has_osxsave = (ecx & (1 << 27)) != 0;
 		}
 
-		void extract_x86_extended_flags(uint32_t ebx) { m_has_avx2 = (ebx & (1 << 5)) != 0; }
+		void extract_x86_extended_flags(uint32_t ebx, uint32_t ecx)
+		{
+			m_has_avx2 = (ebx & (1 << 5)) != 0; m_has_avx512f = (ebx & (1 << 16)) != 0; m_has_avx512bw = (ebx & (1 << 30)) != 0; m_has_avx512vl = (ebx & (1u << 31)) != 0;
+			m_has_vpclmulqdq = (ecx & (1 << 10)) != 0;
+		}
 	};
 
 	cpu_info g_cpu_info;
@@ -390,16 +511,72 @@ namespace fpng
 #endif
 	}
 
-	uint32_t fpng_crc32(const void* pData, size_t size, uint32_t prev_crc32)
+	bool fpng_cpu_supports_avx2()
 	{
 #if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
-		if (g_cpu_info.can_use_pclmul())
-			return crc32_sse41_simd(static_cast<const uint8_t *>(pData), size, prev_crc32);
+		assert(g_cpu_info.m_initialized);
+		return g_cpu_info.can_use_avx2();
+#else
+		return false;
+#endif
+	}
+
+	bool fpng_cpu_supports_avx512()
+	{
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
+		assert(g_cpu_info.m_initialized);
+		return g_cpu_info.can_use_avx512();
+#else
+		return false;
+#endif
+	}
+
+	bool fpng_cpu_supports_vpclmulqdq()
+	{
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
+		assert(g_cpu_info.m_initialized);
+		return g_cpu_info.m_has_vpclmulqdq;
+#else
+		return false;
+#endif
+	}
+
+	uint32_t fpng_crc32_simd(uint32_t simd_level, const void* pData, size_t size, uint32_t prev_crc32)
+	{
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
+		if ((simd_level >= FPNG_SIMD_SSE41) && (size >= 16) && g_cpu_info.can_use_pclmul())
+		{
+			const uint8_t* p = static_cast<const uint8_t*>(pData);
+			const size_t simd_len = size & ~(size_t)15;
+
+			// The wide paths only pay off once the final lane folding is amortized.
+			uint32_t c;
+#if !FPNG_NO_AVX512
+			if ((simd_level >= FPNG_SIMD_AVX512) && (simd_len >= 1024) && g_cpu_info.can_use_vpclmul_avx512())
+				c = crc32_vpclmul_avx512(p, simd_len, prev_crc32);
+			else
+#endif
+#if !FPNG_NO_AVX2
+			if ((simd_level >= FPNG_SIMD_AVX2) && (simd_len >= 512) && g_cpu_info.can_use_vpclmul_avx2())
+				c = crc32_vpclmul_avx2(p, simd_len, prev_crc32);
+			else
+#endif
+				c = crc32_pclmul(p, simd_len, prev_crc32);
+
+			return crc32_slice_by_4(p + simd_len, size - simd_len, c);
+		}
+#else
+		(void)simd_level;
 #endif
 
 		return crc32_slice_by_4(pData, size, prev_crc32);
 	}
 
+	uint32_t fpng_crc32(const void* pData, size_t size, uint32_t prev_crc32)
+	{
+		return fpng_crc32_simd(FPNG_SIMD_AVX512, pData, size, prev_crc32);
+	}
+
 #if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
 	// See "Fast Computation of Adler32 Checksums":
 	// https://www.intel.com/content/www/us/en/developer/articles/technical/fast-computation-of-adler32-checksums.html
@@ -460,6 +637,118 @@ namespace fpng
 
 		return (s1 % K) | ((s2 % K) << 16);
 	}
+
+#if !FPNG_NO_AVX2 || !FPNG_NO_AVX512
+	// Byte weights for s2 within a 64 (AVX-512) or 32 (AVX2, starting at +32) byte block.
+	static const int8_t s_adler32_taps[64] = 
+	{
+		64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33,
+		32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+	};
+#endif
+
+#if !FPNG_NO_AVX2
+	// AVX2, 32 bytes per iteration. s1 is summed with vpsadbw, s2 with vpmaddubsw/vpmaddwd against the taps. 
+	// The s1 value before each block is accumulated in ps and multiplied by the block size once per 5552 byte run.
+	FPNG_TARGET("avx2")
+	static uint32_t adler32_avx2(const uint8_t* p, size_t len, uint32_t initial)
+	{
+		uint32_t s1 = initial & 0xFFFF, s2 = initial >> 16;
+		const uint32_t K = 65521;
+
+		const __m256i taps = _mm256_loadu_si256((const __m256i*)(s_adler32_taps + 32)), ones = _mm256_set1_epi16(1), zero = _mm256_setzero_si256();
+
+		while (len >= 32)
+		{
+			const size_t n = minimum<size_t>(len >> 5, 5552 / 32);
+
+			__m256i vs1 = zero, vs2 = zero, vps = zero;
+			for (size_t i = 0; i < n; i++)
+			{
+				const __m256i v = _mm256_loadu_si256((const __m256i*)(p + i * 32));
+				vps = _mm256_add_epi32(vps, vs1);
+				vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(v, zero));
+				vs2 = _mm256_add_epi32(vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(v, taps), ones));
+			}
+			vs2 = _mm256_add_epi32(vs2, _mm256_slli_epi32(vps, 5));
+
+			uint32_t sa[8], sb[8];
+			_mm256_storeu_si256((__m256i*)sa, vs1); _mm256_storeu_si256((__m256i*)sb, vs2);
+
+			uint64_t vs1_sum = 0, vs2_sum = 0;
+			for (uint32_t i = 0; i < 8; i++)
+			{
+				vs1_sum += sa[i];
+				vs2_sum += sb[i];
+			}
+
+			s2 = (uint32_t)((s2 + (uint64_t)s1 * (n * 32) + vs2_sum) % K);
+			s1 = (uint32_t)((s1 + vs1_sum) % K);
+
+			p += n * 32;
+			len -= n * 32;
+		}
+
+		for (; len; len--)
+		{
+			s1 += *p++;
+			s2 += s1;
+		}
+
+		return (s1 % K) | ((s2 % K) << 16);
+	}
+#endif
+
+#if !FPNG_NO_AVX512
+	// Same as adler32_avx2(), but 64 bytes per iteration. Requires AVX-512 BW.
+	FPNG_TARGET("avx512f,avx512bw")
+	static uint32_t adler32_avx512(const uint8_t* p, size_t len, uint32_t initial)
+	{
+		uint32_t s1 = initial & 0xFFFF, s2 = initial >> 16;
+		const uint32_t K = 65521;
+
+		const __m512i taps = _mm512_loadu_si512(s_adler32_taps), ones = _mm512_set1_epi16(1), zero = _mm512_setzero_si512();
+
+		while (len >= 64)
+		{
+			const size_t n = minimum<size_t>(len >> 6, 5552 / 64);
+
+			__m512i vs1 = zero, vs2 = zero, vps = zero;
+			for (size_t i = 0; i < n; i++)
+			{
+				const __m512i v = _mm512_loadu_si512(p + i * 64);
+				vps = _mm512_add_epi32(vps, vs1);
+				vs1 = _mm512_add_epi32(vs1, _mm512_sad_epu8(v, zero));
+				vs2 = _mm512_add_epi32(vs2, _mm512_madd_epi16(_mm512_maddubs_epi16(v, taps), ones));
+			}
+			vs2 = _mm512_add_epi32(vs2, _mm512_mullo_epi32(vps, _mm512_set1_epi32(64)));
+
+			uint32_t sa[16], sb[16];
+			_mm512_storeu_si512(sa, vs1); _mm512_storeu_si512(sb, vs2);
+
+			uint64_t vs1_sum = 0, vs2_sum = 0;
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				vs1_sum += sa[i];
+				vs2_sum += sb[i];
+			}
+
+			s2 = (uint32_t)((s2 + (uint64_t)s1 * (n * 64) + vs2_sum) % K);
+			s1 = (uint32_t)((s1 + vs1_sum) % K);
+
+			p += n * 64;
+			len -= n * 64;
+		}
+
+		for (; len; len--)
+		{
+			s1 += *p++;
+			s2 += s1;
+		}
+
+		return (s1 % K) | ((s2 % K) << 16);
+	}
+#endif
 #endif
 
 	static uint32_t fpng_adler32_scalar(const uint8_t* ptr, size_t buf_len, uint32_t adler)
@@ -477,15 +766,101 @@ namespace fpng
 		return (s2 << 16) + s1;
 	}
 
-	uint32_t fpng_adler32(const void* pData, size_t size, uint32_t adler)
+	uint32_t fpng_adler32_simd(uint32_t simd_level, const void* pData, size_t size, uint32_t adler)
 	{
 #if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
-		if (g_cpu_info.can_use_sse41())
+#if !FPNG_NO_AVX512
+		if ((simd_level >= FPNG_SIMD_AVX512) && g_cpu_info.can_use_avx512())
+			return adler32_avx512((const uint8_t*)pData, size, adler);
+#endif
+#if !FPNG_NO_AVX2
+		if ((simd_level >= FPNG_SIMD_AVX2) && g_cpu_info.can_use_avx2())
+			return adler32_avx2((const uint8_t*)pData, size, adler);
+#endif
+		if ((simd_level >= FPNG_SIMD_SSE41) && g_cpu_info.can_use_sse41())
 			return adler32_sse_16((const uint8_t*)pData, size, adler);
+#else
+		(void)simd_level;
 #endif
 		return fpng_adler32_scalar((const uint8_t*)pData, size, adler);
 	}
 
+	uint32_t fpng_adler32(const void* pData, size_t size, uint32_t adler)
+	{
+		return fpng_adler32_simd(FPNG_SIMD_AVX512, pData, size, adler);
+	}
+
+	// See zlib's crc32_combine(): crc(A|B) = crc(A) * x^(8*len(B)) mod P ^ crc(B), using reflected polynomial arithmetic.
+	static const uint32_t FPNG_CRC32_POLY = 0xEDB88320;
+
+	// a * b mod P (bit reflected, x^0 is the MSB)
+	static uint32_t crc32_multmodp(uint32_t a, uint32_t b)
+	{
+		uint32_t m = 1U << 31, p = 0;
+		for ( ; ; )
+		{
+			if (a & m)
+			{
+				p ^= b;
+				if ((a & (m - 1)) == 0)
+					break;
+			}
+			m >>= 1;
+			b = (b & 1) ? ((b >> 1) ^ FPNG_CRC32_POLY) : (b >> 1);
+		}
+		return p;
+	}
+
+	// x^(n * 2^k) mod P
+	static uint32_t crc32_x2nmodp(uint64_t n, uint32_t k)
+	{
+		// x^(2^i) mod P for i = 0..31, the sequence repeats after that
+		struct x2n_table
+		{
+			uint32_t m_x2n[32];
+			x2n_table()
+			{
+				uint32_t p = 1U << 30; // x^1
+				m_x2n[0] = p;
+				for (uint32_t i = 1; i < 32; i++)
+					m_x2n[i] = p = crc32_multmodp(p, p);
+			}
+		};
+		static const x2n_table s_table;
+
+		uint32_t p = 1U << 31; // x^0
+		while (n)
+		{
+			if (n & 1)
+				p = crc32_multmodp(s_table.m_x2n[k & 31], p);
+			n >>= 1;
+			k++;
+		}
+		return p;
+	}
+
+	uint32_t fpng_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+	{
+		return crc32_multmodp(crc32_x2nmodp(len2, 3), crc1) ^ crc2;
+	}
+
+	// See zlib's adler32_combine(): s1 = s1(A) + s1(B) - 1, s2 = s2(A) + s2(B) + len(B) * s1(A) - len(B).
+	uint32_t fpng_adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t len2)
+	{
+		const uint32_t K = 65521;
+
+		const uint32_t rem = (uint32_t)(len2 % K);
+		uint32_t sum1 = adler1 & 0xFFFF;
+		uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % K);
+		sum1 += (adler2 & 0xFFFF) + K - 1;
+		sum2 += (adler1 >> 16) + (adler2 >> 16) + K - rem;
+		if (sum1 >= K) sum1 -= K;
+		if (sum1 >= K) sum1 -= K;
+		if (sum2 >= (K << 1)) sum2 -= (K << 1);
+		if (sum2 >= K) sum2 -= K;
+		return sum1 | (sum2 << 16);
+	}
+
 	// Ensure we've been configured for endianness correctly.
 	static inline bool endian_check()
 	{
@@ -1160,25 +1535,21 @@ do { \
 		return dst_ofs;
 	}
 
-	static uint32_t pixel_deflate_dyn_3_rle_one_pass(
+	// Encodes h filtered rows with the fixed one pass Huffman table, continuing from the given bit buffer state.
+	// Rows are independent (matches never cross rows), so this can be called on any number of rows at a time.
+	static bool pixel_deflate_dyn_3_rle_one_pass_rows(
 		const uint8_t* pImg, uint32_t w, uint32_t h,
-		uint8_t* pDst, uint32_t dst_buf_size)
+		uint8_t* pDst, uint32_t dst_buf_size, uint32_t& dst_ofs_state, uint64_t& bit_buf_state, int& bit_buf_size_state)
 	{
 		const uint32_t bpl = 1 + w * 3;
 
-		if (dst_buf_size < sizeof(g_dyn_huff_3))
-			return false;
-		memcpy(pDst, g_dyn_huff_3, sizeof(g_dyn_huff_3));
-		uint32_t dst_ofs = sizeof(g_dyn_huff_3);
-
-		uint64_t bit_buf = DYN_HUFF_3_BITBUF;
-		int bit_buf_size = DYN_HUFF_3_BITBUF_SIZE;
+		uint32_t dst_ofs = dst_ofs_state;
+		uint64_t bit_buf = bit_buf_state;
+		int bit_buf_size = bit_buf_size_state;
 
 		const uint8_t* pSrc = pImg;
 		uint32_t src_ofs = 0;
 
-		uint32_t src_adler32 = fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT);
-
 		for (uint32_t y = 0; y < h; y++)
 		{
 			const uint32_t end_src_ofs = src_ofs + bpl;
@@ -1243,6 +1614,32 @@ do { \
 		} // y
 
 		assert(src_ofs == h * bpl);
+		(void)bpl;
+
+		dst_ofs_state = dst_ofs;
+		bit_buf_state = bit_buf;
+		bit_buf_size_state = bit_buf_size;
+		return true;
+	}
+
+	static uint32_t pixel_deflate_dyn_3_rle_one_pass(
+		const uint8_t* pImg, uint32_t w, uint32_t h,
+		uint8_t* pDst, uint32_t dst_buf_size)
+	{
+		const uint32_t bpl = 1 + w * 3;
+
+		if (dst_buf_size < sizeof(g_dyn_huff_3))
+			return false;
+		memcpy(pDst, g_dyn_huff_3, sizeof(g_dyn_huff_3));
+		uint32_t dst_ofs = sizeof(g_dyn_huff_3);
+
+		uint64_t bit_buf = DYN_HUFF_3_BITBUF;
+		int bit_buf_size = DYN_HUFF_3_BITBUF_SIZE;
+
+		uint32_t src_adler32 = fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT);
+
+		if (!pixel_deflate_dyn_3_rle_one_pass_rows(pImg, w, h, pDst, dst_buf_size, dst_ofs, bit_buf, bit_buf_size))
+			return 0;
 		
 		assert(bit_buf_size <= 7);
 
@@ -1446,25 +1843,21 @@ do { \
 		return dst_ofs;
 	}
 
-	static uint32_t pixel_deflate_dyn_4_rle_one_pass(
+	// Encodes h filtered rows with the fixed one pass Huffman table, continuing from the given bit buffer state.
+	// Rows are independent (matches never cross rows), so this can be called on any number of rows at a time.
+	static bool pixel_deflate_dyn_4_rle_one_pass_rows(
 		const uint8_t* pImg, uint32_t w, uint32_t h,
-		uint8_t* pDst, uint32_t dst_buf_size)
+		uint8_t* pDst, uint32_t dst_buf_size, uint32_t& dst_ofs_state, uint64_t& bit_buf_state, int& bit_buf_size_state)
 	{
 		const uint32_t bpl = 1 + w * 4;
 
-		if (dst_buf_size < sizeof(g_dyn_huff_4))
-			return false;
-		memcpy(pDst, g_dyn_huff_4, sizeof(g_dyn_huff_4));
-		uint32_t dst_ofs = sizeof(g_dyn_huff_4);
-
-		uint64_t bit_buf = DYN_HUFF_4_BITBUF;
-		int bit_buf_size = DYN_HUFF_4_BITBUF_SIZE;
+		uint32_t dst_ofs = dst_ofs_state;
+		uint64_t bit_buf = bit_buf_state;
+		int bit_buf_size = bit_buf_size_state;
 
 		const uint8_t* pSrc = pImg;
 		uint32_t src_ofs = 0;
 
-		uint32_t src_adler32 = fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT);
-
 		for (uint32_t y = 0; y < h; y++)
 		{
 			const uint32_t end_src_ofs = src_ofs + bpl;
@@ -1558,7 +1951,33 @@ do_literals:
 		} // y
 
 		assert(src_ofs == h * bpl);
+		(void)bpl;
+
+		dst_ofs_state = dst_ofs;
+		bit_buf_state = bit_buf;
+		bit_buf_size_state = bit_buf_size;
+		return true;
+	}
+
+	static uint32_t pixel_deflate_dyn_4_rle_one_pass(
+		const uint8_t* pImg, uint32_t w, uint32_t h,
+		uint8_t* pDst, uint32_t dst_buf_size)
+	{
+		const uint32_t bpl = 1 + w * 4;
+
+		if (dst_buf_size < sizeof(g_dyn_huff_4))
+			return false;
+		memcpy(pDst, g_dyn_huff_4, sizeof(g_dyn_huff_4));
+		uint32_t dst_ofs = sizeof(g_dyn_huff_4);
+
+		uint64_t bit_buf = DYN_HUFF_4_BITBUF;
+		int bit_buf_size = DYN_HUFF_4_BITBUF_SIZE;
+
+		uint32_t src_adler32 = fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT);
 
+		if (!pixel_deflate_dyn_4_rle_one_pass_rows(pImg, w, h, pDst, dst_buf_size, dst_ofs, bit_buf, bit_buf_size))
+			return 0;
+		
 		assert(bit_buf_size <= 7);
 
 		PUT_BITS_CZ(g_dyn_huff_4_codes[256].m_code, g_dyn_huff_4_codes[256].m_code_size);
@@ -1659,6 +2078,39 @@ do_literals:
 		}
 	}
 
+	// PNG signature, IHDR chunk, fdEC chunk, and the IDAT chunk's length and type
+	static const uint32_t PNG_HEADER_SIZE = 58;
+
+	// Offset of the IDAT chunk length in the header
+	static const uint32_t PNG_IDAT_LEN_OFS = PNG_HEADER_SIZE - 8;
+
+	static void write_png_header(uint8_t* pDst, uint32_t w, uint32_t h, uint32_t num_chans, uint32_t idat_len)
+	{
+		static const uint8_t s_color_type[] = { 0x00, 0x00, 0x04, 0x02, 0x06 };
+
+		uint8_t pnghdr[58] = { 
+			0x89,0x50,0x4e,0x47,0x0d,0x0a,0x1a,0x0a,   // PNG sig
+			0x00,0x00,0x00,0x0d, 'I','H','D','R',  // IHDR chunk len, type
+		    0,0,(uint8_t)(w >> 8),(uint8_t)w, // width
+			0,0,(uint8_t)(h >> 8),(uint8_t)h, // height
+			8,   //bit_depth
+			s_color_type[num_chans], // color_type
+			0, // compression
+			0, // filter
+			0, // interlace
+			0, 0, 0, 0, // IHDR crc32
+			0, 0, 0, 5, 'f', 'd', 'E', 'C', 82, 36, 147, 227, FPNG_FDEC_VERSION,   0xE5, 0xAB, 0x62, 0x99, // our custom private, ancillary, do not copy, fdEC chunk
+		  (uint8_t)(idat_len >> 24),(uint8_t)(idat_len >> 16),(uint8_t)(idat_len >> 8),(uint8_t)idat_len, 'I','D','A','T' // IDATA chunk len, type
+		}; 
+
+		// Compute IHDR CRC32
+		uint32_t c = (uint32_t)fpng_crc32(pnghdr + 12, 17, FPNG_CRC32_INIT);
+		for (int i = 0; i < 4; ++i, c <<= 8)
+			((uint8_t*)(pnghdr + 29))[i] = (uint8_t)(c >> 24);
+
+		memcpy(pDst, pnghdr, PNG_HEADER_SIZE);
+	}
+
 	bool fpng_encode_image_to_memory(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, std::vector<uint8_t>& out_buf, uint32_t flags)
 	{
 		if (!endian_check())
@@ -1698,8 +2150,6 @@ do_literals:
 			temp_buf_ofs += 1 + bpl;
 		}
 
-		const uint32_t PNG_HEADER_SIZE = 58;
-				
 		uint32_t out_ofs = PNG_HEADER_SIZE;
 				
 		out_buf.resize((out_ofs + (bpl + 1) * h + 7) & ~7);
@@ -1764,31 +2214,7 @@ do_literals:
 		const uint32_t idat_len = (uint32_t)out_buf.size() - PNG_HEADER_SIZE;
 
 		// Write real PNG header, fdEC chunk, and the beginning of the IDAT chunk
-		{
-			static const uint8_t s_color_type[] = { 0x00, 0x00, 0x04, 0x02, 0x06 };
-
-			uint8_t pnghdr[58] = { 
-				0x89,0x50,0x4e,0x47,0x0d,0x0a,0x1a,0x0a,   // PNG sig
-				0x00,0x00,0x00,0x0d, 'I','H','D','R',  // IHDR chunk len, type
-			    0,0,(uint8_t)(w >> 8),(uint8_t)w, // width
-				0,0,(uint8_t)(h >> 8),(uint8_t)h, // height
-				8,   //bit_depth
-				s_color_type[num_chans], // color_type
-				0, // compression
-				0, // filter
-				0, // interlace
-				0, 0, 0, 0, // IHDR crc32
-				0, 0, 0, 5, 'f', 'd', 'E', 'C', 82, 36, 147, 227, FPNG_FDEC_VERSION,   0xE5, 0xAB, 0x62, 0x99, // our custom private, ancillary, do not copy, fdEC chunk
-			  (uint8_t)(idat_len >> 24),(uint8_t)(idat_len >> 16),(uint8_t)(idat_len >> 8),(uint8_t)idat_len, 'I','D','A','T' // IDATA chunk len, type
-			}; 
-
-			// Compute IHDR CRC32
-			uint32_t c = (uint32_t)fpng_crc32(pnghdr + 12, 17, FPNG_CRC32_INIT);
-			for (i = 0; i < 4; ++i, c <<= 8)
-				((uint8_t*)(pnghdr + 29))[i] = (uint8_t)(c >> 24);
-
-			memcpy(out_buf.data(), pnghdr, PNG_HEADER_SIZE);
-		}
+		write_png_header(out_buf.data(), w, h, num_chans, idat_len);
 
 		// Write IDAT chunk's CRC32 and a 0 length IEND chunk
 		vector_append(out_buf, "\0\0\0\0\0\0\0\0\x49\x45\x4e\x44\xae\x42\x60\x82", 16); // IDAT CRC32, followed by the IEND chunk
@@ -1828,6 +2254,299 @@ do_literals:
 	}
 #endif
 
+	// Row streaming compression
+
+	// The output buffer is handed to the sink once it holds at least this many bytes.
+	static const uint32_t STREAM_FLUSH_SIZE = 64 * 1024;
+
+	fpng_stream_encoder::fpng_stream_encoder() :
+		m_pWrite(nullptr), m_pUser(nullptr), m_pFile(nullptr),
+		m_w(0), m_h(0), m_num_chans(0), m_cur_y(0),
+		m_out_size(0), m_file_ofs(0),
+		m_bit_buf(0), m_bit_buf_size(0), m_adler32(FPNG_ADLER32_INIT), m_idat_crc32(FPNG_CRC32_INIT), m_active(false)
+	{
+	}
+
+	fpng_stream_encoder::~fpng_stream_encoder()
+	{
+		if (m_active)
+			fail();
+	}
+
+	bool fpng_stream_encoder::begin(uint32_t w, uint32_t h, uint32_t num_chans, fpng_write_func pWrite, void* pUser)
+	{
+		if (m_active)
+			fail();
+
+		if (!endian_check())
+		{
+			assert(0);
+			return false;
+		}
+
+		if ((w < 1) || (h < 1) || (w * (uint64_t)h > UINT32_MAX) || (w > FPNG_MAX_SUPPORTED_DIM) || (h > FPNG_MAX_SUPPORTED_DIM))
+		{
+			assert(0);
+			return false;
+		}
+
+		if (((num_chans != 3) && (num_chans != 4)) || (!pWrite))
+		{
+			assert(0);
+			return false;
+		}
+
+		m_pWrite = pWrite;
+		m_pUser = pUser;
+		m_w = w;
+		m_h = h;
+		m_num_chans = num_chans;
+		m_cur_y = 0;
+
+		const uint32_t bpl = w * num_chans;
+
+		// The one pass RLE encoders read up to 3 bytes past the end of a row.
+		m_prev_row.resize(bpl);
+		m_filtered_row.resize(1 + bpl + 7);
+
+		// Worst case a row costs 12 bits per byte, plus the 8 bytes PUT_BITS_FLUSH always writes.
+		m_out_buf.resize(STREAM_FLUSH_SIZE + PNG_HEADER_SIZE + sizeof(g_dyn_huff_4) + (1 + bpl) * 2 + 64);
+
+		write_png_header(m_out_buf.data(), w, h, num_chans, 0);
+		m_out_size = PNG_HEADER_SIZE;
+		m_file_ofs = 0;
+
+		if (num_chans == 3)
+		{
+			memcpy(m_out_buf.data() + m_out_size, g_dyn_huff_3, sizeof(g_dyn_huff_3));
+			m_out_size += sizeof(g_dyn_huff_3);
+			m_bit_buf = DYN_HUFF_3_BITBUF;
+			m_bit_buf_size = DYN_HUFF_3_BITBUF_SIZE;
+		}
+		else
+		{
+			memcpy(m_out_buf.data() + m_out_size, g_dyn_huff_4, sizeof(g_dyn_huff_4));
+			m_out_size += sizeof(g_dyn_huff_4);
+			m_bit_buf = DYN_HUFF_4_BITBUF;
+			m_bit_buf_size = DYN_HUFF_4_BITBUF_SIZE;
+		}
+
+		m_adler32 = FPNG_ADLER32_INIT;
+		m_idat_crc32 = FPNG_CRC32_INIT;
+		m_active = true;
+
+		return true;
+	}
+
+#ifndef FPNG_NO_STDIO
+	bool fpng_stream_encoder::file_write_func(const void* pData, size_t size, uint64_t ofs, void* pUser)
+	{
+		fpng_stream_encoder* pEncoder = static_cast<fpng_stream_encoder*>(pUser);
+		FILE* pFile = static_cast<FILE*>(pEncoder->m_pFile);
+
+		// Only the final IDAT length patch isn't at the end of the file.
+		if (ofs != pEncoder->m_file_ofs)
+		{
+			if (fseek(pFile, (long)ofs, SEEK_SET) != 0)
+				return false;
+		}
+
+		return fwrite(pData, 1, size, pFile) == size;
+	}
+
+	bool fpng_stream_encoder::begin_file(const char* pFilename, uint32_t w, uint32_t h, uint32_t num_chans)
+	{
+		if (m_active)
+			fail();
+
+		FILE* pFile = nullptr;
+#ifdef _MSC_VER
+		fopen_s(&pFile, pFilename, "wb");
+#else
+		pFile = fopen(pFilename, "wb");
+#endif
+		if (!pFile)
+			return false;
+
+		m_pFile = pFile;
+
+		if (!begin(w, h, num_chans, file_write_func, this))
+		{
+			fclose(pFile);
+			m_pFile = nullptr;
+			return false;
+		}
+
+		return true;
+	}
+#endif
+
+	bool fpng_stream_encoder::push_rows(const void* pRows, uint32_t num_rows, size_t row_pitch)
+	{
+		if (!m_active)
+			return false;
+
+		if ((m_cur_y + (uint64_t)num_rows) > m_h)
+		{
+			assert(0);
+			return fail();
+		}
+
+		if (!num_rows)
+			return true;
+
+		const uint32_t bpl = m_w * m_num_chans;
+		if (!row_pitch)
+			row_pitch = bpl;
+
+		const uint8_t* pSrc = static_cast<const uint8_t*>(pRows);
+		const uint8_t* pPrev_src = m_prev_row.data();
+
+		for (uint32_t y = 0; y < num_rows; y++, pPrev_src = pSrc, pSrc += row_pitch)
+		{
+			apply_filter(m_cur_y ? 2 : 0, m_w, m_h, m_num_chans, bpl, pSrc, m_cur_y ? pPrev_src : nullptr, m_filtered_row.data());
+
+			m_adler32 = fpng_adler32(m_filtered_row.data(), 1 + bpl, m_adler32);
+
+			uint32_t dst_ofs = m_out_size;
+			bool status;
+			if (m_num_chans == 3)
+				status = pixel_deflate_dyn_3_rle_one_pass_rows(m_filtered_row.data(), m_w, 1, m_out_buf.data(), (uint32_t)m_out_buf.size(), dst_ofs, m_bit_buf, m_bit_buf_size);
+			else
+				status = pixel_deflate_dyn_4_rle_one_pass_rows(m_filtered_row.data(), m_w, 1, m_out_buf.data(), (uint32_t)m_out_buf.size(), dst_ofs, m_bit_buf, m_bit_buf_size);
+
+			if (!status)
+			{
+				// The output buffer is sized for the worst case row.
+				assert(0);
+				return fail();
+			}
+
+			m_out_size = dst_ofs;
+			m_cur_y++;
+
+			if ((m_out_size >= STREAM_FLUSH_SIZE) && (!flush()))
+				return fail();
+		}
+
+		// Keep the last row for the next call's first row filter.
+		memcpy(m_prev_row.data(), pPrev_src, bpl);
+
+		return true;
+	}
+
+	bool fpng_stream_encoder::finish()
+	{
+		if (!m_active)
+			return false;
+
+		if (m_cur_y != m_h)
+		{
+			assert(0);
+			return fail();
+		}
+
+		{
+			uint8_t* pDst = m_out_buf.data();
+			uint32_t dst_ofs = m_out_size;
+			const uint32_t dst_buf_size = (uint32_t)m_out_buf.size();
+			uint64_t bit_buf = m_bit_buf;
+			int bit_buf_size = m_bit_buf_size;
+
+			assert(bit_buf_size <= 7);
+
+			if (m_num_chans == 3)
+				PUT_BITS_CZ(g_dyn_huff_3_codes[256].m_code, g_dyn_huff_3_codes[256].m_code_size);
+			else
+				PUT_BITS_CZ(g_dyn_huff_4_codes[256].m_code, g_dyn_huff_4_codes[256].m_code_size);
+
+			PUT_BITS_FORCE_FLUSH;
+
+			// Write zlib adler32
+			uint32_t src_adler32 = m_adler32;
+			for (uint32_t i = 0; i < 4; i++)
+			{
+				if ((dst_ofs + 1) > dst_buf_size)
+					return fail();
+				*(uint8_t*)(pDst + dst_ofs) = (uint8_t)(src_adler32 >> 24);
+				dst_ofs++;
+
+				src_adler32 <<= 8;
+			}
+
+			m_out_size = dst_ofs;
+		}
+
+		if (!flush())
+			return fail();
+
+		const uint64_t idat_len = m_file_ofs - PNG_HEADER_SIZE;
+		if (idat_len > UINT32_MAX)
+			return fail();
+
+		// IDAT CRC32, followed by the IEND chunk
+		uint8_t trailer[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0x49, 0x45, 0x4e, 0x44, 0xae, 0x42, 0x60, 0x82 };
+		for (uint32_t i = 0; i < 4; i++)
+			trailer[i] = (uint8_t)(m_idat_crc32 >> (24 - i * 8));
+
+		if (!m_pWrite(trailer, sizeof(trailer), m_file_ofs, m_pUser))
+			return fail();
+		m_file_ofs += sizeof(trailer);
+
+		// The IDAT length isn't covered by the chunk's CRC, so it can be patched last.
+		uint8_t len[4] = { (uint8_t)(idat_len >> 24), (uint8_t)(idat_len >> 16), (uint8_t)(idat_len >> 8), (uint8_t)idat_len };
+		if (!m_pWrite(len, sizeof(len), PNG_IDAT_LEN_OFS, m_pUser))
+			return fail();
+
+		m_active = false;
+
+#ifndef FPNG_NO_STDIO
+		if (m_pFile)
+		{
+			const bool closed = (fclose(static_cast<FILE*>(m_pFile)) != EOF);
+			m_pFile = nullptr;
+			return closed;
+		}
+#endif
+
+		return true;
+	}
+
+	bool fpng_stream_encoder::flush()
+	{
+		if (!m_out_size)
+			return true;
+
+		// The IDAT CRC covers the chunk type and data, which start 4 bytes before the end of the header.
+		const uint64_t crc_start_ofs = PNG_HEADER_SIZE - 4;
+		const uint32_t skip = (m_file_ofs < crc_start_ofs) ? (uint32_t)(crc_start_ofs - m_file_ofs) : 0;
+		assert(skip <= m_out_size);
+
+		m_idat_crc32 = fpng_crc32(m_out_buf.data() + skip, m_out_size - skip, m_idat_crc32);
+
+		if (!m_pWrite(m_out_buf.data(), m_out_size, m_file_ofs, m_pUser))
+			return false;
+
+		m_file_ofs += m_out_size;
+		m_out_size = 0;
+		return true;
+	}
+
+	bool fpng_stream_encoder::fail()
+	{
+		m_active = false;
+
+#ifndef FPNG_NO_STDIO
+		if (m_pFile)
+		{
+			fclose(static_cast<FILE*>(m_pFile));
+			m_pFile = nullptr;
+		}
+#endif
+
+		return false;
+	}
+
 	// Decompression
 
 	const uint32_t FPNG_DECODER_TABLE_BITS = 12;
@@ -2106,7 +2825,7 @@ do_literals:
 		
 	static bool fpng_pixel_zlib_raw_decompress(
 		const uint8_t* pSrc, uint32_t src_len, uint32_t zlib_len,
-		uint8_t* pDst, uint32_t w, uint32_t h,
+		uint8_t* pDst, uint32_t w, uint32_t h, size_t dst_pitch,
 		uint32_t src_chans, uint32_t dst_chans)
 	{
 		assert((src_chans == 3) || (src_chans == 4));
@@ -2114,10 +2833,10 @@ do_literals:
 		
 		const uint32_t src_bpl = w * src_chans;
 		const uint32_t dst_bpl = w * dst_chans;
-		const uint32_t dst_len = dst_bpl * h;
 
 		uint32_t src_ofs = 2;
-		uint32_t dst_ofs = 0;
+		uint32_t dst_ofs = 0, dst_y = 0;
+		uint8_t* pDst_row = pDst;
 		uint32_t raster_ofs = 0;
 		uint32_t comp_ofs = 0;
 
@@ -2163,20 +2882,20 @@ do_literals:
 				{
 					if (comp_ofs < dst_chans)
 					{
-						if (dst_ofs == dst_len)
+						if ((dst_y == h) || (dst_ofs == dst_bpl))
 							return false;
 
-						pDst[dst_ofs++] = (uint8_t)c;
+						pDst_row[dst_ofs++] = (uint8_t)c;
 					}
 					
 					if (++comp_ofs == src_chans)
 					{
 						if (dst_chans > src_chans)
 						{
-							if (dst_ofs == dst_len)
+							if ((dst_y == h) || (dst_ofs == dst_bpl))
 								return false;
 
-							pDst[dst_ofs++] = (uint8_t)0xFF;
+							pDst_row[dst_ofs++] = (uint8_t)0xFF;
 						}
 
 						comp_ofs = 0;
@@ -2187,6 +2906,12 @@ do_literals:
 				{
 					assert(!comp_ofs);
 					raster_ofs = 0;
+
+					if (dst_ofs != dst_bpl)
+						return false;
+					dst_ofs = 0;
+					dst_y++;
+					pDst_row += dst_pitch;
 				}
 			}
 
@@ -2203,13 +2928,13 @@ do_literals:
 		if ((src_ofs + 4) != zlib_len)
 			return false;
 
-		return (dst_ofs == dst_len);
+		return (dst_y == h) && (raster_ofs == 0);
 	}
 	
 	template<uint32_t dst_comps>
 	static bool fpng_pixel_zlib_decompress_3(
 		const uint8_t* pSrc, uint32_t src_len, uint32_t zlib_len,
-		uint8_t* pDst, uint32_t w, uint32_t h)
+		uint8_t* pDst, uint32_t w, uint32_t h, size_t dst_pitch)
 	{
 		assert(src_len >= (zlib_len + 4));
 
@@ -2226,7 +2951,7 @@ do_literals:
 		uint32_t src_ofs = 2;
 		
 		if ((pSrc[src_ofs] & 6) == 0)
-			return fpng_pixel_zlib_raw_decompress(pSrc, src_len, zlib_len, pDst, w, h, 3, dst_comps);
+			return fpng_pixel_zlib_raw_decompress(pSrc, src_len, zlib_len, pDst, w, h, dst_pitch, 3, dst_comps);
 		
 		if ((src_ofs + 4) > src_len)
 			return false;
@@ -2552,7 +3277,7 @@ do_literals:
 			} while (x_ofs < dst_bpl);
 
 			pPrev_scanline = pCur_scanline;
-			pCur_scanline += dst_bpl;
+			pCur_scanline += dst_pitch;
 
 		} // y
 
@@ -2587,7 +3312,7 @@ do_literals:
 	template<uint32_t dst_comps>
 	static bool fpng_pixel_zlib_decompress_4(
 		const uint8_t* pSrc, uint32_t src_len, uint32_t zlib_len,
-		uint8_t* pDst, uint32_t w, uint32_t h)
+		uint8_t* pDst, uint32_t w, uint32_t h, size_t dst_pitch)
 	{
 		assert(src_len >= (zlib_len + 4));
 
@@ -2604,7 +3329,7 @@ do_literals:
 		uint32_t src_ofs = 2;
 
 		if ((pSrc[src_ofs] & 6) == 0)
-			return fpng_pixel_zlib_raw_decompress(pSrc, src_len, zlib_len, pDst, w, h, 4, dst_comps);
+			return fpng_pixel_zlib_raw_decompress(pSrc, src_len, zlib_len, pDst, w, h, dst_pitch, 4, dst_comps);
 
 		if ((src_ofs + 4) > src_len)
 			return false;
@@ -2869,7 +3594,7 @@ do_literals:
 			} while (x_ofs < dst_bpl);
 
 			pPrev_scanline = pCur_scanline;
-			pCur_scanline += dst_bpl;
+			pCur_scanline += dst_pitch;
 		} // y
 
 		// The last symbol should be EOB
@@ -3082,6 +3807,36 @@ do_literals:
 		return fpng_get_info_internal(pImage, image_size, width, height, channels_in_file, idat_ofs, idat_len);
 	}
 
+	static int fpng_decode_idat(const void* pImage, uint32_t image_size, uint32_t idat_ofs, uint32_t idat_len, uint8_t* pDst, size_t dst_row_pitch, uint32_t width, uint32_t height, uint32_t channels_in_file, uint32_t desired_channels)
+	{
+		const uint8_t* pIDAT_data = static_cast<const uint8_t*>(pImage) + idat_ofs + sizeof(uint32_t) * 2;
+		const uint32_t src_len = image_size - (idat_ofs + sizeof(uint32_t) * 2);
+
+		bool decomp_status;
+		if (desired_channels == 3)
+		{
+			if (channels_in_file == 3)
+				decomp_status = fpng_pixel_zlib_decompress_3<3>(pIDAT_data, src_len, idat_len, pDst, width, height, dst_row_pitch);
+			else
+				decomp_status = fpng_pixel_zlib_decompress_4<3>(pIDAT_data, src_len, idat_len, pDst, width, height, dst_row_pitch);
+		}
+		else
+		{
+			if (channels_in_file == 3)
+				decomp_status = fpng_pixel_zlib_decompress_3<4>(pIDAT_data, src_len, idat_len, pDst, width, height, dst_row_pitch);
+			else
+				decomp_status = fpng_pixel_zlib_decompress_4<4>(pIDAT_data, src_len, idat_len, pDst, width, height, dst_row_pitch);
+		}
+		if (!decomp_status)
+		{
+			// Something went wrong. Either the file data was corrupted, or it doesn't conform to one of our zlib/Deflate constraints.
+			// The conservative thing to do is indicate it wasn't written by us, and let the general purpose PNG decoder handle it.
+			return FPNG_DECODE_NOT_FPNG;
+		}
+
+		return FPNG_DECODE_SUCCESS;
+	}
+
 	int fpng_decode_memory(const void *pImage, uint32_t image_size, std::vector<uint8_t> &out, uint32_t& width, uint32_t& height, uint32_t &channels_in_file, uint32_t desired_channels)
 	{
 		out.resize(0);
@@ -3110,32 +3865,34 @@ do_literals:
 
 		out.resize(mem_needed);
 		
-		const uint8_t* pIDAT_data = static_cast<const uint8_t*>(pImage) + idat_ofs + sizeof(uint32_t) * 2;
-		const uint32_t src_len = image_size - (idat_ofs + sizeof(uint32_t) * 2);
+		return fpng_decode_idat(pImage, image_size, idat_ofs, idat_len, out.data(), width * desired_channels, width, height, channels_in_file, desired_channels);
+	}
 
-		bool decomp_status;
-		if (desired_channels == 3)
-		{
-			if (channels_in_file == 3)
-				decomp_status = fpng_pixel_zlib_decompress_3<3>(pIDAT_data, src_len, idat_len, out.data(), width, height);
-			else
-				decomp_status = fpng_pixel_zlib_decompress_4<3>(pIDAT_data, src_len, idat_len, out.data(), width, height);
-		}
-		else
-		{
-			if (channels_in_file == 3)
-				decomp_status = fpng_pixel_zlib_decompress_3<4>(pIDAT_data, src_len, idat_len, out.data(), width, height);
-			else
-				decomp_status = fpng_pixel_zlib_decompress_4<4>(pIDAT_data, src_len, idat_len, out.data(), width, height);
-		}
-		if (!decomp_status)
+	int fpng_decode_memory_ptr(const void* pImage, uint32_t image_size, void* pDst, size_t dst_size, size_t dst_row_pitch, uint32_t& width, uint32_t& height, uint32_t& channels_in_file, uint32_t desired_channels)
+	{
+		width = 0;
+		height = 0;
+		channels_in_file = 0;
+
+		if ((!pImage) || (!image_size) || (!pDst) || ((desired_channels != 3) && (desired_channels != 4)))
 		{
-			// Something went wrong. Either the file data was corrupted, or it doesn't conform to one of our zlib/Deflate constraints.
-			// The conservative thing to do is indicate it wasn't written by us, and let the general purpose PNG decoder handle it.
-			return FPNG_DECODE_NOT_FPNG;
+			assert(0);
+			return FPNG_DECODE_INVALID_ARG;
 		}
 
-		return FPNG_DECODE_SUCCESS;
+		uint32_t idat_ofs = 0, idat_len = 0;
+		int status = fpng_get_info_internal(pImage, image_size, width, height, channels_in_file, idat_ofs, idat_len);
+		if (status)
+			return status;
+
+		const uint64_t dst_bpl = (uint64_t)width * desired_channels;
+		if (!dst_row_pitch)
+			dst_row_pitch = (size_t)dst_bpl;
+
+		if ((dst_row_pitch < dst_bpl) || ((uint64_t)dst_row_pitch * (height - 1) + dst_bpl > dst_size))
+			return FPNG_DECODE_DST_BUFFER_TOO_SMALL;
+
+		return fpng_decode_idat(pImage, image_size, idat_ofs, idat_len, static_cast<uint8_t*>(pDst), dst_row_pitch, width, height, channels_in_file, desired_channels);
 	}
 
 #ifndef FPNG_NO_STDIO
@@ -22,14 +22,44 @@ namespace fpng
 	// fpng_init() must have been called first, or it'll assert and return false.
 	bool fpng_cpu_supports_sse41();
 
-	// Fast CRC-32 SSE4.1+pclmul or a scalar fallback (slice by 4)
+	// Returns true if the CPU and OS support AVX2 (ymm state enabled), and it wasn't disabled by FPNG_NO_AVX2=1.
+	bool fpng_cpu_supports_avx2();
+
+	// Returns true if the CPU and OS support AVX-512 F/BW/VL (zmm state enabled), and it wasn't disabled by FPNG_NO_AVX512=1.
+	bool fpng_cpu_supports_avx512();
+
+	// Returns true if the CPU supports VPCLMULQDQ (carry-less multiply on ymm/zmm registers).
+	bool fpng_cpu_supports_vpclmulqdq();
+
+	// SIMD levels for the checksum functions. fpng_crc32()/fpng_adler32() pick the highest level the CPU supports.
+	// CRC-32: SSE41 = SSE4.1+pclmul, AVX2 = AVX2+VPCLMULQDQ, AVX512 = AVX-512+VPCLMULQDQ.
+	// Adler-32: SSE41 = SSE4.1, AVX2 = AVX2, AVX512 = AVX-512 BW.
+	enum
+	{
+		FPNG_SIMD_SCALAR = 0,
+		FPNG_SIMD_SSE41,
+		FPNG_SIMD_AVX2,
+		FPNG_SIMD_AVX512
+	};
+
+	// Fast CRC-32 AVX-512/AVX2 VPCLMULQDQ, SSE4.1+pclmul, or a scalar fallback (slice by 4)
 	const uint32_t FPNG_CRC32_INIT = 0;
 	uint32_t fpng_crc32(const void* pData, size_t size, uint32_t prev_crc32 = FPNG_CRC32_INIT);
 
-	// Fast Adler32 SSE4.1 Adler-32 with a scalar fallback.
+	// Fast Adler32 AVX-512 BW/AVX2/SSE4.1 Adler-32 with a scalar fallback.
 	const uint32_t FPNG_ADLER32_INIT = 1;
 	uint32_t fpng_adler32(const void* pData, size_t size, uint32_t adler = FPNG_ADLER32_INIT);
 
+	// Same as fpng_crc32()/fpng_adler32(), but limited to the specified FPNG_SIMD_ level (for testing and benchmarking).
+	// If the level isn't supported by the CPU the next lower supported level is used.
+	uint32_t fpng_crc32_simd(uint32_t simd_level, const void* pData, size_t size, uint32_t prev_crc32 = FPNG_CRC32_INIT);
+	uint32_t fpng_adler32_simd(uint32_t simd_level, const void* pData, size_t size, uint32_t adler = FPNG_ADLER32_INIT);
+
+	// Returns the checksum of A followed by B, given the checksums of A and B computed independently, and the length of B in bytes.
+	// crc2/adler2 must have been started from FPNG_CRC32_INIT/FPNG_ADLER32_INIT.
+	uint32_t fpng_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+	uint32_t fpng_adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t len2);
+
 	// ---- Compression
 	enum
 	{
@@ -52,6 +82,71 @@ namespace fpng
 	bool fpng_encode_image_to_file(const char* pFilename, const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, uint32_t flags = 0);
 #endif
 
+	// ---- Row streaming compression
+
+	// Receives the PNG file as it's produced. ofs is the byte offset of pData in the file.
+	// All writes are sequential, except for the last one, which patches the 4-byte IDAT chunk length at offset 50 (it isn't known until all rows are compressed).
+	// Return false to abort encoding.
+	typedef bool (*fpng_write_func)(const void* pData, size_t size, uint64_t ofs, void* pUser);
+
+	// Incremental encoder: rows are filtered and compressed as they're pushed, so the whole image never has to exist in memory.
+	// Only the previous row, one filtered row and ~64KB of compressed output are buffered.
+	// The output is a single IDAT FPNG file using the same one pass Huffman tables as fpng_encode_image_to_memory() with flags=0, and is byte identical to it
+	// unless that function falls back to uncompressed blocks (incompressible images), in which case this encoder still emits a valid, slightly larger, compressed stream.
+	// FPNG_ENCODE_SLOWER isn't supported, as it needs the symbol frequencies of the whole image before anything can be written.
+	class fpng_stream_encoder
+	{
+	public:
+		fpng_stream_encoder();
+		~fpng_stream_encoder();
+
+		// Starts a new image and buffers its header. num_chans must be 3 or 4.
+		bool begin(uint32_t w, uint32_t h, uint32_t num_chans, fpng_write_func pWrite, void* pUser);
+
+#ifndef FPNG_NO_STDIO
+		// Same as begin(), writing to the specified file. The file is closed by finish() (or the destructor on failure).
+		bool begin_file(const char* pFilename, uint32_t w, uint32_t h, uint32_t num_chans);
+#endif
+
+		// Compresses the next num_rows rows, top to bottom. row_pitch is the distance between rows in bytes (0 = w * num_chans).
+		bool push_rows(const void* pRows, uint32_t num_rows, size_t row_pitch = 0);
+
+		// Ends the IDAT chunk, writes the IEND chunk and patches the IDAT length. Fails if fewer than h rows were pushed.
+		bool finish();
+
+		uint32_t get_rows_pushed() const { return m_cur_y; }
+		bool is_active() const { return m_active; }
+
+	private:
+		fpng_stream_encoder(const fpng_stream_encoder&) = delete;
+		fpng_stream_encoder& operator= (const fpng_stream_encoder&) = delete;
+
+		bool flush();
+		bool fail();
+
+#ifndef FPNG_NO_STDIO
+		static bool file_write_func(const void* pData, size_t size, uint64_t ofs, void* pUser);
+#endif
+
+		fpng_write_func m_pWrite;
+		void* m_pUser;
+		void* m_pFile;
+
+		uint32_t m_w, m_h, m_num_chans, m_cur_y;
+
+		std::vector<uint8_t> m_prev_row;
+		std::vector<uint8_t> m_filtered_row;
+		std::vector<uint8_t> m_out_buf;
+		uint32_t m_out_size;
+		uint64_t m_file_ofs;
+
+		uint64_t m_bit_buf;
+		int m_bit_buf_size;
+		uint32_t m_adler32;
+		uint32_t m_idat_crc32;
+		bool m_active;
+	};
+
 	// ---- Decompression
 		
 	enum
@@ -73,7 +168,10 @@ namespace fpng
 		FPNG_DECODE_FILE_OPEN_FAILED,
 		FPNG_DECODE_FILE_TOO_LARGE,
 		FPNG_DECODE_FILE_READ_FAILED,
-		FPNG_DECODE_FILE_SEEK_FAILED
+		FPNG_DECODE_FILE_SEEK_FAILED,
+
+		// fpng_decode_memory_ptr() specific errors
+		FPNG_DECODE_DST_BUFFER_TOO_SMALL
 	};
 
 	// Fast PNG decoding of files ONLY created by fpng_encode_image_to_memory() or fpng_encode_image_to_file().
@@ -107,6 +205,12 @@ namespace fpng
 	// If another error occurs, the file is likely corrupted or invalid, but you can still try to decompress the file with another decoder (which will likely fail).
 	int fpng_decode_memory(const void* pImage, uint32_t image_size, std::vector<uint8_t>& out, uint32_t& width, uint32_t& height, uint32_t& channels_in_file, uint32_t desired_channels);
 
+	// Same as fpng_decode_memory(), but decodes straight into caller provided memory (for example a mapped upload buffer), with no intermediate copy.
+	// dst_row_pitch is the distance between rows in bytes (0 = width * desired_channels). dst_size must be at least (height - 1) * dst_row_pitch + width * desired_channels.
+	// Call fpng_get_info() first to size the buffer. Returns FPNG_DECODE_DST_BUFFER_TOO_SMALL if it isn't large enough.
+	// On FPNG_DECODE_NOT_FPNG the buffer may have been partially written.
+	int fpng_decode_memory_ptr(const void* pImage, uint32_t image_size, void* pDst, size_t dst_size, size_t dst_row_pitch, uint32_t& width, uint32_t& height, uint32_t& channels_in_file, uint32_t desired_channels);
+
 #ifndef FPNG_NO_STDIO
 	int fpng_decode_file(const char* pFilename, std::vector<uint8_t>& out, uint32_t& width, uint32_t& height, uint32_t& channels_in_file, uint32_t desired_channels);
 #endif
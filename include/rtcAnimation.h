@@ -0,0 +1,139 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcAnimation.h
+// Desc : Keyframe Animation.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// TransformKey structure
+///////////////////////////////////////////////////////////////////////////////
+struct TransformKey
+{
+    float       Time;                               //!< 時刻[sec]です.
+    float3      Translation = float3(0.0f);         //!< 平行移動です.
+    float4      Rotation    = float4(0, 0, 0, 1);   //!< 回転 (四元数 xyzw) です.
+    float3      Scale       = float3(1.0f);         //!< 拡大縮小です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// TransformTrack structure
+///////////////////////////////////////////////////////////////////////////////
+struct TransformTrack
+{
+    const TransformKey* pKeys       = nullptr;  //!< 時刻順に並んだキーです.
+    uint32_t            KeyCount    = 0;        //!< キー数です. 0 なら単位行列になります.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CameraKey structure
+///////////////////////////////////////////////////////////////////////////////
+struct CameraKey
+{
+    float       Time;                               //!< 時刻[sec]です.
+    float3      Position    = float3(0.0f);         //!< 位置です.
+    float4      Rotation    = float4(0, 0, 0, 1);   //!< カメラからワールドへの回転 (四元数 xyzw) です.
+    float       FovY        = 0.785398f;            //!< 垂直画角[rad]です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CameraTrack structure
+///////////////////////////////////////////////////////////////////////////////
+struct CameraTrack
+{
+    const CameraKey*    pKeys       = nullptr;  //!< 時刻順に並んだキーです.
+    uint32_t            KeyCount    = 0;        //!< キー数です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CameraFrame structure
+///////////////////////////////////////////////////////////////////////////////
+struct CameraFrame
+{
+    float4x4    View;       //!< ビュー行列です.
+    float4x4    InvView;    //!< ビュー行列の逆行列です.
+    float3      Position;   //!< 位置です.
+    float       FovY;       //!< 垂直画角[rad]です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// AnimationDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct AnimationDesc
+{
+    double      FPS         = 60.0;     //!< Config::AnimFPS と同じ値を指定します.
+    double      Duration    = 0.0;      //!< アニメーションの長さ[sec]です.
+    uint32_t    ThreadCount = 0;        //!< ワーカースレッド数です(0ならハードウェアスレッド数).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// AnimationStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct AnimationStats
+{
+    uint32_t    FrameCount  = 0;    //!< フレーム数です.
+    uint32_t    TrackCount  = 0;    //!< トランスフォームのトラック数です.
+    size_t      MemoryBytes = 0;    //!< テーブルのサイズです.
+    double      ElapsedMsec = 0.0;  //!< 評価時間(ミリ秒)です.
+
+    double GetUsecPerFrame() const { return (FrameCount > 0) ? ElapsedMsec * 1000.0 / FrameCount : 0.0; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// AnimationTable class
+///////////////////////////////////////////////////////////////////////////////
+class AnimationTable
+{
+public:
+    AnimationTable () = default;
+    ~AnimationTable() = default;
+
+    //! 全フレームのトランスフォームとカメラを評価します. pCamera は nullptr でも構いません.
+    bool Build(const AnimationDesc& desc, const TransformTrack* pTracks, uint32_t trackCount, const CameraTrack* pCamera);
+    void Clear();
+
+    //! SceneParameters::AnimationTime からフレーム番号を求めます.
+    uint32_t CalcFrameIndex(double time) const;
+
+    //! フレームの全トラックの行列です. そのままトランスフォームバッファにコピーできます.
+    const float3x4* GetTransforms(uint32_t frameIndex) const
+    { return m_Transforms.data() + size_t(std::min(frameIndex, m_FrameCount - 1)) * m_TrackCount; }
+
+    const CameraFrame& GetCamera(uint32_t frameIndex) const
+    { return m_Cameras[std::min(frameIndex, m_FrameCount - 1)]; }
+
+    bool                    HasCamera    () const { return !m_Cameras.empty(); }
+    uint32_t                GetFrameCount() const { return m_FrameCount; }
+    uint32_t                GetTrackCount() const { return m_TrackCount; }
+    const AnimationStats&   GetStats     () const { return m_Stats; }
+
+private:
+    struct PackedKey
+    {
+        float4  Rotation;       // xyzw
+        float4  Translation;    // xyz, w = 時刻.
+        float4  Scale;          // xyz, w = 0.
+    };
+
+    AnimationDesc           m_Desc          = {};
+    uint32_t                m_FrameCount    = 0;
+    uint32_t                m_TrackCount    = 0;
+    std::vector<PackedKey>  m_Keys;         // 全トラックのキーを連結したものです.
+    std::vector<uint32_t>   m_KeyOffsets;   // トラックのキーの先頭です (トラック数 + 1 個).
+    std::vector<float3x4>   m_Transforms;   // [フレーム][トラック] の順です.
+    std::vector<CameraFrame> m_Cameras;
+    AnimationStats          m_Stats         = {};
+
+    void EvaluateFrames(uint32_t beginFrame, uint32_t endFrame, uint32_t* pCursors);
+};
+
+} // namespace rtc
@@ -11,6 +11,8 @@
 #include <rtcTypedef.h>
 #include <rtcTimer.h>
 #include <rtcDevice.h>
+#include <rtcFrameMetrics.h>
+#include <rtcOpacityMask.h>
 
 
 
@@ -25,6 +27,7 @@ struct Config
     uint32_t    Height      = 1080;     //!< 縦幅.
     double      AnimFPS     = 60.0;     //!< アニメーションのFrame Per Second.
     double      RenderTime  = 256.0;    //!< 制限時間(sec).
+    const char* MetricsPath = nullptr;  //!< フレーム統計の出力先 (.csv / .jsonl). nullptr なら集計のみ.
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -41,6 +44,9 @@ private:
     Config      m_Config   = {};
     Timer       m_Timer    = {};
     bool        m_IsLoop   = true;
+    double      m_NextMemoryPrint = 0.0;    //!< 次にメモリ使用量を出力する時間(sec).
+    AnyHitStats m_AnyHitStats = {};         //!< 現フレームの任意ヒット統計. OnRender() で加算します.
+    FrameMetricsRecorder    m_Metrics;
 
     bool Init();
     void Term();
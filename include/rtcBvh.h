@@ -0,0 +1,307 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcBvh.h
+// Desc : Bounding Volume Hierarchy.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <rtcMemoryTracker.h>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// BvhRay structure
+///////////////////////////////////////////////////////////////////////////////
+struct BvhRay
+{
+    float3      Origin;         //!< 原点です.
+    float       TMin;           //!< 最小距離です.
+    float3      Direction;      //!< 方向です.
+    float       TMax;           //!< 最大距離です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// BvhHit structure
+///////////////////////////////////////////////////////////////////////////////
+struct BvhHit
+{
+    float       T               = FLT_MAX;      //!< ヒット距離です.
+    uint32_t    PrimitiveId     = UINT32_MAX;   //!< 三角形番号です.
+    float2      Barycentrics    = float2(0.0f); //!< 重心座標です.
+
+    bool HasHit() const { return PrimitiveId != UINT32_MAX; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// BvhBuildDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct BvhBuildDesc
+{
+    const float3*   pPositions      = nullptr;  //!< 頂点座標です.
+    const uint32_t* pIndices        = nullptr;  //!< 三角形の頂点インデックスです.
+    uint32_t        VertexCount     = 0;        //!< 頂点数です.
+    uint32_t        TriangleCount   = 0;        //!< 三角形数です.
+    uint32_t        MaxLeafSize     = 3;        //!< 葉に格納する最大三角形数です. Bvh8 では 3 以下にしてください.
+    uint32_t        BinCount        = 16;       //!< SAH のビン数です.
+    float           TraversalCost   = 1.0f;     //!< ノード走査コストです(三角形交差コストとの比).
+    bool            EnableSpatialSplits = false;    //!< 空間分割 (SBVH) を有効にします.
+    float           SpatialSplitBudget  = 0.3f;     //!< 三角形数に対する複製参照数の上限です.
+    float           SpatialSplitAlpha   = 1e-5f;    //!< 空間分割を試す子の重なり面積の閾値です(ルートとの比).
+    uint32_t        ThreadCount         = 0;        //!< ワーカースレッド数です(0ならハードウェアスレッド数).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// BvhStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct BvhStats
+{
+    uint32_t    NodeCount           = 0;    //!< ノード数です.
+    uint32_t    LeafCount           = 0;    //!< 葉ノード数です.
+    uint32_t    ReferenceCount      = 0;    //!< 葉が参照する三角形数の合計です.
+    uint32_t    DuplicatedRefs      = 0;    //!< 空間分割で複製された参照数です.
+    uint32_t    SpatialSplits       = 0;    //!< 空間分割を採用したノード数です.
+    size_t      MemoryBytes         = 0;    //!< 使用メモリです(走査に必要な三角形データを含む).
+    float       BytesPerTriangle    = 0.0f; //!< 三角形あたりのメモリです.
+    float       SahCost             = 0.0f; //!< SAH コストです.
+    double      BuildMsec           = 0.0;  //!< 構築時間(ミリ秒)です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// BvhNode structure
+///////////////////////////////////////////////////////////////////////////////
+struct BvhNode
+{
+    Bounds3     Bounds;     //!< バウンディングボックスです.
+    uint32_t    Index;      //!< 節なら左の子 (右の子は Index + 1), 葉なら三角形参照の先頭です.
+    uint32_t    Count;      //!< 葉なら三角形数, 節なら 0 です.
+
+    bool IsLeaf() const { return Count > 0; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Bvh class
+///////////////////////////////////////////////////////////////////////////////
+class Bvh
+{
+public:
+    Bvh () = default;
+    ~Bvh() = default;
+    bool Build(const BvhBuildDesc& desc);
+    bool Attach(const BvhBuildDesc& desc, const BvhNode* pNodes, uint32_t nodeCount, const uint32_t* pReferences, uint32_t referenceCount, const BvhStats& stats);
+    void Clear();
+    bool Intersect(const BvhRay& ray, BvhHit& hit) const;
+
+    const BvhNode*  GetNodes         () const { return m_pNodes; }
+    uint32_t        GetNodeCount     () const { return m_NodeCount; }
+    const uint32_t* GetReferences    () const { return m_pReferences; }
+    uint32_t        GetReferenceCount() const { return m_ReferenceCount; }
+    const float3*   GetPositions     () const { return m_pPositions; }
+    const uint32_t* GetIndices       () const { return m_pIndices; }
+    uint32_t        GetTriangleCount () const { return m_TriangleCount; }
+    const BvhStats& GetStats         () const { return m_Stats; }
+
+private:
+    std::vector<BvhNode>    m_Nodes;
+    std::vector<uint32_t>   m_References;
+    const BvhNode*          m_pNodes         = nullptr;  // m_Nodes またはアタッチしたメモリ.
+    uint32_t                m_NodeCount      = 0;
+    const uint32_t*         m_pReferences    = nullptr;  // m_References またはアタッチしたメモリ.
+    uint32_t                m_ReferenceCount = 0;
+    const float3*           m_pPositions     = nullptr;
+    const uint32_t*         m_pIndices       = nullptr;
+    uint32_t                m_TriangleCount  = 0;
+    BvhStats                m_Stats          = {};
+    TrackedMemory           m_Memory         { MEMORY_TAG_BVH };
+
+    float CalcSahCost(const BvhBuildDesc& desc) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Bvh8Node structure (80 bytes)
+///////////////////////////////////////////////////////////////////////////////
+struct Bvh8Node
+{
+    float3      Origin;             //!< 量子化の原点です.
+    int8_t      Exponent[3];        //!< 量子化の指数です. 1 ステップ = 2^Exponent.
+    uint8_t     InnerMask;          //!< 子が節であるスロットのビットマスクです.
+    uint32_t    ChildBaseIndex;     //!< 子ノードの先頭です.
+    uint32_t    TriangleBaseIndex;  //!< 三角形の先頭です.
+    uint8_t     Meta[8];            //!< 空なら 0, 節なら 0x80 | 子の相対番号, 葉なら (三角形数 << 5) | 三角形の相対番号.
+    uint8_t     QMinX[8];           //!< 量子化した最小値 X です.
+    uint8_t     QMinY[8];           //!< 量子化した最小値 Y です.
+    uint8_t     QMinZ[8];           //!< 量子化した最小値 Z です.
+    uint8_t     QMaxX[8];           //!< 量子化した最大値 X です.
+    uint8_t     QMaxY[8];           //!< 量子化した最大値 Y です.
+    uint8_t     QMaxZ[8];           //!< 量子化した最大値 Z です.
+};
+static_assert(sizeof(Bvh8Node) == 80, "Bvh8Node size is not 80 bytes.");
+
+///////////////////////////////////////////////////////////////////////////////
+// Bvh8Triangle structure
+///////////////////////////////////////////////////////////////////////////////
+struct Bvh8Triangle
+{
+    float3      V0;             //!< 頂点0 です.
+    float3      E1;             //!< 頂点1 - 頂点0 です.
+    float3      E2;             //!< 頂点2 - 頂点0 です.
+    uint32_t    PrimitiveId;    //!< 三角形番号です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Bvh8 class
+///////////////////////////////////////////////////////////////////////////////
+class Bvh8
+{
+public:
+    Bvh8 () = default;
+    ~Bvh8() = default;
+    bool Build(const Bvh& bvh);
+    bool Attach(const Bvh8Node* pNodes, uint32_t nodeCount, const Bvh8Triangle* pTriangles, uint32_t triangleCount, const BvhStats& stats);
+    void Clear();
+    bool Intersect(const BvhRay& ray, BvhHit& hit) const;
+
+    const Bvh8Node*     GetNodes        () const { return m_pNodes; }
+    uint32_t            GetNodeCount    () const { return m_NodeCount; }
+    const Bvh8Triangle* GetTriangles    () const { return m_pTriangles; }
+    uint32_t            GetTriangleCount() const { return m_TriangleCount; }
+    const BvhStats&     GetStats        () const { return m_Stats; }
+
+private:
+    std::vector<Bvh8Node>       m_Nodes;
+    std::vector<Bvh8Triangle>   m_Triangles;
+    const Bvh8Node*             m_pNodes        = nullptr;  // m_Nodes またはアタッチしたメモリ.
+    uint32_t                    m_NodeCount     = 0;
+    const Bvh8Triangle*         m_pTriangles    = nullptr;  // m_Triangles またはアタッチしたメモリ.
+    uint32_t                    m_TriangleCount = 0;
+    BvhStats                    m_Stats = {};
+    TrackedMemory               m_Memory { MEMORY_TAG_BVH };
+
+    void Collapse(const Bvh& bvh, uint32_t srcIndex, uint32_t dstIndex);
+};
+
+//-----------------------------------------------------------------------------
+//      レイとボックスの交差判定を行います.
+//-----------------------------------------------------------------------------
+inline bool IntersectBox
+(
+    const float3&   boxMin,
+    const float3&   boxMax,
+    const float3&   origin,
+    const float3&   invDir,
+    float           tmin,
+    float           tmax,
+    float&          tnear
+)
+{
+    auto t0 = (boxMin - origin) * invDir;
+    auto t1 = (boxMax - origin) * invDir;
+
+    auto n = Min(t0, t1);
+    auto f = Max(t0, t1);
+
+    tnear     = std::max(std::max(n.x, n.y), std::max(n.z, tmin));
+    auto tfar = std::min(std::min(f.x, f.y), std::min(f.z, tmax));
+    return tnear <= tfar;
+}
+
+//-----------------------------------------------------------------------------
+//      レイと三角形の交差判定を行います (Möller-Trumbore).
+//-----------------------------------------------------------------------------
+inline bool IntersectTriangle
+(
+    const BvhRay&   ray,
+    const float3&   v0,
+    const float3&   e1,
+    const float3&   e2,
+    float           tmax,
+    float&          t,
+    float&          u,
+    float&          v
+)
+{
+    auto p   = Cross(ray.Direction, e2);
+    auto det = Dot(e1, p);
+    if (det == 0.0f)
+    { return false; }
+
+    auto invDet = 1.0f / det;
+    auto s = ray.Origin - v0;
+    u = Dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f)
+    { return false; }
+
+    auto q = Cross(s, e1);
+    v = Dot(ray.Direction, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+    { return false; }
+
+    t = Dot(e2, q) * invDet;
+    return t >= ray.TMin && t < tmax;
+}
+
+//-----------------------------------------------------------------------------
+//      逆数方向を求めます.
+//-----------------------------------------------------------------------------
+inline float3 CalcInvDir(const float3& dir)
+{
+    return float3(
+        (dir.x != 0.0f) ? 1.0f / dir.x : FLT_MAX,
+        (dir.y != 0.0f) ? 1.0f / dir.y : FLT_MAX,
+        (dir.z != 0.0f) ? 1.0f / dir.z : FLT_MAX);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// TraversalStack class
+///////////////////////////////////////////////////////////////////////////////
+//! 走査スタックです. 固定長の領域を使い切った場合はヒープに拡張するので, 深い木でも部分木を取りこぼしません.
+template<typename T, uint32_t N>
+class TraversalStack
+{
+public:
+    TraversalStack()
+    : m_pData   (m_Local)
+    , m_Capacity(N)
+    { /* DO_NOTHING */ }
+
+    bool IsEmpty() const
+    { return m_Top == 0; }
+
+    void Push(const T& value)
+    {
+        if (m_Top == m_Capacity)
+        { Grow(); }
+        m_pData[m_Top++] = value;
+    }
+
+    T Pop()
+    { return m_pData[--m_Top]; }
+
+private:
+    T               m_Local[N];
+    std::vector<T>  m_Heap;
+    T*              m_pData;
+    uint32_t        m_Capacity;
+    uint32_t        m_Top = 0;
+
+    void Grow()
+    {
+        std::vector<T> heap(size_t(m_Capacity) * 2);
+        for(auto i=0u; i<m_Top; ++i)
+        { heap[i] = m_pData[i]; }
+
+        m_Heap.swap(heap);
+        m_pData     = m_Heap.data();
+        m_Capacity *= 2;
+    }
+
+    TraversalStack             (const TraversalStack&) = delete;
+    TraversalStack& operator = (const TraversalStack&) = delete;
+};
+
+} // namespace rtc
@@ -0,0 +1,76 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcBvhCache.h
+// Desc : On-Disk Acceleration Structure Cache.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcBvh.h>
+#include <string>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// BvhCacheStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct BvhCacheStats
+{
+    uint32_t    Hits            = 0;    //!< キャッシュから読み込んだ回数です.
+    uint32_t    Misses          = 0;    //!< キャッシュが無く構築した回数です.
+    uint32_t    Rejects         = 0;    //!< バージョンやレイアウトの不一致で破棄した回数です.
+    double      HashMsec        = 0.0;  //!< キー計算時間(ミリ秒)です.
+    double      LoadMsec        = 0.0;  //!< 読み込み時間(ミリ秒)です.
+    double      BuildMsec       = 0.0;  //!< 構築と保存の時間(ミリ秒)です.
+    size_t      MappedBytes     = 0;    //!< マップ中のファイルサイズの合計です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// BvhCache class
+///////////////////////////////////////////////////////////////////////////////
+class BvhCache
+{
+public:
+    BvhCache () = default;
+    ~BvhCache() { Term(); }
+
+    //! directory にキャッシュファイルを置きます. シーンファイルと同じフォルダを指定してください.
+    bool Init(const char* directory);
+
+    //! マップしたファイルを解放します. 読み込んだ Bvh, Bvh8 は先に Clear() してください.
+    void Term();
+
+    //! 頂点・インデックスの内容と構築設定からキーを計算します.
+    static uint64_t CalcKey(const BvhBuildDesc& desc);
+
+    //! キャッシュをマップして bvh (と pBvh8) にアタッチします. 見つからないか不正な場合は false.
+    bool Load(const BvhBuildDesc& desc, uint64_t key, Bvh& bvh, Bvh8* pBvh8);
+
+    //! 構築済みの bvh (と pBvh8) をキャッシュに書き込みます.
+    bool Save(const BvhBuildDesc& desc, uint64_t key, const Bvh& bvh, const Bvh8* pBvh8);
+
+    //! キャッシュがあれば読み込み, 無ければ構築して保存します.
+    bool GetOrBuild(const BvhBuildDesc& desc, Bvh& bvh, Bvh8* pBvh8);
+
+    std::string          GetPath (uint64_t key) const;
+    const BvhCacheStats& GetStats() const { return m_Stats; }
+
+private:
+    struct Mapping
+    {
+        void*       hFile;
+        void*       hMapping;
+        const void* pView;
+        size_t      Size;
+    };
+
+    std::string             m_Directory;
+    std::vector<Mapping>    m_Mappings;
+    BvhCacheStats           m_Stats = {};
+};
+
+} // namespace rtc
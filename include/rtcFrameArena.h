@@ -0,0 +1,204 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcFrameArena.h
+// Desc : Per-Frame Arena Allocator.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcTypedef.h>
+#include <cstddef>
+#include <new>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameArenaDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct FrameArenaDesc
+{
+    size_t      ChunkSize       = 4 * 1024 * 1024;  //!< 最小のチャンクサイズです.
+#if defined(DEBUG) || defined(_DEBUG)
+    bool        EnablePoison    = true;             //!< 確保時に 0xCD, 解放時に 0xDD で埋めます.
+#else
+    bool        EnablePoison    = false;            //!< 確保時に 0xCD, 解放時に 0xDD で埋めます.
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameArenaStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct FrameArenaStats
+{
+    uint64_t    FrameCount          = 0;    //!< Reset() した回数です.
+    size_t      UsedBytes           = 0;    //!< 現在のフレームの使用量です.
+    size_t      PeakBytes           = 0;    //!< 1フレームの使用量の最大値です.
+    size_t      ReservedBytes       = 0;    //!< 確保済みチャンクの合計です.
+    uint32_t    ChunkCount          = 0;    //!< 確保済みチャンク数です.
+    uint32_t    Allocations         = 0;    //!< 現在のフレームの割り当て回数です.
+    uint32_t    FrameHeapCalls      = 0;    //!< 現在のフレームのヒープ呼び出し回数です. アリーナ自身の mimalloc 呼び出しと, ThreadFrame 内の汎用ヒープ呼び出し (CountHeapCall() を通るもの) を数えます.
+    uint32_t    LastFrameHeapCalls  = 0;    //!< 直前のフレームのヒープ呼び出し回数です. 定常状態では 0 になります.
+    uint64_t    TotalHeapCalls      = 0;    //!< ヒープ呼び出し回数の合計です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameArena class
+///////////////////////////////////////////////////////////////////////////////
+class FrameArena
+{
+public:
+    ///////////////////////////////////////////////////////////////////////////
+    // Marker structure
+    ///////////////////////////////////////////////////////////////////////////
+    struct Marker
+    {
+        uint32_t    Chunk;
+        size_t      Offset;
+        size_t      Used;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Scope class (スコープを抜けるとスコープ内の割り当てをまとめて解放します)
+    ///////////////////////////////////////////////////////////////////////////
+    class Scope
+    {
+    public:
+        explicit Scope(FrameArena& arena) : m_Arena(arena), m_Marker(arena.GetMarker()) {}
+        ~Scope() { m_Arena.Rewind(m_Marker); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator = (const Scope&) = delete;
+
+    private:
+        FrameArena& m_Arena;
+        Marker      m_Marker;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    // ThreadFrame class (スレッドの1フレーム分の処理を囲みます)
+    ///////////////////////////////////////////////////////////////////////////
+    class ThreadFrame
+    {
+    public:
+        //! 最も外側の ThreadFrame だけが, AdvanceFrame() 後のリセットと汎用ヒープ呼び出しの計測を行います.
+        ThreadFrame () : m_Arena(FrameArena::BeginThreadFrame()) {}
+        ~ThreadFrame() { m_Arena.EndThreadFrame(); }
+
+        ThreadFrame(const ThreadFrame&) = delete;
+        ThreadFrame& operator = (const ThreadFrame&) = delete;
+
+        FrameArena& GetArena() const { return m_Arena; }
+
+    private:
+        FrameArena& m_Arena;
+    };
+
+    FrameArena () = default;
+    ~FrameArena() { Term(); }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator = (const FrameArena&) = delete;
+
+    //! 呼び出したスレッドが所有者になります. Alloc(), Reset(), Term() は所有スレッドから呼んでください.
+    bool Init(const FrameArenaDesc& desc);
+    void Term();
+
+    //! alignment は 2 のべき乗なら任意の値を指定できます.
+    void* Alloc(size_t size, size_t alignment = 16);
+
+    template<typename T>
+    T* AllocArray(size_t count)
+    { return static_cast<T*>(Alloc(sizeof(T) * count, alignof(T))); }
+
+    Marker GetMarker() const { return Marker{ m_Current, m_Offset, m_Stats.UsedBytes }; }
+    void   Rewind(const Marker& marker);
+
+    //! フレーム終端で全ての割り当てを解放します. 複数チャンクに溢れたフレームの後は
+    //! mi_heap_destroy() でまとめて解放し, ピーク使用量の1チャンクに作り直します.
+    void Reset();
+
+    bool                    IsInit  () const { return m_pHeap != nullptr; }
+    const FrameArenaStats&  GetStats() const { return m_Stats; }
+
+    //! 呼び出したスレッド専用のアリーナを取得します. ここではリセットしません.
+    //! 割り当ては ThreadFrame の中で行ってください. リセットは次の ThreadFrame の開始時に行われます.
+    static FrameArena& GetThreadLocal();
+
+    //! 全スレッドのアリーナのフレームを進めます. レンダーループのフレーム終端で呼んでください.
+    //! 各スレッドのアリーナは, 処理中の ThreadFrame を抜けた後の次の ThreadFrame でリセットされます.
+    static void AdvanceFrame();
+
+private:
+    static constexpr uint32_t kMaxChunks = 32;
+
+    struct Chunk
+    {
+        uint8_t*    pData;
+        size_t      Size;
+    };
+
+    FrameArenaDesc  m_Desc                  = {};
+    mi_heap_t*      m_pHeap                 = nullptr;
+    Chunk           m_Chunks[kMaxChunks]    = {};
+    uint32_t        m_ChunkCount            = 0;
+    uint32_t        m_Current               = 0;
+    size_t          m_Offset                = 0;
+    uint64_t        m_Epoch                 = 0;
+    uint32_t        m_FrameDepth            = 0;    // 入れ子になった ThreadFrame の数です.
+    uint64_t        m_HeapCallBase          = 0;    // 最も外側の ThreadFrame 開始時の汎用ヒープ呼び出し回数です.
+    FrameArenaStats m_Stats                 = {};
+
+    static FrameArena& BeginThreadFrame();
+    void  EndThreadFrame();
+
+    void* AllocFromChunk(size_t size, size_t alignment);
+    void* AllocSlow(size_t size, size_t alignment);
+    bool  AddChunk(size_t size);
+    void  Poison(uint32_t beginChunk, size_t beginOffset);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ArenaAllocator class (一時的な std コンテナ用. 解放はアリーナのリセットで行います)
+// アリーナが確保できない場合は, std のアロケータと同様に std::bad_alloc を送出します.
+///////////////////////////////////////////////////////////////////////////////
+template<typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(FrameArena& arena) : m_pArena(&arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : m_pArena(other.GetArena()) {}
+
+    T* allocate(size_t count)
+    {
+        if (count > SIZE_MAX / sizeof(T))
+        { throw std::bad_alloc(); }
+
+        auto ptr = m_pArena->AllocArray<T>(count);
+        if (ptr == nullptr)
+        { throw std::bad_alloc(); }
+
+        return ptr;
+    }
+
+    void deallocate(T*, size_t) { /* DO_NOTHING */ }
+
+    FrameArena* GetArena() const { return m_pArena; }
+
+    template<typename U>
+    bool operator == (const ArenaAllocator<U>& other) const { return m_pArena == other.GetArena(); }
+
+    template<typename U>
+    bool operator != (const ArenaAllocator<U>& other) const { return m_pArena != other.GetArena(); }
+
+private:
+    FrameArena* m_pArena;
+};
+
+} // namespace rtc
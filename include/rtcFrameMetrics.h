@@ -0,0 +1,229 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcFrameMetrics.h
+// Desc : Per-Frame Render Statistics.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcTypedef.h>
+#include <rtcTimer.h>
+#include <rtcRandom.h>
+#include <rtcMemoryTracker.h>
+#include <atomic>
+#include <cstdio>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// FRAME_STAGE enum
+///////////////////////////////////////////////////////////////////////////////
+enum FRAME_STAGE
+{
+    FRAME_STAGE_TRACE = 0,      //!< レイトレーシングです.
+    FRAME_STAGE_DENOISE,        //!< デノイズです.
+    FRAME_STAGE_TONEMAP,        //!< トーンマップです.
+    FRAME_STAGE_ENCODE,         //!< 画像エンコードです.
+    FRAME_STAGE_WRITE,          //!< ファイル書き出しです.
+    FRAME_STAGE_COUNT
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// METRICS_FORMAT enum
+///////////////////////////////////////////////////////////////////////////////
+enum METRICS_FORMAT
+{
+    METRICS_FORMAT_CSV = 0,     //!< ヘッダ付きの CSV です.
+    METRICS_FORMAT_JSONL,       //!< 1行1フレームの JSON です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameMetrics structure
+///////////////////////////////////////////////////////////////////////////////
+struct FrameMetrics
+{
+    uint64_t    FrameIndex          = 0;    //!< フレーム番号です.
+    double      TimeSec             = 0.0;  //!< 計測開始からのフレーム開始時刻(秒)です.
+    double      FrameMsec           = 0.0;  //!< フレーム時間(ミリ秒)です.
+    uint32_t    Samples             = 0;    //!< ピクセルあたりのサンプル数です.
+    uint64_t    PrimaryRays         = 0;    //!< プライマリレイ数です.
+    uint64_t    SecondaryRays       = 0;    //!< 2次以降のレイ数です.
+    uint64_t    ShadowRays          = 0;    //!< シャドウレイ数です.
+    double      StageMsec[FRAME_STAGE_COUNT] = {};  //!< ステージごとの時間(ミリ秒)です.
+    size_t      MemoryPeakBytes     = 0;    //!< タグ付きメモリの最大使用量です.
+    size_t      CommitPeakBytes     = 0;    //!< プロセスのコミット量の最大値です.
+    uint64_t    OutputBytes         = 0;    //!< 出力したバイト数です.
+
+    uint64_t GetTotalRays() const
+    { return PrimaryRays + SecondaryRays + ShadowRays; }
+
+    double GetRaysPerSec() const
+    { return (FrameMsec > 0.0) ? double(GetTotalRays()) * 1000.0 / FrameMsec : 0.0; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameMetricsDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct FrameMetricsDesc
+{
+    const char*     Path        = nullptr;              //!< 出力ファイルです. nullptr なら集計だけを行います.
+    METRICS_FORMAT  Format      = METRICS_FORMAT_CSV;   //!< 出力形式です.
+    uint32_t        Capacity    = 1024;                 //!< 書き出し待ちのフレーム数の上限です(2のべき乗).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// MetricsPercentiles structure
+///////////////////////////////////////////////////////////////////////////////
+struct MetricsPercentiles
+{
+    double  Mean    = 0.0;
+    double  P50     = 0.0;
+    double  P90     = 0.0;
+    double  P99     = 0.0;
+    double  Max     = 0.0;
+};
+
+//-----------------------------------------------------------------------------
+//! @brief      平均とパーセンタイルを求めます. values は並べ替えられます.
+//-----------------------------------------------------------------------------
+MetricsPercentiles CalcPercentiles(std::vector<double>& values);
+
+///////////////////////////////////////////////////////////////////////////////
+// MetricsReservoir class (平均と最大は全件から, パーセンタイルは一様な標本から求めます)
+///////////////////////////////////////////////////////////////////////////////
+class MetricsReservoir
+{
+public:
+    explicit MetricsReservoir(uint32_t capacity = 4096)
+    : m_Capacity(capacity)
+    { /* DO_NOTHING */ }
+
+    //! 値を追加します. 保持する標本数は capacity を超えません.
+    void Add(double value);
+    void Clear();
+
+    uint64_t            GetCount      () const { return m_Count; }
+    MetricsPercentiles  GetPercentiles() const;
+
+private:
+    uint32_t            m_Capacity;
+    std::vector<double> m_Samples;
+    uint64_t            m_Count     = 0;
+    double              m_Sum       = 0.0;
+    double              m_Max       = 0.0;
+    Random              m_Random    = Random(0, 0, 0);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameMetricsSummary structure
+///////////////////////////////////////////////////////////////////////////////
+struct FrameMetricsSummary
+{
+    uint64_t            FrameCount      = 0;    //!< 集計したフレーム数です.
+    uint64_t            DroppedFrames   = 0;    //!< キューが溢れて記録できなかったフレーム数です.
+    uint64_t            TotalSamples    = 0;    //!< サンプル数の合計です.
+    uint64_t            TotalRays       = 0;    //!< レイ数の合計です.
+    uint64_t            OutputBytes     = 0;    //!< 出力したバイト数の合計です.
+    size_t              MemoryPeakBytes = 0;    //!< タグ付きメモリの最大使用量です.
+    size_t              CommitPeakBytes = 0;    //!< プロセスのコミット量の最大値です.
+    MetricsPercentiles  FrameMsec;              //!< フレーム時間です.
+    MetricsPercentiles  RaysPerSec;             //!< 秒あたりのレイ数です.
+    MetricsPercentiles  StageMsec[FRAME_STAGE_COUNT];   //!< ステージごとの時間です.
+
+    void Print() const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameMetricsRecorder class
+///////////////////////////////////////////////////////////////////////////////
+class FrameMetricsRecorder
+{
+public:
+    ///////////////////////////////////////////////////////////////////////////
+    // StageScope class (スコープの時間をステージに加算します)
+    ///////////////////////////////////////////////////////////////////////////
+    class StageScope
+    {
+    public:
+        StageScope(FrameMetricsRecorder& recorder, FRAME_STAGE stage)
+        : m_Recorder(recorder), m_Stage(stage)
+        { m_Timer.Start(); }
+
+        ~StageScope()
+        {
+            m_Timer.End();
+            m_Recorder.AddStageTime(m_Stage, m_Timer.GetElapsedMsec());
+        }
+
+        StageScope(const StageScope&) = delete;
+        StageScope& operator = (const StageScope&) = delete;
+
+    private:
+        FrameMetricsRecorder&   m_Recorder;
+        FRAME_STAGE             m_Stage;
+        Timer                   m_Timer;
+    };
+
+    FrameMetricsRecorder () = default;
+    ~FrameMetricsRecorder() { Term(); }
+
+    FrameMetricsRecorder(const FrameMetricsRecorder&) = delete;
+    FrameMetricsRecorder& operator = (const FrameMetricsRecorder&) = delete;
+
+    bool Init(const FrameMetricsDesc& desc);
+    void Term();
+
+    //! 以下はレンダースレッドから呼んでください. ファイル I/O は行いません.
+    void BeginFrame();
+    void EndFrame(const MemoryReport& memory);
+
+    void AddSamples    (uint32_t count)                                 { m_Current.Samples += count; }
+    void AddRays       (uint64_t primary, uint64_t secondary, uint64_t shadow);
+    void AddStageTime  (FRAME_STAGE stage, double msec)                 { m_Current.StageMsec[stage] += msec; }
+    void AddOutputBytes(uint64_t bytes)                                 { m_Current.OutputBytes += bytes; }
+
+    //! Term() 後に全フレームの集計を返します.
+    const FrameMetricsSummary& GetSummary() const { return m_Summary; }
+
+    static METRICS_FORMAT GetFormatFromPath(const char* path);
+
+private:
+    FrameMetricsDesc            m_Desc          = {};
+    FILE*                       m_pFile         = nullptr;
+    std::vector<FrameMetrics>   m_Queue;
+    alignas(64) std::atomic<uint64_t>   m_Head  = {};   // レンダースレッドだけが書き込みます.
+    alignas(64) std::atomic<uint64_t>   m_Tail  = {};   // 書き出しスレッドだけが書き込みます.
+    uint64_t                    m_Dropped       = 0;
+    FrameMetrics                m_Current       = {};
+    Timer                       m_RunTimer;
+    Timer                       m_FrameTimer;
+    uint64_t                    m_FrameIndex    = 0;
+    bool                        m_InFrame       = false;
+
+    std::thread                 m_Thread;
+    std::mutex                  m_Mutex;
+    std::condition_variable     m_Wake;
+    bool                        m_StopRequest   = false;
+    bool                        m_Running       = false;
+
+    // 以下は書き出しスレッドだけが触ります. 集計に使うメモリはフレーム数に依らず一定です.
+    FrameMetricsSummary         m_Summary       = {};
+    MetricsReservoir            m_FrameMsec;
+    MetricsReservoir            m_RaysPerSec;
+    MetricsReservoir            m_StageMsec[FRAME_STAGE_COUNT];
+
+    void WriterThread();
+    void WriteHeader(FILE* pFile) const;
+    void WriteFrame (FILE* pFile, const FrameMetrics& frame) const;
+    void Accumulate (const FrameMetrics& frame);
+    void Summarize();
+};
+
+} // namespace rtc
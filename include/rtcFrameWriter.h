@@ -0,0 +1,155 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcFrameWriter.h
+// Desc : Asynchronous Frame Writer.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcTypedef.h>
+#include <rtcTimer.h>
+#include <rtcFrameMetrics.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// FRAME_WRITER_BACKEND enum
+///////////////////////////////////////////////////////////////////////////////
+enum FRAME_WRITER_BACKEND
+{
+    FRAME_WRITER_BACKEND_AUTO = 0,      //!< io_uring が使えればそれを, 使えなければスレッドプールを使います.
+    FRAME_WRITER_BACKEND_IO_URING,      //!< io_uring で作成, 書き込み, クローズを発行します (Linux のみ).
+    FRAME_WRITER_BACKEND_THREAD_POOL,   //!< ワーカースレッドがブロッキング I/O を行います.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameWriterDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct FrameWriterDesc
+{
+    FRAME_WRITER_BACKEND    Backend         = FRAME_WRITER_BACKEND_AUTO;    //!< 使用するバックエンドです.
+    uint32_t                QueueDepth      = 32;                   //!< 同時に発行するファイルの上限です (io_uring のエントリ数).
+    uint32_t                BufferCount     = 16;                   //!< ステージングバッファ数です (io_uring では登録バッファになります).
+    size_t                  BufferSize      = 8 * 1024 * 1024;      //!< ステージングバッファ 1 つのバイト数です. 超えるファイルはその都度確保します.
+    size_t                  DirectThreshold = 0;                    //!< このバイト数以上のファイルはページキャッシュを通さずに書き込みます (0 なら使いません).
+    uint32_t                ThreadCount     = 0;                    //!< スレッドプールのワーカー数です(0ならハードウェアスレッド数, 最大 QueueDepth).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameWriterStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct FrameWriterStats
+{
+    FRAME_WRITER_BACKEND    Backend         = FRAME_WRITER_BACKEND_AUTO;    //!< 使用しているバックエンドです.
+    uint64_t                Submitted       = 0;    //!< 投入したファイル数です.
+    uint64_t                Completed       = 0;    //!< 書き込みが完了したファイル数です.
+    uint64_t                Failed          = 0;    //!< 失敗したファイル数です.
+    uint64_t                Bytes           = 0;    //!< 書き込んだバイト数です.
+    uint64_t                Overflows       = 0;    //!< ステージングバッファが足りずに確保した回数です.
+    uint32_t                MaxQueued       = 0;    //!< 投入済みで未完了のファイル数の最大値です.
+    double                  MeanQueued      = 0.0;  //!< 投入時点の未完了ファイル数の平均です.
+    uint32_t                MaxInFlight     = 0;    //!< カーネルまたはワーカーで処理中のファイル数の最大値です.
+    uint32_t                MaxBuffersUsed  = 0;    //!< 使用中のステージングバッファ数の最大値です.
+    MetricsPercentiles      SubmitUsec;             //!< Submit() の呼び出し時間(マイクロ秒)です.
+    MetricsPercentiles      LatencyMsec;            //!< 投入からクローズ完了までの時間(ミリ秒)です.
+    double                  ElapsedSec      = 0.0;  //!< Init() からの経過時間(秒)です.
+
+    double GetMBytesPerSec() const
+    { return (ElapsedSec > 0.0) ? double(Bytes) / (ElapsedSec * 1024.0 * 1024.0) : 0.0; }
+
+    void Print() const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameWriter class
+///////////////////////////////////////////////////////////////////////////////
+class FrameWriter
+{
+public:
+    FrameWriter ();
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator = (const FrameWriter&) = delete;
+
+    bool Init(const FrameWriterDesc& desc);
+    void Term();
+
+    //! データをステージングバッファにコピーして書き込みを予約します. ディスクは待ちません.
+    //! 失敗するのは引数が不正か, 初期化されていない場合だけです.
+    bool Submit(const char* path, const void* pData, size_t size);
+
+    //! 投入済みの書き込みが全て完了するまで待機します.
+    void Flush();
+
+    FrameWriterStats GetStats() const;
+    FRAME_WRITER_BACKEND GetBackend() const { return m_Backend; }
+
+    //! バックエンドがこの環境で使えるかどうか.
+    static bool IsSupported(FRAME_WRITER_BACKEND backend);
+
+    static const char* GetBackendName(FRAME_WRITER_BACKEND backend);
+
+private:
+    ///////////////////////////////////////////////////////////////////////////
+    // Request structure
+    ///////////////////////////////////////////////////////////////////////////
+    struct Request
+    {
+        std::string     Path;
+        uint8_t*        pData       = nullptr;
+        size_t          Size        = 0;
+        size_t          WriteSize   = 0;            // ダイレクト I/O ではアラインメントに切り上げたサイズです.
+        size_t          Written     = 0;
+        uint32_t        Slot        = UINT32_MAX;   // ステージングバッファ番号です. UINT32_MAX なら個別に確保しています.
+        bool            Direct      = false;
+        bool            Failed      = false;
+        int             Fd          = -1;
+        uint32_t        Stage       = 0;
+        Timer           Latency;
+    };
+
+    struct Uring;
+
+    FrameWriterDesc             m_Desc          = {};
+    FRAME_WRITER_BACKEND        m_Backend       = FRAME_WRITER_BACKEND_AUTO;
+    uint8_t*                    m_pPool         = nullptr;
+    size_t                      m_SlotSize      = 0;
+    std::vector<uint32_t>       m_FreeSlots;
+    std::deque<Request*>        m_Pending;
+    uint32_t                    m_Queued        = 0;    // 投入済みで未完了のファイル数です.
+    uint32_t                    m_InFlight      = 0;
+    bool                        m_StopRequest   = false;
+    bool                        m_Running       = false;
+
+    mutable std::mutex          m_Mutex;
+    std::condition_variable     m_Wake;
+    std::condition_variable     m_Idle;
+    std::vector<std::thread>    m_Threads;
+    std::unique_ptr<Uring>      m_pUring;
+
+    FrameWriterStats            m_Stats         = {};
+    uint64_t                    m_QueuedSum     = 0;
+    MetricsReservoir            m_SubmitUsec;   // 標本数は固定なので長時間動かしても増えません.
+    MetricsReservoir            m_LatencyMsec;
+    Timer                       m_RunTimer;
+
+    Request* Pop();
+    void Complete(Request* pRequest, bool success);
+    void WorkerThread();
+    void UringThread();
+    bool InitUring();
+    void TermUring();
+};
+
+} // namespace rtc
@@ -0,0 +1,115 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcGeometryDedup.h
+// Desc : Geometry Deduplication.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <vector>
+#include <d3d12.h>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// MeshSource structure
+///////////////////////////////////////////////////////////////////////////////
+struct MeshSource
+{
+    const void*     pVertices       = nullptr;  //!< 頂点データです(ローカル座標).
+    uint32_t        VertexCount     = 0;        //!< 頂点数です.
+    uint32_t        VertexStride    = 0;        //!< 頂点サイズ(バイト)です.
+    const uint32_t* pIndices        = nullptr;  //!< 頂点インデックスです.
+    uint32_t        IndexCount      = 0;        //!< 頂点インデックス数です.
+    uint32_t        VertexId        = 0;        //!< 頂点バッファのディスクリプタ番号です.
+    uint32_t        IndexId         = 0;        //!< インデックスバッファのディスクリプタ番号です.
+    uint32_t        MaterialId      = 0;        //!< マテリアル番号です.
+    float4x4        World           = float4x4::Identity();  //!< ワールド行列です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// InstanceRecord structure (Common.hlsli の Instance と同じレイアウト)
+///////////////////////////////////////////////////////////////////////////////
+struct InstanceRecord
+{
+    uint32_t    VertexId;       //!< 頂点番号です.
+    uint32_t    IndexId;        //!< 頂点インデックス番号です.
+    uint32_t    MaterialId;     //!< マテリアル番号です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// DedupGeometry structure
+///////////////////////////////////////////////////////////////////////////////
+struct DedupGeometry
+{
+    uint32_t    MeshIndex;      //!< 代表メッシュの番号です. Blas はこのメッシュのバッファで構築します.
+    uint32_t    InstanceCount;  //!< 参照するインスタンス数です.
+    uint64_t    Hash;           //!< 内容のハッシュ値です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// DedupInstance structure
+///////////////////////////////////////////////////////////////////////////////
+struct DedupInstance
+{
+    uint32_t    GeometryId;     //!< DedupGeometry の番号です.
+    uint32_t    MeshIndex;      //!< 元のメッシュ番号です.
+    float4x4    World;          //!< ワールド行列です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// GeometryDedupStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct GeometryDedupStats
+{
+    uint32_t    MeshCount           = 0;    //!< 入力メッシュ数です.
+    uint32_t    GeometryCount       = 0;    //!< 重複を除いたジオメトリ数 (= Blas 数) です.
+    uint32_t    HashCollisions      = 0;    //!< ハッシュが一致したが内容が異なった回数です.
+    uint32_t    AvoidedBuilds       = 0;    //!< 省略した Blas 構築数です.
+    uint64_t    SourceTriangles     = 0;    //!< 入力の三角形数です.
+    uint64_t    AvoidedTriangles    = 0;    //!< 構築を省略した三角形数です.
+    size_t      SourceBytes         = 0;    //!< 入力の頂点・インデックスのサイズです.
+    size_t      SavedBytes          = 0;    //!< 削減した頂点・インデックスのサイズです.
+    double      ElapsedMsec         = 0.0;  //!< 処理時間(ミリ秒)です.
+
+    //! Blas 構築時間の削減率です (構築時間は三角形数に比例するとみなす).
+    double GetAvoidedBuildRatio() const
+    { return (SourceTriangles > 0) ? double(AvoidedTriangles) / double(SourceTriangles) : 0.0; }
+
+    void Print() const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// GeometryDedup class
+///////////////////////////////////////////////////////////////////////////////
+class GeometryDedup
+{
+public:
+    GeometryDedup () = default;
+    ~GeometryDedup() = default;
+
+    //! 同じ内容のメッシュを1つのジオメトリにまとめ, 各メッシュをそのインスタンスにします.
+    bool Execute(const MeshSource* pMeshes, uint32_t count);
+    void Clear();
+
+    //! pBlasAddresses[GeometryId] を参照するインスタンス記述を書き込みます. InstanceID はインスタンス番号です.
+    //! インスタンス数が 24bit の InstanceID に収まらない場合はエラーを出力して false を返します.
+    bool FillInstanceDescs(const D3D12_GPU_VIRTUAL_ADDRESS* pBlasAddresses, D3D12_RAYTRACING_INSTANCE_DESC* pDescs) const;
+
+    const std::vector<DedupGeometry>&   GetGeometries() const { return m_Geometries; }
+    const std::vector<DedupInstance>&   GetInstances () const { return m_Instances; }
+    const std::vector<InstanceRecord>&  GetRecords   () const { return m_Records; }
+    const GeometryDedupStats&           GetStats     () const { return m_Stats; }
+
+private:
+    std::vector<DedupGeometry>  m_Geometries;
+    std::vector<DedupInstance>  m_Instances;
+    std::vector<InstanceRecord> m_Records;
+    GeometryDedupStats          m_Stats = {};
+};
+
+} // namespace rtc
@@ -0,0 +1,131 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcGeometryStream.h
+// Desc : Out-of-Core Geometry Streaming.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcBvh.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// GeometryStreamBuildDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct GeometryStreamBuildDesc
+{
+    uint32_t    ClusterBytes    = 64 * 1024;    //!< クラスタの目標サイズです. これ以下の部分木を1クラスタにまとめます.
+    uint32_t    PageSize        = 4096;         //!< クラスタの配置単位です. OS のページサイズの倍数にしてください.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// GeometryStreamDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct GeometryStreamDesc
+{
+    size_t      BudgetBytes     = size_t(1) << 30;  //!< 常駐扱いにするクラスタの合計サイズの上限です. 管理上の値で, 実際のワーキングセットは OS の判断で前後します.
+    bool        EnablePrefetch  = true;             //!< レイバッチのフットプリントから先読みします.
+    uint32_t    ThreadCount     = 0;                //!< ワーカースレッド数です(0ならハードウェアスレッド数).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// GeometryStreamStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct GeometryStreamStats
+{
+    // 以下はクラスタ単位の管理上の値です. OS が実際に行ったページインや常駐量ではありません.
+    uint64_t    ClusterMisses               = 0;    //!< 走査中に非常駐扱いのクラスタに触れた回数です.
+    uint64_t    Prefetches                  = 0;    //!< 先読みを要求したクラスタ数です.
+    uint64_t    Evictions                   = 0;    //!< ワーキングセットからの除外を要求したクラスタ数です.
+    uint64_t    ClusterBytesTouched         = 0;    //!< 非常駐扱いから常駐扱いに切り替えたクラスタの合計サイズです.
+    size_t      TrackedResidentBytes        = 0;    //!< 常駐扱いのクラスタの合計サイズです.
+    size_t      PeakTrackedResidentBytes    = 0;    //!< TrackedResidentBytes の最大値です.
+
+    // 以下は OS から取得した計測値です.
+    uint64_t    PageFaults                  = 0;    //!< TraceBatch() 中に発生したプロセス全体のページフォールト数です(ソフトフォールトを含みます).
+    size_t      MappedResidentBytes         = 0;    //!< GetStats() 時点でワーキングセットに載っているマップ領域のサイズです.
+    size_t      WorkingSetBytes             = 0;    //!< GetStats() 時点のプロセスのワーキングセットサイズです.
+    size_t      PeakWorkingSetBytes         = 0;    //!< プロセスのワーキングセットサイズの最大値です.
+
+    uint64_t    Rays                        = 0;    //!< TraceBatch() で処理したレイ数です.
+    double      TraceMsec                   = 0.0;  //!< TraceBatch() の処理時間(ミリ秒)です.
+
+    double GetRaysPerSec() const { return (TraceMsec > 0.0) ? double(Rays) * 1000.0 / TraceMsec : 0.0; }
+    void   Print() const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// StreamCluster structure
+///////////////////////////////////////////////////////////////////////////////
+struct StreamCluster
+{
+    uint64_t    Offset;         //!< ファイル先頭からの位置です(ページ境界).
+    uint32_t    Size;           //!< ページ境界に切り上げたサイズです.
+    uint32_t    NodeCount;      //!< クラスタ内の BvhNode 数です. 三角形 (Bvh8Triangle) はノードの直後に並びます.
+    uint32_t    TriangleCount;  //!< クラスタ内の三角形数です.
+    uint32_t    Reserved;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// GeometryStream class
+///////////////////////////////////////////////////////////////////////////////
+class GeometryStream
+{
+public:
+    GeometryStream () = default;
+    ~GeometryStream() { Close(); }
+
+    //! bvh を上位木とクラスタに分けて書き出します. 上位木の葉は Index がクラスタ番号です.
+    static bool Write(const char* path, const Bvh& bvh, const GeometryStreamBuildDesc& desc);
+
+    bool Open(const char* path, const GeometryStreamDesc& desc);
+    void Close();
+
+    //! 交差判定を行います. 必要なクラスタはその場でページインされます. スレッドセーフです.
+    bool Intersect(const BvhRay& ray, BvhHit& hit);
+
+    //! 上位木だけを辿り, レイが通るクラスタを先読みします.
+    void Prefetch(const BvhRay* pRays, uint32_t count);
+
+    //! 予算を超えた分のクラスタを古い順に追い出します. 交差判定と並行して呼ばないでください.
+    void Trim();
+
+    //! 先読み, 並列交差判定, 追い出しをまとめて行います.
+    void TraceBatch(const BvhRay* pRays, BvhHit* pHits, uint32_t count);
+
+    bool IsResident(uint32_t clusterId) const;
+    void ResetStats();
+
+    uint32_t                    GetClusterCount() const { return m_ClusterCount; }
+    const GeometryStreamStats&  GetStats();
+
+private:
+    GeometryStreamDesc                      m_Desc          = {};
+    void*                                   m_hFile         = nullptr;
+    void*                                   m_hMapping      = nullptr;
+    const uint8_t*                          m_pBase         = nullptr;
+    size_t                                  m_FileSize      = 0;
+    const BvhNode*                          m_pTopNodes     = nullptr;
+    uint32_t                                m_TopNodeCount  = 0;
+    const StreamCluster*                    m_pClusters     = nullptr;
+    uint32_t                                m_ClusterCount  = 0;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_LastUse;     // 0 なら非常駐, それ以外は最後に使ったバッチ番号 + 1.
+    std::atomic<uint32_t>                   m_Batch         = {};
+    std::atomic<uint64_t>                   m_ClusterMisses = {};
+    std::atomic<uint64_t>                   m_TouchedBytes  = {};
+    std::atomic<size_t>                     m_TrackedBytes  = {};
+    GeometryStreamStats                     m_Stats         = {};
+
+    bool   Touch(uint32_t clusterId);
+    void   UpdatePeak();
+    size_t QueryMappedResidentBytes() const;
+};
+
+} // namespace rtc
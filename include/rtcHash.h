@@ -0,0 +1,132 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcHash.h
+// Desc : Non-Cryptographic Hash.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <cstdint>
+#include <cstring>
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint64_t kHashPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t kHashPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t kHashPrime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t kHashPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t kHashPrime5 = 0x27D4EB2F165667C5ull;
+
+//-----------------------------------------------------------------------------
+//      左回転します.
+//-----------------------------------------------------------------------------
+inline uint64_t HashRotl(uint64_t value, int shift)
+{ return (value << shift) | (value >> (64 - shift)); }
+
+//-----------------------------------------------------------------------------
+//      アラインメントを考慮せずに読み込みます.
+//-----------------------------------------------------------------------------
+inline uint64_t HashRead64(const uint8_t* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t HashRead32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+//-----------------------------------------------------------------------------
+//      XXH64 のラウンド処理です.
+//-----------------------------------------------------------------------------
+inline uint64_t HashRound(uint64_t acc, uint64_t input)
+{
+    acc += input * kHashPrime2;
+    acc  = HashRotl(acc, 31);
+    acc *= kHashPrime1;
+    return acc;
+}
+
+inline uint64_t HashMerge(uint64_t acc, uint64_t value)
+{
+    acc ^= HashRound(0, value);
+    return acc * kHashPrime1 + kHashPrime4;
+}
+
+//-----------------------------------------------------------------------------
+//      XXH64 でハッシュ値を計算します (非暗号, 約 10GB/s).
+//-----------------------------------------------------------------------------
+inline uint64_t Hash64(const void* pData, size_t size, uint64_t seed)
+{
+    auto p   = static_cast<const uint8_t*>(pData);
+    auto end = p + size;
+    uint64_t h;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + kHashPrime1 + kHashPrime2;
+        uint64_t v2 = seed + kHashPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kHashPrime1;
+
+        auto limit = end - 32;
+        do
+        {
+            v1 = HashRound(v1, HashRead64(p +  0));
+            v2 = HashRound(v2, HashRead64(p +  8));
+            v3 = HashRound(v3, HashRead64(p + 16));
+            v4 = HashRound(v4, HashRead64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = HashRotl(v1, 1) + HashRotl(v2, 7) + HashRotl(v3, 12) + HashRotl(v4, 18);
+        h = HashMerge(h, v1);
+        h = HashMerge(h, v2);
+        h = HashMerge(h, v3);
+        h = HashMerge(h, v4);
+    }
+    else
+    {
+        h = seed + kHashPrime5;
+    }
+
+    h += uint64_t(size);
+
+    for(; p + 8 <= end; p += 8)
+    {
+        h ^= HashRound(0, HashRead64(p));
+        h  = HashRotl(h, 27) * kHashPrime1 + kHashPrime4;
+    }
+
+    if (p + 4 <= end)
+    {
+        h ^= uint64_t(HashRead32(p)) * kHashPrime1;
+        h  = HashRotl(h, 23) * kHashPrime2 + kHashPrime3;
+        p += 4;
+    }
+
+    for(; p < end; ++p)
+    {
+        h ^= (*p) * kHashPrime5;
+        h  = HashRotl(h, 11) * kHashPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kHashPrime2;
+    h ^= h >> 29;
+    h *= kHashPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace rtc
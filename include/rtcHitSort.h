@@ -0,0 +1,99 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcHitSort.h
+// Desc : Visibility Buffer Hit Sorting.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// HitRecord structure
+///////////////////////////////////////////////////////////////////////////////
+struct HitRecord
+{
+    uint32_t    InstanceId;     //!< インスタンス番号です. ミスの場合は UINT32_MAX (Payload と同じ).
+    uint32_t    PrimitiveId;    //!< プリミティブ番号です.
+    float2      Barycentrics;   //!< 重心座標です.
+    uint32_t    RayIndex;       //!< ウェーブフロント内のレイ番号です.
+
+    bool HasHit() const { return InstanceId != UINT32_MAX; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// HitBatch structure
+///////////////////////////////////////////////////////////////////////////////
+struct HitBatch
+{
+    uint32_t    MaterialId;     //!< マテリアル番号です. ミスの場合は UINT32_MAX.
+    uint32_t    Offset;         //!< ソート済み配列の先頭です.
+    uint32_t    Count;          //!< ヒット数です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// HitSortDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct HitSortDesc
+{
+    uint32_t    Capacity        = 1920 * 1080;  //!< ウェーブフロントの最大レイ数です.
+    uint32_t    MaxBatchSize    = 256;          //!< 1回のシェーディング呼び出しの最大ヒット数です.
+    uint32_t    ThreadCount     = 0;            //!< ワーカースレッド数です(0ならハードウェアスレッド数).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// HitSortStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct HitSortStats
+{
+    uint32_t    HitCount        = 0;    //!< ヒット数です.
+    uint32_t    BatchCount      = 0;    //!< シェーディング呼び出し数です.
+    uint32_t    RadixPasses     = 0;    //!< 実行した基数ソートのパス数です.
+    double      SortMsec        = 0.0;  //!< ソート時間(ミリ秒)です.
+    double      ShadeMsec       = 0.0;  //!< シェーディング時間(ミリ秒)です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// HitSorter class
+///////////////////////////////////////////////////////////////////////////////
+class HitSorter
+{
+public:
+    //! バッチ単位のシェーディング関数です. pHits には同じマテリアルのヒットが連続して並びます.
+    typedef void (*ShadeFunc)(void* pUser, uint32_t materialId, const HitRecord* pHits, uint32_t count);
+
+    HitSorter () = default;
+    ~HitSorter() = default;
+    bool Init(const HitSortDesc& desc);
+    void Term();
+
+    HitSortStats Execute(
+        const HitRecord*    pHits,
+        uint32_t            count,
+        const uint32_t*     pMaterialIds,
+        uint32_t            instanceCount,
+        bool                sort,
+        ShadeFunc           func,
+        void*               pUser);
+
+    const std::vector<HitBatch>& GetBatches() const { return m_Batches; }
+
+private:
+    HitSortDesc             m_Desc = {};
+    std::vector<uint64_t>   m_Keys[2];
+    std::vector<uint32_t>   m_Indices[2];
+    std::vector<HitRecord>  m_Sorted;
+    std::vector<HitBatch>   m_Batches;
+
+    uint32_t RadixSort(uint32_t count);
+    void     BuildBatches(const uint32_t* pMaterialIds, uint32_t instanceCount, uint32_t count);
+    void     ShadeBatches(ShadeFunc func, void* pUser);
+};
+
+} // namespace rtc
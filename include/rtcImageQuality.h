@@ -0,0 +1,65 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcImageQuality.h
+// Desc : Image Quality Metrics.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// ImageQuality structure
+///////////////////////////////////////////////////////////////////////////////
+struct ImageQuality
+{
+    double  Mse         = 0.0;  //!< 表示空間 (トーンマップ後の sRGB [0, 1]) の平均二乗誤差です.
+    double  Psnr        = 0.0;  //!< ピーク信号対雑音比(dB)です. 一致した場合は kMaxPsnr です.
+    double  Ssim        = 0.0;  //!< 輝度の平均 SSIM です (11x11 ガウス窓, sigma = 1.5).
+    double  DeltaE      = 0.0;  //!< CIELAB (D65) の平均色差 (CIE76) です.
+    double  DeltaEP99   = 0.0;  //!< CIELAB 色差の 99 パーセンタイルです.
+
+    static constexpr double kMaxPsnr = 100.0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ImageQualityDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct ImageQualityDesc
+{
+    uint32_t    Width       = 0;        //!< 横幅です.
+    uint32_t    Height      = 0;        //!< 縦幅です.
+    float       Exposure    = 1.0f;     //!< 比較前のトーンマップの露出です.
+};
+
+//-----------------------------------------------------------------------------
+//! @brief      リニアな HDR 画像をトーンマップしてから参照画像と比較します.
+//!
+//! @param[in]      desc        設定です.
+//! @param[in]      pImage      評価する画像です (Width * Height).
+//! @param[in]      pReference  参照画像です (Width * Height).
+//-----------------------------------------------------------------------------
+ImageQuality CalcImageQuality(const ImageQualityDesc& desc, const float3* pImage, const float3* pReference);
+
+//-----------------------------------------------------------------------------
+//! @brief      PSNR だけを求めます. CalcImageQuality() より軽いので毎フレームの評価に使います.
+//-----------------------------------------------------------------------------
+double CalcImagePsnr(const ImageQualityDesc& desc, const float3* pImage, const float3* pReference);
+
+//-----------------------------------------------------------------------------
+//! @brief      PFM (Portable Float Map) 形式で画像を保存します.
+//-----------------------------------------------------------------------------
+bool SaveImagePfm(const char* path, const float3* pImage, uint32_t width, uint32_t height);
+
+//-----------------------------------------------------------------------------
+//! @brief      PFM 形式の RGB 画像を読み込みます.
+//-----------------------------------------------------------------------------
+bool LoadImagePfm(const char* path, std::vector<float3>& image, uint32_t& width, uint32_t& height);
+
+} // namespace rtc
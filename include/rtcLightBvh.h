@@ -0,0 +1,111 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcLightBvh.h
+// Desc : Light Bounding Volume Hierarchy.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// EmissiveTriangle structure
+///////////////////////////////////////////////////////////////////////////////
+struct EmissiveTriangle
+{
+    float3      Position[3];    //!< ワールド空間の頂点座標です.
+    float3      Emission;       //!< 放射輝度です.
+    uint32_t    InstanceId;     //!< インスタンス番号です.
+    uint32_t    PrimitiveId;    //!< プリミティブ番号です.
+    bool        TwoSided;       //!< 両面発光なら true.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// LightBounds structure
+///////////////////////////////////////////////////////////////////////////////
+struct LightBounds
+{
+    Bounds3     Bounds;                 //!< 空間的なバウンディングボックスです.
+    float3      Axis        = float3(0.0f, 0.0f, 1.0f); //!< 法線コーンの軸です.
+    float       Phi         = 0.0f;     //!< 放射束です.
+    float       CosThetaO   = 1.0f;     //!< 法線コーンの広がり角の余弦です.
+    float       CosThetaE   = 1.0f;     //!< 放射の広がり角の余弦です.
+    bool        TwoSided    = false;    //!< 両面発光なら true.
+
+    float Importance(const float3& p, const float3& n) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// LightBvhNode structure
+///////////////////////////////////////////////////////////////////////////////
+struct LightBvhNode
+{
+    LightBounds Bounds;             //!< ライトのバウンドです.
+    uint32_t    Index   : 31;       //!< 葉ならライト番号, 節なら2番目の子ノード番号です. 複数ライトの葉なら葉リストの先頭位置です.
+    uint32_t    IsLeaf  : 1;        //!< 葉ノードなら 1.
+    uint32_t    LightCount;         //!< 葉に含まれるライト数です. 最大深さに達した葉だけが 2 以上になります.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// LightSample structure
+///////////////////////////////////////////////////////////////////////////////
+struct LightSample
+{
+    uint32_t    LightIndex  = UINT32_MAX;   //!< 選択されたライト番号です.
+    float       Pmf         = 0.0f;         //!< 選択確率です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// LightSelectionStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct LightSelectionStats
+{
+    double  VarianceBvh     = 0.0;  //!< ライトBVHによる選択の平均分散です.
+    double  VarianceUniform = 0.0;  //!< 一様選択の平均分散です.
+    size_t  PointCount      = 0;    //!< 評価した点の数です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// LightBvh class
+///////////////////////////////////////////////////////////////////////////////
+class LightBvh
+{
+public:
+    static constexpr uint32_t kMaxDepth = 63;   //!< ビットトレイルに収まる最大深さです. これ以上は分割しません.
+
+    LightBvh () = default;
+    ~LightBvh() = default;
+    bool Build(const EmissiveTriangle* pLights, uint32_t count);
+    void Clear();
+    bool Sample(const float3& p, const float3& n, float u, LightSample& result) const;
+    float Pmf(const float3& p, const float3& n, uint32_t lightIndex) const;
+    LightSelectionStats Evaluate(const float3* pPositions, const float3* pNormals, size_t count) const;
+
+    uint32_t GetLightCount() const { return uint32_t(m_Lights.size()); }
+    const EmissiveTriangle& GetLight(uint32_t index) const { return m_Lights[index]; }
+    const std::vector<LightBvhNode>& GetNodes() const { return m_Nodes; }
+
+private:
+    struct BuildItem
+    {
+        LightBounds Bounds;
+        uint32_t    LightIndex;
+    };
+
+    std::vector<EmissiveTriangle>   m_Lights;
+    std::vector<LightBvhNode>       m_Nodes;
+    std::vector<uint64_t>           m_BitTrails;
+    std::vector<BuildItem>          m_LeafItems;    //!< 複数ライトを持つ葉のライトです.
+
+    uint32_t BuildRecursive(BuildItem* pItems, uint32_t count, uint64_t bitTrail, uint32_t depth);
+    bool SampleLeaf(const LightBvhNode& node, const float3& p, const float3& n, float u, uint32_t& lightIndex, float& pmf) const;
+    float LeafPmf(const LightBvhNode& node, const float3& p, const float3& n, uint32_t lightIndex) const;
+};
+
+} // namespace rtc
@@ -5,12 +5,240 @@
 //-----------------------------------------------------------------------------
 #pragma once
 
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
 #include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
 
+//-----------------------------------------------------------------------------
+// Log Levels
+//-----------------------------------------------------------------------------
+#define RTC_LOG_LEVEL_DEBUG     (0)
+#define RTC_LOG_LEVEL_INFO      (1)     // リリースビルドでも残す統計などです.
+#define RTC_LOG_LEVEL_ERROR     (2)
+#define RTC_LOG_LEVEL_NONE      (3)
+
+// コンパイル時に出力する最小レベルです. これ未満のログは引数ごと消えます.
+#ifndef RTC_LOG_LEVEL
 #if defined(DEBUG) || defined(_DEBUG)
-#define RTC_DLOG(x, ...)    fprintf_s(stdout, "[File:%s, Line:%d] " x "\n", __FILE__, __LINE__, ##__VA_ARGS__ )
+#define RTC_LOG_LEVEL   RTC_LOG_LEVEL_DEBUG
+#else
+#define RTC_LOG_LEVEL   RTC_LOG_LEVEL_INFO
+#endif
+#endif//RTC_LOG_LEVEL
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+//! @brief      汎用ヒープの呼び出しを数えます. rtcMemoryTracker.h と同じ宣言です (ロガーは他のヘッダに依存しません).
+//-----------------------------------------------------------------------------
+void CountHeapCall();
+
+///////////////////////////////////////////////////////////////////////////////
+// LOG_ARG enum
+///////////////////////////////////////////////////////////////////////////////
+enum LOG_ARG : uint8_t
+{
+    LOG_ARG_INT = 0,    //!< 符号付き整数です.
+    LOG_ARG_UINT,       //!< 符号なし整数です.
+    LOG_ARG_DOUBLE,     //!< 浮動小数です.
+    LOG_ARG_STRING,     //!< 文字列です. LogRecord::Strings 内のオフセットを格納します.
+    LOG_ARG_POINTER,    //!< ポインタです.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// LogRecord structure (256 bytes)
+///////////////////////////////////////////////////////////////////////////////
+struct LogRecord
+{
+    static constexpr uint32_t kMaxArgs    = 12;     //!< これを超える引数は呼び出し側で整形して pText に格納します.
+    static constexpr uint32_t kStringSize = 104;
+
+    const char* pFormat;                //!< 書式文字列です (文字列リテラルのみ).
+    const char* pFile;                  //!< ファイル名です.
+    int64_t     Ticks;                  //!< 記録した時刻 (TSC) です. スレッド間の並べ替えにだけ使います.
+    uint32_t    ThreadId;               //!< 記録したスレッドです.
+    uint32_t    Line;                   //!< 行番号です.
+    uint8_t     Level;                  //!< ログレベルです.
+    uint8_t     ArgCount;               //!< 引数の数です.
+    uint8_t     StringUsed;             //!< Strings の使用量です.
+    uint8_t     Types[kMaxArgs + 1];    //!< 引数の型です.
+    uint64_t    Args[kMaxArgs];         //!< 引数の値です.
+    char*       pText;                  //!< 呼び出し側で整形した本文です (malloc). nullptr でなければ引数の代わりに使います.
+    char        Strings[kStringSize];   //!< 文字列引数のコピーです. 収まらない場合は pText に整形します.
+};
+static_assert(sizeof(LogRecord) == 256, "LogRecord size is not 256 bytes.");
+
+///////////////////////////////////////////////////////////////////////////////
+// Logger class
+///////////////////////////////////////////////////////////////////////////////
+class Logger
+{
+public:
+    //! 書き出しスレッドを開始します. 開始前と終了後のログは呼び出しスレッドで同期的に書き出します.
+    static bool Init();
+
+    //! 溜まっているログを書き出してからスレッドを終了します.
+    static void Term();
+
+    //! 呼び出し時点までに記録したログを書き出すまで待ちます.
+    static void Flush();
+
+    template<typename... Args>
+    static void Write(int level, const char* pFile, int line, const char* pFormat, const Args&... args)
+    {
+        static_assert(((std::is_arithmetic<typename std::decay<Args>::type>::value
+                     || std::is_enum      <typename std::decay<Args>::type>::value
+                     || std::is_pointer   <typename std::decay<Args>::type>::value) && ...), "Unsupported log argument type.");
+
+        LogRecord  local;
+        auto pRecord = Acquire();
+        auto& record = (pRecord != nullptr) ? *pRecord : local;
+
+        record.pFormat    = pFormat;
+        record.pFile      = pFile;
+        record.Ticks      = int64_t(__rdtsc());
+        record.Line       = uint32_t(line);
+        record.Level      = uint8_t(level);
+        record.ArgCount   = 0;
+        record.StringUsed = 0;
+        record.pText      = nullptr;
+
+        // 引数が多すぎる場合と文字列が収まらない場合は, ここで本文全体を整形する.
+        auto overflow = false;
+        if constexpr (sizeof...(Args) <= LogRecord::kMaxArgs)
+        { (Capture(record, args, overflow), ...); }
+        else
+        { overflow = true; }
+
+        if constexpr (sizeof...(Args) > 0)
+        {
+            if (overflow)
+            { record.pText = FormatText(pFormat, args...); }
+        }
+
+        if (pRecord != nullptr)
+        {
+            Commit();
+
+            // エラーの直後に落ちても残るように, すぐに書き出す.
+            if (level >= RTC_LOG_LEVEL_ERROR)
+            { Flush(); }
+        }
+        else
+        { WriteSync(local); }
+    }
+
+private:
+    static LogRecord* Acquire();
+    static void       Commit();
+    static void       WriteSync(LogRecord& record);
+
+    //-------------------------------------------------------------------------
+    //      本文を整形してコピーを返します. 失敗した場合は nullptr を返します.
+    //-------------------------------------------------------------------------
+    template<typename... Args>
+    static char* FormatText(const char* pFormat, const Args&... args)
+    {
+        auto length = snprintf(nullptr, 0, pFormat, args...);
+        if (length < 0)
+        { return nullptr; }
+
+        CountHeapCall();
+        auto pText = static_cast<char*>(malloc(size_t(length) + 1));
+        if (pText != nullptr)
+        { snprintf(pText, size_t(length) + 1, pFormat, args...); }
+        return pText;
+    }
+
+    //-------------------------------------------------------------------------
+    //      引数を記録します. 文字列が収まらない場合は overflow を true にします.
+    //-------------------------------------------------------------------------
+    template<typename T>
+    static void Capture(LogRecord& record, T value, bool& overflow)
+    {
+        auto index = record.ArgCount++;
+        if constexpr (std::is_floating_point<T>::value)
+        {
+            double v = double(value);
+            memcpy(&record.Args[index], &v, sizeof(v));
+            record.Types[index] = LOG_ARG_DOUBLE;
+        }
+        else if constexpr (std::is_enum<T>::value)
+        {
+            record.Args [index] = uint64_t(int64_t(value));
+            record.Types[index] = LOG_ARG_INT;
+        }
+        else if constexpr (std::is_integral<T>::value)
+        {
+            record.Args [index] = std::is_signed<T>::value ? uint64_t(int64_t(value)) : uint64_t(value);
+            record.Types[index] = std::is_signed<T>::value ? LOG_ARG_INT : LOG_ARG_UINT;
+        }
+        else if constexpr (std::is_same<typename std::remove_cv<typename std::remove_pointer<T>::type>::type, char>::value)
+        {
+            // 呼び出し元の文字列は書き出しまで生きている保証がないのでコピーする.
+            auto offset = record.StringUsed;
+            auto remain = LogRecord::kStringSize - offset;
+            auto length = (value != nullptr) ? strnlen(value, remain) : 0;
+            auto cut    = (length >= remain);
+            if (cut)
+            { length = remain - 1; }
+            if (length > 0)
+            { memcpy(&record.Strings[offset], value, length); }
+            record.Strings[offset + length] = '\0';
+
+            // 切り詰めた印を付ける. 通常は pText の整形に置き換わる.
+            if (cut)
+            {
+                overflow = true;
+                if (length >= 3)
+                { memcpy(&record.Strings[offset + length - 3], "...", 3); }
+            }
+            record.StringUsed   = uint8_t((std::min<size_t>)(offset + length + 1, LogRecord::kStringSize - 1));
+            record.Args [index] = offset;
+            record.Types[index] = LOG_ARG_STRING;
+        }
+        else
+        {
+            static_assert(std::is_pointer<T>::value, "Unsupported log argument type.");
+            record.Args [index] = uint64_t(uintptr_t(value));
+            record.Types[index] = LOG_ARG_POINTER;
+        }
+    }
+};
+
+} // namespace rtc
+
+
+//-----------------------------------------------------------------------------
+// Macros
+//-----------------------------------------------------------------------------
+#if RTC_LOG_LEVEL <= RTC_LOG_LEVEL_DEBUG
+#define RTC_DLOG(x, ...)    ::rtc::Logger::Write(RTC_LOG_LEVEL_DEBUG, __FILE__, __LINE__, "" x, ##__VA_ARGS__ )
 #else
 #define RTC_DLOG(x, ...)
 #endif
 
-#define RTC_ELOG(x, ...)    fprintf_s(stderr, "[File:%s, Line:%d] " x "\n", __FILE__, __LINE__, ##__VA_ARGS__ )
+#if RTC_LOG_LEVEL <= RTC_LOG_LEVEL_INFO
+#define RTC_ILOG(x, ...)    ::rtc::Logger::Write(RTC_LOG_LEVEL_INFO, __FILE__, __LINE__, "" x, ##__VA_ARGS__ )
+#else
+#define RTC_ILOG(x, ...)
+#endif
+
+#if RTC_LOG_LEVEL <= RTC_LOG_LEVEL_ERROR
+#define RTC_ELOG(x, ...)    ::rtc::Logger::Write(RTC_LOG_LEVEL_ERROR, __FILE__, __LINE__, "" x, ##__VA_ARGS__ )
+#else
+#define RTC_ELOG(x, ...)
+#endif
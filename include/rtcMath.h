@@ -0,0 +1,255 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcMath.h
+// Desc : Math Types and Functions.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcTypedef.h>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr float F_PI        = 3.1415926535897932384626433832795f;
+constexpr float F_2PI       = 6.283185307179586476925286766559f;
+constexpr float F_1DIVPI    = 0.31830988618379067153776752674503f;
+
+///////////////////////////////////////////////////////////////////////////////
+// float2 structure
+///////////////////////////////////////////////////////////////////////////////
+struct float2
+{
+    float x, y;
+
+    float2() = default;
+    constexpr float2(float s) : x(s), y(s) {}
+    constexpr float2(float _x, float _y) : x(_x), y(_y) {}
+
+    float& operator[] (int i)       { return (&x)[i]; }
+    float  operator[] (int i) const { return (&x)[i]; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// float3 structure
+///////////////////////////////////////////////////////////////////////////////
+struct float3
+{
+    float x, y, z;
+
+    float3() = default;
+    constexpr float3(float s) : x(s), y(s), z(s) {}
+    constexpr float3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+
+    float& operator[] (int i)       { return (&x)[i]; }
+    float  operator[] (int i) const { return (&x)[i]; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// float4 structure
+///////////////////////////////////////////////////////////////////////////////
+struct float4
+{
+    float x, y, z, w;
+
+    float4() = default;
+    constexpr float4(float s) : x(s), y(s), z(s), w(s) {}
+    constexpr float4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+    constexpr float4(const float3& v, float _w) : x(v.x), y(v.y), z(v.z), w(_w) {}
+
+    float& operator[] (int i)       { return (&x)[i]; }
+    float  operator[] (int i) const { return (&x)[i]; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// float4x4 structure
+///////////////////////////////////////////////////////////////////////////////
+struct float4x4
+{
+    float4 row[4];  //!< 行ベクトルです. HLSL の mul(M, v) と同じく列ベクトルを右から掛けます.
+
+    float4x4() = default;
+    constexpr float4x4(const float4& r0, const float4& r1, const float4& r2, const float4& r3)
+    : row{ r0, r1, r2, r3 }
+    { /* DO_NOTHING */ }
+
+    float4&       operator[] (int i)       { return row[i]; }
+    const float4& operator[] (int i) const { return row[i]; }
+
+    static constexpr float4x4 Identity()
+    {
+        return float4x4(
+            float4(1.0f, 0.0f, 0.0f, 0.0f),
+            float4(0.0f, 1.0f, 0.0f, 0.0f),
+            float4(0.0f, 0.0f, 1.0f, 0.0f),
+            float4(0.0f, 0.0f, 0.0f, 1.0f));
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// float3x4 structure
+///////////////////////////////////////////////////////////////////////////////
+struct float3x4
+{
+    float4 row[3];  //!< 行ベクトルです. float4x4 の上3行と同じで, D3D12_RAYTRACING_INSTANCE_DESC::Transform と同じ並びです.
+
+    float3x4() = default;
+    constexpr float3x4(const float4& r0, const float4& r1, const float4& r2)
+    : row{ r0, r1, r2 }
+    { /* DO_NOTHING */ }
+
+    float4&       operator[] (int i)       { return row[i]; }
+    const float4& operator[] (int i) const { return row[i]; }
+
+    static constexpr float3x4 Identity()
+    {
+        return float3x4(
+            float4(1.0f, 0.0f, 0.0f, 0.0f),
+            float4(0.0f, 1.0f, 0.0f, 0.0f),
+            float4(0.0f, 0.0f, 1.0f, 0.0f));
+    }
+};
+
+//-----------------------------------------------------------------------------
+// float2 operators
+//-----------------------------------------------------------------------------
+inline float2 operator + (const float2& a, const float2& b) { return float2(a.x + b.x, a.y + b.y); }
+inline float2 operator - (const float2& a, const float2& b) { return float2(a.x - b.x, a.y - b.y); }
+inline float2 operator * (const float2& a, const float2& b) { return float2(a.x * b.x, a.y * b.y); }
+inline float2 operator * (const float2& a, float s)         { return float2(a.x * s, a.y * s); }
+inline float2 operator * (float s, const float2& a)         { return float2(a.x * s, a.y * s); }
+
+//-----------------------------------------------------------------------------
+// float3 operators
+//-----------------------------------------------------------------------------
+inline float3 operator - (const float3& a)                  { return float3(-a.x, -a.y, -a.z); }
+inline float3 operator + (const float3& a, const float3& b) { return float3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline float3 operator - (const float3& a, const float3& b) { return float3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline float3 operator * (const float3& a, const float3& b) { return float3(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline float3 operator / (const float3& a, const float3& b) { return float3(a.x / b.x, a.y / b.y, a.z / b.z); }
+inline float3 operator * (const float3& a, float s)         { return float3(a.x * s, a.y * s, a.z * s); }
+inline float3 operator * (float s, const float3& a)         { return float3(a.x * s, a.y * s, a.z * s); }
+inline float3 operator / (const float3& a, float s)         { return a * (1.0f / s); }
+inline float3& operator += (float3& a, const float3& b)     { a = a + b; return a; }
+inline float3& operator -= (float3& a, const float3& b)     { a = a - b; return a; }
+inline float3& operator *= (float3& a, const float3& b)     { a = a * b; return a; }
+inline float3& operator *= (float3& a, float s)             { a = a * s; return a; }
+
+//-----------------------------------------------------------------------------
+// float4 operators
+//-----------------------------------------------------------------------------
+inline float4 operator + (const float4& a, const float4& b) { return float4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w); }
+inline float4 operator - (const float4& a, const float4& b) { return float4(a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w); }
+inline float4 operator * (const float4& a, const float4& b) { return float4(a.x * b.x, a.y * b.y, a.z * b.z, a.w * b.w); }
+inline float4 operator * (const float4& a, float s)         { return float4(a.x * s, a.y * s, a.z * s, a.w * s); }
+inline float4 operator * (float s, const float4& a)         { return float4(a.x * s, a.y * s, a.z * s, a.w * s); }
+inline float4& operator += (float4& a, const float4& b)     { a = a + b; return a; }
+
+//-----------------------------------------------------------------------------
+// Functions
+//-----------------------------------------------------------------------------
+inline float  Saturate(float v)                             { return std::min(std::max(v, 0.0f), 1.0f); }
+inline float  Lerp(float a, float b, float t)               { return a + (b - a) * t; }
+inline float3 Lerp(const float3& a, const float3& b, float t) { return a + (b - a) * t; }
+inline float4 Lerp(const float4& a, const float4& b, float t) { return a + (b - a) * t; }
+
+inline float  Dot(const float2& a, const float2& b)         { return a.x * b.x + a.y * b.y; }
+inline float  Dot(const float3& a, const float3& b)         { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float  Dot(const float4& a, const float4& b)         { return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w; }
+inline float  Cross(const float2& a, const float2& b)       { return a.x * b.y - a.y * b.x; }
+inline float3 Cross(const float3& a, const float3& b)
+{ return float3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+
+inline float  Length(const float3& v)                       { return sqrtf(Dot(v, v)); }
+inline float3 Normalize(const float3& v)
+{
+    auto len = Length(v);
+    return (len > 0.0f) ? v / len : v;
+}
+
+inline float3 Min(const float3& a, const float3& b)
+{ return float3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)); }
+
+inline float3 Max(const float3& a, const float3& b)
+{ return float3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)); }
+
+inline float4 Mul(const float4x4& m, const float4& v)
+{ return float4(Dot(m[0], v), Dot(m[1], v), Dot(m[2], v), Dot(m[3], v)); }
+
+inline float4x4 Mul(const float4x4& a, const float4x4& b)
+{
+    float4x4 result;
+    for(auto i=0; i<4; ++i)
+    {
+        result[i] = b[0] * a[i].x + b[1] * a[i].y + b[2] * a[i].z + b[3] * a[i].w;
+    }
+    return result;
+}
+
+inline float MaxComponent(const float3& v)                  { return std::max(v.x, std::max(v.y, v.z)); }
+inline float Luminance(const float3& rgb)                   { return Dot(rgb, float3(0.2126f, 0.7152f, 0.0722f)); }
+inline float SafeSqrt(float v)                              { return sqrtf(std::max(v, 0.0f)); }
+inline float SafeAcos(float v)                              { return acosf(std::min(std::max(v, -1.0f), 1.0f)); }
+
+///////////////////////////////////////////////////////////////////////////////
+// Bounds3 structure
+///////////////////////////////////////////////////////////////////////////////
+struct Bounds3
+{
+    float3 Min = float3( FLT_MAX);
+    float3 Max = float3(-FLT_MAX);
+
+    bool   IsValid ()   const { return Min.x <= Max.x && Min.y <= Max.y && Min.z <= Max.z; }
+    float3 Center  ()   const { return (Min + Max) * 0.5f; }
+    float3 Diagonal()   const { return Max - Min; }
+
+    void Merge(const float3& p)
+    {
+        Min = rtc::Min(Min, p);
+        Max = rtc::Max(Max, p);
+    }
+
+    void Merge(const Bounds3& b)
+    {
+        Min = rtc::Min(Min, b.Min);
+        Max = rtc::Max(Max, b.Max);
+    }
+
+    bool Contains(const float3& p) const
+    {
+        return p.x >= Min.x && p.x <= Max.x
+            && p.y >= Min.y && p.y <= Max.y
+            && p.z >= Min.z && p.z <= Max.z;
+    }
+
+    float SurfaceArea() const
+    {
+        if (!IsValid())
+        { return 0.0f; }
+        auto d = Diagonal();
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    int MaxExtent() const
+    {
+        auto d = Diagonal();
+        return (d.x > d.y && d.x > d.z) ? 0 : ((d.y > d.z) ? 1 : 2);
+    }
+};
+
+inline Bounds3 Merge(const Bounds3& a, const Bounds3& b)
+{
+    Bounds3 result = a;
+    result.Merge(b);
+    return result;
+}
+
+} // namespace rtc
@@ -0,0 +1,145 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcMemoryTracker.h
+// Desc : Tagged Memory Accounting.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcTypedef.h>
+#include <cstddef>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// MEMORY_TAG enum
+///////////////////////////////////////////////////////////////////////////////
+enum MEMORY_TAG
+{
+    MEMORY_TAG_BVH = 0,         //!< BVH のノードと三角形です.
+    MEMORY_TAG_TEXTURE,         //!< テクスチャキャッシュのタイルプールです.
+    MEMORY_TAG_FRAMEBUFFER,     //!< 画面解像度のバッファです.
+    MEMORY_TAG_D3D12MA,         //!< D3D12MA が CPU 側で確保するメモリです.
+    MEMORY_TAG_ENCODE,          //!< 画像エンコード用のバッファです.
+    MEMORY_TAG_FRAME_ARENA,     //!< フレームアリーナのチャンクです.
+    MEMORY_TAG_COUNT
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// MemoryTagStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct MemoryTagStats
+{
+    size_t      LiveBytes       = 0;    //!< 現在の使用量です.
+    size_t      PeakBytes       = 0;    //!< 使用量の最大値です(フレーム単位で標本化).
+    uint64_t    AllocCount      = 0;    //!< 割り当て回数の合計です.
+    uint64_t    FreeCount       = 0;    //!< 解放回数の合計です.
+    uint64_t    AllocBytes      = 0;    //!< 割り当てたバイト数の合計です.
+    uint64_t    FrameAllocCount = 0;    //!< 直前のフレームの割り当て回数です.
+    uint64_t    FrameAllocBytes = 0;    //!< 直前のフレームで割り当てたバイト数です.
+    double      AllocPerSec     = 0.0;  //!< 直前のフレームの割り当て頻度(回/秒)です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// MemoryReport structure
+///////////////////////////////////////////////////////////////////////////////
+struct MemoryReport
+{
+    uint64_t        FrameIndex          = 0;    //!< EndFrame() した回数です.
+    double          FrameMsec           = 0.0;  //!< 直前のフレームの時間(ミリ秒)です.
+    MemoryTagStats  Tags[MEMORY_TAG_COUNT];     //!< タグごとの統計です.
+    size_t          TrackedBytes        = 0;    //!< 全タグの使用量の合計です.
+    size_t          PeakTrackedBytes    = 0;    //!< 全タグの使用量の合計の最大値です.
+    size_t          CommitBytes         = 0;    //!< プロセスのコミット量です.
+    size_t          PeakCommitBytes     = 0;    //!< プロセスのコミット量の最大値です.
+
+    void Print() const;
+};
+
+//-----------------------------------------------------------------------------
+//! @brief      割り当てを記録します. 呼び出したスレッドのカウンタだけを更新します.
+//-----------------------------------------------------------------------------
+void TrackAlloc(MEMORY_TAG tag, size_t size);
+
+//-----------------------------------------------------------------------------
+//! @brief      解放を記録します. 割り当てとは別のスレッドから呼んでも構いません.
+//-----------------------------------------------------------------------------
+void TrackFree(MEMORY_TAG tag, size_t size);
+
+//-----------------------------------------------------------------------------
+//! @brief      タグ付きでメモリを割り当てます. TaggedFree() で解放してください.
+//-----------------------------------------------------------------------------
+void* TaggedAlloc(MEMORY_TAG tag, size_t size, size_t alignment);
+
+//-----------------------------------------------------------------------------
+//! @brief      TaggedAlloc() で割り当てたメモリを解放します.
+//-----------------------------------------------------------------------------
+void TaggedFree(MEMORY_TAG tag, void* ptr);
+
+//-----------------------------------------------------------------------------
+//! @brief      汎用ヒープの呼び出しを数えます. rtcNewDelete.h の new/delete, TaggedAlloc()/TaggedFree(),
+//!             ロガーの整形済み本文の malloc/free から呼ばれます. 外部ライブラリが直接呼ぶ malloc は数えません.
+//-----------------------------------------------------------------------------
+void CountHeapCall();
+
+//-----------------------------------------------------------------------------
+//! @brief      呼び出したスレッドの汎用ヒープ呼び出し回数を取得します.
+//-----------------------------------------------------------------------------
+uint64_t GetThreadHeapCalls();
+
+//-----------------------------------------------------------------------------
+//! @brief      タグ名を取得します.
+//-----------------------------------------------------------------------------
+const char* GetMemoryTagName(MEMORY_TAG tag);
+
+///////////////////////////////////////////////////////////////////////////////
+// TrackedMemory class (所有するコンテナの容量をタグに計上します)
+///////////////////////////////////////////////////////////////////////////////
+class TrackedMemory
+{
+public:
+    explicit TrackedMemory(MEMORY_TAG tag) : m_Tag(tag) {}
+    ~TrackedMemory() { Set(0); }
+
+    TrackedMemory(const TrackedMemory&) = delete;
+    TrackedMemory& operator = (const TrackedMemory&) = delete;
+
+    //! 計上するバイト数を置き換えます. 0 なら解放として記録します.
+    void Set(size_t bytes)
+    {
+        if (bytes == m_Bytes)
+        { return; }
+        if (m_Bytes > 0)
+        { TrackFree(m_Tag, m_Bytes); }
+        if (bytes > 0)
+        { TrackAlloc(m_Tag, bytes); }
+        m_Bytes = bytes;
+    }
+
+    size_t Get() const { return m_Bytes; }
+
+private:
+    MEMORY_TAG  m_Tag;
+    size_t      m_Bytes = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// MemoryTracker class
+///////////////////////////////////////////////////////////////////////////////
+class MemoryTracker
+{
+public:
+    //! 全スレッドのカウンタを集計します. フレームは進めません.
+    static void Query(MemoryReport& report);
+
+    //! フレーム終端で集計し, ピークとフレームあたりの割り当て頻度を更新します.
+    static const MemoryReport& EndFrame();
+
+    //! 終了時の集計と mimalloc の統計を出力します.
+    static void PrintSummary();
+};
+
+} // namespace rtc
@@ -0,0 +1,40 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcNewDelete.h
+// Desc : Counted mimalloc new/delete.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+// mimalloc-new-delete.h の代わりに使います. new/delete を mimalloc に転送し,
+// スレッドごとの汎用ヒープ呼び出し回数を数えます (FrameArena::ThreadFrame の計測用).
+// malloc は数えないので, このリポジトリのコードで malloc を使う箇所は CountHeapCall() を併せて呼んでください.
+// 置き換え関数の定義なので, 実行ファイルの1つの翻訳単位でだけインクルードしてください.
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMemoryTracker.h>
+#include <new>
+
+
+void operator delete  (void* p) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete[](void* p) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete  (void* p, const std::nothrow_t&) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete  (void* p, std::size_t) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete[](void* p, std::size_t) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete  (void* p, std::align_val_t) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete  (void* p, std::size_t, std::align_val_t) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete  (void* p, std::align_val_t, const std::nothrow_t&) noexcept { rtc::CountHeapCall(); mi_free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { rtc::CountHeapCall(); mi_free(p); }
+
+void* operator new  (std::size_t n) { rtc::CountHeapCall(); return mi_new(n); }
+void* operator new[](std::size_t n) { rtc::CountHeapCall(); return mi_new(n); }
+void* operator new  (std::size_t n, const std::nothrow_t&) noexcept { rtc::CountHeapCall(); return mi_new_nothrow(n); }
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept { rtc::CountHeapCall(); return mi_new_nothrow(n); }
+void* operator new  (std::size_t n, std::align_val_t al) { rtc::CountHeapCall(); return mi_new_aligned(n, static_cast<size_t>(al)); }
+void* operator new[](std::size_t n, std::align_val_t al) { rtc::CountHeapCall(); return mi_new_aligned(n, static_cast<size_t>(al)); }
+void* operator new  (std::size_t n, std::align_val_t al, const std::nothrow_t&) noexcept { rtc::CountHeapCall(); return mi_new_aligned_nothrow(n, static_cast<size_t>(al)); }
+void* operator new[](std::size_t n, std::align_val_t al, const std::nothrow_t&) noexcept { rtc::CountHeapCall(); return mi_new_aligned_nothrow(n, static_cast<size_t>(al)); }
@@ -0,0 +1,122 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcOpacityMask.h
+// Desc : Opacity Micro-Map (2bit Mask).
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <atomic>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// OPACITY_STATE enum
+///////////////////////////////////////////////////////////////////////////////
+enum OPACITY_STATE : uint8_t
+{
+    OPACITY_STATE_TRANSPARENT   = 0,    //!< 完全に透明です.
+    OPACITY_STATE_OPAQUE        = 1,    //!< 完全に不透明です.
+    OPACITY_STATE_UNKNOWN       = 2,    //!< テクスチャを参照する必要があります.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// AlphaImage structure
+///////////////////////////////////////////////////////////////////////////////
+struct AlphaImage
+{
+    uint32_t        Width       = 0;        //!< 横幅です.
+    uint32_t        Height      = 0;        //!< 縦幅です.
+    const uint8_t*  pPixels     = nullptr;  //!< アルファ値の先頭です. RGBA8 なら pPixels + 3 を渡します.
+    uint32_t        PixelStride = 1;        //!< 1ピクセルのバイト数です.
+    uint32_t        RowPitch    = 0;        //!< 1行のバイト数です(0なら Width * PixelStride).
+    uint8_t         Cutoff      = 128;      //!< アルファテストの閾値です. これ以上なら不透明です.
+
+    uint8_t Fetch(int x, int y) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// OpacityMaskDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct OpacityMaskDesc
+{
+    const float2*   pTexCoords      = nullptr;  //!< 頂点のテクスチャ座標です.
+    const uint32_t* pIndices        = nullptr;  //!< 三角形の頂点インデックスです.
+    uint32_t        TriangleCount   = 0;        //!< 三角形数です.
+    AlphaImage      Alpha;                      //!< アルファテクスチャです.
+    uint32_t        SubdivisionLevel = 4;       //!< 分割レベルです. 三角形あたり 4^Level 個に分割します.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// OpacityMaskStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct OpacityMaskStats
+{
+    uint32_t    Triangles           = 0;    //!< 三角形数です.
+    uint32_t    UniformTriangles    = 0;    //!< 全体が同じ状態でマスクを持たない三角形数です.
+    uint64_t    OpaqueCount         = 0;    //!< 不透明なマイクロ三角形数です.
+    uint64_t    TransparentCount    = 0;    //!< 透明なマイクロ三角形数です.
+    uint64_t    UnknownCount        = 0;    //!< 未確定なマイクロ三角形数です.
+    size_t      MemoryBytes         = 0;    //!< マスクの使用メモリです.
+    double      ElapsedMsec         = 0.0;  //!< 構築時間(ミリ秒)です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// AnyHitStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct AnyHitStats
+{
+    uint64_t    Invocations     = 0;    //!< 任意ヒットの呼び出し数です.
+    uint64_t    Avoided         = 0;    //!< マスクで解決しテクスチャ参照を省略した数です.
+    uint64_t    TextureFetches  = 0;    //!< テクスチャを参照した数です.
+
+    static constexpr uint32_t kCounterCount = 3;   //!< シェーダの AnyHitCounters の要素数です.
+
+    static AnyHitStats FromCounters(const uint32_t* pCounters);
+    AnyHitStats& operator += (const AnyHitStats& value);
+    void Print(const char* name) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// OpacityMask class
+///////////////////////////////////////////////////////////////////////////////
+class OpacityMask
+{
+public:
+    //! アルファテスト関数です. 不透明なら true を返します.
+    typedef bool (*AlphaTestFunc)(void* pUser, uint32_t triangleIndex, const float2& barycentrics);
+
+    OpacityMask () = default;
+    ~OpacityMask() = default;
+    bool Build(const OpacityMaskDesc& desc);
+    void Clear();
+
+    OPACITY_STATE GetState(uint32_t triangleIndex, const float2& barycentrics) const;
+    bool AnyHit(uint32_t triangleIndex, const float2& barycentrics, AlphaTestFunc func, void* pUser);
+
+    AnyHitStats ResetAnyHitStats();
+    const OpacityMaskStats& GetStats() const { return m_Stats; }
+    uint32_t GetSubdivisionLevel() const { return m_Level; }
+
+    static uint32_t CalcMicroTriangleIndex(const float2& barycentrics, uint32_t level);
+    static void Pack(const OpacityMask* const* ppMasks, uint32_t count, std::vector<uint32_t>& result);
+
+private:
+    static constexpr uint32_t kUniformIndex = 0xFFFFFFFC;   // 以上なら三角形全体が (値 - kUniformIndex) の状態.
+
+    std::vector<uint32_t>   m_Descs;    // 三角形ごとの先頭エントリ番号, または一様状態.
+    std::vector<uint32_t>   m_Bits;     // 2bit マスク.
+    uint32_t                m_Level = 0;
+    OpacityMaskStats        m_Stats = {};
+
+    std::atomic<uint64_t>   m_Invocations    = {};
+    std::atomic<uint64_t>   m_Avoided        = {};
+    std::atomic<uint64_t>   m_TextureFetches = {};
+};
+
+} // namespace rtc
@@ -0,0 +1,123 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcPathGuiding.h
+// Desc : Path Guiding (Spatial-Directional Tree).
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <atomic>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// PathGuidingDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct PathGuidingDesc
+{
+    Bounds3     SceneBounds;                        //!< シーンのバウンディングボックスです.
+    uint32_t    TrainingIterations  = 6;            //!< 学習するイテレーション数です.
+    float       SpatialThreshold    = 12000.0f;     //!< 空間分割する際のサンプル数の閾値です.
+    float       DirectionalRho      = 0.01f;        //!< 方向分割する際のエネルギー比率の閾値です.
+    uint32_t    MaxDirectionalDepth = 20;           //!< 四分木の最大深度です.
+    size_t      MaxMemoryBytes      = 64 * 1024 * 1024; //!< 最大使用メモリです.
+    float       BsdfSamplingFraction = 0.5f;        //!< BSDFサンプリングを選択する確率です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PathGuidingStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct PathGuidingStats
+{
+    uint32_t    Iteration       = 0;    //!< 現在のイテレーション数です.
+    uint32_t    SpatialNodes    = 0;    //!< 空間二分木のノード数です.
+    uint32_t    DirectionalNodes= 0;    //!< 方向四分木のノード数の合計です.
+    size_t      MemoryBytes     = 0;    //!< 使用メモリです.
+    uint64_t    RecordedSamples = 0;    //!< 現在のイテレーションで記録したサンプル数です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// DirectionalTree class
+///////////////////////////////////////////////////////////////////////////////
+class DirectionalTree
+{
+public:
+    DirectionalTree();
+    DirectionalTree(const DirectionalTree& value);
+    DirectionalTree& operator = (const DirectionalTree& value);
+
+    void  Record(const float2& p, float value);
+    float2 Sample(float u0, float u1) const;
+    float Pdf(const float2& p) const;
+    void  Refine(const DirectionalTree& prev, float rho, uint32_t maxDepth, uint32_t maxNodes);
+    float GetTotal() const;
+    uint32_t GetNodeCount() const { return uint32_t(m_Nodes.size()); }
+
+    uint64_t GetSampleCount() const { return m_SampleCount.load(std::memory_order_relaxed); }
+
+private:
+    struct Node
+    {
+        std::atomic<float>  Sum[4];
+        uint32_t            Child[4];
+
+        Node();
+        Node(const Node& value);
+        Node& operator = (const Node& value);
+    };
+
+    std::vector<Node>       m_Nodes;
+    std::atomic<uint64_t>   m_SampleCount = {};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PathGuiding class
+///////////////////////////////////////////////////////////////////////////////
+class PathGuiding
+{
+public:
+    PathGuiding () = default;
+    ~PathGuiding() = default;
+    bool Init(const PathGuidingDesc& desc);
+    void Term();
+
+    void  Record(const float3& position, const float3& dir, const float3& radiance, float pdf);
+    bool  Sample(const float3& position, float u0, float u1, float3& dir, float& pdf) const;
+    float Pdf   (const float3& position, const float3& dir) const;
+    bool  SampleMIS(const float3& position, float uSelect, float u0, float u1, bool& useBsdf, float3& dir) const;
+    float MixturePdf(float bsdfPdf, float guidePdf) const;
+    void  EndIteration();
+
+    bool  IsTraining() const { return m_Iteration < m_Desc.TrainingIterations; }
+    bool  IsReady   () const { return m_Iteration > 0; }
+    PathGuidingStats GetStats() const;
+
+private:
+    struct SpatialNode
+    {
+        uint32_t    Child[2];
+        uint32_t    Leaf;       //!< 葉ノードなら DTreePair の番号, 節なら UINT32_MAX.
+        uint8_t     Axis;
+    };
+
+    struct DTreePair
+    {
+        DirectionalTree Sampling;
+        DirectionalTree Building;
+    };
+
+    PathGuidingDesc             m_Desc      = {};
+    std::vector<SpatialNode>    m_Spatial;
+    std::vector<DTreePair>      m_Leaves;
+    uint32_t                    m_Iteration = 0;
+
+    uint32_t FindLeaf(const float3& position) const;
+    size_t   CalcMemoryBytes() const;
+};
+
+} // namespace rtc
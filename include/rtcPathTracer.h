@@ -0,0 +1,146 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcPathTracer.h
+// Desc : Reference Path Tracer.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <vector>
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+// Forward Declarations.
+//-----------------------------------------------------------------------------
+class PathGuiding;
+
+///////////////////////////////////////////////////////////////////////////////
+// RouletteMode enum
+///////////////////////////////////////////////////////////////////////////////
+enum class RouletteMode
+{
+    None,           //!< ロシアンルーレットを行いません.
+    Throughput,     //!< スループットの最大成分を生存確率とします.
+    Efficiency,     //!< スループットの輝度と, OptimizeRoulette() で効率が最大となるよう選んだ閾値から生存確率を決めます.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PathVertex structure
+///////////////////////////////////////////////////////////////////////////////
+struct PathVertex
+{
+    float3      Position;       //!< ワールド空間位置です.
+    float3      Normal;         //!< シェーディング法線です.
+    float3      Albedo;         //!< 拡散反射率です.
+    float3      Emission;       //!< 放射輝度です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PathTracerDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct PathTracerDesc
+{
+    uint32_t        Width               = 1920;     //!< 横幅です.
+    uint32_t        Height              = 1080;     //!< 縦幅です.
+    uint32_t        MaxBounce           = 8;        //!< 最大バウンス数です(SceneParameters::MaxIteration).
+    uint32_t        MinBounce           = 3;        //!< ロシアンルーレットを開始するバウンス数です.
+    RouletteMode    Roulette            = RouletteMode::Efficiency; //!< ロシアンルーレットの方式です.
+    float           RouletteThreshold   = 0.5f;     //!< 生存確率が 1 となるスループット輝度です. OptimizeRoulette() で更新されます.
+    float           MinSurvival         = 0.05f;    //!< 生存確率の下限です.
+    uint32_t        ThreadCount         = 0;        //!< ワーカースレッド数です(0ならハードウェアスレッド数).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PathTracerFrame structure
+///////////////////////////////////////////////////////////////////////////////
+struct PathTracerFrame
+{
+    //! 交差判定関数です. ヒットした場合は true を返し, hit を設定します.
+    typedef bool   (*IntersectFunc)(void* pUser, const float3& origin, const float3& dir, PathVertex& hit);
+
+    //! 環境光関数です.
+    typedef float3 (*EnvironmentFunc)(void* pUser, const float3& dir);
+
+    float4x4            InvView         = float4x4::Identity(); //!< ビュー行列の逆行列です.
+    float4x4            InvProj         = float4x4::Identity(); //!< 射影行列の逆行列です.
+    uint32_t            FrameIndex      = 0;        //!< フレーム番号です. 乱数のシードに使用します.
+    uint32_t            SamplesPerPixel = 1;        //!< ピクセルあたりのサンプル数です.
+    IntersectFunc       Intersect       = nullptr;  //!< 交差判定関数です.
+    EnvironmentFunc     Environment     = nullptr;  //!< 環境光関数です(省略可).
+    void*               pUser           = nullptr;  //!< コールバックに渡すユーザーデータです.
+    PathGuiding*        pGuiding        = nullptr;  //!< パスガイドです(省略可). 学習中はパス頂点を記録し, 学習済みなら BSDF と一標本 MIS でサンプリングします.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// BounceStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct BounceStats
+{
+    uint64_t    Rays            = 0;    //!< このバウンスで発行したレイ数です.
+    uint64_t    Terminated      = 0;    //!< このバウンスでロシアンルーレットにより終了したパス数です.
+    double      ThroughputSum   = 0.0;  //!< レイ発行時のスループット輝度の合計です.
+    double      Contribution    = 0.0;  //!< このバウンスで加算した放射輝度の輝度の合計です.
+
+    double GetMeanThroughput() const
+    { return (Rays > 0) ? ThroughputSum / double(Rays) : 0.0; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PathTracerStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct PathTracerStats
+{
+    double                      ElapsedMsec = 0.0;  //!< 処理時間(ミリ秒)です.
+    uint64_t                    TotalRays   = 0;    //!< 発行したレイ数の合計です.
+    std::vector<BounceStats>    Bounces;            //!< バウンスごとの統計です.
+
+    //! 最終画像に対するバウンスの寄与率を求めます.
+    double GetContributionRatio(size_t bounce) const;
+
+    //! バウンスごとの統計をログに出力します.
+    void Print() const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// RouletteCandidate structure
+///////////////////////////////////////////////////////////////////////////////
+struct RouletteCandidate
+{
+    float       Threshold   = 0.0f; //!< 評価した閾値です.
+    double      Variance    = 0.0;  //!< 1フレームあたりの分散の推定値です.
+    double      ElapsedMsec = 0.0;  //!< 1フレームあたりの描画時間(ミリ秒)です.
+    double      Efficiency  = 0.0;  //!< CalcEfficiency() で求めた効率です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PathTracer class
+///////////////////////////////////////////////////////////////////////////////
+class PathTracer
+{
+public:
+    PathTracer () = default;
+    ~PathTracer() = default;
+    bool Init(const PathTracerDesc& desc);
+    void Term();
+    PathTracerStats Render(const PathTracerFrame& frame, float3* pOutput);
+    float OptimizeRoulette(const PathTracerFrame& frame, const float* pThresholds, uint32_t count, std::vector<RouletteCandidate>* pCandidates = nullptr);
+    const PathTracerDesc& GetDesc() const { return m_Desc; }
+
+    static float  CalcSurvivalProbability(const PathTracerDesc& desc, const float3& throughput, uint32_t bounce);
+    static double CalcEfficiency(double meanSquaredError, double elapsedMsec);
+
+private:
+    PathTracerDesc  m_Desc = {};
+
+    float3 TracePath(const PathTracerFrame& frame, uint32_t x, uint32_t y, uint32_t sampleIndex, BounceStats* pStats) const;
+
+    template<typename Func>
+    void ParallelRows(Func func) const;
+};
+
+} // namespace rtc
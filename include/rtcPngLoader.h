@@ -0,0 +1,155 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcPngLoader.h
+// Desc : Parallel PNG Loader.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <cstdint>
+#include <cstddef>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// PNG_RESULT enum
+///////////////////////////////////////////////////////////////////////////////
+enum PNG_RESULT
+{
+    PNG_OK = 0,             //!< 成功です.
+    PNG_INVALID_ARG,        //!< 引数が不正です.
+    PNG_FILE_ERROR,         //!< ファイルを開けませんでした.
+    PNG_NOT_PNG,            //!< PNG ファイルではありません.
+    PNG_CORRUPT,            //!< データが壊れています (CRC, Adler-32, 圧縮データの不整合).
+    PNG_UNSUPPORTED,        //!< 対応していない形式です.
+    PNG_NO_DESTINATION,     //!< 出力先が無いか, 小さすぎます.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PngInfo structure
+///////////////////////////////////////////////////////////////////////////////
+struct PngInfo
+{
+    uint32_t    Width       = 0;        //!< 横幅です.
+    uint32_t    Height      = 0;        //!< 縦幅です.
+    uint32_t    Channels    = 0;        //!< ファイルのチャンネル数です (パレットは tRNS の有無で 3 か 4).
+    uint32_t    BitDepth    = 0;        //!< ファイルのビット深度です.
+    uint32_t    ColorType   = 0;        //!< PNG のカラータイプです.
+    bool        Interlaced  = false;    //!< Adam7 インターレースかどうか.
+    bool        IsFpng      = false;    //!< fpng で書き出されたファイルかどうか (高速パスで展開されます).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PngBatchItem structure
+///////////////////////////////////////////////////////////////////////////////
+struct PngBatchItem
+{
+    // 入力.
+    const char*     pPath       = nullptr;  //!< ファイルパスです. nullptr なら pData を使います.
+    const void*     pData       = nullptr;  //!< メモリ上の PNG データです.
+    size_t          DataSize    = 0;        //!< pData のバイト数です.
+    uint32_t        Channels    = 4;        //!< 出力チャンネル数です (1 - 4, 各 8bit).
+    void*           pDst        = nullptr;  //!< 出力先です. nullptr なら PngBatchDesc::Alloc で確保します.
+    size_t          RowPitch    = 0;        //!< 出力の行ピッチです (0 なら Width * Channels).
+    size_t          DstSize     = 0;        //!< 出力先のバイト数です.
+
+    // 結果.
+    PNG_RESULT      Result      = PNG_INVALID_ARG;  //!< 結果です.
+    PngInfo         Info;                           //!< ファイルの情報です.
+    size_t          FileBytes   = 0;                //!< 入力のバイト数です.
+    size_t          DecodedBytes= 0;                //!< 出力したバイト数です.
+    double          ReadMsec    = 0.0;              //!< ファイルのマップにかかった時間(ミリ秒)です.
+    double          DecodeMsec  = 0.0;              //!< 展開にかかった時間(ミリ秒)です.
+
+    //! 展開のスループット (出力 MB/sec) を取得します.
+    double GetDecodeMBytesPerSec() const
+    { return (DecodeMsec > 0.0) ? double(DecodedBytes) / (DecodeMsec * 1000.0) : 0.0; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PngBatchDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct PngBatchDesc
+{
+    //! 出力先の確保関数です. ワーカースレッドから並行して呼ばれます.
+    //! rowPitch と dstSize は Width * Channels, Height * rowPitch で初期化されています.
+    typedef void* (*AllocFunc)(void* pUser, uint32_t index, const PngInfo& info, uint32_t channels, size_t& rowPitch, size_t& dstSize);
+
+    uint32_t    ThreadCount = 0;        //!< ワーカースレッド数です(0ならハードウェアスレッド数).
+    AllocFunc   Alloc       = nullptr;  //!< 出力先の確保関数です.
+    void*       pUser       = nullptr;  //!< ユーザーデータです.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PngBatchStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct PngBatchStats
+{
+    uint32_t    FileCount       = 0;    //!< ファイル数です.
+    uint32_t    FailedCount     = 0;    //!< 失敗したファイル数です.
+    uint32_t    FpngCount       = 0;    //!< fpng の高速パスで展開したファイル数です.
+    uint32_t    ThreadCount     = 0;    //!< 使用したスレッド数です.
+    uint64_t    FileBytes       = 0;    //!< 入力の合計バイト数です.
+    uint64_t    DecodedBytes    = 0;    //!< 出力の合計バイト数です.
+    double      ReadMsec        = 0.0;  //!< ファイルのマップ時間の合計(ミリ秒)です.
+    double      DecodeMsec      = 0.0;  //!< 展開時間の合計(ミリ秒)です.
+    double      WallMsec        = 0.0;  //!< バッチ全体の経過時間(ミリ秒)です.
+
+    //! バッチ全体のスループット (出力 MB/sec) を取得します.
+    double GetMBytesPerSec() const
+    { return (WallMsec > 0.0) ? double(DecodedBytes) / (WallMsec * 1000.0) : 0.0; }
+
+    //! 集計とファイルごとのスループットを出力します.
+    void Print(const PngBatchItem* pItems, uint32_t count) const;
+};
+
+//-----------------------------------------------------------------------------
+//! @brief      PNG のヘッダを読み取ります.
+//!
+//! @param[in]      pData       PNG データです.
+//! @param[in]      size        バイト数です.
+//! @param[out]     info        ファイルの情報です.
+//-----------------------------------------------------------------------------
+PNG_RESULT GetPngInfo(const void* pData, size_t size, PngInfo& info);
+
+//-----------------------------------------------------------------------------
+//! @brief      PNG を呼び出し側のメモリへ直接展開します.
+//!
+//! @param[in]      pData       PNG データです.
+//! @param[in]      size        バイト数です.
+//! @param[in]      channels    出力チャンネル数です (1 - 4). 16bit は上位 8bit に丸めます.
+//!                             1, 2 チャンネルはカラー画像の R (と A) を出力します.
+//! @param[out]     pDst        出力先です.
+//! @param[in]      rowPitch    出力の行ピッチです (0 なら Width * channels).
+//! @param[in]      dstSize     出力先のバイト数です.
+//! @param[out]     pInfo       ファイルの情報です (nullptr 可).
+//-----------------------------------------------------------------------------
+PNG_RESULT DecodePng
+(
+    const void* pData,
+    size_t      size,
+    uint32_t    channels,
+    void*       pDst,
+    size_t      rowPitch,
+    size_t      dstSize,
+    PngInfo*    pInfo = nullptr
+);
+
+//-----------------------------------------------------------------------------
+//! @brief      複数の PNG をスレッドプールで並列に展開します.
+//!
+//! @param[in]      desc        設定です.
+//! @param[in,out]  pItems      展開する項目です. 結果が書き込まれます.
+//! @param[in]      count       項目数です.
+//-----------------------------------------------------------------------------
+PngBatchStats DecodePngBatch(const PngBatchDesc& desc, PngBatchItem* pItems, uint32_t count);
+
+//-----------------------------------------------------------------------------
+//! @brief      結果の名前を取得します.
+//-----------------------------------------------------------------------------
+const char* GetPngResultName(PNG_RESULT result);
+
+} // namespace rtc
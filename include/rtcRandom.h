@@ -0,0 +1,89 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcRandom.h
+// Desc : Random Number Generator.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcTypedef.h>
+#include <cstring>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// Random class
+///////////////////////////////////////////////////////////////////////////////
+class Random
+{
+public:
+    //-------------------------------------------------------------------------
+    //! @brief      シェーダの SetSeed() と同じシード値で初期化します.
+    //-------------------------------------------------------------------------
+    Random(uint32_t x, uint32_t y, uint32_t frameIndex)
+    : m_State{ x, y, frameIndex, 0 }
+    { /* DO_NOTHING */ }
+
+    //-------------------------------------------------------------------------
+    //! @brief      [0, 1) の乱数を取得します.
+    //-------------------------------------------------------------------------
+    float GetAsF32()
+    {
+        m_State[3]++;
+        uint32_t v[4];
+        PCG(m_State, v);
+        return ToFloat(v[0]);
+    }
+
+    //-------------------------------------------------------------------------
+    //! @brief      32bit 乱数を取得します.
+    //-------------------------------------------------------------------------
+    uint32_t GetAsU32()
+    {
+        m_State[3]++;
+        uint32_t v[4];
+        PCG(m_State, v);
+        return v[0];
+    }
+
+private:
+    uint32_t m_State[4];
+
+    //-------------------------------------------------------------------------
+    //! @brief      Permuted Congruential Generator (PCG) です. Common.hlsli と同じ実装です.
+    //-------------------------------------------------------------------------
+    static void PCG(const uint32_t in[4], uint32_t v[4])
+    {
+        for(auto i=0; i<4; ++i)
+        { v[i] = in[i] * 1664525u + 101390422u; }
+
+        v[0] += v[1] * v[3];
+        v[1] += v[2] * v[0];
+        v[2] += v[0] * v[1];
+        v[3] += v[1] * v[2];
+
+        for(auto i=0; i<4; ++i)
+        { v[i] ^= (v[i] >> 16u); }
+
+        v[0] += v[1] * v[3];
+        v[1] += v[2] * v[0];
+        v[2] += v[0] * v[1];
+        v[3] += v[1] * v[2];
+    }
+
+    //-------------------------------------------------------------------------
+    //! @brief      [0, 1) の浮動小数に変換します.
+    //-------------------------------------------------------------------------
+    static float ToFloat(uint32_t x)
+    {
+        uint32_t bits = 0x3f800000u | (x >> 9);
+        float result;
+        memcpy(&result, &bits, sizeof(result));
+        return result - 1.0f;
+    }
+};
+
+} // namespace rtc
@@ -0,0 +1,117 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcRayCone.h
+// Desc : Ray Cone for Texture LOD.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// RayCone structure
+///////////////////////////////////////////////////////////////////////////////
+struct RayCone
+{
+    float   Width;          //!< 現在の円錐の幅です.
+    float   SpreadAngle;    //!< 広がり角(ラジアン)です.
+};
+
+//-----------------------------------------------------------------------------
+//      1ピクセルあたりの広がり角を求めます.
+//-----------------------------------------------------------------------------
+inline float CalcPixelSpreadAngle(float proj11, float screenHeight)
+{
+    // Ray Tracing Gems, Chapter 20. tan(fovY / 2) = 1 / Proj._22.
+    return atanf(2.0f / (proj11 * screenHeight));
+}
+
+//-----------------------------------------------------------------------------
+//      一次レイの円錐を初期化します.
+//-----------------------------------------------------------------------------
+inline RayCone InitRayCone(float pixelSpreadAngle)
+{ return RayCone{ 0.0f, pixelSpreadAngle }; }
+
+//-----------------------------------------------------------------------------
+//      ヒット位置まで円錐を伝搬させます.
+//-----------------------------------------------------------------------------
+inline RayCone PropagateRayCone(const RayCone& cone, float surfaceSpreadAngle, float hitT)
+{
+    RayCone result;
+    result.Width       = cone.SpreadAngle * hitT + cone.Width;
+    result.SpreadAngle = cone.SpreadAngle + surfaceSpreadAngle;
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      頂点法線から三角形の曲率を推定します.
+//-----------------------------------------------------------------------------
+inline float EstimateCurvature(const float3 p[3], const float3 n[3])
+{
+    // Ray Tracing Gems II, Chapter 7. 各辺の法線の変化量の平均.
+    float result = 0.0f;
+    for(auto i=0; i<3; ++i)
+    {
+        auto j  = (i + 1) % 3;
+        auto dp = p[i] - p[j];
+        auto len2 = Dot(dp, dp);
+        if (len2 > 0.0f)
+        { result += Dot(n[i] - n[j], dp) / len2; }
+    }
+    return result / 3.0f;
+}
+
+//-----------------------------------------------------------------------------
+//      曲率による広がり角の増分を求めます.
+//-----------------------------------------------------------------------------
+inline float CalcSurfaceSpreadAngle(float curvature, float coneWidth, float cosTheta)
+{ return 2.0f * curvature * fabsf(coneWidth) / std::max(fabsf(cosTheta), 1e-4f); }
+
+//-----------------------------------------------------------------------------
+//      三角形ごとのLOD定数 (0.5 * log2(テクスチャ座標面積 / ワールド面積)) を求めます.
+//-----------------------------------------------------------------------------
+inline float CalcTriangleLodConstant(const float3 p[3], const float2 uv[3])
+{
+    auto worldArea = Length(Cross(p[1] - p[0], p[2] - p[0]));
+    auto uvArea    = fabsf(Cross(uv[1] - uv[0], uv[2] - uv[0]));
+    if (worldArea <= 0.0f || uvArea <= 0.0f)
+    { return 0.0f; }
+
+    return 0.5f * log2f(uvArea / worldArea);
+}
+
+//-----------------------------------------------------------------------------
+//      円錐のフットプリントからテクスチャLODを求めます.
+//-----------------------------------------------------------------------------
+inline float CalcTextureLod
+(
+    const RayCone&  cone,
+    float           lodConstant,
+    float           cosTheta,
+    uint32_t        textureWidth,
+    uint32_t        textureHeight
+)
+{
+    auto lod = lodConstant;
+    lod += 0.5f * log2f(float(textureWidth) * float(textureHeight));
+    lod += log2f(std::max(fabsf(cone.Width), 1e-8f));
+    lod -= log2f(std::max(fabsf(cosTheta), 1e-4f));
+    return std::max(lod, 0.0f);
+}
+
+//-----------------------------------------------------------------------------
+//      球面マップ参照時のLODを求めます.
+//-----------------------------------------------------------------------------
+inline float CalcSphereMapLod(float spreadAngle, uint32_t textureHeight)
+{
+    // 縦方向で π ラジアンをカバーするので 1テクセル = π / height ラジアン.
+    auto texels = spreadAngle * float(textureHeight) * F_1DIVPI;
+    return std::max(log2f(std::max(texels, 1e-8f)), 0.0f);
+}
+
+} // namespace rtc
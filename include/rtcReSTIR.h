@@ -0,0 +1,122 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcReSTIR.h
+// Desc : Reservoir-based Spatio-Temporal Importance Resampling.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <rtcLightBvh.h>
+#include <rtcMemoryTracker.h>
+#include <atomic>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// Reservoir structure
+///////////////////////////////////////////////////////////////////////////////
+struct Reservoir
+{
+    uint32_t    LightIndex  = UINT32_MAX;   //!< 選択したライト番号です.
+    float2      LightUV     = float2(0.0f); //!< ライト上の重心座標です.
+    float       TargetPdf   = 0.0f;         //!< 選択したサンプルの目標分布 p^ です.
+    float       WeightSum   = 0.0f;         //!< 重みの合計です.
+    float       M           = 0.0f;         //!< 候補数です.
+    float       W           = 0.0f;         //!< 寄与重みです.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ReSTIRSurface structure
+///////////////////////////////////////////////////////////////////////////////
+struct ReSTIRSurface
+{
+    float3      Position;       //!< ワールド空間位置です.
+    float3      Normal;         //!< シェーディング法線です.
+    float3      Albedo;         //!< 拡散反射率です.
+    float       ViewDepth;      //!< ビュー空間の深度です.
+    bool        Valid;          //!< ヒットしていれば true.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ReSTIRDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct ReSTIRDesc
+{
+    uint32_t    Width               = 1920;     //!< 横幅です.
+    uint32_t    Height              = 1080;     //!< 縦幅です.
+    uint32_t    CandidateCount      = 32;       //!< 初期候補数です.
+    uint32_t    SpatialNeighbors    = 5;        //!< 空間再利用の近傍数です.
+    float       SpatialRadius       = 30.0f;    //!< 空間再利用の半径(ピクセル)です.
+    float       TemporalMaxM        = 20.0f;    //!< 時間再利用で前フレームの M を現在の何倍まで許すかです.
+    bool        EnableTemporal      = true;     //!< 時間再利用を有効にします.
+    bool        EnableSpatial       = true;     //!< 空間再利用を有効にします.
+    uint32_t    ThreadCount         = 0;        //!< ワーカースレッド数です(0ならハードウェアスレッド数).
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ReSTIRFrame structure
+///////////////////////////////////////////////////////////////////////////////
+struct ReSTIRFrame
+{
+    //! 遮蔽判定関数です. CastShadowRay() と同様に, 可視なら true を返します.
+    typedef bool (*VisibilityFunc)(void* pUser, const float3& position, const float3& normal, const float3& target);
+
+    const ReSTIRSurface*    pSurfaces       = nullptr;  //!< 現フレームのサーフェイスです.
+    const ReSTIRSurface*    pPrevSurfaces   = nullptr;  //!< 前フレームのサーフェイスです.
+    float4x4                PrevView        = float4x4::Identity(); //!< 前フレームのビュー行列です.
+    float4x4                PrevProj        = float4x4::Identity(); //!< 前フレームの射影行列です.
+    uint32_t                FrameIndex      = 0;        //!< フレーム番号です. 乱数のシードに使用します.
+    VisibilityFunc          Visibility      = nullptr;  //!< 遮蔽判定関数です.
+    void*                   pUser           = nullptr;  //!< 遮蔽判定関数に渡すユーザーデータです.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ReSTIRStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct ReSTIRStats
+{
+    double      ElapsedMsec     = 0.0;  //!< 処理時間(ミリ秒)です.
+    uint64_t    ShadowRays      = 0;    //!< 発行したシャドウレイ数です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ReSTIR class
+///////////////////////////////////////////////////////////////////////////////
+class ReSTIR
+{
+public:
+    ReSTIR () = default;
+    ~ReSTIR() = default;
+    bool Init(const ReSTIRDesc& desc, const LightBvh* pLights);
+    void Term();
+    ReSTIRStats Execute(const ReSTIRFrame& frame, float3* pOutput);
+    ReSTIRStats ExecuteNEE(const ReSTIRFrame& frame, uint32_t samplesPerPixel, float3* pOutput);
+
+    static double CalcMeanSquaredError(const float3* pImage, const float3* pReference, size_t count);
+
+private:
+    ReSTIRDesc              m_Desc      = {};
+    const LightBvh*         m_pLights   = nullptr;
+    std::vector<Reservoir>  m_Reservoirs[2];
+    std::vector<Reservoir>  m_Spatial;
+    uint32_t                m_Current   = 0;
+    bool                    m_HasHistory = false;
+    TrackedMemory           m_Memory    { MEMORY_TAG_FRAMEBUFFER };
+
+    float  EvaluateTarget(const ReSTIRSurface& surface, const Reservoir& r, float3* pRadiance, float3* pLightPos) const;
+    bool   SampleLight(const ReSTIRSurface& surface, float u0, float u1, float u2, Reservoir& sample, float& sourcePdf) const;
+    void   InitialSampling(const ReSTIRFrame& frame, uint32_t x, uint32_t y, Reservoir& result) const;
+    void   TemporalReuse  (const ReSTIRFrame& frame, uint32_t x, uint32_t y, Reservoir& result) const;
+    void   SpatialReuse   (const ReSTIRFrame& frame, uint32_t x, uint32_t y, Reservoir& result) const;
+    float3 Shade          (const ReSTIRFrame& frame, uint32_t x, uint32_t y, const Reservoir& r, std::atomic<uint64_t>& rays) const;
+
+    template<typename Func>
+    void ParallelRows(Func func) const;
+};
+
+} // namespace rtc
@@ -0,0 +1,86 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcSceneParams.h
+// Desc : Scene Parameters Generation.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcAnimation.h>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// SceneParameters structure (SceneParameters.hlsli と同じレイアウト)
+///////////////////////////////////////////////////////////////////////////////
+struct SceneParameters
+{
+    float4x4    View;               //!< ビュー行列.
+    float4x4    Proj;               //!< 射影行列.
+    float4x4    InvView;            //!< ビュー行列の逆行列.
+    float4x4    InvProj;            //!< 射影行列の逆行列.
+    float4x4    InvViewProj;        //!< ビュー射影行列の逆行列.
+
+    float4x4    PrevView;           //!< 前フレームのビュー行列.
+    float4x4    PrevProj;           //!< 前フレームの射影行列.
+    float4x4    PrevInvView;        //!< 前フレームのビュー行列の逆行列.
+    float4x4    PrevInvProj;        //!< 前フレームの射影行列の逆行列.
+    float4x4    PrevInvViewProj;    //!< 前フレームのビュー射影行列の逆行列.
+
+    float4      ScreenSize;         //!< (w, h, 1/w, 1/h).
+    float3      CameraDir;          //!< カメラの方向ベクトル.
+    uint32_t    MaxIteration;       //!< 最大イタレーション回数.
+
+    uint32_t    FrameIndex;         //!< フレーム番号.
+    float       AnimationTime;      //!< アニメーション時間[sec].
+    uint32_t    EnableAccumulation; //!< アキュームレーション有効フラグ (HLSL の bool は 4 byte).
+    uint32_t    AccumulatedFrames;  //!< アキュームレーション済みフレーム数.
+
+    int32_t     DebugRayIndex[2];   //!< デバッグレイ番号.
+    uint32_t    MinBounce;          //!< ロシアンルーレットを開始するバウンス数.
+    float       RouletteThreshold;  //!< 生存確率が 1 となるスループット輝度.
+};
+static_assert(sizeof(SceneParameters) == 704, "SceneParameters size is not matched with HLSL.");
+
+///////////////////////////////////////////////////////////////////////////////
+// SceneParamsDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct SceneParamsDesc
+{
+    uint32_t        Width               = 1920;     //!< 横幅です.
+    uint32_t        Height              = 1080;     //!< 縦幅です.
+    float           NearClip            = 0.1f;     //!< ニアクリップ平面です.
+    float           FarClip             = 1000.0f;  //!< ファークリップ平面です.
+    double          FPS                 = 60.0;     //!< Config::AnimFPS と同じ値を指定します.
+    uint32_t        MaxIteration        = 8;        //!< 最大イタレーション回数です.
+    uint32_t        MinBounce           = 3;        //!< ロシアンルーレットを開始するバウンス数です.
+    float           RouletteThreshold   = 0.5f;     //!< 生存確率が 1 となるスループット輝度です. PathTracer::OptimizeRoulette() の結果を使えます.
+    bool            EnableAccumulation  = false;    //!< アキュームレーション有効フラグです.
+    const float2*   pJitters            = nullptr;  //!< フレームごとの NDC 空間のジッターです (nullptr なら無し).
+    bool            TransposeForHlsl    = true;     //!< HLSL の既定 (column_major) に合わせて行列を転置して格納します.
+};
+
+//-----------------------------------------------------------------------------
+//! @brief      右手系の透視投影行列を求めます (深度は [0, 1]).
+//-----------------------------------------------------------------------------
+float4x4 CreatePerspectiveFovRH(float fovY, float aspect, float nearClip, float farClip, const float2& jitter);
+
+//-----------------------------------------------------------------------------
+//! @brief      全フレームの SceneParameters を生成します.
+//!
+//! @param[in]  desc        設定です.
+//! @param[in]  pCameras    フレームごとのカメラです (AnimationTable::GetCamera()).
+//! @param[in]  frameCount  フレーム数です.
+//! @param[out] pResult     frameCount 個の出力先です.
+//-----------------------------------------------------------------------------
+bool GenerateSceneParameters(const SceneParamsDesc& desc, const CameraFrame* pCameras, uint32_t frameCount, SceneParameters* pResult);
+
+//-----------------------------------------------------------------------------
+//! @brief      倍精度の一般逆行列で求めた参照値との最大相対誤差を返します.
+//-----------------------------------------------------------------------------
+double ValidateSceneParameters(const SceneParamsDesc& desc, const CameraFrame* pCameras, uint32_t frameCount, const SceneParameters* pParams);
+
+} // namespace rtc
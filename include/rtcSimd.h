@@ -0,0 +1,201 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcSimd.h
+// Desc : SIMD Math Functions.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+#include <emmintrin.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+// Load / Store
+//-----------------------------------------------------------------------------
+inline __m128 LoadSimd(const float4& v)             { return _mm_loadu_ps(&v.x); }
+inline __m128 LoadSimd(const float3& v, float w)    { return _mm_set_ps(w, v.z, v.y, v.x); }
+inline void   StoreSimd(float4& dst, __m128 v)      { _mm_storeu_ps(&dst.x, v); }
+
+inline void LoadSimd(const float4x4& m, __m128 rows[4])
+{
+    rows[0] = LoadSimd(m.row[0]);
+    rows[1] = LoadSimd(m.row[1]);
+    rows[2] = LoadSimd(m.row[2]);
+    rows[3] = LoadSimd(m.row[3]);
+}
+
+inline void StoreSimd(float4x4& dst, const __m128 rows[4])
+{
+    StoreSimd(dst.row[0], rows[0]);
+    StoreSimd(dst.row[1], rows[1]);
+    StoreSimd(dst.row[2], rows[2]);
+    StoreSimd(dst.row[3], rows[3]);
+}
+
+//-----------------------------------------------------------------------------
+//      要素を複製します.
+//-----------------------------------------------------------------------------
+template<int I>
+inline __m128 SplatSimd(__m128 v)
+{ return _mm_shuffle_ps(v, v, _MM_SHUFFLE(I, I, I, I)); }
+
+//-----------------------------------------------------------------------------
+//      3要素の外積を求めます (w は 0).
+//-----------------------------------------------------------------------------
+inline __m128 CrossSimd(__m128 a, __m128 b)
+{
+    auto a1 = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    auto b1 = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    auto c  = _mm_sub_ps(_mm_mul_ps(a, b1), _mm_mul_ps(a1, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+//-----------------------------------------------------------------------------
+//      3要素の内積を全要素に求めます.
+//-----------------------------------------------------------------------------
+inline __m128 Dot3Simd(__m128 a, __m128 b)
+{
+    auto m = _mm_mul_ps(a, b);
+    return _mm_add_ps(_mm_add_ps(SplatSimd<0>(m), SplatSimd<1>(m)), SplatSimd<2>(m));
+}
+
+//-----------------------------------------------------------------------------
+//      行列の積 a * b を求めます (列ベクトルを右から掛ける規約).
+//-----------------------------------------------------------------------------
+inline float4x4 MulSimd(const float4x4& a, const float4x4& b)
+{
+    float4x4 result;
+#if defined(__AVX__)
+    // 2行ずつ処理する.
+    auto b01 = _mm256_loadu2_m128(&b.row[0].x, &b.row[0].x);
+    auto b11 = _mm256_loadu2_m128(&b.row[1].x, &b.row[1].x);
+    auto b21 = _mm256_loadu2_m128(&b.row[2].x, &b.row[2].x);
+    auto b31 = _mm256_loadu2_m128(&b.row[3].x, &b.row[3].x);
+    for(auto i=0; i<4; i+=2)
+    {
+        auto r = _mm256_mul_ps(_mm256_setr_m128(_mm_set1_ps(a.row[i].x), _mm_set1_ps(a.row[i + 1].x)), b01);
+        r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_setr_m128(_mm_set1_ps(a.row[i].y), _mm_set1_ps(a.row[i + 1].y)), b11));
+        r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_setr_m128(_mm_set1_ps(a.row[i].z), _mm_set1_ps(a.row[i + 1].z)), b21));
+        r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_setr_m128(_mm_set1_ps(a.row[i].w), _mm_set1_ps(a.row[i + 1].w)), b31));
+        _mm256_storeu_ps(&result.row[i].x, r);
+    }
+#else
+    __m128 rb[4];
+    LoadSimd(b, rb);
+    for(auto i=0; i<4; ++i)
+    {
+        auto ra = LoadSimd(a.row[i]);
+        auto r  = _mm_mul_ps(SplatSimd<0>(ra), rb[0]);
+        r = _mm_add_ps(r, _mm_mul_ps(SplatSimd<1>(ra), rb[1]));
+        r = _mm_add_ps(r, _mm_mul_ps(SplatSimd<2>(ra), rb[2]));
+        r = _mm_add_ps(r, _mm_mul_ps(SplatSimd<3>(ra), rb[3]));
+        StoreSimd(result.row[i], r);
+    }
+#endif
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      転置行列を求めます.
+//-----------------------------------------------------------------------------
+inline float4x4 TransposeSimd(const float4x4& m)
+{
+    __m128 rows[4];
+    LoadSimd(m, rows);
+    _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+
+    float4x4 result;
+    StoreSimd(result, rows);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      アフィン変換 [A t; 0 1] の逆行列 [A^-1, -A^-1 t; 0 1] を求めます.
+//      A^-1 は余因子 (行の外積) から閉じた形で求めます.
+//-----------------------------------------------------------------------------
+inline float4x4 InverseAffineSimd(const float4x4& m)
+{
+    __m128 rows[4];
+    LoadSimd(m, rows);
+
+    auto t = _mm_set_ps(0.0f, m.row[2].w, m.row[1].w, m.row[0].w);
+
+    // 平行移動を除いた行ベクトル.
+    auto mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    auto r0 = _mm_and_ps(rows[0], mask);
+    auto r1 = _mm_and_ps(rows[1], mask);
+    auto r2 = _mm_and_ps(rows[2], mask);
+
+    // A^-1 の列は (r1 x r2, r2 x r0, r0 x r1) / det.
+    auto c0  = CrossSimd(r1, r2);
+    auto c1  = CrossSimd(r2, r0);
+    auto c2  = CrossSimd(r0, r1);
+    auto det = Dot3Simd(r0, c0);
+    auto inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+    c0 = _mm_mul_ps(c0, inv);
+    c1 = _mm_mul_ps(c1, inv);
+    c2 = _mm_mul_ps(c2, inv);
+
+    // 列を行に並べ替える.
+    auto c3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+    // -A^-1 t を w に入れる.
+    auto tx = _mm_sub_ps(_mm_setzero_ps(), Dot3Simd(c0, t));
+    auto ty = _mm_sub_ps(_mm_setzero_ps(), Dot3Simd(c1, t));
+    auto tz = _mm_sub_ps(_mm_setzero_ps(), Dot3Simd(c2, t));
+
+    float4x4 result;
+    StoreSimd(result.row[0], c0);
+    StoreSimd(result.row[1], c1);
+    StoreSimd(result.row[2], c2);
+    result.row[0].w = _mm_cvtss_f32(tx);
+    result.row[1].w = _mm_cvtss_f32(ty);
+    result.row[2].w = _mm_cvtss_f32(tz);
+    result.row[3]   = float4(0.0f, 0.0f, 0.0f, 1.0f);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      透視投影行列の逆行列を閉じた形で求めます.
+//      P = [a 0 c 0; 0 b d 0; 0 0 e f; 0 0 g 0] の形 (ジッターを含む) を前提とします.
+//-----------------------------------------------------------------------------
+inline float4x4 InversePerspectiveSimd(const float4x4& m)
+{
+    auto a = m.row[0].x;
+    auto c = m.row[0].z;
+    auto b = m.row[1].y;
+    auto d = m.row[1].z;
+    auto e = m.row[2].z;
+    auto f = m.row[2].w;
+    auto g = m.row[3].z;
+
+    auto inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_set_ps(g, f, b, a));
+    alignas(16) float r[4];
+    _mm_store_ps(r, inv);
+
+    return float4x4(
+        float4(r[0], 0.0f, 0.0f, -c * r[0] * r[3]),
+        float4(0.0f, r[1], 0.0f, -d * r[1] * r[3]),
+        float4(0.0f, 0.0f, 0.0f, r[3]),
+        float4(0.0f, 0.0f, r[2], -e * r[2] * r[3]));
+}
+
+//-----------------------------------------------------------------------------
+//      射影行列の逆行列を求めます. 正射影はアフィン変換として扱います.
+//-----------------------------------------------------------------------------
+inline float4x4 InverseProjectionSimd(const float4x4& m)
+{
+    auto isAffine = m.row[3].x == 0.0f && m.row[3].y == 0.0f && m.row[3].z == 0.0f && m.row[3].w == 1.0f;
+    return isAffine ? InverseAffineSimd(m) : InversePerspectiveSimd(m);
+}
+
+} // namespace rtc
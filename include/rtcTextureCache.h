@@ -0,0 +1,140 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcTextureCache.h
+// Desc : Tiled Texture Cache.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcTypedef.h>
+#include <rtcMath.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// TextureSource structure
+///////////////////////////////////////////////////////////////////////////////
+struct TextureSource
+{
+    //! タイル読み込み関数です. pDst には kTileSize x kTileSize テクセル分の領域が渡されます.
+    typedef bool (*LoadTileFunc)(void* pUser, uint32_t mipLevel, uint32_t tileX, uint32_t tileY, uint8_t* pDst, uint32_t rowPitch);
+
+    uint32_t        Width       = 0;        //!< 最上位ミップの横幅です.
+    uint32_t        Height      = 0;        //!< 最上位ミップの縦幅です.
+    uint32_t        MipLevels   = 0;        //!< ミップレベル数です(0なら自動計算).
+    LoadTileFunc    LoadTile    = nullptr;  //!< タイル読み込み関数です.
+    void*           pUser       = nullptr;  //!< ユーザーデータです.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// TextureCacheDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct TextureCacheDesc
+{
+    size_t      BudgetBytes     = 256 * 1024 * 1024;    //!< タイルプールに使用する最大バイト数です.
+    uint32_t    TexelSize       = 4;                    //!< 1テクセルあたりのバイト数です.
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// TextureCacheStats structure
+///////////////////////////////////////////////////////////////////////////////
+struct TextureCacheStats
+{
+    uint64_t    Lookups         = 0;    //!< タイル参照回数です.
+    uint64_t    Hits            = 0;    //!< キャッシュヒット回数です.
+    uint64_t    TileLoads       = 0;    //!< タイル読み込み回数です.
+    uint64_t    Evictions       = 0;    //!< 追い出し回数です.
+    uint64_t    LoadedBytes     = 0;    //!< タイル読み込みで転送したバイト数です.
+    double      StallMsec       = 0.0;  //!< タイル読み込み待ちの合計時間(ミリ秒)です. ロック待ちを含みます.
+    size_t      ResidentBytes   = 0;    //!< 常駐しているタイルのバイト数です.
+
+    double GetHitRate() const
+    { return (Lookups > 0) ? double(Hits) / double(Lookups) : 0.0; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// TextureCache class
+///////////////////////////////////////////////////////////////////////////////
+class TextureCache
+{
+public:
+    static constexpr uint32_t kTileSize         = 64;
+    static constexpr uint32_t kInvalidTexture   = UINT32_MAX;
+    static constexpr uint32_t kMaxTextureCount  = 1u << 20;     //!< キーに格納できるテクスチャ数です.
+    static constexpr uint32_t kMaxTileCount     = 1u << 20;     //!< キーに格納できる1辺あたりのタイル数です.
+
+    TextureCache () = default;
+    ~TextureCache();
+    bool Init(const TextureCacheDesc& desc);
+    void Term();
+    uint32_t Register(const TextureSource& source);
+    bool Load(uint32_t textureId, uint32_t mipLevel, uint32_t x, uint32_t y, void* pTexel);
+    float4 SampleLevel(uint32_t textureId, const float2& uv, float lod);
+    void BeginFrame();
+    TextureCacheStats EndFrame();
+
+    uint32_t GetWidth    (uint32_t textureId, uint32_t mipLevel) const;
+    uint32_t GetHeight   (uint32_t textureId, uint32_t mipLevel) const;
+    uint32_t GetMipLevels(uint32_t textureId) const;
+
+private:
+    static constexpr uint64_t kEmptyKey = UINT64_MAX;
+    static constexpr uint64_t kTombKey  = UINT64_MAX - 1;
+    static constexpr uint32_t kCounterStripes = 64;
+
+    struct Entry
+    {
+        std::atomic<uint64_t>   Key;
+        std::atomic<uint32_t>   Slot;
+    };
+
+    struct Slot
+    {
+        std::atomic<uint64_t>   Key;
+        std::atomic<uint32_t>   Generation;     //!< 書き込み中は奇数になります.
+        std::atomic<uint8_t>    Referenced;
+    };
+
+    //! スレッドごとのカウンタです. 共有キャッシュラインへの RMW を避けるためキャッシュライン単位で分けます.
+    struct alignas(64) Counters
+    {
+        std::atomic<uint64_t>   Lookups;
+        std::atomic<uint64_t>   Hits;
+    };
+
+    std::vector<TextureSource>  m_Sources;
+    std::vector<Slot>           m_Slots;
+    std::vector<Entry>          m_Table;
+    uint8_t*                    m_pPool         = nullptr;
+    uint32_t                    m_TexelSize     = 0;
+    uint32_t                    m_TileBytes     = 0;
+    uint32_t                    m_TableMask     = 0;
+    uint32_t                    m_ClockHand     = 0;
+    uint32_t                    m_UsedSlots     = 0;
+    uint32_t                    m_TombCount     = 0;
+    std::mutex                  m_Mutex;
+
+    Counters                    m_Counters[kCounterStripes] = {};
+    std::atomic<uint64_t>       m_TileLoads     = {};
+    std::atomic<uint64_t>       m_Evictions     = {};
+    std::atomic<uint64_t>       m_StallTicks    = {};   // 短いミスも切り捨てないようにカウンタ値で積算します.
+
+    uint32_t Find(uint64_t key) const;
+    uint32_t LoadTile(uint64_t key);
+    uint32_t EvictSlot();
+    void InsertEntry(uint64_t key, uint32_t slot);
+    void RemoveEntry(uint64_t key);
+    void RebuildTable();
+    float4 SampleBilinear(uint32_t textureId, uint32_t mipLevel, const float2& uv);
+
+    TextureCache             (const TextureCache&) = delete;
+    TextureCache& operator = (const TextureCache&) = delete;
+};
+
+} // namespace rtc
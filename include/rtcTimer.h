@@ -76,6 +76,18 @@ public:
     double GetElapsedUsec() const
     { return GetElapsedSec() * 1000.0 * 1000.0; }
 
+    //-------------------------------------------------------------------------
+    //! @brief      経過時間をカウンタ値のまま取得します. 短い区間を丸めずに積算する場合に使います.
+    //-------------------------------------------------------------------------
+    int64_t GetElapsedTicks() const
+    { return m_End.QuadPart - m_Start.QuadPart; }
+
+    //-------------------------------------------------------------------------
+    //! @brief      カウンタ値 1 あたりの秒数を取得します.
+    //-------------------------------------------------------------------------
+    double GetSecPerTick() const
+    { return m_InvTicksPerSec; }
+
 private:
     //=========================================================================
     // private variables.
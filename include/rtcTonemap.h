@@ -0,0 +1,47 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcTonemap.h
+// Desc : HDR to LDR Conversion.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+#pragma once
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMath.h>
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// TonemapDesc structure
+///////////////////////////////////////////////////////////////////////////////
+struct TonemapDesc
+{
+    float       Exposure        = 1.0f;     //!< 露出スケールです.
+    uint32_t    Channels        = 3;        //!< 出力チャンネル数です (3 なら RGB, 4 なら RGBA で A = 255).
+    uint32_t    ThreadCount     = 0;        //!< ワーカースレッド数です(0ならハードウェアスレッド数).
+};
+
+//-----------------------------------------------------------------------------
+//! @brief      ACES フィルミック近似でトーンマップし, sRGB の 8bit に変換します.
+//!
+//! @param[in]      desc        設定です.
+//! @param[in]      pSrc        リニアな HDR 画像です (width * height).
+//! @param[in]      width       横幅です.
+//! @param[in]      height      縦幅です.
+//! @param[out]     pDst        出力先です (width * height * desc.Channels バイト).
+//-----------------------------------------------------------------------------
+void Tonemap(const TonemapDesc& desc, const float3* pSrc, uint32_t width, uint32_t height, uint8_t* pDst);
+
+//-----------------------------------------------------------------------------
+//! @brief      1画素をトーンマップし, 量子化前の sRGB 値 [0, 1] を返します. 画質評価に使います.
+//-----------------------------------------------------------------------------
+float3 TonemapPixel(const float3& color, float exposure);
+
+//-----------------------------------------------------------------------------
+//! @brief      1行分をトーンマップします. 呼び出し側でスレッドを分ける場合に使います.
+//-----------------------------------------------------------------------------
+void TonemapRow(const TonemapDesc& desc, const float3* pSrc, uint32_t width, uint8_t* pDst);
+
+} // namespace rtc
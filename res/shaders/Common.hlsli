@@ -17,6 +17,12 @@
 #define INVALID_ID          (-1)
 #define STANDARD_RAY_INDEX  (0)
 #define SHADOW_RAY_INDEX    (1)
+#define MIN_SURVIVAL_PROBABILITY    (0.05f)
+
+#define OPACITY_STATE_TRANSPARENT   (0)
+#define OPACITY_STATE_OPAQUE        (1)
+#define OPACITY_STATE_UNKNOWN       (2)
+#define OPACITY_UNIFORM_INDEX       (0xFFFFFFFC)
 
 #define RTC_DEBUG   (0)
 #define RTC_RELEASE (1)
@@ -32,6 +38,7 @@ struct Payload
     uint    InstanceId;
     uint    PrimitiveId;
     float2  Barycentrics;
+    float   HitT;           // ヒットまでの距離 (レイコーンの伝搬に使います).
 
     bool HasHit()
     { return InstanceId != INVALID_ID; }
@@ -45,6 +52,15 @@ struct ShadowPayload
     bool    Visible;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// RayCone structure
+///////////////////////////////////////////////////////////////////////////////
+struct RayCone
+{
+    float   Width;          // 円錐の幅.
+    float   SpreadAngle;    // 広がり角.
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Instance structure
 ///////////////////////////////////////////////////////////////////////////////
@@ -92,7 +108,7 @@ uint4 SetSeed(uint2 pixelCoords, uint frameIndex)
 //-----------------------------------------------------------------------------
 //      疑似乱数を取得します.
 //-----------------------------------------------------------------------------
-float Random(uint4 seed)
+float Random(inout uint4 seed)
 {
     seed.w++;
     return ToFloat(PCG(seed).x);
@@ -139,4 +155,95 @@ float ProbabilityToSampleDiffuse(float3 diffuseColor, float3 specularColor)
     return lumDiffuse / (lumDiffuse + lumSpecular);
 }
 
+//-----------------------------------------------------------------------------
+//      ロシアンルーレットの生存確率を求めます.
+//-----------------------------------------------------------------------------
+float CalcSurvivalProbability(float3 throughput, uint bounce, uint minBounce, float threshold)
+{
+    // 最低バウンス数までは必ず継続する.
+    if (bounce < minBounce)
+    { return 1.0f; }
+
+    // 輝度が閾値を下回るパスだけを確率的に打ち切る. rtc::PathTracer と同じ.
+    float q = Luminance(throughput) / max(threshold, 1e-6f);
+    return clamp(q, MIN_SURVIVAL_PROBABILITY, 1.0f);
+}
+
+//-----------------------------------------------------------------------------
+//      重心座標からマイクロ三角形番号を求めます. rtc::OpacityMask と同じ.
+//-----------------------------------------------------------------------------
+uint CalcMicroTriangleIndex(float2 barycentrics, uint level)
+{
+    uint  S  = 1u << level;
+    float fu = saturate(barycentrics.x) * float(S);
+    float fv = saturate(barycentrics.y) * float(S);
+
+    uint j = min(uint(fv), S - 1);
+    uint i = min(uint(fu), S - 1 - j);
+
+    float a = fu - float(i);
+    float b = fv - float(j);
+    bool upper = (a + b > 1.0f) && (i + j < S - 1);
+
+    return j * (2 * S - j) + 2 * i + (upper ? 1 : 0);
+}
+
+//-----------------------------------------------------------------------------
+//      1ピクセルあたりの広がり角を求めます.
+//-----------------------------------------------------------------------------
+float CalcPixelSpreadAngle(float proj11, float screenHeight)
+{
+    // Ray Tracing Gems, Chapter 20. tan(fovY / 2) = 1 / Proj._22.
+    return atan(2.0f / (proj11 * screenHeight));
+}
+
+//-----------------------------------------------------------------------------
+//      ヒット位置まで円錐を伝搬させます.
+//-----------------------------------------------------------------------------
+RayCone PropagateRayCone(RayCone cone, float surfaceSpreadAngle, float hitT)
+{
+    RayCone result;
+    result.Width       = cone.SpreadAngle * hitT + cone.Width;
+    result.SpreadAngle = cone.SpreadAngle + surfaceSpreadAngle;
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      頂点法線から三角形の曲率を推定します.
+//-----------------------------------------------------------------------------
+float EstimateCurvature(float3 p[3], float3 n[3])
+{
+    // Ray Tracing Gems II, Chapter 7.
+    float result = 0.0f;
+
+    [unroll]
+    for(uint i=0; i<3; ++i)
+    {
+        uint   j  = (i + 1) % 3;
+        float3 dp = p[i] - p[j];
+        float  len2 = dot(dp, dp);
+        result += (len2 > 0.0f) ? dot(n[i] - n[j], dp) / len2 : 0.0f;
+    }
+
+    return result / 3.0f;
+}
+
+//-----------------------------------------------------------------------------
+//      曲率による広がり角の増分を求めます.
+//-----------------------------------------------------------------------------
+float CalcSurfaceSpreadAngle(float curvature, float coneWidth, float cosTheta)
+{ return 2.0f * curvature * abs(coneWidth) / max(abs(cosTheta), 1e-4f); }
+
+//-----------------------------------------------------------------------------
+//      円錐のフットプリントからテクスチャLODを求めます.
+//-----------------------------------------------------------------------------
+float CalcTextureLod(RayCone cone, float lodConstant, float cosTheta, float2 textureSize)
+{
+    float lod = lodConstant;
+    lod += 0.5f * log2(textureSize.x * textureSize.y);
+    lod += log2(max(abs(cone.Width), 1e-8f));
+    lod -= log2(max(abs(cosTheta), 1e-4f));
+    return max(lod, 0.0f);
+}
+
 #endif//COMMON_HLSLI
@@ -14,6 +14,11 @@
 #define RTC_TARGET  (RTC_DEBUG)
 #endif//RTC_TARGET
 
+// 任意ヒットの統計を集計します. リリースでも有効で, 0 を定義すると外せます.
+#ifndef RTC_ANYHIT_STATS
+#define RTC_ANYHIT_STATS    (1)
+#endif//RTC_ANYHIT_STATS
+
 #define OFFSET_P    (0)     // 位置座標オフセット.
 #define OFFSET_N    (12)    // 法線オフセット.
 #define OFFSET_T    (24)    // 接線オフセット.
@@ -24,14 +29,18 @@
 #define STRIDE_INDEX        (sizeof(uint3))
 #define STRIDE_INSTANCE     (sizeof(Instance))
 
+#define RTC_PI      (3.14159265358979323f)  // π.
+#define RTC_1DIVPI  (0.31830988618379067f)  // 1 / π.
+#define ALBEDO      (0.8f)                  // マテリアル未対応の間に使う反射率.
+
 //-----------------------------------------------------------------------------
 // Resources
 //-----------------------------------------------------------------------------
 ConstantBuffer<SceneParameters> SceneParam : register(b0);
 RayTracingAS                    SceneAS    : register(t0);
-//ByteAddressBuffer               Instances  : register(t1);
-//ByteAddressBuffer               Transforms : register(t2);
-//Texture2D                       BackGround : register(t3);
+ByteAddressBuffer               Instances  : register(t5);
+ByteAddressBuffer               Transforms : register(t6);
+Texture2D                       BackGround : register(t3);
 RWTexture2D<float4>             Radiance   : register(u0);
 
 #if RTC_TARGET == RTC_DEBUG
@@ -41,11 +50,16 @@ RWByteAddressBuffer         RayPoints  : register(u2);
 
 ByteAddressBuffer   Vertices : register(t1);
 ByteAddressBuffer   Indices  : register(t2);
+ByteAddressBuffer   OpacityMasks : register(t4);   // rtc::OpacityMask::Pack() で作成.
+
+#if RTC_ANYHIT_STATS
+RWByteAddressBuffer AnyHitCounters : register(u3);  // (呼び出し数, 省略数, テクスチャ参照数). rtc::AnyHitStats::FromCounters() で読み替え.
+#endif//RTC_ANYHIT_STATS
 
 //-----------------------------------------------------------------------------
 // Forward Declarations.
 //-----------------------------------------------------------------------------
-float3 PathTracing (RayDesc ray);
+float3 PathTracing (RayDesc ray, RayCone cone, inout uint4 seed);
 float3 DebugTracing(RayDesc ray, bool debugRay);
 
 
@@ -59,16 +73,51 @@ struct SurfaceHit
     float3  Tangent;        // 接線ベクトル.
     float2  TexCoord;       // テクスチャ座標.
     float3  GeometryNormal; // ジオメトリ法線.
+    float   Curvature;      // 推定曲率.
+    float   LodConstant;    // テクスチャLOD定数.
 };
 
-#if 0
+//-----------------------------------------------------------------------------
+//      オパシティマスクの状態を取得します.
+//-----------------------------------------------------------------------------
+uint GetOpacityState(uint instanceId, uint primitiveId, float2 barycentrics)
+{
+    // uint4(記述子の先頭, マスクの先頭, 分割レベル, 三角形数).
+    uint4 header = OpacityMasks.Load4(instanceId * 16);
+    if (primitiveId >= header.w)
+    { return OPACITY_STATE_UNKNOWN; }
+
+    uint desc = OpacityMasks.Load((header.x + primitiveId) * 4);
+    if (desc >= OPACITY_UNIFORM_INDEX)
+    { return desc - OPACITY_UNIFORM_INDEX; }
+
+    uint entry = desc + CalcMicroTriangleIndex(barycentrics, header.z);
+    uint bits  = OpacityMasks.Load((header.y + entry / 16) * 4);
+    return (bits >> ((entry % 16) * 2)) & 0x3;
+}
+
+//-----------------------------------------------------------------------------
+//      アルファテストを行います.
+//-----------------------------------------------------------------------------
+bool AlphaTest(uint instanceId, uint primitiveId, float2 barycentrics)
+{
+    // マテリアルのアルファテクスチャはまだバインドされていないので不透明として扱う.
+    return true;
+}
+
 //-----------------------------------------------------------------------------
 //      IBLをサンプルします.
 //-----------------------------------------------------------------------------
-float3 SampleIBL(float3 dir)
+float3 SampleIBL(float3 dir, float spreadAngle)
 {
+    float2 size;
+    BackGround.GetDimensions(size.x, size.y);
+
+    // 縦方向で π ラジアンをカバーするので 1テクセル = π / height ラジアン.
+    float lod = max(log2(max(spreadAngle * size.y * RTC_1DIVPI, 1e-8f)), 0.0f);
+
     float2 uv = ToSphereMapCoord(dir);
-    return BackGround.SampleLevel(LinearWrap, uv, 0.0f).rgb;
+    return BackGround.SampleLevel(LinearWrap, uv, lod).rgb;
 }
 
 //-----------------------------------------------------------------------------
@@ -100,6 +149,8 @@ SurfaceHit GetSurfaceHit(uint instanceId, uint triangleIndex, float2 barycentric
     ByteAddressBuffer vertices = ResourceDescriptorHeap[id.x];
 
     float3 pos[3];
+    float3 nrm[3];
+    float2 tex[3];
 
     float4   row0  = asfloat(Transforms.Load4(instanceId * STRIDE_TRANSFORM));
     float4   row1  = asfloat(Transforms.Load4(instanceId * STRIDE_TRANSFORM + 16));
@@ -114,10 +165,13 @@ SurfaceHit GetSurfaceHit(uint instanceId, uint triangleIndex, float2 barycentric
         float3 p = asfloat(vertices.Load3(address));
         pos[i] = mul(world, float4(p, 1.0f)).xyz;
 
-        surfaceHit.Position += p[i] * factor[i];
+        surfaceHit.Position += pos[i] * factor[i];
+        nrm[i] = normalize(mul((float3x3)world, asfloat(vertices.Load3(address + OFFSET_N))));
+        tex[i] = asfloat(vertices.Load2(address + OFFSET_U));
+
         surfaceHit.Normal   += asfloat(vertices.Load3(address + OFFSET_N)) * factor[i];
         surfaceHit.Tangent  += asfloat(vertices.Load3(address + OFFSET_T)) * factor[i];
-        surfaceHit.TexCoord += asfloat(vertices.Load2(address + OFFSET_U)) * factor[i];
+        surfaceHit.TexCoord += tex[i] * factor[i];
     }
 
     surfaceHit.Normal  = normalize(mul((float3x3)world, normalize(surfaceHit.Normal)));
@@ -127,9 +181,30 @@ SurfaceHit GetSurfaceHit(uint instanceId, uint triangleIndex, float2 barycentric
     float3 e1 = pos[2] - pos[0];
     surfaceHit.GeometryNormal = normalize(cross(e0, e1));
 
+    // レイコーン用の曲率とLOD定数.
+    float2 t0 = tex[1] - tex[0];
+    float2 t1 = tex[2] - tex[0];
+    float worldArea = length(cross(e0, e1));
+    float uvArea    = abs(t0.x * t1.y - t0.y * t1.x);
+    surfaceHit.Curvature   = EstimateCurvature(pos, nrm);
+    surfaceHit.LodConstant = (worldArea > 0.0f && uvArea > 0.0f) ? 0.5f * log2(uvArea / worldArea) : 0.0f;
+
     return surfaceHit;
 }
-#endif
+
+//-----------------------------------------------------------------------------
+//      コサイン重点で半球方向をサンプルします.
+//-----------------------------------------------------------------------------
+float3 SampleCosineHemisphere(float3 normal, float2 u)
+{
+    float r   = sqrt(u.x);
+    float phi = 2.0f * RTC_PI * u.y;
+
+    float3 T = normalize((abs(normal.z) < 0.999f) ? cross(float3(0.0f, 0.0f, 1.0f), normal) : cross(float3(1.0f, 0.0f, 0.0f), normal));
+    float3 B = cross(normal, T);
+
+    return normalize(T * (r * cos(phi)) + B * (r * sin(phi)) + normal * sqrt(max(1.0f - u.x, 0.0f)));
+}
 
 //-----------------------------------------------------------------------------
 //      スクリーン上へのレイを求めます.
@@ -207,16 +282,21 @@ void OnGenerateRay()
 {
     const uint2 rayId = DispatchRaysIndex().xy;
 
-    // 乱数初期化.
+    // 乱数初期化. パストレーシングも同じ系列を続けて使う.
     uint4 seed = SetSeed(rayId, SceneParam.FrameIndex);
     float2 offset = float2(Random(seed), Random(seed));
 
     // レイを設定.
     RayDesc ray = GeneratePinholeCameraRay(offset);
 
+    // 一次レイの円錐. 幅はカメラ位置で 0 から始まる.
+    RayCone cone;
+    cone.Width       = 0.0f;
+    cone.SpreadAngle = CalcPixelSpreadAngle(SceneParam.Proj._22, SceneParam.ScreenSize.y);
+
     // パストレ.
     #if RTC_TARGET == RTC_RELEASE
-        float3 radiance = PathTracing(ray);
+        float3 radiance = PathTracing(ray, cone, seed);
     #else
         const bool debugRay = all(rayId == uint2(SceneParam.DebugRayIndex));
         float3 radiance = DebugTracing(ray, debugRay);
@@ -239,6 +319,7 @@ void OnClosestHit(inout Payload payload, in HitArgs args)
     payload.InstanceId   = InstanceID();
     payload.PrimitiveId  = PrimitiveIndex();
     payload.Barycentrics = args.barycentrics;
+    payload.HitT         = RayTCurrent();
 }
 
 //-----------------------------------------------------------------------------
@@ -257,6 +338,20 @@ void OnMiss(inout Payload payload)
 [shader("anyhit")]
 void OnShadowAnyHit(inout ShadowPayload payload, in HitArgs args)
 {
+    // マスクで確定する場合はテクスチャを参照しない.
+    uint state = GetOpacityState(InstanceID(), PrimitiveIndex(), args.barycentrics);
+
+#if RTC_ANYHIT_STATS
+    AnyHitCounters.InterlockedAdd(0, 1);
+    AnyHitCounters.InterlockedAdd((state == OPACITY_STATE_UNKNOWN) ? 8 : 4, 1);
+#endif//RTC_ANYHIT_STATS
+
+    if (state == OPACITY_STATE_TRANSPARENT)
+    { IgnoreHit(); }
+
+    if (state == OPACITY_STATE_UNKNOWN && !AlphaTest(InstanceID(), PrimitiveIndex(), args.barycentrics))
+    { IgnoreHit(); }
+
     payload.Visible = true;
     AcceptHitAndEndSearch();
 }
@@ -273,13 +368,57 @@ void OnShadowMiss(inout ShadowPayload payload)
 //-----------------------------------------------------------------------------
 //      パストレーシング処理.
 //-----------------------------------------------------------------------------
-float3 PathTracing(RayDesc ray)
+float3 PathTracing(RayDesc ray, RayCone cone, inout uint4 seed)
 {
     Payload payload = (Payload)0;
 
     float3 W  = 1.0f.xxx;
     float3 Lo = 0.0f.xxx;
 
+    for(uint bounce=0; bounce<SceneParam.MaxIteration; ++bounce)
+    {
+        TraceRay(SceneAS, RAY_FLAG_NONE, 0xFF, STANDARD_RAY_INDEX, 0, STANDARD_RAY_INDEX, ray, payload);
+
+        if (!payload.HasHit())
+        {
+            // 円錐の広がり角に見合ったミップで環境光を参照する.
+            Lo += W * SampleIBL(ray.Direction, cone.SpreadAngle);
+            break;
+        }
+
+        SurfaceHit hit = GetSurfaceHit(payload.InstanceId, payload.PrimitiveId, payload.Barycentrics);
+
+        // 裏面から当たった場合は法線を反転.
+        float3 N  = hit.Normal;
+        float3 Ng = hit.GeometryNormal;
+        if (dot(Ng, ray.Direction) > 0.0f)
+        {
+            N  = -N;
+            Ng = -Ng;
+        }
+
+        // 円錐をヒット位置まで伝搬し, 曲率による広がりを加える.
+        float cosTheta = dot(-ray.Direction, Ng);
+        float width    = cone.Width + cone.SpreadAngle * payload.HitT;
+        cone = PropagateRayCone(cone, CalcSurfaceSpreadAngle(hit.Curvature, width, cosTheta), payload.HitT);
+
+        // マテリアルはまだバインドされていないので, 一様な拡散面として扱う.
+        // コサイン重点サンプリングなので BRDF * cos / pdf は反射率になる.
+        float2 u = float2(Random(seed), Random(seed));
+        W *= ALBEDO;
+
+        // ロシアンルーレット. 閾値はホスト側で rtc::PathTracer::OptimizeRoulette() により選んだ値.
+        float q = CalcSurvivalProbability(W, bounce + 1, SceneParam.MinBounce, SceneParam.RouletteThreshold);
+        if (Random(seed) >= q)
+        { break; }
+        W /= q;
+
+        ray.Origin    = OffsetRay(hit.Position, Ng);
+        ray.Direction = SampleCosineHemisphere(N, u);
+        ray.TMin      = 0.0f;
+        ray.TMax      = FLT_MAX;
+    }
+
     return SaturateFloat(Lo);
 }
 
@@ -33,7 +33,8 @@ struct SceneParameters
     uint    AccumulatedFrames;  // アキュームレーション済みフレーム数.
 
     int2    DebugRayIndex;      // デバッグレイ番号.
-    int2    Reserved0;
+    uint    MinBounce;          // ロシアンルーレットを開始するバウンス数.
+    float   RouletteThreshold;  // 生存確率が 1 となるスループット輝度.
 };
 
 #endif//SCENE_PARAMETERS_HLSLI
@@ -1,5 +1,5 @@
 ﻿#include <rtcApp.h>
-#include <mimalloc-new-delete.h>
+#include <rtcNewDelete.h>
 
 int main(int argc, char** argv)
 {
@@ -8,6 +8,7 @@ int main(int argc, char** argv)
     config.Height     = 1080;
     config.AnimFPS    = 60.0;
     config.RenderTime = 255.9;
+    config.MetricsPath = "metrics.csv";
 
     rtc::App().Run(config);
 
@@ -0,0 +1,433 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcAnimation.cpp
+// Desc : Keyframe Animation.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcAnimation.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <atomic>
+#include <thread>
+#include <xmmintrin.h>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t kLaneCount   = 4;    // SSE のレーン数.
+constexpr uint32_t kFrameChunk  = 16;   // スレッドが一度に評価するフレーム数.
+
+// Eberly, "A Fast and Accurate Algorithm for Computing SLERP" の係数 (最大誤差 約 4e-7).
+constexpr float kSlerpOnePlusMu = 1.90110745351730037f;
+constexpr float kSlerpU[8] = {
+    1.0f /  3.0f, 1.0f / 10.0f, 1.0f / 21.0f, 1.0f / 36.0f,
+    1.0f / 55.0f, 1.0f / 78.0f, 1.0f / 105.0f, kSlerpOnePlusMu / 136.0f };
+constexpr float kSlerpV[8] = {
+    1.0f /  3.0f, 2.0f /  5.0f, 3.0f /  7.0f, 4.0f /  9.0f,
+    5.0f / 11.0f, 6.0f / 13.0f, 7.0f / 15.0f, kSlerpOnePlusMu * 8.0f / 17.0f };
+
+//-----------------------------------------------------------------------------
+//      4トラック分の球面線形補間の係数を求めます. x = cos(θ) >= 0.
+//-----------------------------------------------------------------------------
+inline void CalcSlerpWeights(__m128 x, __m128 t, __m128& w0, __m128& w1)
+{
+    auto one = _mm_set1_ps(1.0f);
+    auto xm1 = _mm_sub_ps(x, one);
+    auto d   = _mm_sub_ps(one, t);
+    auto t2  = _mm_mul_ps(t, t);
+    auto d2  = _mm_mul_ps(d, d);
+
+    auto accT = one;
+    auto accD = one;
+    for(auto i=7; i>=0; --i)
+    {
+        auto u  = _mm_set1_ps(kSlerpU[i]);
+        auto v  = _mm_set1_ps(kSlerpV[i]);
+        auto bT = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(u, t2), v), xm1);
+        auto bD = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(u, d2), v), xm1);
+        accT = _mm_add_ps(one, _mm_mul_ps(bT, accT));
+        accD = _mm_add_ps(one, _mm_mul_ps(bD, accD));
+    }
+
+    w0 = _mm_mul_ps(d, accD);
+    w1 = _mm_mul_ps(t, accT);
+}
+
+//-----------------------------------------------------------------------------
+//      球面線形補間を行います.
+//-----------------------------------------------------------------------------
+rtc::float4 Slerp(const rtc::float4& q0, rtc::float4 q1, float t)
+{
+    auto cosTheta = rtc::Dot(q0, q1);
+    if (cosTheta < 0.0f)
+    {
+        q1       = q1 * -1.0f;
+        cosTheta = -cosTheta;
+    }
+
+    if (cosTheta > 0.9995f)
+    {
+        auto q = rtc::Lerp(q0, q1, t);
+        return q * (1.0f / sqrtf(rtc::Dot(q, q)));
+    }
+
+    auto theta    = acosf(cosTheta);
+    auto invSin   = 1.0f / sinf(theta);
+    return q0 * (sinf((1.0f - t) * theta) * invSin) + q1 * (sinf(t * theta) * invSin);
+}
+
+//-----------------------------------------------------------------------------
+//      カメラからワールドへの回転と位置からカメラ行列を求めます.
+//-----------------------------------------------------------------------------
+void CalcCameraMatrix(const rtc::float4& q, const rtc::float3& p, rtc::float4x4& view, rtc::float4x4& invView)
+{
+    auto xx = q.x * q.x; auto yy = q.y * q.y; auto zz = q.z * q.z;
+    auto xy = q.x * q.y; auto xz = q.x * q.z; auto yz = q.y * q.z;
+    auto wx = q.w * q.x; auto wy = q.w * q.y; auto wz = q.w * q.z;
+
+    rtc::float3 r0(1.0f - 2.0f * (yy + zz), 2.0f * (xy - wz), 2.0f * (xz + wy));
+    rtc::float3 r1(2.0f * (xy + wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz - wx));
+    rtc::float3 r2(2.0f * (xz - wy), 2.0f * (yz + wx), 1.0f - 2.0f * (xx + yy));
+
+    invView = rtc::float4x4(
+        rtc::float4(r0, p.x),
+        rtc::float4(r1, p.y),
+        rtc::float4(r2, p.z),
+        rtc::float4(0.0f, 0.0f, 0.0f, 1.0f));
+
+    // 回転部は転置, 平行移動は -R^T p.
+    rtc::float3 c0(r0.x, r1.x, r2.x);
+    rtc::float3 c1(r0.y, r1.y, r2.y);
+    rtc::float3 c2(r0.z, r1.z, r2.z);
+    view = rtc::float4x4(
+        rtc::float4(c0, -rtc::Dot(c0, p)),
+        rtc::float4(c1, -rtc::Dot(c1, p)),
+        rtc::float4(c2, -rtc::Dot(c2, p)),
+        rtc::float4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// AnimationTable class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      全フレームを評価します.
+//-----------------------------------------------------------------------------
+bool AnimationTable::Build
+(
+    const AnimationDesc&    desc,
+    const TransformTrack*   pTracks,
+    uint32_t                trackCount,
+    const CameraTrack*      pCamera
+)
+{
+    Clear();
+
+    if (desc.FPS <= 0.0 || desc.Duration < 0.0 || (trackCount > 0 && pTracks == nullptr))
+    { return false; }
+
+    Timer timer;
+    timer.Start();
+
+    m_Desc       = desc;
+    m_FrameCount = uint32_t(floor(desc.Duration * desc.FPS)) + 1;
+    m_TrackCount = trackCount;
+
+    // SIMD で読みやすいように 16 byte 単位に詰め直す. キーが無いトラックは単位行列のキーを1つ置く.
+    m_KeyOffsets.resize(trackCount + 1);
+    for(auto i=0u; i<trackCount; ++i)
+    {
+        m_KeyOffsets[i] = uint32_t(m_Keys.size());
+
+        auto& track = pTracks[i];
+        if (track.pKeys == nullptr || track.KeyCount == 0)
+        {
+            m_Keys.push_back({ float4(0.0f, 0.0f, 0.0f, 1.0f), float4(0.0f), float4(1.0f, 1.0f, 1.0f, 0.0f) });
+            continue;
+        }
+
+        for(auto j=0u; j<track.KeyCount; ++j)
+        {
+            auto& key = track.pKeys[j];
+            m_Keys.push_back({ key.Rotation, float4(key.Translation, key.Time), float4(key.Scale, 0.0f) });
+        }
+    }
+    m_KeyOffsets[trackCount] = uint32_t(m_Keys.size());
+
+    m_Transforms.resize(size_t(m_FrameCount) * trackCount);
+
+    if (pCamera != nullptr && pCamera->pKeys != nullptr && pCamera->KeyCount > 0)
+    {
+        m_Cameras.resize(m_FrameCount);
+
+        auto cursor = 0u;
+        for(auto f=0u; f<m_FrameCount; ++f)
+        {
+            auto time = float(f / desc.FPS);
+            while (cursor + 1 < pCamera->KeyCount && pCamera->pKeys[cursor + 1].Time <= time)
+            { cursor++; }
+
+            auto& k0 = pCamera->pKeys[cursor];
+            auto& k1 = pCamera->pKeys[std::min(cursor + 1, pCamera->KeyCount - 1)];
+            auto  dt = k1.Time - k0.Time;
+            auto  t  = (dt > 0.0f) ? Saturate((time - k0.Time) / dt) : 0.0f;
+
+            auto& frame = m_Cameras[f];
+            frame.Position = Lerp(k0.Position, k1.Position, t);
+            frame.FovY     = Lerp(k0.FovY, k1.FovY, t);
+            CalcCameraMatrix(Slerp(k0.Rotation, k1.Rotation, t), frame.Position, frame.View, frame.InvView);
+        }
+    }
+
+    if (trackCount > 0)
+    {
+        auto chunkCount  = (m_FrameCount + kFrameChunk - 1) / kFrameChunk;
+        auto threadCount = (desc.ThreadCount > 0) ? desc.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+        threadCount = std::min(threadCount, chunkCount);
+
+        std::atomic<uint32_t> nextChunk = {};
+        auto worker = [&]()
+        {
+            std::vector<uint32_t> cursors(trackCount);
+            for(;;)
+            {
+                auto chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+                if (chunk >= chunkCount)
+                { break; }
+
+                auto begin = chunk * kFrameChunk;
+                auto end   = std::min(begin + kFrameChunk, m_FrameCount);
+                EvaluateFrames(begin, end, cursors.data());
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(threadCount - 1);
+        for(auto i=1u; i<threadCount; ++i)
+        { threads.emplace_back(worker); }
+
+        worker();
+
+        for(auto& thread : threads)
+        { thread.join(); }
+    }
+
+    timer.End();
+
+    m_Stats.FrameCount  = m_FrameCount;
+    m_Stats.TrackCount  = m_TrackCount;
+    m_Stats.MemoryBytes = m_Transforms.size() * sizeof(float3x4) + m_Cameras.size() * sizeof(CameraFrame);
+    m_Stats.ElapsedMsec = timer.GetElapsedMsec();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      [beginFrame, endFrame) のトランスフォームを4トラックずつ評価します.
+//-----------------------------------------------------------------------------
+void AnimationTable::EvaluateFrames(uint32_t beginFrame, uint32_t endFrame, uint32_t* pCursors)
+{
+    // チャンク先頭の時刻でキーを二分探索し, 以降は単調に進める.
+    auto beginTime = float(beginFrame / m_Desc.FPS);
+    for(auto i=0u; i<m_TrackCount; ++i)
+    {
+        auto lo = m_KeyOffsets[i];
+        auto hi = m_KeyOffsets[i + 1];
+        auto itr = std::upper_bound(m_Keys.begin() + lo, m_Keys.begin() + hi, beginTime,
+            [](float value, const PackedKey& key) { return value < key.Translation.w; });
+        pCursors[i] = uint32_t(std::max(itr - (m_Keys.begin() + lo), ptrdiff_t(1)) - 1);
+    }
+
+    const auto signMask = _mm_set1_ps(-0.0f);
+    const auto one      = _mm_set1_ps(1.0f);
+
+    for(auto f=beginFrame; f<endFrame; ++f)
+    {
+        auto time = float(f / m_Desc.FPS);
+        auto pDst = m_Transforms.data() + size_t(f) * m_TrackCount;
+
+        for(auto base=0u; base<m_TrackCount; base += kLaneCount)
+        {
+            const PackedKey* k0[kLaneCount];
+            const PackedKey* k1[kLaneCount];
+            alignas(16) float weights[kLaneCount];
+
+            for(auto lane=0u; lane<kLaneCount; ++lane)
+            {
+                // 端数のレーンは最後のトラックを重複して評価し, 結果は捨てる.
+                auto track  = std::min(base + lane, m_TrackCount - 1);
+                auto offset = m_KeyOffsets[track];
+                auto count  = m_KeyOffsets[track + 1] - offset;
+
+                auto& cursor = pCursors[track];
+                while (cursor + 1 < count && m_Keys[offset + cursor + 1].Translation.w <= time)
+                { cursor++; }
+
+                k0[lane] = &m_Keys[offset + cursor];
+                k1[lane] = &m_Keys[offset + std::min(cursor + 1, count - 1)];
+
+                auto t0 = k0[lane]->Translation.w;
+                auto dt = k1[lane]->Translation.w - t0;
+                weights[lane] = (dt > 0.0f) ? Saturate((time - t0) / dt) : 0.0f;
+            }
+
+            auto t = _mm_load_ps(weights);
+
+            // AoS -> SoA.
+            auto qx0 = _mm_loadu_ps(&k0[0]->Rotation.x);
+            auto qy0 = _mm_loadu_ps(&k0[1]->Rotation.x);
+            auto qz0 = _mm_loadu_ps(&k0[2]->Rotation.x);
+            auto qw0 = _mm_loadu_ps(&k0[3]->Rotation.x);
+            _MM_TRANSPOSE4_PS(qx0, qy0, qz0, qw0);
+
+            auto qx1 = _mm_loadu_ps(&k1[0]->Rotation.x);
+            auto qy1 = _mm_loadu_ps(&k1[1]->Rotation.x);
+            auto qz1 = _mm_loadu_ps(&k1[2]->Rotation.x);
+            auto qw1 = _mm_loadu_ps(&k1[3]->Rotation.x);
+            _MM_TRANSPOSE4_PS(qx1, qy1, qz1, qw1);
+
+            auto tx0 = _mm_loadu_ps(&k0[0]->Translation.x);
+            auto ty0 = _mm_loadu_ps(&k0[1]->Translation.x);
+            auto tz0 = _mm_loadu_ps(&k0[2]->Translation.x);
+            auto tw0 = _mm_loadu_ps(&k0[3]->Translation.x);
+            _MM_TRANSPOSE4_PS(tx0, ty0, tz0, tw0);
+
+            auto tx1 = _mm_loadu_ps(&k1[0]->Translation.x);
+            auto ty1 = _mm_loadu_ps(&k1[1]->Translation.x);
+            auto tz1 = _mm_loadu_ps(&k1[2]->Translation.x);
+            auto tw1 = _mm_loadu_ps(&k1[3]->Translation.x);
+            _MM_TRANSPOSE4_PS(tx1, ty1, tz1, tw1);
+
+            auto sx0 = _mm_loadu_ps(&k0[0]->Scale.x);
+            auto sy0 = _mm_loadu_ps(&k0[1]->Scale.x);
+            auto sz0 = _mm_loadu_ps(&k0[2]->Scale.x);
+            auto sw0 = _mm_loadu_ps(&k0[3]->Scale.x);
+            _MM_TRANSPOSE4_PS(sx0, sy0, sz0, sw0);
+
+            auto sx1 = _mm_loadu_ps(&k1[0]->Scale.x);
+            auto sy1 = _mm_loadu_ps(&k1[1]->Scale.x);
+            auto sz1 = _mm_loadu_ps(&k1[2]->Scale.x);
+            auto sw1 = _mm_loadu_ps(&k1[3]->Scale.x);
+            _MM_TRANSPOSE4_PS(sx1, sy1, sz1, sw1);
+
+            // 最短経路になるように q1 の符号を合わせる.
+            auto cosTheta = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(qx0, qx1), _mm_mul_ps(qy0, qy1)),
+                _mm_add_ps(_mm_mul_ps(qz0, qz1), _mm_mul_ps(qw0, qw1)));
+            auto sign = _mm_and_ps(cosTheta, signMask);
+            cosTheta = _mm_xor_ps(cosTheta, sign);
+            qx1 = _mm_xor_ps(qx1, sign);
+            qy1 = _mm_xor_ps(qy1, sign);
+            qz1 = _mm_xor_ps(qz1, sign);
+            qw1 = _mm_xor_ps(qw1, sign);
+            cosTheta = _mm_min_ps(cosTheta, one);
+
+            __m128 w0, w1;
+            CalcSlerpWeights(cosTheta, t, w0, w1);
+
+            auto qx = _mm_add_ps(_mm_mul_ps(qx0, w0), _mm_mul_ps(qx1, w1));
+            auto qy = _mm_add_ps(_mm_mul_ps(qy0, w0), _mm_mul_ps(qy1, w1));
+            auto qz = _mm_add_ps(_mm_mul_ps(qz0, w0), _mm_mul_ps(qz1, w1));
+            auto qw = _mm_add_ps(_mm_mul_ps(qw0, w0), _mm_mul_ps(qw1, w1));
+
+            auto tx = _mm_add_ps(tx0, _mm_mul_ps(_mm_sub_ps(tx1, tx0), t));
+            auto ty = _mm_add_ps(ty0, _mm_mul_ps(_mm_sub_ps(ty1, ty0), t));
+            auto tz = _mm_add_ps(tz0, _mm_mul_ps(_mm_sub_ps(tz1, tz0), t));
+
+            auto sx = _mm_add_ps(sx0, _mm_mul_ps(_mm_sub_ps(sx1, sx0), t));
+            auto sy = _mm_add_ps(sy0, _mm_mul_ps(_mm_sub_ps(sy1, sy0), t));
+            auto sz = _mm_add_ps(sz0, _mm_mul_ps(_mm_sub_ps(sz1, sz0), t));
+
+            // s = 2 / |q|^2 とすれば正規化せずに回転行列を作れる.
+            auto len2 = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)),
+                _mm_add_ps(_mm_mul_ps(qz, qz), _mm_mul_ps(qw, qw)));
+            auto s = _mm_div_ps(_mm_set1_ps(2.0f), _mm_max_ps(len2, _mm_set1_ps(FLT_MIN)));
+
+            auto xs = _mm_mul_ps(qx, s);
+            auto ys = _mm_mul_ps(qy, s);
+            auto zs = _mm_mul_ps(qz, s);
+            auto xx = _mm_mul_ps(qx, xs);
+            auto yy = _mm_mul_ps(qy, ys);
+            auto zz = _mm_mul_ps(qz, zs);
+            auto xy = _mm_mul_ps(qx, ys);
+            auto xz = _mm_mul_ps(qx, zs);
+            auto yz = _mm_mul_ps(qy, zs);
+            auto wx = _mm_mul_ps(qw, xs);
+            auto wy = _mm_mul_ps(qw, ys);
+            auto wz = _mm_mul_ps(qw, zs);
+
+            auto m00 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+            auto m01 = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+            auto m02 = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+            auto m10 = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+            auto m11 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+            auto m12 = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+            auto m20 = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+            auto m21 = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+            auto m22 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+
+            // SoA -> AoS. 行ごとに4トラック分を転置する.
+            auto r0 = m00; auto r1 = m01; auto r2 = m02; auto r3 = tx;
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            auto u0 = m10; auto u1 = m11; auto u2 = m12; auto u3 = ty;
+            _MM_TRANSPOSE4_PS(u0, u1, u2, u3);
+            auto v0 = m20; auto v1 = m21; auto v2 = m22; auto v3 = tz;
+            _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+
+            const __m128 rows[3][kLaneCount] = {
+                { r0, r1, r2, r3 },
+                { u0, u1, u2, u3 },
+                { v0, v1, v2, v3 },
+            };
+
+            auto laneCount = std::min(kLaneCount, m_TrackCount - base);
+            for(auto lane=0u; lane<laneCount; ++lane)
+            {
+                auto& dst = pDst[base + lane];
+                _mm_storeu_ps(&dst.row[0].x, rows[0][lane]);
+                _mm_storeu_ps(&dst.row[1].x, rows[1][lane]);
+                _mm_storeu_ps(&dst.row[2].x, rows[2][lane]);
+            }
+
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      破棄処理を行います.
+//-----------------------------------------------------------------------------
+void AnimationTable::Clear()
+{
+    m_Keys      .clear();
+    m_KeyOffsets.clear();
+    m_Transforms.clear();
+    m_Cameras   .clear();
+    m_FrameCount = 0;
+    m_TrackCount = 0;
+    m_Stats = AnimationStats();
+}
+
+//-----------------------------------------------------------------------------
+//      フレーム番号を求めます.
+//-----------------------------------------------------------------------------
+uint32_t AnimationTable::CalcFrameIndex(double time) const
+{
+    if (m_FrameCount == 0 || time <= 0.0)
+    { return 0; }
+
+    auto index = uint32_t(floor(time * m_Desc.FPS + 0.5));
+    return std::min(index, m_FrameCount - 1);
+}
+
+} // namespace rtc
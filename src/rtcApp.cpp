@@ -10,6 +10,18 @@
 #include <cstdio>
 #include <rtcApp.h>
 #include <rtcLog.h>
+#include <rtcMemoryTracker.h>
+#include <rtcFrameArena.h>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr double kMemoryPrintInterval = 1.0;    // メモリ使用量を出力する間隔(sec).
+
+} // namespace
 
 
 namespace rtc {
@@ -23,6 +35,9 @@ namespace rtc {
 //-----------------------------------------------------------------------------
 void App::Run(const Config& config)
 {
+    // ログの書き出しスレッドを開始.
+    Logger::Init();
+
     // タイマー開始.
     m_Timer.Start();
 
@@ -38,6 +53,9 @@ void App::Run(const Config& config)
 
     // 終了処理.
     Term();
+
+    // 残りのログを書き出して終了.
+    Logger::Term();
 }
 
 //-----------------------------------------------------------------------------
@@ -54,6 +72,15 @@ bool App::Init()
         }
     }
 
+    {
+        FrameMetricsDesc desc;
+        desc.Path   = m_Config.MetricsPath;
+        desc.Format = FrameMetricsRecorder::GetFormatFromPath(m_Config.MetricsPath);
+        // 統計が取れなくても描画は続ける.
+        if (!m_Metrics.Init(desc))
+        { RTC_ELOG("Error : FrameMetricsRecorder::Init() Failed. Continue without metrics."); }
+    }
+
     if (!OnLoad())
     {
         RTC_ELOG("Error : OnLoad() Failed.");
@@ -71,6 +98,11 @@ void App::Term()
     OnUnload();
 
     Device::Term();
+
+    m_Metrics.Term();
+    m_Metrics.GetSummary().Print();
+
+    MemoryTracker::PrintSummary();
 }
 
 //-----------------------------------------------------------------------------
@@ -90,8 +122,31 @@ void App::MainLoop()
         if (sec >= m_Config.RenderTime)
         { return; }
 
-        // 描画処理.
-        OnRender();
+        m_Metrics.BeginFrame();
+
+        // 描画処理. フレーム内の一時メモリはスレッドごとのフレームアリーナから取る.
+        {
+            FrameArena::ThreadFrame threadFrame;
+            OnRender();
+        }
+
+        // 任意ヒットの統計はフレームごとに取り出してリセットする.
+        auto anyHit = m_AnyHitStats;
+        m_AnyHitStats = AnyHitStats();
+
+        // メモリ使用量を集計. 毎フレーム出力すると描画より重くなるので間隔を空ける.
+        auto& memory = MemoryTracker::EndFrame();
+        if (sec >= m_NextMemoryPrint)
+        {
+            memory.Print();
+            if (anyHit.Invocations > 0)
+            { anyHit.Print("frame"); }
+            m_NextMemoryPrint = sec + kMemoryPrintInterval;
+        }
+
+        m_Metrics.EndFrame(memory);
+
+        FrameArena::AdvanceFrame();
     }
 }
 
@@ -116,6 +171,8 @@ void App::OnUnload()
 //-----------------------------------------------------------------------------
 void App::OnRender()
 {
+    // 描画を実装したら m_Metrics の AddSamples(), AddRays(), AddOutputBytes(), StageScope で計測値を記録する.
+    // シャドウレイの後で AnyHitCounters を読み戻し, AnyHitStats::FromCounters() で m_AnyHitStats に加算してゼロクリアする.
 }
 
 } // namespace rtc
@@ -0,0 +1,1198 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcBvh.cpp
+// Desc : Bounding Volume Hierarchy.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcBvh.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t kMaxBinCount     = 64;       // SAH の最大ビン数.
+constexpr uint32_t kStackSize       = 128;      // 二分木の走査スタックの初期サイズ. 足りない場合はヒープに拡張します.
+constexpr uint32_t kStackSize8      = 8 * 32;   // 8分木の走査スタックの初期サイズ. 足りない場合はヒープに拡張します.
+constexpr uint8_t  kMetaInner       = 0x80;     // 節を表すメタデータのビット.
+constexpr uint32_t kMaxLeafSize8    = 3;        // 8分木の葉に格納できる最大三角形数.
+constexpr size_t   kMinParallelRefs = 4096;     // 並列構築のタスクに分ける最小の参照数.
+
+///////////////////////////////////////////////////////////////////////////////
+// Bin structure
+///////////////////////////////////////////////////////////////////////////////
+struct Bin
+{
+    rtc::Bounds3    Bounds;
+    uint32_t        Count = 0;
+};
+
+//-----------------------------------------------------------------------------
+//      ビン番号を求めます.
+//-----------------------------------------------------------------------------
+inline uint32_t CalcBinIndex(float value, float minValue, float scale, uint32_t binCount)
+{
+    auto index = int((value - minValue) * scale);
+    return uint32_t(std::min(std::max(index, 0), int(binCount) - 1));
+}
+
+//-----------------------------------------------------------------------------
+//      量子化の指数を求めます. extent を 255 ステップ以内で覆う最小の 2 の冪.
+//-----------------------------------------------------------------------------
+inline int CalcExponent(float extent)
+{
+    if (!(extent > 0.0f))
+    { return -126; }
+
+    int e = 0;
+    frexpf(extent / 255.0f, &e);
+    e = std::max(e, -126);
+    while (ldexpf(255.0f, e - 1) >= extent && e > -126)
+    { e--; }
+    while (ldexpf(255.0f, e) < extent)
+    { e++; }
+    return std::min(e, 127);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BuildRef structure
+///////////////////////////////////////////////////////////////////////////////
+struct BuildRef
+{
+    rtc::Bounds3    Bounds;         // 分割でクリップされた範囲.
+    uint32_t        PrimitiveId;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Split structure
+///////////////////////////////////////////////////////////////////////////////
+struct Split
+{
+    float           Cost        = FLT_MAX;
+    int             Axis        = -1;
+    uint32_t        Bin         = 0;
+    float           Position    = 0.0f;     // 空間分割の分割面.
+    bool            Spatial     = false;
+    rtc::Bounds3    Left;
+    rtc::Bounds3    Right;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PendingTask structure
+///////////////////////////////////////////////////////////////////////////////
+struct PendingTask
+{
+    uint32_t                NodeIndex;
+    std::vector<BuildRef>   Refs;
+};
+
+//-----------------------------------------------------------------------------
+//      2つのボックスの共通部分を求めます.
+//-----------------------------------------------------------------------------
+inline rtc::Bounds3 Intersection(const rtc::Bounds3& a, const rtc::Bounds3& b)
+{
+    rtc::Bounds3 result;
+    result.Min = rtc::Max(a.Min, b.Min);
+    result.Max = rtc::Min(a.Max, b.Max);
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Builder class
+///////////////////////////////////////////////////////////////////////////////
+class Builder
+{
+public:
+    Builder(const rtc::BvhBuildDesc& desc, float rootArea)
+    : m_Desc       (desc)
+    , m_MaxLeafSize(std::max(desc.MaxLeafSize, 1u))
+    , m_BinCount   (std::min(std::max(desc.BinCount, 2u), kMaxBinCount))
+    , m_MinOverlap (desc.SpatialSplitAlpha * rootArea)
+    {
+        auto budget = desc.EnableSpatialSplits ? double(desc.TriangleCount) * double(desc.SpatialSplitBudget) : 0.0;
+        m_Budget.store(int64_t(budget));
+    }
+
+    uint32_t GetMaxLeafSize  () const { return m_MaxLeafSize; }
+    uint32_t GetSpatialSplits() const { return m_SpatialSplits.load(); }
+
+    void SplitNode(std::vector<BuildRef>& refs, const rtc::Bounds3& bounds, std::vector<BuildRef>& left, std::vector<BuildRef>& right);
+    void BuildSubtree(std::vector<BuildRef>& refs, std::vector<rtc::BvhNode>& nodes, std::vector<uint32_t>& references);
+
+private:
+    const rtc::BvhBuildDesc&    m_Desc;
+    uint32_t                    m_MaxLeafSize;
+    uint32_t                    m_BinCount;
+    float                       m_MinOverlap;
+    std::atomic<int64_t>        m_Budget        = {};
+    std::atomic<uint32_t>       m_SpatialSplits = {};
+
+    Split        FindObjectSplit (const std::vector<BuildRef>& refs, const rtc::Bounds3& centerBounds) const;
+    Split        FindSpatialSplit(const std::vector<BuildRef>& refs, const rtc::Bounds3& bounds) const;
+    rtc::Bounds3 ClipReference   (const BuildRef& ref, int axis, float lo, float hi) const;
+};
+
+//-----------------------------------------------------------------------------
+//      三角形を軸に垂直な2平面で挟まれた領域にクリップした範囲を求めます.
+//-----------------------------------------------------------------------------
+rtc::Bounds3 Builder::ClipReference(const BuildRef& ref, int axis, float lo, float hi) const
+{
+    rtc::float3 v[3];
+    for(auto i=0; i<3; ++i)
+    { v[i] = m_Desc.pPositions[m_Desc.pIndices[ref.PrimitiveId * 3 + i]]; }
+
+    rtc::Bounds3 result;
+    for(auto i=0; i<3; ++i)
+    {
+        auto& p0 = v[i];
+        auto& p1 = v[(i + 1) % 3];
+        auto  d0 = p0[axis];
+        auto  d1 = p1[axis];
+
+        if (lo <= d0 && d0 <= hi)
+        { result.Merge(p0); }
+
+        // 辺と分割面の交点.
+        if ((d0 < lo && lo < d1) || (d1 < lo && lo < d0))
+        {
+            auto t = (lo - d0) / (d1 - d0);
+            auto p = p0 + (p1 - p0) * t;
+            p[axis] = lo;
+            result.Merge(p);
+        }
+        if ((d0 < hi && hi < d1) || (d1 < hi && hi < d0))
+        {
+            auto t = (hi - d0) / (d1 - d0);
+            auto p = p0 + (p1 - p0) * t;
+            p[axis] = hi;
+            result.Merge(p);
+        }
+    }
+
+    return Intersection(result, ref.Bounds);
+}
+
+//-----------------------------------------------------------------------------
+//      ビン分割による SAH で最良のオブジェクト分割を探します.
+//-----------------------------------------------------------------------------
+Split Builder::FindObjectSplit(const std::vector<BuildRef>& refs, const rtc::Bounds3& centerBounds) const
+{
+    Split result;
+    auto count = uint32_t(refs.size());
+
+    for(auto a=0; a<3; ++a)
+    {
+        auto minValue = centerBounds.Min[a];
+        auto extent   = centerBounds.Max[a] - minValue;
+        if (!(extent > 0.0f))
+        { continue; }
+
+        auto scale = float(m_BinCount) / extent;
+
+        Bin bins[kMaxBinCount];
+        for(auto i=0u; i<count; ++i)
+        {
+            auto& b = bins[CalcBinIndex(refs[i].Bounds.Center()[a], minValue, scale, m_BinCount)];
+            b.Bounds.Merge(refs[i].Bounds);
+            b.Count++;
+        }
+
+        // 右側からの累積.
+        rtc::Bounds3 rightBounds[kMaxBinCount];
+        uint32_t     rightCount [kMaxBinCount];
+        rtc::Bounds3 acc;
+        uint32_t     accCount = 0;
+        for(auto i=m_BinCount - 1; i>0; --i)
+        {
+            acc.Merge(bins[i].Bounds);
+            accCount += bins[i].Count;
+            rightBounds[i] = acc;
+            rightCount [i] = accCount;
+        }
+
+        acc = rtc::Bounds3();
+        accCount = 0;
+        for(auto i=0u; i<m_BinCount - 1; ++i)
+        {
+            acc.Merge(bins[i].Bounds);
+            accCount += bins[i].Count;
+            if (accCount == 0 || rightCount[i + 1] == 0)
+            { continue; }
+
+            auto c = acc.SurfaceArea() * float(accCount) + rightBounds[i + 1].SurfaceArea() * float(rightCount[i + 1]);
+            if (c < result.Cost)
+            {
+                result.Cost  = c;
+                result.Axis  = a;
+                result.Bin   = i;
+                result.Left  = acc;
+                result.Right = rightBounds[i + 1];
+            }
+        }
+    }
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      三角形をクリップしながらビンに分配し, 最良の空間分割を探します.
+//-----------------------------------------------------------------------------
+Split Builder::FindSpatialSplit(const std::vector<BuildRef>& refs, const rtc::Bounds3& bounds) const
+{
+    Split result;
+    result.Spatial = true;
+
+    for(auto a=0; a<3; ++a)
+    {
+        auto minValue = bounds.Min[a];
+        auto extent   = bounds.Max[a] - minValue;
+        if (!(extent > 0.0f))
+        { continue; }
+
+        auto width = extent / float(m_BinCount);
+        auto scale = float(m_BinCount) / extent;
+
+        rtc::Bounds3 binBounds[kMaxBinCount];
+        uint32_t     entry    [kMaxBinCount] = {};
+        uint32_t     exit     [kMaxBinCount] = {};
+
+        for(auto& ref : refs)
+        {
+            auto first = CalcBinIndex(ref.Bounds.Min[a], minValue, scale, m_BinCount);
+            auto last  = CalcBinIndex(ref.Bounds.Max[a], minValue, scale, m_BinCount);
+            entry[first]++;
+            exit [last ]++;
+
+            if (first == last)
+            {
+                binBounds[first].Merge(ref.Bounds);
+                continue;
+            }
+
+            for(auto i=first; i<=last; ++i)
+            {
+                auto lo = minValue + width * float(i);
+                auto hi = (i == m_BinCount - 1) ? bounds.Max[a] : lo + width;
+                binBounds[i].Merge(ClipReference(ref, a, lo, hi));
+            }
+        }
+
+        rtc::Bounds3 rightBounds[kMaxBinCount];
+        uint32_t     rightCount [kMaxBinCount];
+        rtc::Bounds3 acc;
+        uint32_t     accCount = 0;
+        for(auto i=m_BinCount - 1; i>0; --i)
+        {
+            acc.Merge(binBounds[i]);
+            accCount += exit[i];
+            rightBounds[i] = acc;
+            rightCount [i] = accCount;
+        }
+
+        acc = rtc::Bounds3();
+        accCount = 0;
+        for(auto i=0u; i<m_BinCount - 1; ++i)
+        {
+            acc.Merge(binBounds[i]);
+            accCount += entry[i];
+            if (accCount == 0 || rightCount[i + 1] == 0)
+            { continue; }
+
+            auto c = acc.SurfaceArea() * float(accCount) + rightBounds[i + 1].SurfaceArea() * float(rightCount[i + 1]);
+            if (c < result.Cost)
+            {
+                result.Cost     = c;
+                result.Axis     = a;
+                result.Bin      = i;
+                result.Position = minValue + width * float(i + 1);
+                result.Left     = acc;
+                result.Right    = rightBounds[i + 1];
+            }
+        }
+    }
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      ノードを分割します.
+//-----------------------------------------------------------------------------
+void Builder::SplitNode
+(
+    std::vector<BuildRef>&  refs,
+    const rtc::Bounds3&     bounds,
+    std::vector<BuildRef>&  left,
+    std::vector<BuildRef>&  right
+)
+{
+    rtc::Bounds3 centerBounds;
+    for(auto& ref : refs)
+    { centerBounds.Merge(ref.Bounds.Center()); }
+
+    auto split = FindObjectSplit(refs, centerBounds);
+
+    // 子の重なりが大きい場合だけ空間分割を試す (Stich et al. 2009).
+    if (m_Desc.EnableSpatialSplits && split.Axis >= 0 && m_Budget.load(std::memory_order_relaxed) > 0)
+    {
+        auto overlap = Intersection(split.Left, split.Right);
+        if (overlap.IsValid() && overlap.SurfaceArea() > m_MinOverlap)
+        {
+            auto spatial = FindSpatialSplit(refs, bounds);
+            if (spatial.Axis >= 0 && spatial.Cost < split.Cost)
+            { split = spatial; }
+        }
+    }
+
+    left .clear();
+    right.clear();
+
+    if (split.Axis >= 0 && !split.Spatial)
+    {
+        auto minValue = centerBounds.Min[split.Axis];
+        auto scale    = float(m_BinCount) / (centerBounds.Max[split.Axis] - minValue);
+        for(auto& ref : refs)
+        {
+            if (CalcBinIndex(ref.Bounds.Center()[split.Axis], minValue, scale, m_BinCount) <= split.Bin)
+            { left.push_back(ref); }
+            else
+            { right.push_back(ref); }
+        }
+    }
+    else if (split.Axis >= 0)
+    {
+        auto a   = split.Axis;
+        auto pos = split.Position;
+
+        // 分割面に完全に含まれる参照の数を先に数える.
+        float leftCount  = 0.0f;
+        float rightCount = 0.0f;
+        rtc::Bounds3 leftBounds;
+        rtc::Bounds3 rightBounds;
+        for(auto& ref : refs)
+        {
+            if (ref.Bounds.Max[a] <= pos)
+            {
+                leftCount += 1.0f;
+                leftBounds.Merge(ref.Bounds);
+            }
+            else if (ref.Bounds.Min[a] >= pos)
+            {
+                rightCount += 1.0f;
+                rightBounds.Merge(ref.Bounds);
+            }
+        }
+
+        for(auto& ref : refs)
+        {
+            if (ref.Bounds.Max[a] <= pos)
+            {
+                left.push_back(ref);
+                continue;
+            }
+            if (ref.Bounds.Min[a] >= pos)
+            {
+                right.push_back(ref);
+                continue;
+            }
+
+            auto l = ref;
+            auto r = ref;
+            l.Bounds = ClipReference(ref, a, ref.Bounds.Min[a], pos);
+            r.Bounds = ClipReference(ref, a, pos, ref.Bounds.Max[a]);
+
+            // 参照の分割を取りやめた方が安い場合は片側に寄せる (Reference Unsplitting).
+            auto ml = rtc::Merge(leftBounds,  ref.Bounds);
+            auto mr = rtc::Merge(rightBounds, ref.Bounds);
+            auto costSplit = rtc::Merge(leftBounds, l.Bounds).SurfaceArea() * (leftCount + 1.0f)
+                           + rtc::Merge(rightBounds, r.Bounds).SurfaceArea() * (rightCount + 1.0f);
+            auto costLeft  = ml.SurfaceArea() * (leftCount + 1.0f) + rightBounds.SurfaceArea() * rightCount;
+            auto costRight = leftBounds.SurfaceArea() * leftCount  + mr.SurfaceArea() * (rightCount + 1.0f);
+
+            auto duplicate = costSplit < std::min(costLeft, costRight)
+                          && l.Bounds.IsValid() && r.Bounds.IsValid()
+                          && m_Budget.fetch_sub(1, std::memory_order_relaxed) > 0;
+
+            if (duplicate)
+            {
+                left .push_back(l);
+                right.push_back(r);
+                leftBounds .Merge(l.Bounds);
+                rightBounds.Merge(r.Bounds);
+                leftCount  += 1.0f;
+                rightCount += 1.0f;
+            }
+            else if (costLeft <= costRight)
+            {
+                left.push_back(ref);
+                leftBounds.Merge(ref.Bounds);
+                leftCount += 1.0f;
+            }
+            else
+            {
+                right.push_back(ref);
+                rightBounds.Merge(ref.Bounds);
+                rightCount += 1.0f;
+            }
+        }
+
+        m_SpatialSplits.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 分割できない場合は中央で分ける.
+    if (left.empty() || right.empty())
+    {
+        left .clear();
+        right.clear();
+
+        auto axis = centerBounds.IsValid() ? centerBounds.MaxExtent() : 0;
+        auto mid  = refs.size() / 2;
+        std::nth_element(refs.begin(), refs.begin() + mid, refs.end(), [&](const BuildRef& lhs, const BuildRef& rhs)
+        { return lhs.Bounds.Center()[axis] < rhs.Bounds.Center()[axis]; });
+
+        left .assign(refs.begin(), refs.begin() + mid);
+        right.assign(refs.begin() + mid, refs.end());
+    }
+
+    refs.clear();
+    refs.shrink_to_fit();
+}
+
+//-----------------------------------------------------------------------------
+//      部分木を構築します. nodes[0] が部分木の根になります.
+//-----------------------------------------------------------------------------
+void Builder::BuildSubtree(std::vector<BuildRef>& refs, std::vector<rtc::BvhNode>& nodes, std::vector<uint32_t>& references)
+{
+    nodes.clear();
+    nodes.push_back(rtc::BvhNode());
+
+    std::vector<PendingTask> stack;
+    stack.push_back({ 0, std::move(refs) });
+
+    while(!stack.empty())
+    {
+        auto task = std::move(stack.back());
+        stack.pop_back();
+
+        rtc::Bounds3 bounds;
+        for(auto& ref : task.Refs)
+        { bounds.Merge(ref.Bounds); }
+        nodes[task.NodeIndex].Bounds = bounds;
+
+        if (task.Refs.size() <= m_MaxLeafSize)
+        {
+            auto& node = nodes[task.NodeIndex];
+            node.Index = uint32_t(references.size());
+            node.Count = uint32_t(task.Refs.size());
+            for(auto& ref : task.Refs)
+            { references.push_back(ref.PrimitiveId); }
+            continue;
+        }
+
+        PendingTask left;
+        PendingTask right;
+        SplitNode(task.Refs, bounds, left.Refs, right.Refs);
+
+        auto child = uint32_t(nodes.size());
+        nodes.push_back(rtc::BvhNode());
+        nodes.push_back(rtc::BvhNode());
+
+        nodes[task.NodeIndex].Index = child;
+        nodes[task.NodeIndex].Count = 0;
+
+        left .NodeIndex = child + 0;
+        right.NodeIndex = child + 1;
+        stack.push_back(std::move(right));
+        stack.push_back(std::move(left));
+    }
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// Bvh class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      構築処理を行います.
+//-----------------------------------------------------------------------------
+bool Bvh::Build(const BvhBuildDesc& desc)
+{
+    Clear();
+
+    if (desc.pPositions == nullptr || desc.pIndices == nullptr || desc.TriangleCount == 0)
+    { return false; }
+
+    Timer timer;
+    timer.Start();
+
+    m_pPositions    = desc.pPositions;
+    m_pIndices      = desc.pIndices;
+    m_TriangleCount = desc.TriangleCount;
+
+    PendingTask root;
+    root.NodeIndex = 0;
+    root.Refs.resize(desc.TriangleCount);
+
+    Bounds3 rootBounds;
+    for(auto i=0u; i<desc.TriangleCount; ++i)
+    {
+        auto& ref = root.Refs[i];
+        for(auto j=0; j<3; ++j)
+        { ref.Bounds.Merge(desc.pPositions[desc.pIndices[i * 3 + j]]); }
+        ref.PrimitiveId = i;
+        rootBounds.Merge(ref.Bounds);
+    }
+
+    Builder builder(desc, rootBounds.SurfaceArea());
+
+    auto threadCount = (desc.ThreadCount > 0) ? desc.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+
+    m_Nodes.reserve(size_t(desc.TriangleCount) * 2);
+    m_References.reserve(desc.TriangleCount);
+    m_Nodes.push_back(BvhNode());
+
+    // 上位の階層は逐次的に分割して, 独立した部分木のタスクを作る.
+    std::vector<PendingTask> tasks;
+    tasks.push_back(std::move(root));
+    for(;;)
+    {
+        size_t largest = 0;
+        for(size_t i=1; i<tasks.size(); ++i)
+        {
+            if (tasks[i].Refs.size() > tasks[largest].Refs.size())
+            { largest = i; }
+        }
+
+        if (tasks.size() >= threadCount * 4 || tasks[largest].Refs.size() < kMinParallelRefs)
+        { break; }
+
+        auto task = std::move(tasks[largest]);
+        tasks.erase(tasks.begin() + largest);
+
+        Bounds3 bounds;
+        for(auto& ref : task.Refs)
+        { bounds.Merge(ref.Bounds); }
+        m_Nodes[task.NodeIndex].Bounds = bounds;
+
+        PendingTask left;
+        PendingTask right;
+        builder.SplitNode(task.Refs, bounds, left.Refs, right.Refs);
+
+        auto child = uint32_t(m_Nodes.size());
+        m_Nodes.push_back(BvhNode());
+        m_Nodes.push_back(BvhNode());
+        m_Nodes[task.NodeIndex].Index = child;
+        m_Nodes[task.NodeIndex].Count = 0;
+
+        left .NodeIndex = child + 0;
+        right.NodeIndex = child + 1;
+        tasks.push_back(std::move(left));
+        tasks.push_back(std::move(right));
+    }
+
+    // 部分木を並列に構築する.
+    auto taskCount = uint32_t(tasks.size());
+    std::vector<std::vector<BvhNode>>  subNodes(taskCount);
+    std::vector<std::vector<uint32_t>> subRefs (taskCount);
+    {
+        std::atomic<uint32_t> nextTask = {};
+        auto worker = [&]()
+        {
+            for(;;)
+            {
+                auto index = nextTask.fetch_add(1, std::memory_order_relaxed);
+                if (index >= taskCount)
+                { break; }
+
+                builder.BuildSubtree(tasks[index].Refs, subNodes[index], subRefs[index]);
+            }
+        };
+
+        auto workerCount = std::min(threadCount, taskCount);
+        std::vector<std::thread> threads;
+        threads.reserve(workerCount - 1);
+        for(auto i=1u; i<workerCount; ++i)
+        { threads.emplace_back(worker); }
+
+        worker();
+
+        for(auto& thread : threads)
+        { thread.join(); }
+    }
+
+    // 部分木を連結する. 部分木の根はタスクのノードに置き, 残りは末尾に追加する.
+    for(auto i=0u; i<taskCount; ++i)
+    {
+        auto& nodes   = subNodes[i];
+        auto nodeBase = uint32_t(m_Nodes.size());
+        auto refBase  = uint32_t(m_References.size());
+
+        auto remap = [&](uint32_t local)
+        { return (local == 0) ? tasks[i].NodeIndex : nodeBase + local - 1; };
+
+        for(size_t j=0; j<nodes.size(); ++j)
+        {
+            auto node = nodes[j];
+            node.Index = node.IsLeaf() ? node.Index + refBase : remap(node.Index);
+            if (j == 0)
+            { m_Nodes[tasks[i].NodeIndex] = node; }
+            else
+            { m_Nodes.push_back(node); }
+        }
+
+        m_References.insert(m_References.end(), subRefs[i].begin(), subRefs[i].end());
+
+        nodes.clear();
+        nodes.shrink_to_fit();
+    }
+
+    timer.End();
+
+    m_pNodes         = m_Nodes.data();
+    m_NodeCount      = uint32_t(m_Nodes.size());
+    m_pReferences    = m_References.data();
+    m_ReferenceCount = uint32_t(m_References.size());
+    m_Memory.Set(m_Nodes.capacity() * sizeof(BvhNode) + m_References.capacity() * sizeof(uint32_t));
+
+    m_Stats.NodeCount       = m_NodeCount;
+    m_Stats.ReferenceCount  = m_ReferenceCount;
+    m_Stats.DuplicatedRefs  = m_Stats.ReferenceCount - desc.TriangleCount;
+    m_Stats.SpatialSplits   = builder.GetSpatialSplits();
+    m_Stats.LeafCount       = 0;
+    for(auto& node : m_Nodes)
+    {
+        if (node.IsLeaf())
+        { m_Stats.LeafCount++; }
+    }
+
+    // ノードと参照に加えて, 走査時に参照する頂点インデックスと頂点座標を含める.
+    m_Stats.MemoryBytes = m_Nodes.size() * sizeof(BvhNode)
+                        + m_References.size() * sizeof(uint32_t)
+                        + size_t(desc.TriangleCount) * 3 * sizeof(uint32_t)
+                        + size_t(desc.VertexCount) * sizeof(float3);
+    m_Stats.BytesPerTriangle = float(double(m_Stats.MemoryBytes) / double(desc.TriangleCount));
+    m_Stats.SahCost          = CalcSahCost(desc);
+    m_Stats.BuildMsec        = timer.GetElapsedMsec();
+
+    RTC_DLOG("Bvh : triangles = %u, nodes = %u, duplicated = %u (%u spatial splits), %.2f bytes/triangle, SAH = %.2f, %.3lf msec",
+        desc.TriangleCount,
+        m_Stats.NodeCount,
+        m_Stats.DuplicatedRefs,
+        m_Stats.SpatialSplits,
+        m_Stats.BytesPerTriangle,
+        m_Stats.SahCost,
+        m_Stats.BuildMsec);
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      SAH コストを求めます.
+//-----------------------------------------------------------------------------
+float Bvh::CalcSahCost(const BvhBuildDesc& desc) const
+{
+    auto rootArea = m_pNodes[0].Bounds.SurfaceArea();
+    if (!(rootArea > 0.0f))
+    { return 0.0f; }
+
+    double cost = 0.0;
+    for(auto i=0u; i<m_NodeCount; ++i)
+    {
+        auto& node = m_pNodes[i];
+        auto area = double(node.Bounds.SurfaceArea());
+        cost += area * (node.IsLeaf() ? double(node.Count) : double(desc.TraversalCost));
+    }
+
+    return float(cost / rootArea);
+}
+
+//-----------------------------------------------------------------------------
+//      構築済みのデータを参照します. メモリは Clear() まで保持してください.
+//-----------------------------------------------------------------------------
+bool Bvh::Attach
+(
+    const BvhBuildDesc& desc,
+    const BvhNode*      pNodes,
+    uint32_t            nodeCount,
+    const uint32_t*     pReferences,
+    uint32_t            referenceCount,
+    const BvhStats&     stats
+)
+{
+    Clear();
+
+    if (pNodes == nullptr || nodeCount == 0 || pReferences == nullptr || referenceCount == 0)
+    { return false; }
+
+    m_pNodes         = pNodes;
+    m_NodeCount      = nodeCount;
+    m_pReferences    = pReferences;
+    m_ReferenceCount = referenceCount;
+    m_pPositions     = desc.pPositions;
+    m_pIndices       = desc.pIndices;
+    m_TriangleCount  = desc.TriangleCount;
+    m_Stats          = stats;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      破棄処理を行います.
+//-----------------------------------------------------------------------------
+void Bvh::Clear()
+{
+    std::vector<BvhNode> ().swap(m_Nodes);
+    std::vector<uint32_t>().swap(m_References);
+    m_Memory.Set(0);
+    m_pNodes         = nullptr;
+    m_NodeCount      = 0;
+    m_pReferences    = nullptr;
+    m_ReferenceCount = 0;
+    m_pPositions    = nullptr;
+    m_pIndices      = nullptr;
+    m_TriangleCount = 0;
+    m_Stats         = BvhStats();
+}
+
+//-----------------------------------------------------------------------------
+//      最近接交差を求めます.
+//-----------------------------------------------------------------------------
+bool Bvh::Intersect(const BvhRay& ray, BvhHit& hit) const
+{
+    if (m_NodeCount == 0)
+    { return false; }
+
+    auto invDir = CalcInvDir(ray.Direction);
+    auto tmax   = std::min(ray.TMax, hit.T);
+
+    TraversalStack<uint32_t, kStackSize> stack;
+
+    float tnear;
+    if (!IntersectBox(m_pNodes[0].Bounds.Min, m_pNodes[0].Bounds.Max, ray.Origin, invDir, ray.TMin, tmax, tnear))
+    { return false; }
+
+    auto found = false;
+    auto index = 0u;
+    for(;;)
+    {
+        auto& node = m_pNodes[index];
+        if (node.IsLeaf())
+        {
+            for(auto i=0u; i<node.Count; ++i)
+            {
+                auto primId = m_pReferences[node.Index + i];
+                auto& p0 = m_pPositions[m_pIndices[primId * 3 + 0]];
+                auto& p1 = m_pPositions[m_pIndices[primId * 3 + 1]];
+                auto& p2 = m_pPositions[m_pIndices[primId * 3 + 2]];
+
+                float t, u, v;
+                if (IntersectTriangle(ray, p0, p1 - p0, p2 - p0, tmax, t, u, v))
+                {
+                    tmax             = t;
+                    hit.T            = t;
+                    hit.PrimitiveId  = primId;
+                    hit.Barycentrics = float2(u, v);
+                    found            = true;
+                }
+            }
+        }
+        else
+        {
+            auto& left  = m_pNodes[node.Index + 0];
+            auto& right = m_pNodes[node.Index + 1];
+
+            float t0, t1;
+            auto hit0 = IntersectBox(left .Bounds.Min, left .Bounds.Max, ray.Origin, invDir, ray.TMin, tmax, t0);
+            auto hit1 = IntersectBox(right.Bounds.Min, right.Bounds.Max, ray.Origin, invDir, ray.TMin, tmax, t1);
+
+            if (hit0 && hit1)
+            {
+                // 近い方から辿る.
+                auto nearIndex = (t0 <= t1) ? node.Index : node.Index + 1;
+                auto farIndex  = (t0 <= t1) ? node.Index + 1 : node.Index;
+                stack.Push(farIndex);
+                index = nearIndex;
+                continue;
+            }
+            else if (hit0)
+            {
+                index = node.Index;
+                continue;
+            }
+            else if (hit1)
+            {
+                index = node.Index + 1;
+                continue;
+            }
+        }
+
+        // スタックから取り出して, 既に遠いノードは飛ばす.
+        auto next = false;
+        while(!stack.IsEmpty())
+        {
+            index = stack.Pop();
+            auto& b = m_pNodes[index].Bounds;
+            if (IntersectBox(b.Min, b.Max, ray.Origin, invDir, ray.TMin, tmax, tnear))
+            {
+                next = true;
+                break;
+            }
+        }
+
+        if (!next)
+        { break; }
+    }
+
+    return found;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Bvh8 class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      二分木を8分木に変換します.
+//-----------------------------------------------------------------------------
+bool Bvh8::Build(const Bvh& bvh)
+{
+    Clear();
+
+    auto srcNodes  = bvh.GetNodes();
+    auto nodeCount = bvh.GetNodeCount();
+    if (nodeCount == 0)
+    { return false; }
+
+    for(auto i=0u; i<nodeCount; ++i)
+    {
+        auto& node = srcNodes[i];
+        if (node.IsLeaf() && node.Count > kMaxLeafSize8)
+        {
+            RTC_ELOG("Error : Bvh8 requires MaxLeafSize <= %u.", kMaxLeafSize8);
+            return false;
+        }
+    }
+
+    Timer timer;
+    timer.Start();
+
+    m_Nodes    .reserve(nodeCount / 4 + 1);
+    m_Triangles.reserve(bvh.GetReferenceCount());
+
+    m_Nodes.push_back(Bvh8Node());
+    Collapse(bvh, 0, 0);
+
+    timer.End();
+
+    uint32_t leafCount = 0;
+    for(auto& node : m_Nodes)
+    {
+        for(auto i=0; i<8; ++i)
+        {
+            if (node.Meta[i] != 0 && (node.Meta[i] & kMetaInner) == 0)
+            { leafCount++; }
+        }
+    }
+
+    m_pNodes        = m_Nodes.data();
+    m_NodeCount     = uint32_t(m_Nodes.size());
+    m_pTriangles    = m_Triangles.data();
+    m_TriangleCount = uint32_t(m_Triangles.size());
+    m_Memory.Set(m_Nodes.capacity() * sizeof(Bvh8Node) + m_Triangles.capacity() * sizeof(Bvh8Triangle));
+
+    m_Stats.NodeCount        = m_NodeCount;
+    m_Stats.LeafCount        = leafCount;
+    m_Stats.ReferenceCount   = uint32_t(m_Triangles.size());
+    m_Stats.MemoryBytes      = m_Nodes.size() * sizeof(Bvh8Node) + m_Triangles.size() * sizeof(Bvh8Triangle);
+    m_Stats.BytesPerTriangle = float(double(m_Stats.MemoryBytes) / double(std::max(bvh.GetTriangleCount(), 1u)));
+    m_Stats.SahCost          = bvh.GetStats().SahCost;
+    m_Stats.BuildMsec        = timer.GetElapsedMsec();
+
+    RTC_DLOG("Bvh8 : nodes = %u, %.2f bytes/triangle (binary %.2f), %.3lf msec",
+        m_Stats.NodeCount,
+        m_Stats.BytesPerTriangle,
+        bvh.GetStats().BytesPerTriangle,
+        m_Stats.BuildMsec);
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      二分木のノードを最大8個の子を持つノードにまとめます.
+//-----------------------------------------------------------------------------
+void Bvh8::Collapse(const Bvh& bvh, uint32_t srcIndex, uint32_t dstIndex)
+{
+    auto  srcNodes = bvh.GetNodes();
+    auto  refs     = bvh.GetReferences();
+    auto& src      = srcNodes[srcIndex];
+
+    // 表面積の大きい節から順に開いて子を最大8個集める.
+    uint32_t children[8];
+    uint32_t childCount = 0;
+    if (src.IsLeaf())
+    {
+        children[childCount++] = srcIndex;
+    }
+    else
+    {
+        children[childCount++] = src.Index + 0;
+        children[childCount++] = src.Index + 1;
+    }
+
+    while(childCount < 8)
+    {
+        auto best     = UINT32_MAX;
+        auto bestArea = -1.0f;
+        for(auto i=0u; i<childCount; ++i)
+        {
+            auto& node = srcNodes[children[i]];
+            if (node.IsLeaf())
+            { continue; }
+
+            auto area = node.Bounds.SurfaceArea();
+            if (area > bestArea)
+            {
+                bestArea = area;
+                best     = i;
+            }
+        }
+
+        if (best == UINT32_MAX)
+        { break; }
+
+        auto index = children[best];
+        children[best]         = srcNodes[index].Index + 0;
+        children[childCount++] = srcNodes[index].Index + 1;
+    }
+
+    // 量子化フレームを決める.
+    Bounds3 bounds;
+    for(auto i=0u; i<childCount; ++i)
+    { bounds.Merge(srcNodes[children[i]].Bounds); }
+
+    Bvh8Node node = {};
+    node.Origin = bounds.Min;
+
+    float scale[3];
+    for(auto a=0; a<3; ++a)
+    {
+        auto e = CalcExponent(bounds.Max[a] - bounds.Min[a]);
+
+        // 丸め誤差で最大値を覆えない場合は指数を上げる.
+        while(e < 127 && node.Origin[a] + ldexpf(255.0f, e) < bounds.Max[a])
+        { e++; }
+
+        node.Exponent[a] = int8_t(e);
+        scale[a] = ldexpf(1.0f, e);
+    }
+
+    uint8_t* qmin[3] = { node.QMinX, node.QMinY, node.QMinZ };
+    uint8_t* qmax[3] = { node.QMaxX, node.QMaxY, node.QMaxZ };
+
+    uint32_t innerCount    = 0;
+    uint32_t triangleCount = 0;
+    uint32_t innerChildren[8];
+
+    node.ChildBaseIndex    = uint32_t(m_Nodes.size());
+    node.TriangleBaseIndex = uint32_t(m_Triangles.size());
+
+    for(auto i=0u; i<childCount; ++i)
+    {
+        auto& child = srcNodes[children[i]];
+
+        // 保守的に量子化する. 復号と同じ式で確認して覆えていなければ広げる.
+        for(auto a=0; a<3; ++a)
+        {
+            auto lo = int(floorf((child.Bounds.Min[a] - node.Origin[a]) / scale[a]));
+            auto hi = int(ceilf ((child.Bounds.Max[a] - node.Origin[a]) / scale[a]));
+            lo = std::min(std::max(lo, 0), 255);
+            hi = std::min(std::max(hi, 0), 255);
+
+            while(lo > 0 && node.Origin[a] + float(lo) * scale[a] > child.Bounds.Min[a])
+            { lo--; }
+            while(hi < 255 && node.Origin[a] + float(hi) * scale[a] < child.Bounds.Max[a])
+            { hi++; }
+
+            qmin[a][i] = uint8_t(lo);
+            qmax[a][i] = uint8_t(hi);
+        }
+
+        if (child.IsLeaf())
+        {
+            node.Meta[i] = uint8_t((child.Count << 5) | triangleCount);
+            for(auto j=0u; j<child.Count; ++j)
+            {
+                auto primId = refs[child.Index + j];
+                auto pIndices   = bvh.GetIndices();
+                auto pPositions = bvh.GetPositions();
+                auto& p0 = pPositions[pIndices[primId * 3 + 0]];
+                auto& p1 = pPositions[pIndices[primId * 3 + 1]];
+                auto& p2 = pPositions[pIndices[primId * 3 + 2]];
+
+                Bvh8Triangle tri;
+                tri.V0          = p0;
+                tri.E1          = p1 - p0;
+                tri.E2          = p2 - p0;
+                tri.PrimitiveId = primId;
+                m_Triangles.push_back(tri);
+            }
+            triangleCount += child.Count;
+        }
+        else
+        {
+            node.Meta[i]   = uint8_t(kMetaInner | innerCount);
+            node.InnerMask |= uint8_t(1u << i);
+            innerChildren[innerCount++] = children[i];
+        }
+    }
+
+    m_Nodes.resize(m_Nodes.size() + innerCount);
+    m_Nodes[dstIndex] = node;
+
+    for(auto i=0u; i<innerCount; ++i)
+    { Collapse(bvh, innerChildren[i], node.ChildBaseIndex + i); }
+}
+
+//-----------------------------------------------------------------------------
+//      構築済みのデータを参照します. メモリは Clear() まで保持してください.
+//-----------------------------------------------------------------------------
+bool Bvh8::Attach
+(
+    const Bvh8Node*     pNodes,
+    uint32_t            nodeCount,
+    const Bvh8Triangle* pTriangles,
+    uint32_t            triangleCount,
+    const BvhStats&     stats
+)
+{
+    Clear();
+
+    if (pNodes == nullptr || nodeCount == 0 || pTriangles == nullptr || triangleCount == 0)
+    { return false; }
+
+    m_pNodes        = pNodes;
+    m_NodeCount     = nodeCount;
+    m_pTriangles    = pTriangles;
+    m_TriangleCount = triangleCount;
+    m_Stats         = stats;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      破棄処理を行います.
+//-----------------------------------------------------------------------------
+void Bvh8::Clear()
+{
+    std::vector<Bvh8Node>    ().swap(m_Nodes);
+    std::vector<Bvh8Triangle>().swap(m_Triangles);
+    m_Memory.Set(0);
+    m_pNodes        = nullptr;
+    m_NodeCount     = 0;
+    m_pTriangles    = nullptr;
+    m_TriangleCount = 0;
+    m_Stats = BvhStats();
+}
+
+//-----------------------------------------------------------------------------
+//      最近接交差を求めます.
+//-----------------------------------------------------------------------------
+bool Bvh8::Intersect(const BvhRay& ray, BvhHit& hit) const
+{
+    if (m_NodeCount == 0)
+    { return false; }
+
+    auto invDir = CalcInvDir(ray.Direction);
+    auto tmax   = std::min(ray.TMax, hit.T);
+
+    struct Entry
+    {
+        uint32_t    Index;
+        float       TNear;
+    };
+
+    TraversalStack<Entry, kStackSize8> stack;
+    stack.Push({ 0, ray.TMin });
+
+    auto found = false;
+    while(!stack.IsEmpty())
+    {
+        auto entry = stack.Pop();
+        if (entry.TNear > tmax)
+        { continue; }
+
+        auto& node = m_pNodes[entry.Index];
+
+        float3 scale(
+            ldexpf(1.0f, node.Exponent[0]),
+            ldexpf(1.0f, node.Exponent[1]),
+            ldexpf(1.0f, node.Exponent[2]));
+
+        Entry    inner[8];
+        uint32_t innerCount = 0;
+
+        for(auto i=0; i<8; ++i)
+        {
+            auto meta = node.Meta[i];
+            if (meta == 0)
+            { continue; }
+
+            float3 boxMin(
+                node.Origin.x + float(node.QMinX[i]) * scale.x,
+                node.Origin.y + float(node.QMinY[i]) * scale.y,
+                node.Origin.z + float(node.QMinZ[i]) * scale.z);
+            float3 boxMax(
+                node.Origin.x + float(node.QMaxX[i]) * scale.x,
+                node.Origin.y + float(node.QMaxY[i]) * scale.y,
+                node.Origin.z + float(node.QMaxZ[i]) * scale.z);
+
+            float tnear;
+            if (!IntersectBox(boxMin, boxMax, ray.Origin, invDir, ray.TMin, tmax, tnear))
+            { continue; }
+
+            if (meta & kMetaInner)
+            {
+                inner[innerCount++] = { node.ChildBaseIndex + (meta & 0x7), tnear };
+                continue;
+            }
+
+            auto offset = node.TriangleBaseIndex + (meta & 0x1f);
+            auto count  = uint32_t(meta >> 5);
+            for(auto j=0u; j<count; ++j)
+            {
+                auto& tri = m_pTriangles[offset + j];
+
+                float t, u, v;
+                if (IntersectTriangle(ray, tri.V0, tri.E1, tri.E2, tmax, t, u, v))
+                {
+                    tmax             = t;
+                    hit.T            = t;
+                    hit.PrimitiveId  = tri.PrimitiveId;
+                    hit.Barycentrics = float2(u, v);
+                    found            = true;
+                }
+            }
+        }
+
+        // 遠い順に積んで近い子から辿る.
+        std::sort(inner, inner + innerCount, [](const Entry& lhs, const Entry& rhs)
+        { return lhs.TNear > rhs.TNear; });
+
+        for(auto i=0u; i<innerCount; ++i)
+        { stack.Push(inner[i]); }
+    }
+
+    return found;
+}
+
+} // namespace rtc
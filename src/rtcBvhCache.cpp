@@ -0,0 +1,472 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcBvhCache.cpp
+// Desc : On-Disk Acceleration Structure Cache.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcBvhCache.h>
+#include <rtcHash.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t kCacheMagic      = 0x48564252;   // 'RBVH'
+constexpr uint32_t kCacheVersion    = 1;            // ファイル形式や構築アルゴリズムを変えたら上げること.
+constexpr uint64_t kSectionAlign    = 64;
+constexpr uint8_t  kMetaInner       = 0x80;         // Bvh8Node::Meta の節を表すビット. rtcBvh.cpp と同じ.
+
+///////////////////////////////////////////////////////////////////////////////
+// FileHeader structure
+///////////////////////////////////////////////////////////////////////////////
+struct FileHeader
+{
+    uint32_t        Magic;
+    uint32_t        Version;
+    uint32_t        HeaderSize;
+    uint16_t        NodeSize;           // sizeof(BvhNode)
+    uint16_t        Node8Size;          // sizeof(Bvh8Node)
+    uint16_t        Triangle8Size;      // sizeof(Bvh8Triangle)
+    uint16_t        StatsSize;          // sizeof(BvhStats)
+    uint32_t        TriangleCount;
+    uint64_t        Key;
+    uint64_t        FileSize;
+    uint32_t        NodeCount;
+    uint32_t        ReferenceCount;
+    uint32_t        Node8Count;
+    uint32_t        Triangle8Count;
+    uint64_t        NodeOffset;
+    uint64_t        ReferenceOffset;
+    uint64_t        Node8Offset;
+    uint64_t        Triangle8Offset;
+    rtc::BvhStats   Stats;
+    rtc::BvhStats   Stats8;
+};
+
+//-----------------------------------------------------------------------------
+//      アラインメントに切り上げます.
+//-----------------------------------------------------------------------------
+inline uint64_t AlignUp(uint64_t value, uint64_t align)
+{ return (value + align - 1) & ~(align - 1); }
+
+//-----------------------------------------------------------------------------
+//      セクションがファイル内に収まっているかチェックします.
+//-----------------------------------------------------------------------------
+inline bool IsValidSection(uint64_t offset, uint64_t count, uint64_t stride, uint64_t fileSize)
+{
+    if ((offset % kSectionAlign) != 0)
+    { return false; }
+    if (offset > fileSize)
+    { return false; }
+    return count <= (fileSize - offset) / stride;
+}
+
+//-----------------------------------------------------------------------------
+//      ヘッダのバージョンとレイアウトを検証します.
+//-----------------------------------------------------------------------------
+bool ValidateHeader(const FileHeader& header, uint64_t key, uint32_t triangleCount, uint64_t fileSize)
+{
+    if (header.Magic         != kCacheMagic
+     || header.Version       != kCacheVersion
+     || header.HeaderSize    != sizeof(FileHeader)
+     || header.NodeSize      != sizeof(rtc::BvhNode)
+     || header.Node8Size     != sizeof(rtc::Bvh8Node)
+     || header.Triangle8Size != sizeof(rtc::Bvh8Triangle)
+     || header.StatsSize     != sizeof(rtc::BvhStats))
+    { return false; }
+
+    if (header.Key != key || header.TriangleCount != triangleCount || header.FileSize != fileSize)
+    { return false; }
+
+    if (header.NodeCount == 0 || header.ReferenceCount == 0)
+    { return false; }
+
+    return IsValidSection(header.NodeOffset,      header.NodeCount,      sizeof(rtc::BvhNode),      fileSize)
+        && IsValidSection(header.ReferenceOffset, header.ReferenceCount, sizeof(uint32_t),          fileSize)
+        && IsValidSection(header.Node8Offset,     header.Node8Count,     sizeof(rtc::Bvh8Node),     fileSize)
+        && IsValidSection(header.Triangle8Offset, header.Triangle8Count, sizeof(rtc::Bvh8Triangle), fileSize);
+}
+
+//-----------------------------------------------------------------------------
+//      2分木の子ノードと三角形参照が範囲内か検証します.
+//      子は親より後ろに置かれるので, 後ろを指さないノードは循環とみなして弾きます.
+//-----------------------------------------------------------------------------
+bool ValidateNodes
+(
+    const rtc::BvhNode* pNodes,
+    uint32_t            nodeCount,
+    const uint32_t*     pReferences,
+    uint32_t            referenceCount,
+    uint32_t            triangleCount
+)
+{
+    for(auto i=0u; i<nodeCount; ++i)
+    {
+        auto& node = pNodes[i];
+        if (node.IsLeaf())
+        {
+            if (uint64_t(node.Index) + node.Count > referenceCount)
+            { return false; }
+        }
+        else if (node.Index <= i || uint64_t(node.Index) + 1 >= nodeCount)
+        { return false; }
+    }
+
+    for(auto i=0u; i<referenceCount; ++i)
+    {
+        if (pReferences[i] >= triangleCount)
+        { return false; }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      8分木の子ノードと三角形が範囲内か検証します.
+//-----------------------------------------------------------------------------
+bool ValidateNodes8
+(
+    const rtc::Bvh8Node*        pNodes,
+    uint32_t                    nodeCount,
+    const rtc::Bvh8Triangle*    pTriangles,
+    uint32_t                    triangle8Count,
+    uint32_t                    triangleCount
+)
+{
+    for(auto i=0u; i<nodeCount; ++i)
+    {
+        auto& node = pNodes[i];
+        for(auto j=0; j<8; ++j)
+        {
+            auto meta = node.Meta[j];
+            if (meta == 0)
+            { continue; }
+
+            if (meta & kMetaInner)
+            {
+                auto child = uint64_t(node.ChildBaseIndex) + (meta & 0x7);
+                if (child <= i || child >= nodeCount)
+                { return false; }
+            }
+            else if (uint64_t(node.TriangleBaseIndex) + (meta & 0x1f) + (meta >> 5) > triangle8Count)
+            { return false; }
+        }
+    }
+
+    for(auto i=0u; i<triangle8Count; ++i)
+    {
+        if (pTriangles[i].PrimitiveId >= triangleCount)
+        { return false; }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      パディングを含めて書き込みます.
+//-----------------------------------------------------------------------------
+bool WriteSection(HANDLE hFile, const void* pData, uint64_t size, uint64_t& offset)
+{
+    static const uint8_t kZeros[kSectionAlign] = {};
+
+    auto padding = AlignUp(offset, kSectionAlign) - offset;
+    DWORD written = 0;
+    if (padding > 0 && !WriteFile(hFile, kZeros, DWORD(padding), &written, nullptr))
+    { return false; }
+    offset += padding;
+
+    auto p = static_cast<const uint8_t*>(pData);
+    while (size > 0)
+    {
+        auto chunk = DWORD(std::min<uint64_t>(size, 1u << 30));
+        if (!WriteFile(hFile, p, chunk, &written, nullptr) || written != chunk)
+        { return false; }
+        p      += chunk;
+        size   -= chunk;
+        offset += chunk;
+    }
+    return true;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// BvhCache class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      初期化処理を行います.
+//-----------------------------------------------------------------------------
+bool BvhCache::Init(const char* directory)
+{
+    if (directory == nullptr)
+    { return false; }
+
+    m_Directory = directory;
+    if (!m_Directory.empty() && m_Directory.back() != '/' && m_Directory.back() != '\\')
+    { m_Directory += '/'; }
+
+    if (!m_Directory.empty()
+     && !CreateDirectoryA(m_Directory.c_str(), nullptr)
+     && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        RTC_ELOG("Error : CreateDirectory() Failed. path = %s", m_Directory.c_str());
+        return false;
+    }
+
+    m_Stats = BvhCacheStats();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      終了処理を行います.
+//-----------------------------------------------------------------------------
+void BvhCache::Term()
+{
+    for(auto& mapping : m_Mappings)
+    {
+        UnmapViewOfFile(mapping.pView);
+        CloseHandle(mapping.hMapping);
+        CloseHandle(mapping.hFile);
+    }
+    m_Mappings.clear();
+    m_Stats.MappedBytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+//      キーを計算します.
+//-----------------------------------------------------------------------------
+uint64_t BvhCache::CalcKey(const BvhBuildDesc& desc)
+{
+    if (desc.pPositions == nullptr || desc.pIndices == nullptr || desc.TriangleCount == 0)
+    { return 0; }
+
+    auto indexCount  = size_t(desc.TriangleCount) * 3;
+    auto vertexCount = desc.VertexCount;
+    if (vertexCount == 0)
+    {
+        for(size_t i=0; i<indexCount; ++i)
+        { vertexCount = std::max(vertexCount, desc.pIndices[i] + 1); }
+    }
+
+    // 結果に影響しない ThreadCount は含めない.
+    uint32_t params[] = {
+        kCacheVersion,
+        vertexCount,
+        desc.TriangleCount,
+        desc.MaxLeafSize,
+        desc.BinCount,
+        desc.EnableSpatialSplits ? 1u : 0u,
+        0, 0, 0,
+    };
+    memcpy(&params[6], &desc.TraversalCost,      sizeof(float));
+    memcpy(&params[7], &desc.SpatialSplitBudget, sizeof(float));
+    memcpy(&params[8], &desc.SpatialSplitAlpha,  sizeof(float));
+
+    auto h = Hash64(params, sizeof(params), 0);
+    h = Hash64(desc.pPositions, size_t(vertexCount) * sizeof(float3), h);
+    h = Hash64(desc.pIndices,   indexCount * sizeof(uint32_t),        h);
+    return h;
+}
+
+//-----------------------------------------------------------------------------
+//      キャッシュファイルのパスを取得します.
+//-----------------------------------------------------------------------------
+std::string BvhCache::GetPath(uint64_t key) const
+{
+    char name[32];
+    sprintf_s(name, "%016llx.bvh", static_cast<unsigned long long>(key));
+    return m_Directory + name;
+}
+
+//-----------------------------------------------------------------------------
+//      キャッシュを読み込みます.
+//-----------------------------------------------------------------------------
+bool BvhCache::Load(const BvhBuildDesc& desc, uint64_t key, Bvh& bvh, Bvh8* pBvh8)
+{
+    Timer timer;
+    timer.Start();
+
+    auto path  = GetPath(key);
+    auto hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    { return false; }
+
+    LARGE_INTEGER fileSize = {};
+    if (!GetFileSizeEx(hFile, &fileSize) || uint64_t(fileSize.QuadPart) < sizeof(FileHeader))
+    {
+        CloseHandle(hFile);
+        m_Stats.Rejects++;
+        return false;
+    }
+
+    auto hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (hMapping == nullptr)
+    {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    auto pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (pView == nullptr)
+    {
+        CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return false;
+    }
+
+    auto  pBase  = static_cast<const uint8_t*>(pView);
+    auto& header = *reinterpret_cast<const FileHeader*>(pBase);
+
+    auto valid = ValidateHeader(header, key, desc.TriangleCount, uint64_t(fileSize.QuadPart));
+    if (valid && pBvh8 != nullptr && header.Node8Count == 0)
+    { valid = false; }
+
+    auto pNodes      = reinterpret_cast<const BvhNode*>     (pBase + header.NodeOffset);
+    auto pReferences = reinterpret_cast<const uint32_t*>    (pBase + header.ReferenceOffset);
+    auto pNodes8     = reinterpret_cast<const Bvh8Node*>    (pBase + header.Node8Offset);
+    auto pTriangles8 = reinterpret_cast<const Bvh8Triangle*>(pBase + header.Triangle8Offset);
+
+    // ヘッダが正しくても中身が壊れていれば範囲外を参照するので, 返す前に全ての添字を検証する.
+    if (valid && !ValidateNodes(pNodes, header.NodeCount, pReferences, header.ReferenceCount, desc.TriangleCount))
+    { valid = false; }
+    if (valid && pBvh8 != nullptr && !ValidateNodes8(pNodes8, header.Node8Count, pTriangles8, header.Triangle8Count, desc.TriangleCount))
+    { valid = false; }
+
+    if (!valid)
+    {
+        RTC_DLOG("Info : BvhCache rejected stale or corrupt file. path = %s", path.c_str());
+        UnmapViewOfFile(pView);
+        CloseHandle(hMapping);
+        CloseHandle(hFile);
+        m_Stats.Rejects++;
+        return false;
+    }
+
+    bvh.Attach(desc, pNodes, header.NodeCount, pReferences, header.ReferenceCount, header.Stats);
+
+    if (pBvh8 != nullptr)
+    { pBvh8->Attach(pNodes8, header.Node8Count, pTriangles8, header.Triangle8Count, header.Stats8); }
+
+    m_Mappings.push_back({ hFile, hMapping, pView, size_t(fileSize.QuadPart) });
+    m_Stats.MappedBytes += size_t(fileSize.QuadPart);
+
+    timer.End();
+    m_Stats.LoadMsec += timer.GetElapsedMsec();
+    m_Stats.Hits++;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      キャッシュを書き込みます.
+//-----------------------------------------------------------------------------
+bool BvhCache::Save(const BvhBuildDesc& desc, uint64_t key, const Bvh& bvh, const Bvh8* pBvh8)
+{
+    if (bvh.GetNodeCount() == 0)
+    { return false; }
+
+    auto hasBvh8 = (pBvh8 != nullptr && pBvh8->GetNodeCount() > 0);
+
+    FileHeader header = {};
+    header.Magic            = kCacheMagic;
+    header.Version          = kCacheVersion;
+    header.HeaderSize       = sizeof(FileHeader);
+    header.NodeSize         = uint16_t(sizeof(BvhNode));
+    header.Node8Size        = uint16_t(sizeof(Bvh8Node));
+    header.Triangle8Size    = uint16_t(sizeof(Bvh8Triangle));
+    header.StatsSize        = uint16_t(sizeof(BvhStats));
+    header.TriangleCount    = desc.TriangleCount;
+    header.Key              = key;
+    header.NodeCount        = bvh.GetNodeCount();
+    header.ReferenceCount   = bvh.GetReferenceCount();
+    header.Node8Count       = hasBvh8 ? pBvh8->GetNodeCount()     : 0;
+    header.Triangle8Count   = hasBvh8 ? pBvh8->GetTriangleCount() : 0;
+    header.Stats            = bvh.GetStats();
+    header.Stats8           = hasBvh8 ? pBvh8->GetStats() : BvhStats();
+
+    uint64_t offset = sizeof(FileHeader);
+    header.NodeOffset       = offset = AlignUp(offset, kSectionAlign); offset += uint64_t(header.NodeCount)      * sizeof(BvhNode);
+    header.ReferenceOffset  = offset = AlignUp(offset, kSectionAlign); offset += uint64_t(header.ReferenceCount) * sizeof(uint32_t);
+    header.Node8Offset      = offset = AlignUp(offset, kSectionAlign); offset += uint64_t(header.Node8Count)     * sizeof(Bvh8Node);
+    header.Triangle8Offset  = offset = AlignUp(offset, kSectionAlign); offset += uint64_t(header.Triangle8Count) * sizeof(Bvh8Triangle);
+    header.FileSize         = offset;
+
+    // 途中で失敗しても壊れたファイルが残らないように一時ファイルに書いてから置き換える.
+    auto path     = GetPath(key);
+    auto tempPath = path + ".tmp";
+    auto hFile    = CreateFileA(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        RTC_ELOG("Error : CreateFile() Failed. path = %s", tempPath.c_str());
+        return false;
+    }
+
+    uint64_t written = 0;
+    auto ret = WriteSection(hFile, &header, sizeof(header), written)
+            && WriteSection(hFile, bvh.GetNodes(),      uint64_t(header.NodeCount)      * sizeof(BvhNode),  written)
+            && WriteSection(hFile, bvh.GetReferences(), uint64_t(header.ReferenceCount) * sizeof(uint32_t), written);
+    if (ret && hasBvh8)
+    {
+        ret = WriteSection(hFile, pBvh8->GetNodes(),     uint64_t(header.Node8Count)     * sizeof(Bvh8Node),     written)
+           && WriteSection(hFile, pBvh8->GetTriangles(), uint64_t(header.Triangle8Count) * sizeof(Bvh8Triangle), written);
+    }
+    CloseHandle(hFile);
+
+    if (!ret || written != header.FileSize
+     || !MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        RTC_ELOG("Error : BvhCache write failed. path = %s", path.c_str());
+        DeleteFileA(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      キャッシュがあれば読み込み, 無ければ構築して保存します.
+//-----------------------------------------------------------------------------
+bool BvhCache::GetOrBuild(const BvhBuildDesc& desc, Bvh& bvh, Bvh8* pBvh8)
+{
+    Timer timer;
+    timer.Start();
+    auto key = CalcKey(desc);
+    timer.End();
+    m_Stats.HashMsec += timer.GetElapsedMsec();
+
+    if (key == 0)
+    { return false; }
+
+    if (Load(desc, key, bvh, pBvh8))
+    { return true; }
+
+    m_Stats.Misses++;
+
+    timer.Start();
+    if (!bvh.Build(desc))
+    { return false; }
+
+    if (pBvh8 != nullptr && !pBvh8->Build(bvh))
+    { return false; }
+
+    // 保存に失敗しても構築結果はそのまま使える.
+    Save(desc, key, bvh, pBvh8);
+
+    timer.End();
+    m_Stats.BuildMsec += timer.GetElapsedMsec();
+    return true;
+}
+
+} // namespace rtc
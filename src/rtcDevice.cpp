@@ -10,6 +10,7 @@
 #include <rtcDevice.h>
 #include <rtcTimer.h>
 #include <rtcLog.h>
+#include <rtcMemoryTracker.h>
 #include <algorithm>
 #if RTC_TARGET == RTC_DEVELOP
 #include <ShlObj.h>
@@ -77,7 +78,7 @@ void LoadPixGpuCpatureDll()
 //-------------------------------------------------------------------------------------------------
 void* CustomAlloc(size_t size, size_t alignment, void*)
 { 
-    return mi_malloc_aligned(size, alignment); 
+    return rtc::TaggedAlloc(rtc::MEMORY_TAG_D3D12MA, size, alignment); 
 }
 
 //-------------------------------------------------------------------------------------------------
@@ -85,7 +86,7 @@ void* CustomAlloc(size_t size, size_t alignment, void*)
 //-------------------------------------------------------------------------------------------------
 void CustomFree(void* ptr, void*)
 {
-    return mi_free(ptr);
+    return rtc::TaggedFree(rtc::MEMORY_TAG_D3D12MA, ptr);
 }
 
 //-----------------------------------------------------------------------------
@@ -0,0 +1,304 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcFrameArena.cpp
+// Desc : Per-Frame Arena Allocator.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcFrameArena.h>
+#include <rtcLog.h>
+#include <rtcMemoryTracker.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr size_t  kChunkAlignment   = 64;
+constexpr uint8_t kAllocPattern     = 0xCD;
+constexpr uint8_t kFreePattern      = 0xDD;
+
+//-----------------------------------------------------------------------------
+// Global Variables
+//-----------------------------------------------------------------------------
+std::atomic<uint64_t> g_FrameEpoch = {};
+
+//-----------------------------------------------------------------------------
+//      アラインメントに切り上げます.
+//-----------------------------------------------------------------------------
+inline size_t AlignUp(size_t value, size_t alignment)
+{ return (value + alignment - 1) & ~(alignment - 1); }
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameArena class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      初期化処理を行います.
+//-----------------------------------------------------------------------------
+bool FrameArena::Init(const FrameArenaDesc& desc)
+{
+    Term();
+
+    if (desc.ChunkSize == 0)
+    { return false; }
+
+    m_Desc  = desc;
+    m_Stats = FrameArenaStats();
+
+    m_pHeap = mi_heap_new();
+    m_Stats.FrameHeapCalls++;
+    if (m_pHeap == nullptr)
+    {
+        RTC_ELOG("Error : mi_heap_new() Failed.");
+        return false;
+    }
+
+    m_Epoch = g_FrameEpoch.load(std::memory_order_relaxed);
+    return AddChunk(desc.ChunkSize);
+}
+
+//-----------------------------------------------------------------------------
+//      終了処理を行います.
+//-----------------------------------------------------------------------------
+void FrameArena::Term()
+{
+    if (m_pHeap != nullptr)
+    {
+        TrackFree(MEMORY_TAG_FRAME_ARENA, m_Stats.ReservedBytes);
+        mi_heap_destroy(m_pHeap);
+        m_pHeap = nullptr;
+    }
+
+    m_Stats.ReservedBytes = 0;
+    m_Stats.ChunkCount    = 0;
+    m_ChunkCount = 0;
+    m_Current    = 0;
+    m_Offset     = 0;
+}
+
+//-----------------------------------------------------------------------------
+//      メモリを割り当てます.
+//-----------------------------------------------------------------------------
+void* FrameArena::Alloc(size_t size, size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    auto ptr = AllocFromChunk(size, alignment);
+    if (ptr != nullptr)
+    { return ptr; }
+
+    return AllocSlow(size, alignment);
+}
+
+//-----------------------------------------------------------------------------
+//      現在のチャンクから割り当てます. 収まらない場合は nullptr を返します.
+//-----------------------------------------------------------------------------
+void* FrameArena::AllocFromChunk(size_t size, size_t alignment)
+{
+    if (m_ChunkCount == 0)
+    { return nullptr; }
+
+    // チャンクは kChunkAlignment 境界なので, それより大きなアラインメントはアドレスで揃える.
+    auto& chunk   = m_Chunks[m_Current];
+    auto  base    = reinterpret_cast<uintptr_t>(chunk.pData);
+    auto  offset  = AlignUp(base + m_Offset, alignment) - base;
+    if (offset + size > chunk.Size)
+    { return nullptr; }
+
+    auto ptr = chunk.pData + offset;
+    m_Stats.UsedBytes += offset + size - m_Offset;
+    m_Stats.Allocations++;
+    m_Offset = offset + size;
+
+    if (m_Desc.EnablePoison)
+    { memset(ptr, kAllocPattern, size); }
+    return ptr;
+}
+
+//-----------------------------------------------------------------------------
+//      次のチャンクから割り当てます.
+//-----------------------------------------------------------------------------
+void* FrameArena::AllocSlow(size_t size, size_t alignment)
+{
+    if (m_pHeap == nullptr)
+    { return nullptr; }
+
+    // 前のフレームで確保済みのチャンクを先に使う.
+    while (m_Current + 1 < m_ChunkCount)
+    {
+        m_Current++;
+        m_Offset = 0;
+
+        auto ptr = AllocFromChunk(size, alignment);
+        if (ptr != nullptr)
+        { return ptr; }
+    }
+
+    // size + alignment あればチャンク先頭の位置に関係なく収まる.
+    if (!AddChunk(std::max(m_Desc.ChunkSize, size + alignment)))
+    { return nullptr; }
+
+    m_Current = m_ChunkCount - 1;
+    m_Offset  = 0;
+    return AllocFromChunk(size, alignment);
+}
+
+//-----------------------------------------------------------------------------
+//      チャンクを追加します.
+//-----------------------------------------------------------------------------
+bool FrameArena::AddChunk(size_t size)
+{
+    if (m_ChunkCount >= kMaxChunks)
+    {
+        RTC_ELOG("Error : FrameArena chunk count is over. size = %zu", size);
+        return false;
+    }
+
+    size = AlignUp(size, kChunkAlignment);
+    auto ptr = static_cast<uint8_t*>(mi_heap_malloc_aligned(m_pHeap, size, kChunkAlignment));
+    m_Stats.FrameHeapCalls++;
+    if (ptr == nullptr)
+    {
+        RTC_ELOG("Error : mi_heap_malloc_aligned() Failed. size = %zu", size);
+        return false;
+    }
+
+    TrackAlloc(MEMORY_TAG_FRAME_ARENA, size);
+
+    m_Chunks[m_ChunkCount++] = { ptr, size };
+    m_Stats.ChunkCount     = m_ChunkCount;
+    m_Stats.ReservedBytes += size;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      指定位置から現在位置までを解放パターンで埋めます.
+//-----------------------------------------------------------------------------
+void FrameArena::Poison(uint32_t beginChunk, size_t beginOffset)
+{
+    for(auto i=beginChunk; i<=m_Current && i<m_ChunkCount; ++i)
+    {
+        auto begin = (i == beginChunk) ? beginOffset : 0;
+        auto end   = (i == m_Current)  ? m_Offset    : m_Chunks[i].Size;
+        if (end > begin)
+        { memset(m_Chunks[i].pData + begin, kFreePattern, end - begin); }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      マーカーの位置まで巻き戻します.
+//-----------------------------------------------------------------------------
+void FrameArena::Rewind(const Marker& marker)
+{
+    if (m_Desc.EnablePoison)
+    { Poison(marker.Chunk, marker.Offset); }
+
+    m_Current         = marker.Chunk;
+    m_Offset          = marker.Offset;
+    m_Stats.UsedBytes = marker.Used;
+}
+
+//-----------------------------------------------------------------------------
+//      フレーム終端の処理を行います.
+//-----------------------------------------------------------------------------
+void FrameArena::Reset()
+{
+    if (m_pHeap == nullptr)
+    { return; }
+
+    if (m_Desc.EnablePoison)
+    { Poison(0, 0); }
+
+    m_Stats.PeakBytes = std::max(m_Stats.PeakBytes, m_Stats.UsedBytes);
+
+    if (m_Current > 0)
+    {
+        // 溢れたフレームの後はヒープごと破棄し, 次から1チャンクに収まるように作り直す.
+        auto size = std::max(m_Desc.ChunkSize, m_Stats.PeakBytes + m_Stats.PeakBytes / 4);
+
+        TrackFree(MEMORY_TAG_FRAME_ARENA, m_Stats.ReservedBytes);
+        mi_heap_destroy(m_pHeap);
+        m_pHeap = mi_heap_new();
+        m_Stats.FrameHeapCalls += 2;
+
+        m_ChunkCount          = 0;
+        m_Stats.ReservedBytes = 0;
+        if (m_pHeap == nullptr || !AddChunk(size))
+        { RTC_ELOG("Error : FrameArena reset failed."); }
+    }
+
+    m_Current = 0;
+    m_Offset  = 0;
+
+    m_Stats.FrameCount++;
+    m_Stats.TotalHeapCalls    += m_Stats.FrameHeapCalls;
+    m_Stats.LastFrameHeapCalls = m_Stats.FrameHeapCalls;
+    m_Stats.FrameHeapCalls     = 0;
+    m_Stats.UsedBytes          = 0;
+    m_Stats.Allocations        = 0;
+}
+
+//-----------------------------------------------------------------------------
+//      スレッド専用のアリーナを取得します.
+//-----------------------------------------------------------------------------
+FrameArena& FrameArena::GetThreadLocal()
+{
+    thread_local FrameArena arena;
+    if (!arena.IsInit())
+    { arena.Init(FrameArenaDesc()); }
+
+    return arena;
+}
+
+//-----------------------------------------------------------------------------
+//      スレッドのフレーム処理を開始します.
+//-----------------------------------------------------------------------------
+FrameArena& FrameArena::BeginThreadFrame()
+{
+    auto& arena = GetThreadLocal();
+    if (arena.m_FrameDepth++ > 0)
+    { return arena; }
+
+    // 外側に ThreadFrame が無ければ, このスレッドは前のフレームのメモリを使っていない.
+    auto epoch = g_FrameEpoch.load(std::memory_order_acquire);
+    if (arena.m_Epoch != epoch)
+    {
+        arena.Reset();
+        arena.m_Epoch = epoch;
+    }
+
+    arena.m_HeapCallBase = GetThreadHeapCalls();
+    return arena;
+}
+
+//-----------------------------------------------------------------------------
+//      スレッドのフレーム処理を終了します.
+//-----------------------------------------------------------------------------
+void FrameArena::EndThreadFrame()
+{
+    assert(m_FrameDepth > 0);
+    if (--m_FrameDepth > 0)
+    { return; }
+
+    m_Stats.FrameHeapCalls += uint32_t(GetThreadHeapCalls() - m_HeapCallBase);
+}
+
+//-----------------------------------------------------------------------------
+//      フレームを進めます.
+//-----------------------------------------------------------------------------
+void FrameArena::AdvanceFrame()
+{ g_FrameEpoch.fetch_add(1, std::memory_order_release); }
+
+} // namespace rtc
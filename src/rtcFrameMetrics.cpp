@@ -0,0 +1,447 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcFrameMetrics.cpp
+// Desc : Per-Frame Render Statistics.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcFrameMetrics.h>
+#include <rtcLog.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr auto      kWriteInterval  = std::chrono::milliseconds(100);
+constexpr size_t    kFileBufferSize = 64 * 1024;
+constexpr double    kMegaBytes      = 1.0 / (1024.0 * 1024.0);
+
+const char* kStageNames[rtc::FRAME_STAGE_COUNT] = {
+    "trace",
+    "denoise",
+    "tonemap",
+    "encode",
+    "write",
+};
+
+//-----------------------------------------------------------------------------
+//      2のべき乗に切り上げます.
+//-----------------------------------------------------------------------------
+inline uint32_t NextPow2(uint32_t value)
+{
+    uint32_t result = 1;
+    while (result < value)
+    { result <<= 1; }
+    return result;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+//      パーセンタイルを求めます. values は並べ替えられます.
+//-----------------------------------------------------------------------------
+MetricsPercentiles CalcPercentiles(std::vector<double>& values)
+{
+    MetricsPercentiles result;
+    if (values.empty())
+    { return result; }
+
+    std::sort(values.begin(), values.end());
+
+    double sum = 0.0;
+    for(auto v : values)
+    { sum += v; }
+
+    // 最近接順位法.
+    auto rank = [&](double p)
+    {
+        auto index = size_t(p * double(values.size()) + 0.999999);
+        return values[std::min(std::max(index, size_t(1)), values.size()) - 1];
+    };
+
+    result.Mean = sum / double(values.size());
+    result.P50  = rank(0.50);
+    result.P90  = rank(0.90);
+    result.P99  = rank(0.99);
+    result.Max  = values.back();
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MetricsReservoir class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      値を追加します.
+//-----------------------------------------------------------------------------
+void MetricsReservoir::Add(double value)
+{
+    m_Max = (m_Count == 0) ? value : std::max(m_Max, value);
+    m_Sum += value;
+    m_Count++;
+
+    if (m_Samples.size() < m_Capacity)
+    {
+        m_Samples.push_back(value);
+        return;
+    }
+
+    // Algorithm R: i 番目の値を capacity / i の確率で残す.
+    auto r     = (uint64_t(m_Random.GetAsU32()) << 32) | m_Random.GetAsU32();
+    auto index = r % m_Count;
+    if (index < m_Capacity)
+    { m_Samples[size_t(index)] = value; }
+}
+
+//-----------------------------------------------------------------------------
+//      全ての値を破棄します.
+//-----------------------------------------------------------------------------
+void MetricsReservoir::Clear()
+{
+    m_Samples.clear();
+    m_Count = 0;
+    m_Sum   = 0.0;
+    m_Max   = 0.0;
+}
+
+//-----------------------------------------------------------------------------
+//      平均とパーセンタイルを求めます.
+//-----------------------------------------------------------------------------
+MetricsPercentiles MetricsReservoir::GetPercentiles() const
+{
+    auto values = m_Samples;
+    auto result = CalcPercentiles(values);
+    if (m_Count > 0)
+    {
+        result.Mean = m_Sum / double(m_Count);
+        result.Max  = m_Max;
+    }
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameMetricsSummary structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      ログに出力します.
+//-----------------------------------------------------------------------------
+void FrameMetricsSummary::Print() const
+{
+    RTC_ILOG("FrameMetrics : %llu frames (%llu dropped), %llu samples, %llu rays, output = %.2lf MB, memory peak = %.2lf MB, commit peak = %.2lf MB",
+        static_cast<unsigned long long>(FrameCount),
+        static_cast<unsigned long long>(DroppedFrames),
+        static_cast<unsigned long long>(TotalSamples),
+        static_cast<unsigned long long>(TotalRays),
+        OutputBytes     * kMegaBytes,
+        MemoryPeakBytes * kMegaBytes,
+        CommitPeakBytes * kMegaBytes);
+    RTC_ILOG("  %-10s : mean = %9.3lf, p50 = %9.3lf, p90 = %9.3lf, p99 = %9.3lf, max = %9.3lf (msec)",
+        "frame", FrameMsec.Mean, FrameMsec.P50, FrameMsec.P90, FrameMsec.P99, FrameMsec.Max);
+    for(auto i=0; i<FRAME_STAGE_COUNT; ++i)
+    {
+        auto& item = StageMsec[i];
+        if (item.Max <= 0.0)
+        { continue; }
+
+        RTC_ILOG("  %-10s : mean = %9.3lf, p50 = %9.3lf, p90 = %9.3lf, p99 = %9.3lf, max = %9.3lf (msec)",
+            kStageNames[i], item.Mean, item.P50, item.P90, item.P99, item.Max);
+        RTC_UNUSED(item);
+    }
+    RTC_ILOG("  %-10s : mean = %9.2lf, p50 = %9.2lf, p90 = %9.2lf, p99 = %9.2lf, max = %9.2lf (Mrays/sec)",
+        "rays",
+        RaysPerSec.Mean * 1e-6,
+        RaysPerSec.P50  * 1e-6,
+        RaysPerSec.P90  * 1e-6,
+        RaysPerSec.P99  * 1e-6,
+        RaysPerSec.Max  * 1e-6);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameMetricsRecorder class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      初期化処理を行います.
+//-----------------------------------------------------------------------------
+bool FrameMetricsRecorder::Init(const FrameMetricsDesc& desc)
+{
+    Term();
+
+    if (desc.Capacity == 0)
+    { return false; }
+
+    m_Desc = desc;
+
+    if (desc.Path != nullptr)
+    {
+        if (fopen_s(&m_pFile, desc.Path, "wb") != 0 || m_pFile == nullptr)
+        {
+            RTC_ELOG("Error : File Open Failed. path = %s", desc.Path);
+            m_pFile = nullptr;
+            return false;
+        }
+
+        setvbuf(m_pFile, nullptr, _IOFBF, kFileBufferSize);
+        WriteHeader(m_pFile);
+    }
+
+    m_Queue.resize(NextPow2(desc.Capacity));
+    m_Head.store(0, std::memory_order_relaxed);
+    m_Tail.store(0, std::memory_order_relaxed);
+    m_Dropped    = 0;
+    m_FrameIndex = 0;
+    m_InFrame    = false;
+    m_Summary    = FrameMetricsSummary();
+    m_FrameMsec .Clear();
+    m_RaysPerSec.Clear();
+    for(auto& item : m_StageMsec)
+    { item.Clear(); }
+
+    m_StopRequest = false;
+    m_Running     = true;
+    m_Thread      = std::thread(&FrameMetricsRecorder::WriterThread, this);
+
+    m_RunTimer.Start();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      終了処理を行います. 残りを書き出して集計します.
+//-----------------------------------------------------------------------------
+void FrameMetricsRecorder::Term()
+{
+    if (!m_Running)
+    { return; }
+
+    {
+        std::lock_guard<std::mutex> locker(m_Mutex);
+        m_StopRequest = true;
+    }
+    m_Wake.notify_one();
+    m_Thread.join();
+    m_Running = false;
+
+    if (m_pFile != nullptr)
+    {
+        fclose(m_pFile);
+        m_pFile = nullptr;
+    }
+
+    Summarize();
+
+    m_Queue.clear();
+    m_Queue.shrink_to_fit();
+}
+
+//-----------------------------------------------------------------------------
+//      フレームの計測を開始します.
+//-----------------------------------------------------------------------------
+void FrameMetricsRecorder::BeginFrame()
+{
+    m_RunTimer.End();
+
+    m_Current = FrameMetrics();
+    m_Current.FrameIndex = m_FrameIndex;
+    m_Current.TimeSec    = m_RunTimer.GetElapsedSec();
+    m_InFrame = true;
+
+    m_FrameTimer.Start();
+}
+
+//-----------------------------------------------------------------------------
+//      フレームの計測を終了して書き出しキューに積みます.
+//-----------------------------------------------------------------------------
+void FrameMetricsRecorder::EndFrame(const MemoryReport& memory)
+{
+    if (!m_Running || !m_InFrame)
+    { return; }
+
+    m_FrameTimer.End();
+    m_Current.FrameMsec       = m_FrameTimer.GetElapsedMsec();
+    m_Current.MemoryPeakBytes = memory.PeakTrackedBytes;
+    m_Current.CommitPeakBytes = memory.PeakCommitBytes;
+
+    m_InFrame = false;
+    m_FrameIndex++;
+
+    // 書き出しが追いつかない場合は待たずに捨てる.
+    auto head = m_Head.load(std::memory_order_relaxed);
+    auto tail = m_Tail.load(std::memory_order_acquire);
+    if (head - tail >= m_Queue.size())
+    {
+        m_Dropped++;
+        return;
+    }
+
+    m_Queue[head & (m_Queue.size() - 1)] = m_Current;
+    m_Head.store(head + 1, std::memory_order_release);
+
+    // 半分溜まったら書き出し間隔を待たずに起こす. 取りこぼしても次の間隔で書き出される.
+    if (head + 1 - tail == m_Queue.size() / 2)
+    { m_Wake.notify_one(); }
+}
+
+//-----------------------------------------------------------------------------
+//      レイ数を加算します.
+//-----------------------------------------------------------------------------
+void FrameMetricsRecorder::AddRays(uint64_t primary, uint64_t secondary, uint64_t shadow)
+{
+    m_Current.PrimaryRays   += primary;
+    m_Current.SecondaryRays += secondary;
+    m_Current.ShadowRays    += shadow;
+}
+
+//-----------------------------------------------------------------------------
+//      拡張子から出力形式を決めます.
+//-----------------------------------------------------------------------------
+METRICS_FORMAT FrameMetricsRecorder::GetFormatFromPath(const char* path)
+{
+    if (path == nullptr)
+    { return METRICS_FORMAT_CSV; }
+
+    auto ext = strrchr(path, '.');
+    if (ext != nullptr && (_stricmp(ext, ".json") == 0 || _stricmp(ext, ".jsonl") == 0))
+    { return METRICS_FORMAT_JSONL; }
+
+    return METRICS_FORMAT_CSV;
+}
+
+//-----------------------------------------------------------------------------
+//      書き出しスレッドです.
+//-----------------------------------------------------------------------------
+void FrameMetricsRecorder::WriterThread()
+{
+    for(;;)
+    {
+        bool stop = false;
+        {
+            std::unique_lock<std::mutex> locker(m_Mutex);
+            m_Wake.wait_for(locker, kWriteInterval, [&]()
+            {
+                auto pending = m_Head.load(std::memory_order_acquire) - m_Tail.load(std::memory_order_relaxed);
+                return m_StopRequest || pending >= m_Queue.size() / 2;
+            });
+            stop = m_StopRequest;
+        }
+
+        auto head = m_Head.load(std::memory_order_acquire);
+        auto tail = m_Tail.load(std::memory_order_relaxed);
+        for(; tail != head; ++tail)
+        {
+            auto& frame = m_Queue[tail & (m_Queue.size() - 1)];
+            if (m_pFile != nullptr)
+            { WriteFrame(m_pFile, frame); }
+            Accumulate(frame);
+        }
+        m_Tail.store(tail, std::memory_order_release);
+
+        if (m_pFile != nullptr)
+        { fflush(m_pFile); }
+
+        if (stop)
+        { break; }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      ヘッダを書き出します.
+//-----------------------------------------------------------------------------
+void FrameMetricsRecorder::WriteHeader(FILE* pFile) const
+{
+    if (m_Desc.Format != METRICS_FORMAT_CSV)
+    { return; }
+
+    fprintf(pFile, "frame,time_sec,frame_msec,samples,primary_rays,secondary_rays,shadow_rays,rays_per_sec");
+    for(auto i=0; i<FRAME_STAGE_COUNT; ++i)
+    { fprintf(pFile, ",%s_msec", kStageNames[i]); }
+    fprintf(pFile, ",memory_peak_bytes,commit_peak_bytes,output_bytes\n");
+}
+
+//-----------------------------------------------------------------------------
+//      1フレーム分を書き出します.
+//-----------------------------------------------------------------------------
+void FrameMetricsRecorder::WriteFrame(FILE* pFile, const FrameMetrics& frame) const
+{
+    if (m_Desc.Format == METRICS_FORMAT_CSV)
+    {
+        fprintf(pFile, "%llu,%.6lf,%.4lf,%u,%llu,%llu,%llu,%.0lf",
+            static_cast<unsigned long long>(frame.FrameIndex),
+            frame.TimeSec,
+            frame.FrameMsec,
+            frame.Samples,
+            static_cast<unsigned long long>(frame.PrimaryRays),
+            static_cast<unsigned long long>(frame.SecondaryRays),
+            static_cast<unsigned long long>(frame.ShadowRays),
+            frame.GetRaysPerSec());
+        for(auto i=0; i<FRAME_STAGE_COUNT; ++i)
+        { fprintf(pFile, ",%.4lf", frame.StageMsec[i]); }
+        fprintf(pFile, ",%zu,%zu,%llu\n",
+            frame.MemoryPeakBytes,
+            frame.CommitPeakBytes,
+            static_cast<unsigned long long>(frame.OutputBytes));
+    }
+    else
+    {
+        fprintf(pFile, "{\"frame\":%llu,\"time_sec\":%.6lf,\"frame_msec\":%.4lf,\"samples\":%u,\"primary_rays\":%llu,\"secondary_rays\":%llu,\"shadow_rays\":%llu,\"rays_per_sec\":%.0lf,\"stage_msec\":{",
+            static_cast<unsigned long long>(frame.FrameIndex),
+            frame.TimeSec,
+            frame.FrameMsec,
+            frame.Samples,
+            static_cast<unsigned long long>(frame.PrimaryRays),
+            static_cast<unsigned long long>(frame.SecondaryRays),
+            static_cast<unsigned long long>(frame.ShadowRays),
+            frame.GetRaysPerSec());
+        for(auto i=0; i<FRAME_STAGE_COUNT; ++i)
+        { fprintf(pFile, "%s\"%s\":%.4lf", (i > 0) ? "," : "", kStageNames[i], frame.StageMsec[i]); }
+        fprintf(pFile, "},\"memory_peak_bytes\":%zu,\"commit_peak_bytes\":%zu,\"output_bytes\":%llu}\n",
+            frame.MemoryPeakBytes,
+            frame.CommitPeakBytes,
+            static_cast<unsigned long long>(frame.OutputBytes));
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      1フレーム分を集計に加えます.
+//-----------------------------------------------------------------------------
+void FrameMetricsRecorder::Accumulate(const FrameMetrics& frame)
+{
+    auto& summary = m_Summary;
+    summary.FrameCount++;
+    summary.TotalSamples   += frame.Samples;
+    summary.TotalRays      += frame.GetTotalRays();
+    summary.OutputBytes    += frame.OutputBytes;
+    summary.MemoryPeakBytes = std::max(summary.MemoryPeakBytes, frame.MemoryPeakBytes);
+    summary.CommitPeakBytes = std::max(summary.CommitPeakBytes, frame.CommitPeakBytes);
+
+    m_FrameMsec .Add(frame.FrameMsec);
+    m_RaysPerSec.Add(frame.GetRaysPerSec());
+    for(auto i=0; i<FRAME_STAGE_COUNT; ++i)
+    { m_StageMsec[i].Add(frame.StageMsec[i]); }
+}
+
+//-----------------------------------------------------------------------------
+//      全フレームの集計を確定します.
+//-----------------------------------------------------------------------------
+void FrameMetricsRecorder::Summarize()
+{
+    auto& summary = m_Summary;
+    summary.DroppedFrames = m_Dropped;
+    summary.FrameMsec     = m_FrameMsec .GetPercentiles();
+    summary.RaysPerSec    = m_RaysPerSec.GetPercentiles();
+    for(auto i=0; i<FRAME_STAGE_COUNT; ++i)
+    { summary.StageMsec[i] = m_StageMsec[i].GetPercentiles(); }
+}
+
+} // namespace rtc
@@ -0,0 +1,919 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcFrameWriter.cpp
+// Desc : Asynchronous Frame Writer.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcFrameWriter.h>
+#include <rtcMemoryTracker.h>
+#include <rtcLog.h>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr size_t    kDirectAlign    = 4096;             // ダイレクト I/O のアラインメントです.
+constexpr size_t    kMaxWriteSize   = 1u << 30;         // 1 回の書き込みの上限です.
+constexpr uint64_t  kPollTag        = 0;                // io_uring で eventfd の監視を表す user_data です.
+constexpr uint32_t  kStageOpen      = 0;
+constexpr uint32_t  kStageWrite     = 1;
+constexpr uint32_t  kStageClose     = 2;
+
+//-----------------------------------------------------------------------------
+//      アラインメントに切り上げます.
+//-----------------------------------------------------------------------------
+inline size_t AlignUp(size_t value, size_t align)
+{ return (value + align - 1) / align * align; }
+
+//-----------------------------------------------------------------------------
+//      ブロッキング I/O でファイルを書き込みます.
+//      direct の場合 writeSize はアラインメント済みで, 最後に size へ切り詰めます.
+//-----------------------------------------------------------------------------
+bool WriteFileBlocking(const char* path, const uint8_t* pData, size_t size, size_t writeSize, bool direct)
+{
+#if defined(__linux__)
+    auto fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (direct ? O_DIRECT : 0), 0644);
+    if (fd < 0 && direct && errno == EINVAL)
+    {
+        // ダイレクト I/O に対応していないファイルシステムです.
+        direct    = false;
+        writeSize = size;
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0)
+    { return false; }
+
+    auto success = true;
+    size_t written = 0;
+    while(written < writeSize)
+    {
+        auto result = pwrite(fd, pData + written, std::min(writeSize - written, kMaxWriteSize), off_t(written));
+        if (result < 0 && errno == EINTR)
+        { continue; }
+        if (result <= 0)
+        {
+            success = false;
+            break;
+        }
+        written += size_t(result);
+    }
+
+    if (success && writeSize != size)
+    { success = ftruncate(fd, off_t(size)) == 0; }
+
+    return (close(fd) == 0) && success;
+#else
+    auto flags = FILE_ATTRIBUTE_NORMAL | (direct ? FILE_FLAG_NO_BUFFERING : 0);
+    auto hFile = CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, flags, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    { return false; }
+
+    auto success = true;
+    size_t written = 0;
+    while(written < writeSize)
+    {
+        DWORD result = 0;
+        if (!WriteFile(hFile, pData + written, DWORD(std::min(writeSize - written, kMaxWriteSize)), &result, nullptr) || result == 0)
+        {
+            success = false;
+            break;
+        }
+        written += result;
+    }
+
+    if (success && writeSize != size)
+    {
+        FILE_END_OF_FILE_INFO info = {};
+        info.EndOfFile.QuadPart = LONGLONG(size);
+        success = SetFileInformationByHandle(hFile, FileEndOfFileInfo, &info, sizeof(info)) != FALSE;
+    }
+
+    return CloseHandle(hFile) && success;
+#endif
+}
+
+} // namespace
+
+
+namespace rtc {
+
+#if defined(__linux__)
+///////////////////////////////////////////////////////////////////////////////
+// FrameWriter::Uring structure (liburing を使わずにシステムコールを直接呼びます)
+///////////////////////////////////////////////////////////////////////////////
+struct FrameWriter::Uring
+{
+    int             Fd          = -1;
+    int             EventFd     = -1;
+    void*           pSqRing     = nullptr;
+    void*           pCqRing     = nullptr;
+    size_t          SqRingSize  = 0;
+    size_t          CqRingSize  = 0;
+    io_uring_sqe*   pSqes       = nullptr;
+    size_t          SqesSize    = 0;
+    uint32_t*       pSqHead     = nullptr;
+    uint32_t*       pSqTail     = nullptr;
+    uint32_t*       pSqArray    = nullptr;
+    uint32_t        SqMask      = 0;
+    uint32_t        SqEntries   = 0;
+    uint32_t*       pCqHead     = nullptr;
+    uint32_t*       pCqTail     = nullptr;
+    io_uring_cqe*   pCqes       = nullptr;
+    uint32_t        CqMask      = 0;
+    uint32_t        ToSubmit    = 0;
+    bool            FixedBuffers = false;
+    bool            PollArmed   = false;
+
+    ~Uring() { Term(); }
+
+    //-------------------------------------------------------------------------
+    //      リングを作成し, 必要な命令に対応しているか確認します.
+    //-------------------------------------------------------------------------
+    bool Init(uint32_t entries)
+    {
+        io_uring_params params = {};
+        Fd = int(syscall(__NR_io_uring_setup, entries, &params));
+        if (Fd < 0)
+        { return false; }
+
+        SqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        CqRingSize = params.cq_off.cqes  + params.cq_entries * sizeof(io_uring_cqe);
+        auto singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap)
+        { SqRingSize = CqRingSize = std::max(SqRingSize, CqRingSize); }
+
+        pSqRing = mmap(nullptr, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQ_RING);
+        if (pSqRing == MAP_FAILED)
+        {
+            pSqRing = nullptr;
+            return false;
+        }
+
+        if (singleMap)
+        { pCqRing = pSqRing; }
+        else
+        {
+            pCqRing = mmap(nullptr, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_CQ_RING);
+            if (pCqRing == MAP_FAILED)
+            {
+                pCqRing = nullptr;
+                return false;
+            }
+        }
+
+        SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        auto pSqes_ = mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQES);
+        if (pSqes_ == MAP_FAILED)
+        { return false; }
+        pSqes = static_cast<io_uring_sqe*>(pSqes_);
+
+        auto pSq = static_cast<uint8_t*>(pSqRing);
+        auto pCq = static_cast<uint8_t*>(pCqRing);
+        pSqHead   = reinterpret_cast<uint32_t*>(pSq + params.sq_off.head);
+        pSqTail   = reinterpret_cast<uint32_t*>(pSq + params.sq_off.tail);
+        pSqArray  = reinterpret_cast<uint32_t*>(pSq + params.sq_off.array);
+        SqMask    = *reinterpret_cast<uint32_t*>(pSq + params.sq_off.ring_mask);
+        SqEntries = params.sq_entries;
+        pCqHead   = reinterpret_cast<uint32_t*>(pCq + params.cq_off.head);
+        pCqTail   = reinterpret_cast<uint32_t*>(pCq + params.cq_off.tail);
+        pCqes     = reinterpret_cast<io_uring_cqe*>(pCq + params.cq_off.cqes);
+        CqMask    = *reinterpret_cast<uint32_t*>(pCq + params.cq_off.ring_mask);
+
+        // OPENAT, WRITE, CLOSE は 5.6 以降です.
+        const uint8_t required[] = { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_WRITE_FIXED, IORING_OP_CLOSE, IORING_OP_POLL_ADD };
+        std::vector<uint8_t> buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        auto pProbe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (syscall(__NR_io_uring_register, Fd, IORING_REGISTER_PROBE, pProbe, 256) < 0)
+        { return false; }
+        for(auto op : required)
+        {
+            if (op > pProbe->last_op || (pProbe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)
+            { return false; }
+        }
+
+        EventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return EventFd >= 0;
+    }
+
+    //-------------------------------------------------------------------------
+    //      リングを破棄します.
+    //-------------------------------------------------------------------------
+    void Term()
+    {
+        if (pSqes != nullptr)
+        { munmap(pSqes, SqesSize); }
+        if (pCqRing != nullptr && pCqRing != pSqRing)
+        { munmap(pCqRing, CqRingSize); }
+        if (pSqRing != nullptr)
+        { munmap(pSqRing, SqRingSize); }
+        if (Fd >= 0)
+        { close(Fd); }
+        if (EventFd >= 0)
+        { close(EventFd); }
+
+        pSqes   = nullptr;
+        pSqRing = nullptr;
+        pCqRing = nullptr;
+        Fd      = -1;
+        EventFd = -1;
+    }
+
+    //-------------------------------------------------------------------------
+    //      ステージングバッファを登録します. memlock の制限で失敗した場合は通常の書き込みを使います.
+    //-------------------------------------------------------------------------
+    void RegisterBuffers(uint8_t* pPool, size_t slotSize, uint32_t count)
+    {
+        if (pPool == nullptr || count == 0)
+        { return; }
+
+        std::vector<iovec> iovecs(count);
+        for(auto i=0u; i<count; ++i)
+        {
+            iovecs[i].iov_base = pPool + slotSize * i;
+            iovecs[i].iov_len  = slotSize;
+        }
+        FixedBuffers = syscall(__NR_io_uring_register, Fd, IORING_REGISTER_BUFFERS, iovecs.data(), count) == 0;
+        if (!FixedBuffers)
+        { RTC_DLOG("FrameWriter : io_uring buffer registration failed (errno = %d). using unregistered writes.", errno); }
+    }
+
+    //-------------------------------------------------------------------------
+    //      空きエントリを取得します. 発行は Enter() で行います.
+    //-------------------------------------------------------------------------
+    io_uring_sqe* Next(uint64_t userData)
+    {
+        auto tail = *pSqTail;
+        auto head = __atomic_load_n(pSqHead, __ATOMIC_ACQUIRE);
+        if (tail - head >= SqEntries)
+        { return nullptr; }
+
+        auto index = tail & SqMask;
+        auto pSqe  = &pSqes[index];
+        memset(pSqe, 0, sizeof(*pSqe));
+        pSqe->user_data = userData;
+        pSqArray[index] = index;
+
+        __atomic_store_n(pSqTail, tail + 1, __ATOMIC_RELEASE);
+        ToSubmit++;
+        return pSqe;
+    }
+
+    //-------------------------------------------------------------------------
+    //      溜まったエントリを完了を待たずに発行します. 空きエントリが無い場合に使います.
+    //-------------------------------------------------------------------------
+    void Submit()
+    {
+        while(ToSubmit > 0)
+        {
+            auto result = syscall(__NR_io_uring_enter, Fd, ToSubmit, 0, 0, nullptr, 0);
+            if (result >= 0)
+            {
+                ToSubmit -= std::min(uint32_t(result), ToSubmit);
+                return;
+            }
+            if (errno != EINTR)
+            { return; }
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    //      溜まったエントリを発行し, 完了が 1 つ以上あるまで待機します.
+    //-------------------------------------------------------------------------
+    void Enter()
+    {
+        for(;;)
+        {
+            auto result = syscall(__NR_io_uring_enter, Fd, ToSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result >= 0)
+            {
+                ToSubmit -= std::min(uint32_t(result), ToSubmit);
+                return;
+            }
+            if (errno != EINTR)
+            { return; }
+        }
+    }
+};
+#else
+///////////////////////////////////////////////////////////////////////////////
+// FrameWriter::Uring structure (Linux 以外では使いません)
+///////////////////////////////////////////////////////////////////////////////
+struct FrameWriter::Uring
+{
+};
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameWriterStats structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      デバッグログに出力します.
+//-----------------------------------------------------------------------------
+void FrameWriterStats::Print() const
+{
+    RTC_DLOG("FrameWriter : backend = %s, %llu files (%llu failed), %.2lf MB, %.2lf MB/sec, overflows = %llu",
+        FrameWriter::GetBackendName(Backend),
+        static_cast<unsigned long long>(Completed),
+        static_cast<unsigned long long>(Failed),
+        double(Bytes) / (1024.0 * 1024.0),
+        GetMBytesPerSec(),
+        static_cast<unsigned long long>(Overflows));
+    RTC_DLOG("  queued    : mean = %9.2lf, max = %u, in flight max = %u, buffers max = %u",
+        MeanQueued, MaxQueued, MaxInFlight, MaxBuffersUsed);
+    RTC_DLOG("  %-9s : mean = %9.3lf, p50 = %9.3lf, p90 = %9.3lf, p99 = %9.3lf, max = %9.3lf (usec)",
+        "submit", SubmitUsec.Mean, SubmitUsec.P50, SubmitUsec.P90, SubmitUsec.P99, SubmitUsec.Max);
+    RTC_DLOG("  %-9s : mean = %9.3lf, p50 = %9.3lf, p90 = %9.3lf, p99 = %9.3lf, max = %9.3lf (msec)",
+        "latency", LatencyMsec.Mean, LatencyMsec.P50, LatencyMsec.P90, LatencyMsec.P99, LatencyMsec.Max);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameWriter class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      コンストラクタです.
+//-----------------------------------------------------------------------------
+FrameWriter::FrameWriter()
+{ /* DO_NOTHING */ }
+
+//-----------------------------------------------------------------------------
+//      デストラクタです.
+//-----------------------------------------------------------------------------
+FrameWriter::~FrameWriter()
+{ Term(); }
+
+//-----------------------------------------------------------------------------
+//      初期化処理を行います.
+//-----------------------------------------------------------------------------
+bool FrameWriter::Init(const FrameWriterDesc& desc)
+{
+    Term();
+
+    if (desc.QueueDepth == 0)
+    { return false; }
+
+    m_Desc     = desc;
+    m_SlotSize = AlignUp(desc.BufferSize, kDirectAlign);
+    if (desc.BufferCount > 0 && m_SlotSize > 0)
+    {
+        m_pPool = static_cast<uint8_t*>(TaggedAlloc(MEMORY_TAG_ENCODE, m_SlotSize * desc.BufferCount, kDirectAlign));
+        if (m_pPool == nullptr)
+        {
+            RTC_ELOG("Error : Out of memory.");
+            return false;
+        }
+    }
+
+    m_FreeSlots.clear();
+    for(auto i=0u; i<desc.BufferCount && m_pPool != nullptr; ++i)
+    { m_FreeSlots.push_back(desc.BufferCount - 1 - i); }
+
+    m_Queued      = 0;
+    m_InFlight    = 0;
+    m_QueuedSum   = 0;
+    m_Stats       = FrameWriterStats();
+    m_StopRequest = false;
+    m_SubmitUsec .Clear();
+    m_LatencyMsec.Clear();
+
+    m_Backend = FRAME_WRITER_BACKEND_THREAD_POOL;
+    if (desc.Backend != FRAME_WRITER_BACKEND_THREAD_POOL)
+    {
+        if (InitUring())
+        { m_Backend = FRAME_WRITER_BACKEND_IO_URING; }
+        else if (desc.Backend == FRAME_WRITER_BACKEND_IO_URING)
+        {
+            RTC_ELOG("Error : io_uring is not available.");
+            TermUring();
+            TaggedFree(MEMORY_TAG_ENCODE, m_pPool);
+            m_pPool = nullptr;
+            return false;
+        }
+    }
+    m_Stats.Backend = m_Backend;
+
+    m_Running = true;
+    if (m_Backend == FRAME_WRITER_BACKEND_IO_URING)
+    { m_Threads.emplace_back(&FrameWriter::UringThread, this); }
+    else
+    {
+        auto threadCount = (desc.ThreadCount > 0) ? desc.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+        threadCount = std::min(threadCount, desc.QueueDepth);
+        for(auto i=0u; i<threadCount; ++i)
+        { m_Threads.emplace_back(&FrameWriter::WorkerThread, this); }
+    }
+
+    m_RunTimer.Start();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      終了処理を行います. 投入済みのファイルは全て書き込みます.
+//-----------------------------------------------------------------------------
+void FrameWriter::Term()
+{
+    if (!m_Running)
+    { return; }
+
+    {
+        std::lock_guard<std::mutex> locker(m_Mutex);
+        m_StopRequest = true;
+    }
+    m_Wake.notify_all();
+#if defined(__linux__)
+    if (m_pUring)
+    {
+        uint64_t value = 1;
+        RTC_UNUSED(write(m_pUring->EventFd, &value, sizeof(value)));
+    }
+#endif
+
+    for(auto& thread : m_Threads)
+    { thread.join(); }
+    m_Threads.clear();
+
+    TermUring();
+
+    m_RunTimer.End();
+    m_Stats.ElapsedSec = m_RunTimer.GetElapsedSec();
+    m_Running = false;
+
+    if (m_pPool != nullptr)
+    {
+        TaggedFree(MEMORY_TAG_ENCODE, m_pPool);
+        m_pPool = nullptr;
+    }
+    m_FreeSlots.clear();
+}
+
+//-----------------------------------------------------------------------------
+//      データをステージングバッファにコピーして書き込みを予約します.
+//-----------------------------------------------------------------------------
+bool FrameWriter::Submit(const char* path, const void* pData, size_t size)
+{
+    if (!m_Running || path == nullptr || (pData == nullptr && size > 0))
+    { return false; }
+
+    Timer timer;
+    timer.Start();
+
+    auto pRequest = new Request();
+    pRequest->Path      = path;
+    pRequest->Size      = size;
+    pRequest->Direct    = (m_Desc.DirectThreshold > 0) && (size >= m_Desc.DirectThreshold);
+    pRequest->WriteSize = pRequest->Direct ? AlignUp(size, kDirectAlign) : size;
+
+    if (pRequest->WriteSize <= m_SlotSize)
+    {
+        std::lock_guard<std::mutex> locker(m_Mutex);
+        if (!m_FreeSlots.empty())
+        {
+            pRequest->Slot = m_FreeSlots.back();
+            m_FreeSlots.pop_back();
+
+            auto used = m_Desc.BufferCount - uint32_t(m_FreeSlots.size());
+            m_Stats.MaxBuffersUsed = std::max(m_Stats.MaxBuffersUsed, used);
+        }
+    }
+
+    // ステージングバッファが足りなければ待たずに確保します.
+    auto overflow = (pRequest->Slot == UINT32_MAX);
+    if (overflow)
+    {
+        pRequest->pData = static_cast<uint8_t*>(TaggedAlloc(MEMORY_TAG_ENCODE, std::max(pRequest->WriteSize, size_t(1)), kDirectAlign));
+        if (pRequest->pData == nullptr)
+        {
+            RTC_ELOG("Error : Out of memory. path = %s", path);
+            delete pRequest;
+            return false;
+        }
+    }
+    else
+    { pRequest->pData = m_pPool + m_SlotSize * pRequest->Slot; }
+
+    if (size > 0)
+    { memcpy(pRequest->pData, pData, size); }
+    if (pRequest->WriteSize > size)
+    { memset(pRequest->pData + size, 0, pRequest->WriteSize - size); }
+
+    pRequest->Latency.Start();
+
+    {
+        std::lock_guard<std::mutex> locker(m_Mutex);
+        m_Pending.push_back(pRequest);
+        m_Queued++;
+        m_QueuedSum += m_Queued;
+        m_Stats.Submitted++;
+        m_Stats.MaxQueued = std::max(m_Stats.MaxQueued, m_Queued);
+        if (overflow)
+        { m_Stats.Overflows++; }
+
+        timer.End();
+        m_SubmitUsec.Add(timer.GetElapsedUsec());
+    }
+
+    if (m_Backend == FRAME_WRITER_BACKEND_IO_URING)
+    {
+#if defined(__linux__)
+        uint64_t value = 1;
+        RTC_UNUSED(write(m_pUring->EventFd, &value, sizeof(value)));
+#endif
+    }
+    else
+    { m_Wake.notify_one(); }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      投入済みの書き込みが全て完了するまで待機します.
+//-----------------------------------------------------------------------------
+void FrameWriter::Flush()
+{
+    std::unique_lock<std::mutex> locker(m_Mutex);
+    m_Idle.wait(locker, [&]() { return m_Queued == 0; });
+}
+
+//-----------------------------------------------------------------------------
+//      統計を取得します.
+//-----------------------------------------------------------------------------
+FrameWriterStats FrameWriter::GetStats() const
+{
+    // 標本のコピーだけをロック内で行い, ソートはロックの外で行います.
+    MetricsReservoir    submitUsec;
+    MetricsReservoir    latencyMsec;
+    FrameWriterStats    result;
+    {
+        std::lock_guard<std::mutex> locker(m_Mutex);
+        result      = m_Stats;
+        submitUsec  = m_SubmitUsec;
+        latencyMsec = m_LatencyMsec;
+        if (result.Submitted > 0)
+        { result.MeanQueued = double(m_QueuedSum) / double(result.Submitted); }
+    }
+
+    if (m_Running)
+    {
+        auto timer = m_RunTimer;
+        timer.End();
+        result.ElapsedSec = timer.GetElapsedSec();
+    }
+
+    result.SubmitUsec  = submitUsec .GetPercentiles();
+    result.LatencyMsec = latencyMsec.GetPercentiles();
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      バックエンドがこの環境で使えるかどうか.
+//-----------------------------------------------------------------------------
+bool FrameWriter::IsSupported(FRAME_WRITER_BACKEND backend)
+{
+    if (backend != FRAME_WRITER_BACKEND_IO_URING)
+    { return true; }
+
+#if defined(__linux__)
+    static const bool supported = []()
+    {
+        Uring ring;
+        return ring.Init(4);
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+//      バックエンドの名前を取得します.
+//-----------------------------------------------------------------------------
+const char* FrameWriter::GetBackendName(FRAME_WRITER_BACKEND backend)
+{
+    switch(backend)
+    {
+    case FRAME_WRITER_BACKEND_IO_URING:     return "io_uring";
+    case FRAME_WRITER_BACKEND_THREAD_POOL:  return "thread_pool";
+    default:                                return "auto";
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      待機中の要求を取り出します. ロックした状態で呼んでください.
+//-----------------------------------------------------------------------------
+FrameWriter::Request* FrameWriter::Pop()
+{
+    auto pRequest = m_Pending.front();
+    m_Pending.pop_front();
+
+    m_InFlight++;
+    m_Stats.MaxInFlight = std::max(m_Stats.MaxInFlight, m_InFlight);
+    return pRequest;
+}
+
+//-----------------------------------------------------------------------------
+//      要求を完了し, ステージングバッファを返却します.
+//-----------------------------------------------------------------------------
+void FrameWriter::Complete(Request* pRequest, bool success)
+{
+    pRequest->Latency.End();
+
+    if (!success)
+    { RTC_ELOG("Error : Frame write failed. path = %s", pRequest->Path.c_str()); }
+
+    if (pRequest->Slot == UINT32_MAX)
+    { TaggedFree(MEMORY_TAG_ENCODE, pRequest->pData); }
+
+    {
+        std::lock_guard<std::mutex> locker(m_Mutex);
+        if (pRequest->Slot != UINT32_MAX)
+        { m_FreeSlots.push_back(pRequest->Slot); }
+
+        if (success)
+        {
+            m_Stats.Completed++;
+            m_Stats.Bytes += pRequest->Size;
+        }
+        else
+        { m_Stats.Failed++; }
+
+        m_LatencyMsec.Add(pRequest->Latency.GetElapsedMsec());
+        m_InFlight--;
+        m_Queued--;
+        if (m_Queued == 0)
+        { m_Idle.notify_all(); }
+    }
+
+    delete pRequest;
+}
+
+//-----------------------------------------------------------------------------
+//      スレッドプールのワーカーです.
+//-----------------------------------------------------------------------------
+void FrameWriter::WorkerThread()
+{
+    for(;;)
+    {
+        Request* pRequest = nullptr;
+        {
+            std::unique_lock<std::mutex> locker(m_Mutex);
+            m_Wake.wait(locker, [&]() { return m_StopRequest || !m_Pending.empty(); });
+            if (m_Pending.empty())
+            { break; }
+
+            pRequest = Pop();
+        }
+
+        auto success = WriteFileBlocking(pRequest->Path.c_str(), pRequest->pData, pRequest->Size, pRequest->WriteSize, pRequest->Direct);
+        Complete(pRequest, success);
+    }
+}
+
+#if defined(__linux__)
+//-----------------------------------------------------------------------------
+//      io_uring を初期化します.
+//-----------------------------------------------------------------------------
+bool FrameWriter::InitUring()
+{
+    // eventfd の監視に 1 エントリを使います.
+    m_pUring.reset(new Uring());
+    if (!m_pUring->Init(m_Desc.QueueDepth + 1))
+    {
+        m_pUring.reset();
+        return false;
+    }
+
+    m_pUring->RegisterBuffers(m_pPool, m_SlotSize, m_Desc.BufferCount);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      io_uring を破棄します.
+//-----------------------------------------------------------------------------
+void FrameWriter::TermUring()
+{ m_pUring.reset(); }
+
+//-----------------------------------------------------------------------------
+//      io_uring の発行と完了処理を行うスレッドです.
+//      1 ファイルにつき 作成 -> 書き込み -> クローズ を順に発行し, 同時に QueueDepth ファイルまで進めます.
+//-----------------------------------------------------------------------------
+void FrameWriter::UringThread()
+{
+    auto& ring  = *m_pUring;
+    auto  limit = m_Desc.QueueDepth;
+
+    std::vector<Request*> requests;
+    uint32_t active = 0;
+
+    // 空きエントリを取得します. 満杯なら溜まったエントリを発行してから取り直します.
+    auto acquire = [&](Request* pRequest)
+    {
+        auto pSqe = ring.Next(reinterpret_cast<uint64_t>(pRequest));
+        if (pSqe == nullptr)
+        {
+            ring.Submit();
+            pSqe = ring.Next(reinterpret_cast<uint64_t>(pRequest));
+        }
+        return pSqe;
+    };
+
+    // エントリを取得できなかった要求は, 開いたファイルを直接閉じて完了させます.
+    auto abort = [&](Request* pRequest, bool success)
+    {
+        RTC_ELOG("Error : io_uring submission queue is full. path = %s", pRequest->Path.c_str());
+        if (pRequest->Fd >= 0 && close(pRequest->Fd) != 0)
+        { success = false; }
+        pRequest->Fd = -1;
+        active--;
+        Complete(pRequest, success);
+    };
+
+    auto prepOpen = [&](Request* pRequest)
+    {
+        pRequest->Stage = kStageOpen;
+        auto pSqe = acquire(pRequest);
+        if (pSqe == nullptr)
+        {
+            abort(pRequest, false);
+            return;
+        }
+        pSqe->opcode     = IORING_OP_OPENAT;
+        pSqe->fd         = AT_FDCWD;
+        pSqe->addr       = reinterpret_cast<uint64_t>(pRequest->Path.c_str());
+        pSqe->len        = 0644;
+        pSqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (pRequest->Direct ? O_DIRECT : 0);
+    };
+
+    auto prepWrite = [&](Request* pRequest)
+    {
+        pRequest->Stage = kStageWrite;
+        auto pSqe = acquire(pRequest);
+        if (pSqe == nullptr)
+        {
+            abort(pRequest, false);
+            return;
+        }
+        auto fixed = ring.FixedBuffers && pRequest->Slot != UINT32_MAX;
+        pSqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        pSqe->fd     = pRequest->Fd;
+        pSqe->addr   = reinterpret_cast<uint64_t>(pRequest->pData + pRequest->Written);
+        pSqe->len    = uint32_t(std::min(pRequest->WriteSize - pRequest->Written, kMaxWriteSize));
+        pSqe->off    = pRequest->Written;
+        if (fixed)
+        { pSqe->buf_index = uint16_t(pRequest->Slot); }
+    };
+
+    auto prepClose = [&](Request* pRequest)
+    {
+        pRequest->Stage = kStageClose;
+        auto pSqe = acquire(pRequest);
+        if (pSqe == nullptr)
+        {
+            abort(pRequest, !pRequest->Failed);
+            return;
+        }
+        pSqe->opcode = IORING_OP_CLOSE;
+        pSqe->fd     = pRequest->Fd;
+    };
+
+    for(;;)
+    {
+        requests.clear();
+        bool stop = false;
+        {
+            std::lock_guard<std::mutex> locker(m_Mutex);
+            while(active + requests.size() < limit && !m_Pending.empty())
+            { requests.push_back(Pop()); }
+            stop = m_StopRequest && m_Pending.empty() && active == 0 && requests.empty();
+        }
+        if (stop)
+        { break; }
+
+        active += uint32_t(requests.size());
+        for(auto pRequest : requests)
+        { prepOpen(pRequest); }
+
+        // 取得できなければ次の周回で登録し直します.
+        auto pPollSqe = ring.PollArmed ? nullptr : ring.Next(kPollTag);
+        if (pPollSqe != nullptr)
+        {
+            pPollSqe->opcode      = IORING_OP_POLL_ADD;
+            pPollSqe->fd          = ring.EventFd;
+            pPollSqe->poll_events = POLLIN;
+            ring.PollArmed = true;
+        }
+
+        ring.Enter();
+
+        auto head = *ring.pCqHead;
+        auto tail = __atomic_load_n(ring.pCqTail, __ATOMIC_ACQUIRE);
+        for(; head != tail; ++head)
+        {
+            auto& cqe = ring.pCqes[head & ring.CqMask];
+            if (cqe.user_data == kPollTag)
+            {
+                uint64_t value;
+                RTC_UNUSED(read(ring.EventFd, &value, sizeof(value)));
+                ring.PollArmed = false;
+                continue;
+            }
+
+            auto pRequest = reinterpret_cast<Request*>(cqe.user_data);
+            auto result   = cqe.res;
+            switch(pRequest->Stage)
+            {
+            case kStageOpen:
+                if (result >= 0)
+                {
+                    pRequest->Fd = result;
+                    if (pRequest->WriteSize > 0)
+                    { prepWrite(pRequest); }
+                    else
+                    { prepClose(pRequest); }
+                }
+                else if (result == -EINVAL && pRequest->Direct)
+                {
+                    // ダイレクト I/O に対応していないファイルシステムです.
+                    pRequest->Direct    = false;
+                    pRequest->WriteSize = pRequest->Size;
+                    prepOpen(pRequest);
+                }
+                else
+                {
+                    active--;
+                    Complete(pRequest, false);
+                }
+                break;
+
+            case kStageWrite:
+                if (result == -EINTR || result == -EAGAIN)
+                { prepWrite(pRequest); }
+                else if (result <= 0)
+                {
+                    pRequest->Failed = true;
+                    prepClose(pRequest);
+                }
+                else
+                {
+                    pRequest->Written += size_t(result);
+                    if (pRequest->Written < pRequest->WriteSize)
+                    { prepWrite(pRequest); }
+                    else
+                    {
+                        // 切り詰めは io_uring の命令が新しいカーネルにしか無いため直接呼びます.
+                        if (pRequest->WriteSize != pRequest->Size && ftruncate(pRequest->Fd, off_t(pRequest->Size)) != 0)
+                        { pRequest->Failed = true; }
+                        prepClose(pRequest);
+                    }
+                }
+                break;
+
+            default:
+                active--;
+                Complete(pRequest, !pRequest->Failed && result >= 0);
+                break;
+            }
+        }
+        __atomic_store_n(ring.pCqHead, head, __ATOMIC_RELEASE);
+    }
+}
+#else
+//-----------------------------------------------------------------------------
+//      io_uring は Linux でのみ使えます.
+//-----------------------------------------------------------------------------
+bool FrameWriter::InitUring()
+{ return false; }
+
+//-----------------------------------------------------------------------------
+//      io_uring を破棄します.
+//-----------------------------------------------------------------------------
+void FrameWriter::TermUring()
+{ /* DO_NOTHING */ }
+
+//-----------------------------------------------------------------------------
+//      io_uring の発行と完了処理を行うスレッドです.
+//-----------------------------------------------------------------------------
+void FrameWriter::UringThread()
+{ /* DO_NOTHING */ }
+#endif
+
+} // namespace rtc
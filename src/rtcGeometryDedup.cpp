@@ -0,0 +1,224 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcGeometryDedup.cpp
+// Desc : Geometry Deduplication.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcGeometryDedup.h>
+#include <rtcHash.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <cstring>
+#include <unordered_map>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t kMaxInstanceId = 0xFFFFFF;   // D3D12_RAYTRACING_INSTANCE_DESC::InstanceID は 24bit.
+
+//-----------------------------------------------------------------------------
+//      頂点データのサイズを取得します.
+//-----------------------------------------------------------------------------
+inline size_t GetVertexBytes(const rtc::MeshSource& mesh)
+{ return size_t(mesh.VertexCount) * mesh.VertexStride; }
+
+//-----------------------------------------------------------------------------
+//      インデックスデータのサイズを取得します.
+//-----------------------------------------------------------------------------
+inline size_t GetIndexBytes(const rtc::MeshSource& mesh)
+{ return size_t(mesh.IndexCount) * sizeof(uint32_t); }
+
+//-----------------------------------------------------------------------------
+//      メッシュ内容のハッシュ値を計算します.
+//-----------------------------------------------------------------------------
+uint64_t HashMesh(const rtc::MeshSource& mesh)
+{
+    uint32_t layout[] = { mesh.VertexCount, mesh.VertexStride, mesh.IndexCount };
+    auto h = rtc::Hash64(layout, sizeof(layout), 0);
+    h = rtc::Hash64(mesh.pVertices, GetVertexBytes(mesh), h);
+    h = rtc::Hash64(mesh.pIndices,  GetIndexBytes(mesh),  h);
+    return h;
+}
+
+//-----------------------------------------------------------------------------
+//      メッシュ内容が一致するか検証します.
+//-----------------------------------------------------------------------------
+bool IsSameMesh(const rtc::MeshSource& a, const rtc::MeshSource& b)
+{
+    if (a.VertexCount != b.VertexCount || a.VertexStride != b.VertexStride || a.IndexCount != b.IndexCount)
+    { return false; }
+
+    if (a.pVertices != b.pVertices && memcmp(a.pVertices, b.pVertices, GetVertexBytes(a)) != 0)
+    { return false; }
+
+    return a.pIndices == b.pIndices || memcmp(a.pIndices, b.pIndices, GetIndexBytes(a)) == 0;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// GeometryDedupStats structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      統計情報をログ出力します.
+//-----------------------------------------------------------------------------
+void GeometryDedupStats::Print() const
+{
+    RTC_ILOG("GeometryDedup : %u meshes -> %u geometries, %.3lf msec", MeshCount, GeometryCount, ElapsedMsec);
+    RTC_ILOG("  saved memory  : %.2lf MB / %.2lf MB", SavedBytes / (1024.0 * 1024.0), SourceBytes / (1024.0 * 1024.0));
+    RTC_ILOG("  avoided build : %u blas, %llu triangles (%.2lf%%)",
+        AvoidedBuilds,
+        static_cast<unsigned long long>(AvoidedTriangles),
+        GetAvoidedBuildRatio() * 100.0);
+    if (HashCollisions > 0)
+    { RTC_ILOG("  hash collisions : %u", HashCollisions); }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GeometryDedup class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      重複を除去します.
+//-----------------------------------------------------------------------------
+bool GeometryDedup::Execute(const MeshSource* pMeshes, uint32_t count)
+{
+    Clear();
+
+    if (pMeshes == nullptr || count == 0)
+    { return false; }
+
+    Timer timer;
+    timer.Start();
+
+    m_Instances.reserve(count);
+    m_Records  .reserve(count);
+
+    // ハッシュ値 -> ジオメトリ番号. 衝突に備えて同じハッシュ値の候補は連結リストで辿る.
+    std::unordered_map<uint64_t, uint32_t> heads;
+    std::vector<uint32_t>                  nexts;
+    heads.reserve(count);
+
+    for(auto i=0u; i<count; ++i)
+    {
+        auto& mesh = pMeshes[i];
+        if ((mesh.VertexCount > 0 && mesh.pVertices == nullptr) || (mesh.IndexCount > 0 && mesh.pIndices == nullptr))
+        {
+            RTC_ELOG("Error : Invalid mesh. index = %u", i);
+            Clear();
+            return false;
+        }
+
+        auto hash  = HashMesh(mesh);
+        auto bytes = GetVertexBytes(mesh) + GetIndexBytes(mesh);
+        auto tris  = uint64_t(mesh.IndexCount / 3);
+
+        m_Stats.SourceBytes     += bytes;
+        m_Stats.SourceTriangles += tris;
+
+        auto geometryId = UINT32_MAX;
+        auto itr = heads.find(hash);
+        if (itr != heads.end())
+        {
+            for(auto id = itr->second; id != UINT32_MAX; id = nexts[id])
+            {
+                if (IsSameMesh(pMeshes[m_Geometries[id].MeshIndex], mesh))
+                { geometryId = id; break; }
+            }
+
+            if (geometryId == UINT32_MAX)
+            { m_Stats.HashCollisions++; }
+        }
+
+        if (geometryId == UINT32_MAX)
+        {
+            geometryId = uint32_t(m_Geometries.size());
+            m_Geometries.push_back({ i, 0, hash });
+            nexts.push_back((itr != heads.end()) ? itr->second : UINT32_MAX);
+            heads[hash] = geometryId;
+        }
+        else
+        {
+            m_Stats.AvoidedBuilds++;
+            m_Stats.AvoidedTriangles += tris;
+            m_Stats.SavedBytes       += bytes;
+        }
+
+        auto& geometry = m_Geometries[geometryId];
+        geometry.InstanceCount++;
+
+        // 頂点・インデックスは代表メッシュのバッファを参照し, マテリアルはインスタンスごとに保持する.
+        auto& canonical = pMeshes[geometry.MeshIndex];
+        m_Instances.push_back({ geometryId, i, mesh.World });
+        m_Records  .push_back({ canonical.VertexId, canonical.IndexId, mesh.MaterialId });
+    }
+
+    timer.End();
+
+    m_Stats.MeshCount     = count;
+    m_Stats.GeometryCount = uint32_t(m_Geometries.size());
+    m_Stats.ElapsedMsec   = timer.GetElapsedMsec();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      破棄処理を行います.
+//-----------------------------------------------------------------------------
+void GeometryDedup::Clear()
+{
+    m_Geometries.clear();
+    m_Instances .clear();
+    m_Records   .clear();
+    m_Stats = GeometryDedupStats();
+}
+
+//-----------------------------------------------------------------------------
+//      インスタンス記述を書き込みます.
+//-----------------------------------------------------------------------------
+bool GeometryDedup::FillInstanceDescs
+(
+    const D3D12_GPU_VIRTUAL_ADDRESS*    pBlasAddresses,
+    D3D12_RAYTRACING_INSTANCE_DESC*     pDescs
+) const
+{
+    if (pBlasAddresses == nullptr || pDescs == nullptr)
+    { return false; }
+
+    // InstanceID は 24bit に切り詰められるので, 収まらない場合は書き込まない.
+    if (m_Instances.size() > size_t(kMaxInstanceId) + 1)
+    {
+        RTC_ELOG("Error : Too many instances for 24bit InstanceID. count = %zu, max = %u",
+            m_Instances.size(), kMaxInstanceId + 1);
+        return false;
+    }
+
+    for(size_t i=0; i<m_Instances.size(); ++i)
+    {
+        auto& instance = m_Instances[i];
+        auto& desc     = pDescs[i];
+
+        for(auto r=0; r<3; ++r)
+        for(auto c=0; c<4; ++c)
+        { desc.Transform[r][c] = instance.World.row[r][c]; }
+
+        desc.InstanceID                          = uint32_t(i);
+        desc.InstanceMask                        = 0xFF;
+        desc.InstanceContributionToHitGroupIndex = 0;
+        desc.Flags                               = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
+        desc.AccelerationStructure               = pBlasAddresses[instance.GeometryId];
+    }
+
+    return true;
+}
+
+} // namespace rtc
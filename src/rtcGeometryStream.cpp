@@ -0,0 +1,832 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcGeometryStream.cpp
+// Desc : Out-of-Core Geometry Streaming.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcGeometryStream.h>
+#include <rtcFrameArena.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <algorithm>
+#include <thread>
+#include <Windows.h>
+#include <Psapi.h>
+
+#pragma comment(lib, "psapi.lib")
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t kStreamMagic     = 0x54534752;   // 'RGST'
+constexpr uint32_t kStreamVersion   = 1;
+constexpr uint32_t kStackSize       = 128;          // 走査スタックの初期サイズ. 足りない場合はヒープに拡張します.
+constexpr uint32_t kBatchChunk      = 64;           // TraceBatch() でスレッドが一度に取るレイ数.
+
+///////////////////////////////////////////////////////////////////////////////
+// FileHeader structure
+///////////////////////////////////////////////////////////////////////////////
+struct FileHeader
+{
+    uint32_t    Magic;
+    uint32_t    Version;
+    uint32_t    HeaderSize;
+    uint32_t    PageSize;
+    uint32_t    NodeSize;           // sizeof(BvhNode)
+    uint32_t    TriangleSize;       // sizeof(Bvh8Triangle)
+    uint32_t    ClusterSize;        // sizeof(StreamCluster)
+    uint32_t    TopNodeCount;
+    uint32_t    ClusterCount;
+    uint32_t    TriangleCount;
+    uint64_t    TopNodeOffset;
+    uint64_t    ClusterOffset;
+    uint64_t    FileSize;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// StackEntry structure
+///////////////////////////////////////////////////////////////////////////////
+struct StackEntry
+{
+    uint32_t    Index;
+    float       TNear;      // 積んだ時点の入射距離. 取り出す時に縮んだ tmax と比べる.
+};
+
+//-----------------------------------------------------------------------------
+//      二分木を近い順に辿り, 葉ごとに leaf(node, tmax) を呼び出します.
+//-----------------------------------------------------------------------------
+template<typename LeafFunc>
+bool Traverse
+(
+    const rtc::BvhNode* pNodes,
+    const rtc::BvhRay&  ray,
+    const rtc::float3&  invDir,
+    float&              tmax,
+    LeafFunc            leaf
+)
+{
+    rtc::TraversalStack<StackEntry, kStackSize> stack;
+
+    float tnear;
+    if (!rtc::IntersectBox(pNodes[0].Bounds.Min, pNodes[0].Bounds.Max, ray.Origin, invDir, ray.TMin, tmax, tnear))
+    { return false; }
+
+    auto found = false;
+    auto index = 0u;
+    for(;;)
+    {
+        auto& node = pNodes[index];
+        if (node.IsLeaf())
+        {
+            found |= leaf(node, tmax);
+        }
+        else
+        {
+            float t0, t1;
+            auto hit0 = rtc::IntersectBox(pNodes[node.Index + 0].Bounds.Min, pNodes[node.Index + 0].Bounds.Max, ray.Origin, invDir, ray.TMin, tmax, t0);
+            auto hit1 = rtc::IntersectBox(pNodes[node.Index + 1].Bounds.Min, pNodes[node.Index + 1].Bounds.Max, ray.Origin, invDir, ray.TMin, tmax, t1);
+
+            if (hit0 && hit1)
+            {
+                auto nearIndex = (t0 <= t1) ? node.Index : node.Index + 1;
+                auto farIndex  = (t0 <= t1) ? node.Index + 1 : node.Index;
+                stack.Push({ farIndex, std::max(t0, t1) });
+                index = nearIndex;
+                continue;
+            }
+            else if (hit0)
+            {
+                index = node.Index;
+                continue;
+            }
+            else if (hit1)
+            {
+                index = node.Index + 1;
+                continue;
+            }
+        }
+
+        // 積んだ後で近い側の葉が tmax を縮めていれば, 遠い側の節は辿らない.
+        auto next = false;
+        while(!stack.IsEmpty())
+        {
+            auto entry = stack.Pop();
+            if (entry.TNear <= tmax)
+            {
+                index = entry.Index;
+                next  = true;
+                break;
+            }
+        }
+
+        if (!next)
+        { break; }
+    }
+
+    return found;
+}
+
+//-----------------------------------------------------------------------------
+//      プロセスのメモリカウンタを取得します.
+//-----------------------------------------------------------------------------
+PROCESS_MEMORY_COUNTERS GetProcessMemoryCounters()
+{
+    PROCESS_MEMORY_COUNTERS counters = {};
+    counters.cb = sizeof(counters);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    { counters = {}; }
+    return counters;
+}
+
+//-----------------------------------------------------------------------------
+//      アラインメントに切り上げます.
+//-----------------------------------------------------------------------------
+inline uint64_t AlignUp(uint64_t value, uint64_t align)
+{ return (value + align - 1) / align * align; }
+
+///////////////////////////////////////////////////////////////////////////////
+// ClusterLayout class
+///////////////////////////////////////////////////////////////////////////////
+class ClusterLayout
+{
+public:
+    std::vector<rtc::BvhNode>       TopNodes;
+    std::vector<rtc::StreamCluster> Clusters;
+    std::vector<uint32_t>           Roots;      // クラスタの根となる元のノード番号.
+
+    ClusterLayout(const rtc::Bvh& bvh, uint32_t clusterBytes, uint32_t pageSize)
+    : m_pSrc(bvh.GetNodes())
+    , m_ClusterBytes(clusterBytes)
+    , m_PageSize(pageSize)
+    {
+        m_NodeCounts    .resize(bvh.GetNodeCount());
+        m_TriangleCounts.resize(bvh.GetNodeCount());
+        Count(0);
+
+        TopNodes.resize(1);
+        Emit(0, 0);
+    }
+
+    //-------------------------------------------------------------------------
+    //      クラスタのノードと三角形を書き出します.
+    //-------------------------------------------------------------------------
+    static void Serialize
+    (
+        const rtc::Bvh&                 bvh,
+        uint32_t                        srcIndex,
+        uint32_t                        dstIndex,
+        std::vector<rtc::BvhNode>&      nodes,
+        std::vector<rtc::Bvh8Triangle>& triangles
+    )
+    {
+        auto& src = bvh.GetNodes()[srcIndex];
+        if (src.IsLeaf())
+        {
+            nodes[dstIndex] = { src.Bounds, uint32_t(triangles.size()), src.Count };
+
+            auto pPositions = bvh.GetPositions();
+            auto pIndices   = bvh.GetIndices();
+            for(auto i=0u; i<src.Count; ++i)
+            {
+                auto primId = bvh.GetReferences()[src.Index + i];
+                auto& p0 = pPositions[pIndices[primId * 3 + 0]];
+                auto& p1 = pPositions[pIndices[primId * 3 + 1]];
+                auto& p2 = pPositions[pIndices[primId * 3 + 2]];
+                triangles.push_back({ p0, p1 - p0, p2 - p0, primId });
+            }
+            return;
+        }
+
+        auto child = uint32_t(nodes.size());
+        nodes.resize(nodes.size() + 2);
+        nodes[dstIndex] = { src.Bounds, child, 0 };
+        Serialize(bvh, src.Index + 0, child + 0, nodes, triangles);
+        Serialize(bvh, src.Index + 1, child + 1, nodes, triangles);
+    }
+
+private:
+    const rtc::BvhNode*     m_pSrc;
+    uint32_t                m_ClusterBytes;
+    uint32_t                m_PageSize;
+    std::vector<uint32_t>   m_NodeCounts;
+    std::vector<uint32_t>   m_TriangleCounts;
+
+    //-------------------------------------------------------------------------
+    //      部分木のノード数と三角形数を数えます.
+    //-------------------------------------------------------------------------
+    void Count(uint32_t index)
+    {
+        auto& node = m_pSrc[index];
+        if (node.IsLeaf())
+        {
+            m_NodeCounts    [index] = 1;
+            m_TriangleCounts[index] = node.Count;
+            return;
+        }
+
+        Count(node.Index + 0);
+        Count(node.Index + 1);
+        m_NodeCounts    [index] = 1 + m_NodeCounts    [node.Index] + m_NodeCounts    [node.Index + 1];
+        m_TriangleCounts[index] =     m_TriangleCounts[node.Index] + m_TriangleCounts[node.Index + 1];
+    }
+
+    //-------------------------------------------------------------------------
+    //      目標サイズ以下になるまで上位木を下り, 部分木をクラスタにします.
+    //-------------------------------------------------------------------------
+    void Emit(uint32_t srcIndex, uint32_t topIndex)
+    {
+        auto& src   = m_pSrc[srcIndex];
+        auto  bytes = uint64_t(m_NodeCounts[srcIndex]) * sizeof(rtc::BvhNode)
+                    + uint64_t(m_TriangleCounts[srcIndex]) * sizeof(rtc::Bvh8Triangle);
+
+        if (src.IsLeaf() || bytes <= m_ClusterBytes)
+        {
+            rtc::StreamCluster cluster = {};
+            cluster.Size            = uint32_t(AlignUp(bytes, m_PageSize));
+            cluster.NodeCount       = m_NodeCounts[srcIndex];
+            cluster.TriangleCount   = m_TriangleCounts[srcIndex];
+
+            TopNodes[topIndex] = { src.Bounds, uint32_t(Clusters.size()), 1 };
+            Clusters.push_back(cluster);
+            Roots   .push_back(srcIndex);
+            return;
+        }
+
+        auto child = uint32_t(TopNodes.size());
+        TopNodes.resize(TopNodes.size() + 2);
+        TopNodes[topIndex] = { src.Bounds, child, 0 };
+        Emit(src.Index + 0, child + 0);
+        Emit(src.Index + 1, child + 1);
+    }
+};
+
+//-----------------------------------------------------------------------------
+//      パディングしてから書き込みます.
+//-----------------------------------------------------------------------------
+bool WriteAligned(HANDLE hFile, const void* pData, uint64_t size, uint64_t align, uint64_t& offset)
+{
+    static const uint8_t kZeros[4096] = {};
+
+    auto padding = AlignUp(offset, align) - offset;
+    while (padding > 0)
+    {
+        auto chunk   = DWORD(std::min<uint64_t>(padding, sizeof(kZeros)));
+        DWORD written = 0;
+        if (!WriteFile(hFile, kZeros, chunk, &written, nullptr) || written != chunk)
+        { return false; }
+        padding -= chunk;
+        offset  += chunk;
+    }
+
+    auto p = static_cast<const uint8_t*>(pData);
+    while (size > 0)
+    {
+        auto chunk   = DWORD(std::min<uint64_t>(size, 1u << 30));
+        DWORD written = 0;
+        if (!WriteFile(hFile, p, chunk, &written, nullptr) || written != chunk)
+        { return false; }
+        p      += chunk;
+        size   -= chunk;
+        offset += chunk;
+    }
+    return true;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// GeometryStreamStats structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      統計情報をログ出力します.
+//-----------------------------------------------------------------------------
+void GeometryStreamStats::Print() const
+{
+    RTC_DLOG("GeometryStream : %llu rays, %.3lf Mrays/sec",
+        static_cast<unsigned long long>(Rays), GetRaysPerSec() * 1e-6);
+    RTC_DLOG("  clusters : misses = %llu, prefetches = %llu, evictions = %llu",
+        static_cast<unsigned long long>(ClusterMisses),
+        static_cast<unsigned long long>(Prefetches),
+        static_cast<unsigned long long>(Evictions));
+    RTC_DLOG("  clusters : touched = %.2lf MB, tracked resident = %.2lf MB (peak %.2lf MB)",
+        ClusterBytesTouched / (1024.0 * 1024.0),
+        TrackedResidentBytes / (1024.0 * 1024.0),
+        PeakTrackedResidentBytes / (1024.0 * 1024.0));
+    RTC_DLOG("  process  : page faults = %llu, mapped resident = %.2lf MB, working set = %.2lf MB (peak %.2lf MB)",
+        static_cast<unsigned long long>(PageFaults),
+        MappedResidentBytes / (1024.0 * 1024.0),
+        WorkingSetBytes / (1024.0 * 1024.0),
+        PeakWorkingSetBytes / (1024.0 * 1024.0));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GeometryStream class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      クラスタ化したファイルを書き出します.
+//-----------------------------------------------------------------------------
+bool GeometryStream::Write(const char* path, const Bvh& bvh, const GeometryStreamBuildDesc& desc)
+{
+    if (path == nullptr || bvh.GetNodeCount() == 0 || bvh.GetPositions() == nullptr || desc.PageSize == 0)
+    { return false; }
+
+    ClusterLayout layout(bvh, desc.ClusterBytes, desc.PageSize);
+
+    FileHeader header = {};
+    header.Magic        = kStreamMagic;
+    header.Version      = kStreamVersion;
+    header.HeaderSize   = sizeof(FileHeader);
+    header.PageSize     = desc.PageSize;
+    header.NodeSize     = sizeof(BvhNode);
+    header.TriangleSize = sizeof(Bvh8Triangle);
+    header.ClusterSize  = sizeof(StreamCluster);
+    header.TopNodeCount = uint32_t(layout.TopNodes.size());
+    header.ClusterCount = uint32_t(layout.Clusters.size());
+    header.TriangleCount = bvh.GetTriangleCount();
+
+    // 先に配置を決めてから, ヘッダ -> 上位木 -> クラスタ表 -> クラスタの順に書き出す.
+    uint64_t offset = sizeof(FileHeader);
+    header.TopNodeOffset = offset = AlignUp(offset, 64); offset += layout.TopNodes.size() * sizeof(BvhNode);
+    header.ClusterOffset = offset = AlignUp(offset, 64); offset += layout.Clusters.size() * sizeof(StreamCluster);
+    for(auto& cluster : layout.Clusters)
+    {
+        cluster.Offset = offset = AlignUp(offset, desc.PageSize);
+        offset += cluster.Size;
+    }
+    header.FileSize = offset;
+
+    auto hFile = CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        RTC_ELOG("Error : CreateFile() Failed. path = %s", path);
+        return false;
+    }
+
+    uint64_t written = 0;
+    auto ret = WriteAligned(hFile, &header, sizeof(header), 1, written)
+            && WriteAligned(hFile, layout.TopNodes.data(), layout.TopNodes.size() * sizeof(BvhNode),       64, written)
+            && WriteAligned(hFile, layout.Clusters.data(), layout.Clusters.size() * sizeof(StreamCluster), 64, written);
+
+    std::vector<BvhNode>      nodes;
+    std::vector<Bvh8Triangle> triangles;
+    for(size_t i=0; ret && i<layout.Clusters.size(); ++i)
+    {
+        auto& cluster = layout.Clusters[i];
+        nodes    .clear();
+        triangles.clear();
+        nodes.resize(1);
+        ClusterLayout::Serialize(bvh, layout.Roots[i], 0, nodes, triangles);
+
+        ret = WriteAligned(hFile, nodes    .data(), nodes    .size() * sizeof(BvhNode),      desc.PageSize, written)
+           && WriteAligned(hFile, triangles.data(), triangles.size() * sizeof(Bvh8Triangle), 1,             written);
+    }
+
+    // 最後のクラスタの末尾もページ境界まで埋める.
+    ret = ret && WriteAligned(hFile, nullptr, 0, desc.PageSize, written);
+    CloseHandle(hFile);
+
+    if (!ret || written != header.FileSize)
+    {
+        RTC_ELOG("Error : GeometryStream write failed. path = %s", path);
+        DeleteFileA(path);
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      ファイルをマップします.
+//-----------------------------------------------------------------------------
+bool GeometryStream::Open(const char* path, const GeometryStreamDesc& desc)
+{
+    Close();
+
+    auto hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        RTC_ELOG("Error : CreateFile() Failed. path = %s", path);
+        return false;
+    }
+    m_hFile = hFile;
+
+    LARGE_INTEGER fileSize = {};
+    if (!GetFileSizeEx(hFile, &fileSize) || uint64_t(fileSize.QuadPart) < sizeof(FileHeader))
+    {
+        Close();
+        return false;
+    }
+    m_FileSize = size_t(fileSize.QuadPart);
+
+    m_hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_hMapping == nullptr)
+    {
+        RTC_ELOG("Error : CreateFileMapping() Failed. path = %s", path);
+        Close();
+        return false;
+    }
+
+    m_pBase = static_cast<const uint8_t*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_pBase == nullptr)
+    {
+        RTC_ELOG("Error : MapViewOfFile() Failed. path = %s", path);
+        Close();
+        return false;
+    }
+
+    auto& header = *reinterpret_cast<const FileHeader*>(m_pBase);
+    if (header.Magic        != kStreamMagic
+     || header.Version      != kStreamVersion
+     || header.HeaderSize   != sizeof(FileHeader)
+     || header.NodeSize     != sizeof(BvhNode)
+     || header.TriangleSize != sizeof(Bvh8Triangle)
+     || header.ClusterSize  != sizeof(StreamCluster)
+     || header.FileSize     != m_FileSize
+     || header.PageSize     == 0
+     || header.TopNodeCount == 0
+     || header.ClusterCount == 0
+     || header.TopNodeOffset > m_FileSize
+     || header.ClusterOffset > m_FileSize
+     || uint64_t(header.TopNodeCount) > (m_FileSize - header.TopNodeOffset) / sizeof(BvhNode)
+     || uint64_t(header.ClusterCount) > (m_FileSize - header.ClusterOffset) / sizeof(StreamCluster))
+    {
+        RTC_ELOG("Error : Invalid geometry stream. path = %s", path);
+        Close();
+        return false;
+    }
+
+    m_pTopNodes    = reinterpret_cast<const BvhNode*>(m_pBase + header.TopNodeOffset);
+    m_TopNodeCount = header.TopNodeCount;
+    m_pClusters    = reinterpret_cast<const StreamCluster*>(m_pBase + header.ClusterOffset);
+    m_ClusterCount = header.ClusterCount;
+
+    // 上位木の葉はクラスタ番号を, 節は自分より後ろの子を指す.
+    for(auto i=0u; i<m_TopNodeCount; ++i)
+    {
+        auto& node  = m_pTopNodes[i];
+        auto  valid = node.IsLeaf()
+            ? (node.Index < m_ClusterCount)
+            : (node.Index > i && uint64_t(node.Index) + 1 < m_TopNodeCount);
+        if (!valid)
+        {
+            RTC_ELOG("Error : Invalid top node. index = %u", i);
+            Close();
+            return false;
+        }
+    }
+
+    // ノードと三角形がクラスタのサイズに収まっていること. クラスタ内のノードは触れるまで読まない.
+    for(auto i=0u; i<m_ClusterCount; ++i)
+    {
+        auto& cluster = m_pClusters[i];
+        auto  bytes   = uint64_t(cluster.NodeCount) * sizeof(BvhNode) + uint64_t(cluster.TriangleCount) * sizeof(Bvh8Triangle);
+        if (cluster.Offset % header.PageSize != 0
+         || cluster.Offset > m_FileSize
+         || cluster.Size   > m_FileSize - cluster.Offset
+         || cluster.NodeCount == 0
+         || bytes > cluster.Size)
+        {
+            RTC_ELOG("Error : Invalid cluster. index = %u", i);
+            Close();
+            return false;
+        }
+    }
+
+    m_Desc    = desc;
+    m_LastUse = std::make_unique<std::atomic<uint32_t>[]>(m_ClusterCount);
+    for(auto i=0u; i<m_ClusterCount; ++i)
+    { m_LastUse[i].store(0, std::memory_order_relaxed); }
+
+    m_Batch = 0;
+    ResetStats();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      ファイルを閉じます.
+//-----------------------------------------------------------------------------
+void GeometryStream::Close()
+{
+    if (m_pBase != nullptr)
+    {
+        UnmapViewOfFile(m_pBase);
+        m_pBase = nullptr;
+    }
+
+    if (m_hMapping != nullptr)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = nullptr;
+    }
+
+    if (m_hFile != nullptr)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = nullptr;
+    }
+
+    m_LastUse.reset();
+    m_FileSize      = 0;
+    m_pTopNodes     = nullptr;
+    m_TopNodeCount  = 0;
+    m_pClusters     = nullptr;
+    m_ClusterCount  = 0;
+    m_TrackedBytes  = 0;
+}
+
+//-----------------------------------------------------------------------------
+//      クラスタを使用済みにします. 非常駐だった場合は true を返します.
+//-----------------------------------------------------------------------------
+bool GeometryStream::Touch(uint32_t clusterId)
+{
+    auto  stamp   = m_Batch.load(std::memory_order_relaxed) + 1;
+    auto& lastUse = m_LastUse[clusterId];
+
+    // 同じバッチで既に触れていれば書き込まない (キャッシュラインの競合を避ける).
+    if (lastUse.load(std::memory_order_relaxed) == stamp)
+    { return false; }
+
+    if (lastUse.exchange(stamp, std::memory_order_relaxed) != 0)
+    { return false; }
+
+    auto size = m_pClusters[clusterId].Size;
+    m_TouchedBytes.fetch_add(size, std::memory_order_relaxed);
+    m_TrackedBytes.fetch_add(size, std::memory_order_relaxed);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      交差判定を行います.
+//-----------------------------------------------------------------------------
+bool GeometryStream::Intersect(const BvhRay& ray, BvhHit& hit)
+{
+    if (m_TopNodeCount == 0)
+    { return false; }
+
+    auto invDir = CalcInvDir(ray.Direction);
+    auto tmax   = std::min(ray.TMax, hit.T);
+
+    return Traverse(m_pTopNodes, ray, invDir, tmax, [&](const BvhNode& topLeaf, float& topTMax)
+    {
+        auto clusterId = topLeaf.Index;
+        if (Touch(clusterId))
+        { m_ClusterMisses.fetch_add(1, std::memory_order_relaxed); }
+
+        // ここで初めてクラスタのページに触れる. 非常駐なら OS がページインする.
+        auto& cluster    = m_pClusters[clusterId];
+        auto  pNodes     = reinterpret_cast<const BvhNode*>(m_pBase + cluster.Offset);
+        auto  pTriangles = reinterpret_cast<const Bvh8Triangle*>(pNodes + cluster.NodeCount);
+
+        return Traverse(pNodes, ray, invDir, topTMax, [&](const BvhNode& leaf, float& leafTMax)
+        {
+            auto found = false;
+            for(auto i=0u; i<leaf.Count; ++i)
+            {
+                auto& tri = pTriangles[leaf.Index + i];
+
+                float t, u, v;
+                if (IntersectTriangle(ray, tri.V0, tri.E1, tri.E2, leafTMax, t, u, v))
+                {
+                    leafTMax         = t;
+                    hit.T            = t;
+                    hit.PrimitiveId  = tri.PrimitiveId;
+                    hit.Barycentrics = float2(u, v);
+                    found            = true;
+                }
+            }
+            return found;
+        });
+    });
+}
+
+//-----------------------------------------------------------------------------
+//      レイバッチのフットプリントを先読みします.
+//-----------------------------------------------------------------------------
+void GeometryStream::Prefetch(const BvhRay* pRays, uint32_t count)
+{
+    if (pRays == nullptr || m_TopNodeCount == 0)
+    { return; }
+
+    FrameArena::ThreadFrame threadFrame;
+    FrameArena::Scope       scope(threadFrame.GetArena());
+
+    std::vector<WIN32_MEMORY_RANGE_ENTRY, ArenaAllocator<WIN32_MEMORY_RANGE_ENTRY>> ranges(
+        (ArenaAllocator<WIN32_MEMORY_RANGE_ENTRY>(threadFrame.GetArena())));
+    for(auto i=0u; i<count; ++i)
+    {
+        // 予算を超えてまで先読みすると追い出しと読み込みを繰り返すだけになる.
+        if (m_TrackedBytes.load(std::memory_order_relaxed) >= m_Desc.BudgetBytes)
+        { break; }
+
+        auto& ray    = pRays[i];
+        auto  invDir = CalcInvDir(ray.Direction);
+        auto  tmax   = ray.TMax;
+
+        Traverse(m_pTopNodes, ray, invDir, tmax, [&](const BvhNode& topLeaf, float&)
+        {
+            if (Touch(topLeaf.Index))
+            {
+                auto& cluster = m_pClusters[topLeaf.Index];
+                WIN32_MEMORY_RANGE_ENTRY range = {};
+                range.VirtualAddress = const_cast<uint8_t*>(m_pBase + cluster.Offset);
+                range.NumberOfBytes  = cluster.Size;
+                ranges.push_back(range);
+            }
+            return false;
+        });
+    }
+
+    if (ranges.empty())
+    { return; }
+
+    PrefetchVirtualMemory(GetCurrentProcess(), ranges.size(), ranges.data(), 0);
+    m_Stats.Prefetches += ranges.size();
+}
+
+//-----------------------------------------------------------------------------
+//      予算を超えた分を追い出します.
+//-----------------------------------------------------------------------------
+void GeometryStream::Trim()
+{
+    auto resident = m_TrackedBytes.load();
+    if (resident <= m_Desc.BudgetBytes)
+    { return; }
+
+    FrameArena::ThreadFrame threadFrame;
+    FrameArena::Scope       scope(threadFrame.GetArena());
+
+    using Candidate = std::pair<uint32_t, uint32_t>;    // (最後に使ったバッチ, クラスタ番号).
+    std::vector<Candidate, ArenaAllocator<Candidate>> candidates((ArenaAllocator<Candidate>(threadFrame.GetArena())));
+    for(auto i=0u; i<m_ClusterCount; ++i)
+    {
+        auto stamp = m_LastUse[i].load(std::memory_order_relaxed);
+        if (stamp != 0)
+        { candidates.push_back({ stamp, i }); }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for(auto& item : candidates)
+    {
+        if (resident <= m_Desc.BudgetBytes)
+        { break; }
+
+        // ロックしていない範囲への VirtualUnlock はワーキングセットからページを外す.
+        auto& cluster = m_pClusters[item.second];
+        VirtualUnlock(const_cast<uint8_t*>(m_pBase + cluster.Offset), cluster.Size);
+
+        m_LastUse[item.second].store(0, std::memory_order_relaxed);
+        resident -= cluster.Size;
+        m_Stats.Evictions++;
+    }
+
+    m_TrackedBytes = resident;
+}
+
+//-----------------------------------------------------------------------------
+//      レイバッチを処理します.
+//-----------------------------------------------------------------------------
+void GeometryStream::TraceBatch(const BvhRay* pRays, BvhHit* pHits, uint32_t count)
+{
+    if (pRays == nullptr || pHits == nullptr || count == 0)
+    { return; }
+
+    Timer timer;
+    timer.Start();
+
+    auto faults = GetProcessMemoryCounters().PageFaultCount;
+
+    if (m_Desc.EnablePrefetch)
+    {
+        Prefetch(pRays, count);
+        UpdatePeak();
+    }
+
+    auto chunkCount  = (count + kBatchChunk - 1) / kBatchChunk;
+    auto threadCount = (m_Desc.ThreadCount > 0) ? m_Desc.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = std::min(threadCount, chunkCount);
+
+    std::atomic<uint32_t> nextChunk = {};
+    auto worker = [&]()
+    {
+        for(;;)
+        {
+            auto chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= chunkCount)
+            { break; }
+
+            auto end = std::min((chunk + 1) * kBatchChunk, count);
+            for(auto i=chunk * kBatchChunk; i<end; ++i)
+            {
+                pHits[i] = BvhHit();
+                Intersect(pRays[i], pHits[i]);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for(auto i=1u; i<threadCount; ++i)
+    { threads.emplace_back(worker); }
+
+    worker();
+
+    for(auto& thread : threads)
+    { thread.join(); }
+
+    UpdatePeak();
+    Trim();
+    m_Batch++;
+
+    timer.End();
+    m_Stats.Rays       += count;
+    m_Stats.TraceMsec  += timer.GetElapsedMsec();
+    m_Stats.PageFaults += GetProcessMemoryCounters().PageFaultCount - faults;
+}
+
+//-----------------------------------------------------------------------------
+//      常駐サイズの最大値を更新します.
+//-----------------------------------------------------------------------------
+void GeometryStream::UpdatePeak()
+{ m_Stats.PeakTrackedResidentBytes = std::max(m_Stats.PeakTrackedResidentBytes, m_TrackedBytes.load()); }
+
+//-----------------------------------------------------------------------------
+//      マップ領域のうちワーキングセットに載っているサイズを計測します.
+//-----------------------------------------------------------------------------
+size_t GeometryStream::QueryMappedResidentBytes() const
+{
+    if (m_pBase == nullptr || m_FileSize == 0)
+    { return 0; }
+
+    SYSTEM_INFO info = {};
+    GetSystemInfo(&info);
+
+    const size_t kQueryPages = 4096;    // 一度に問い合わせるページ数.
+    auto pageSize  = size_t(info.dwPageSize);
+    auto pageCount = (m_FileSize + pageSize - 1) / pageSize;
+
+    std::vector<PSAPI_WORKING_SET_EX_INFORMATION> entries(std::min(pageCount, kQueryPages));
+
+    size_t resident = 0;
+    for(size_t first=0; first<pageCount; first+=kQueryPages)
+    {
+        auto count = std::min(kQueryPages, pageCount - first);
+        for(size_t i=0; i<count; ++i)
+        { entries[i].VirtualAddress = const_cast<uint8_t*>(m_pBase + (first + i) * pageSize); }
+
+        if (!QueryWorkingSetEx(GetCurrentProcess(), entries.data(), DWORD(count * sizeof(entries[0]))))
+        { return 0; }
+
+        for(size_t i=0; i<count; ++i)
+        {
+            if (entries[i].VirtualAttributes.Valid)
+            { resident += pageSize; }
+        }
+    }
+
+    return std::min(resident, m_FileSize);
+}
+
+//-----------------------------------------------------------------------------
+//      クラスタが常駐しているかどうか.
+//-----------------------------------------------------------------------------
+bool GeometryStream::IsResident(uint32_t clusterId) const
+{ return clusterId < m_ClusterCount && m_LastUse[clusterId].load(std::memory_order_relaxed) != 0; }
+
+//-----------------------------------------------------------------------------
+//      統計情報をリセットします.
+//-----------------------------------------------------------------------------
+void GeometryStream::ResetStats()
+{
+    m_ClusterMisses = 0;
+    m_TouchedBytes  = 0;
+    m_Stats         = GeometryStreamStats();
+}
+
+//-----------------------------------------------------------------------------
+//      統計情報を取得します.
+//-----------------------------------------------------------------------------
+const GeometryStreamStats& GeometryStream::GetStats()
+{
+    auto counters = GetProcessMemoryCounters();
+
+    m_Stats.ClusterMisses           = m_ClusterMisses.load();
+    m_Stats.ClusterBytesTouched     = m_TouchedBytes.load();
+    m_Stats.TrackedResidentBytes    = m_TrackedBytes.load();
+    m_Stats.MappedResidentBytes     = QueryMappedResidentBytes();
+    m_Stats.WorkingSetBytes         = counters.WorkingSetSize;
+    m_Stats.PeakWorkingSetBytes     = counters.PeakWorkingSetSize;
+    return m_Stats;
+}
+
+} // namespace rtc
@@ -0,0 +1,261 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcHitSort.cpp
+// Desc : Visibility Buffer Hit Sorting.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcHitSort.h>
+#include <rtcFrameArena.h>
+#include <rtcTimer.h>
+#include <atomic>
+#include <thread>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t kRadixBits   = 8;
+constexpr uint32_t kRadixSize   = 1u << kRadixBits;
+constexpr uint32_t kRadixPasses = 64 / kRadixBits;
+
+//-----------------------------------------------------------------------------
+//      ヒットのマテリアル番号を取得します.
+//-----------------------------------------------------------------------------
+inline uint32_t GetMaterialId(const rtc::HitRecord& hit, const uint32_t* pMaterialIds, uint32_t instanceCount)
+{
+    if (!hit.HasHit())
+    { return UINT32_MAX; }
+
+    return (pMaterialIds != nullptr && hit.InstanceId < instanceCount) ? pMaterialIds[hit.InstanceId] : 0;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// HitSorter class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      初期化処理を行います.
+//-----------------------------------------------------------------------------
+bool HitSorter::Init(const HitSortDesc& desc)
+{
+    if (desc.Capacity == 0 || desc.MaxBatchSize == 0)
+    { return false; }
+
+    m_Desc = desc;
+    for(auto i=0; i<2; ++i)
+    {
+        m_Keys   [i].resize(desc.Capacity);
+        m_Indices[i].resize(desc.Capacity);
+    }
+    m_Sorted .resize(desc.Capacity);
+    m_Batches.reserve(1024);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      終了処理を行います.
+//-----------------------------------------------------------------------------
+void HitSorter::Term()
+{
+    for(auto i=0; i<2; ++i)
+    {
+        m_Keys   [i].clear();
+        m_Indices[i].clear();
+    }
+    m_Sorted .clear();
+    m_Batches.clear();
+}
+
+//-----------------------------------------------------------------------------
+//      m_Keys[0], m_Indices[0] を LSD 基数ソートします. 実行したパス数を返します.
+//-----------------------------------------------------------------------------
+uint32_t HitSorter::RadixSort(uint32_t count)
+{
+    FrameArena::ThreadFrame threadFrame;
+    FrameArena::Scope       scope(threadFrame.GetArena());
+
+    // 全パスのヒストグラムを1回の走査で求める.
+    auto histogram = threadFrame.GetArena().AllocArray<uint32_t>(kRadixPasses * kRadixSize);
+    std::fill(histogram, histogram + kRadixPasses * kRadixSize, 0u);
+    for(auto i=0u; i<count; ++i)
+    {
+        auto key = m_Keys[0][i];
+        for(auto p=0u; p<kRadixPasses; ++p)
+        { histogram[p * kRadixSize + ((key >> (p * kRadixBits)) & (kRadixSize - 1))]++; }
+    }
+
+    uint32_t passes = 0;
+    uint32_t src    = 0;
+    for(auto p=0u; p<kRadixPasses; ++p)
+    {
+        auto counts = &histogram[p * kRadixSize];
+
+        // 全てのキーが同じ桁を持つパスは省略する.
+        auto skip = false;
+        for(auto b=0u; b<kRadixSize; ++b)
+        {
+            if (counts[b] == count)
+            { skip = true; break; }
+            if (counts[b] != 0)
+            { break; }
+        }
+        if (skip)
+        { continue; }
+
+        uint32_t offset = 0;
+        for(auto b=0u; b<kRadixSize; ++b)
+        {
+            auto c = counts[b];
+            counts[b] = offset;
+            offset += c;
+        }
+
+        auto shift = p * kRadixBits;
+        auto dst   = src ^ 1;
+        for(auto i=0u; i<count; ++i)
+        {
+            auto key = m_Keys[src][i];
+            auto pos = counts[(key >> shift) & (kRadixSize - 1)]++;
+            m_Keys   [dst][pos] = key;
+            m_Indices[dst][pos] = m_Indices[src][i];
+        }
+
+        src = dst;
+        passes++;
+    }
+
+    if (src != 0)
+    {
+        std::copy(m_Keys   [1].begin(), m_Keys   [1].begin() + count, m_Keys   [0].begin());
+        std::copy(m_Indices[1].begin(), m_Indices[1].begin() + count, m_Indices[0].begin());
+    }
+
+    return passes;
+}
+
+//-----------------------------------------------------------------------------
+//      同じマテリアルが連続する区間をバッチにします.
+//-----------------------------------------------------------------------------
+void HitSorter::BuildBatches(const uint32_t* pMaterialIds, uint32_t instanceCount, uint32_t count)
+{
+    m_Batches.clear();
+
+    for(auto i=0u; i<count; ++i)
+    {
+        auto materialId = GetMaterialId(m_Sorted[i], pMaterialIds, instanceCount);
+        if (!m_Batches.empty())
+        {
+            auto& last = m_Batches.back();
+            if (last.MaterialId == materialId && last.Count < m_Desc.MaxBatchSize)
+            {
+                last.Count++;
+                continue;
+            }
+        }
+
+        m_Batches.push_back({ materialId, i, 1 });
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      バッチ単位で並列にシェーディングします.
+//-----------------------------------------------------------------------------
+void HitSorter::ShadeBatches(ShadeFunc func, void* pUser)
+{
+    auto batchCount  = uint32_t(m_Batches.size());
+    auto threadCount = (m_Desc.ThreadCount > 0) ? m_Desc.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = std::min(threadCount, std::max(batchCount, 1u));
+
+    std::atomic<uint32_t> nextBatch = {};
+    auto worker = [&]()
+    {
+        for(;;)
+        {
+            auto index = nextBatch.fetch_add(1, std::memory_order_relaxed);
+            if (index >= batchCount)
+            { break; }
+
+            auto& batch = m_Batches[index];
+            func(pUser, batch.MaterialId, &m_Sorted[batch.Offset], batch.Count);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for(auto i=1u; i<threadCount; ++i)
+    { threads.emplace_back(worker); }
+
+    worker();
+
+    for(auto& thread : threads)
+    { thread.join(); }
+}
+
+//-----------------------------------------------------------------------------
+//      ヒットを並べ替えてシェーディングします.
+//      sort が false の場合はレイ順のまま同じ処理を行い, 比較の基準とします.
+//-----------------------------------------------------------------------------
+HitSortStats HitSorter::Execute
+(
+    const HitRecord*    pHits,
+    uint32_t            count,
+    const uint32_t*     pMaterialIds,
+    uint32_t            instanceCount,
+    bool                sort,
+    ShadeFunc           func,
+    void*               pUser
+)
+{
+    HitSortStats result;
+    if (pHits == nullptr || func == nullptr || count == 0 || count > m_Desc.Capacity)
+    { return result; }
+
+    Timer timer;
+    timer.Start();
+
+    if (sort)
+    {
+        // マテリアル番号 -> プリミティブ番号の順. ミスは末尾に集まる.
+        for(auto i=0u; i<count; ++i)
+        {
+            auto& hit = pHits[i];
+            m_Keys   [0][i] = (uint64_t(GetMaterialId(hit, pMaterialIds, instanceCount)) << 32) | hit.PrimitiveId;
+            m_Indices[0][i] = i;
+        }
+
+        result.RadixPasses = RadixSort(count);
+
+        for(auto i=0u; i<count; ++i)
+        { m_Sorted[i] = pHits[m_Indices[0][i]]; }
+    }
+    else
+    {
+        std::copy(pHits, pHits + count, m_Sorted.begin());
+    }
+
+    BuildBatches(pMaterialIds, instanceCount, count);
+
+    timer.End();
+    result.SortMsec = timer.GetElapsedMsec();
+
+    timer.Start();
+    ShadeBatches(func, pUser);
+    timer.End();
+
+    result.ShadeMsec  = timer.GetElapsedMsec();
+    result.HitCount   = count;
+    result.BatchCount = uint32_t(m_Batches.size());
+    return result;
+}
+
+} // namespace rtc
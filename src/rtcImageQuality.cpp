@@ -0,0 +1,339 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcImageQuality.cpp
+// Desc : Image Quality Metrics.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcImageQuality.h>
+#include <rtcTonemap.h>
+#include <rtcLog.h>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr int    kSsimRadius = 5;       // 11x11 窓.
+constexpr float  kSsimSigma  = 1.5f;
+constexpr double kSsimC1     = (0.01 * 0.01);
+constexpr double kSsimC2     = (0.03 * 0.03);
+
+//-----------------------------------------------------------------------------
+//      sRGB からリニアに戻します.
+//-----------------------------------------------------------------------------
+inline float ToLinear(float x)
+{ return (x <= 0.04045f) ? x / 12.92f : powf((x + 0.055f) / 1.055f, 2.4f); }
+
+//-----------------------------------------------------------------------------
+//      CIELAB の f(t) です.
+//-----------------------------------------------------------------------------
+inline float LabF(float t)
+{
+    constexpr float kDelta = 6.0f / 29.0f;
+    return (t > kDelta * kDelta * kDelta) ? cbrtf(t) : t / (3.0f * kDelta * kDelta) + 4.0f / 29.0f;
+}
+
+//-----------------------------------------------------------------------------
+//      表示空間の sRGB を CIELAB (D65) に変換します.
+//-----------------------------------------------------------------------------
+rtc::float3 ToLab(const rtc::float3& srgb)
+{
+    auto r = ToLinear(srgb.x);
+    auto g = ToLinear(srgb.y);
+    auto b = ToLinear(srgb.z);
+
+    auto x = (0.4124564f * r + 0.3575761f * g + 0.1804375f * b) / 0.95047f;
+    auto y = (0.2126729f * r + 0.7151522f * g + 0.0721750f * b);
+    auto z = (0.0193339f * r + 0.1191920f * g + 0.9503041f * b) / 1.08883f;
+
+    auto fx = LabF(x);
+    auto fy = LabF(y);
+    auto fz = LabF(z);
+    return rtc::float3(116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz));
+}
+
+//-----------------------------------------------------------------------------
+//      分離可能なガウスフィルタを掛けます (端はクランプ).
+//-----------------------------------------------------------------------------
+void GaussianBlur
+(
+    const std::vector<float>&   src,
+    uint32_t                    width,
+    uint32_t                    height,
+    const float*                pWeights,
+    std::vector<float>&         temp,
+    std::vector<float>&         dst
+)
+{
+    temp.resize(src.size());
+    dst .resize(src.size());
+
+    auto w = int(width);
+    auto h = int(height);
+
+    for(auto y=0; y<h; ++y)
+    {
+        auto pRow = &src[size_t(y) * width];
+        for(auto x=0; x<w; ++x)
+        {
+            float sum = 0.0f;
+            for(auto k=-kSsimRadius; k<=kSsimRadius; ++k)
+            { sum += pWeights[k + kSsimRadius] * pRow[std::min(std::max(x + k, 0), w - 1)]; }
+            temp[size_t(y) * width + x] = sum;
+        }
+    }
+
+    for(auto y=0; y<h; ++y)
+    {
+        for(auto x=0; x<w; ++x)
+        {
+            float sum = 0.0f;
+            for(auto k=-kSsimRadius; k<=kSsimRadius; ++k)
+            { sum += pWeights[k + kSsimRadius] * temp[size_t(std::min(std::max(y + k, 0), h - 1)) * width + x]; }
+            dst[size_t(y) * width + x] = sum;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      輝度の平均 SSIM を求めます.
+//-----------------------------------------------------------------------------
+double CalcSsim(const std::vector<float>& a, const std::vector<float>& b, uint32_t width, uint32_t height)
+{
+    float weights[kSsimRadius * 2 + 1];
+    float total = 0.0f;
+    for(auto k=-kSsimRadius; k<=kSsimRadius; ++k)
+    {
+        weights[k + kSsimRadius] = expf(-float(k * k) / (2.0f * kSsimSigma * kSsimSigma));
+        total += weights[k + kSsimRadius];
+    }
+    for(auto& w : weights)
+    { w /= total; }
+
+    auto count = a.size();
+    std::vector<float> aa(count), bb(count), ab(count);
+    for(size_t i=0; i<count; ++i)
+    {
+        aa[i] = a[i] * a[i];
+        bb[i] = b[i] * b[i];
+        ab[i] = a[i] * b[i];
+    }
+
+    std::vector<float> temp;
+    std::vector<float> muA, muB, sigmaAA, sigmaBB, sigmaAB;
+    GaussianBlur(a,  width, height, weights, temp, muA);
+    GaussianBlur(b,  width, height, weights, temp, muB);
+    GaussianBlur(aa, width, height, weights, temp, sigmaAA);
+    GaussianBlur(bb, width, height, weights, temp, sigmaBB);
+    GaussianBlur(ab, width, height, weights, temp, sigmaAB);
+
+    double sum = 0.0;
+    for(size_t i=0; i<count; ++i)
+    {
+        double ma  = muA[i];
+        double mb  = muB[i];
+        double vaa = sigmaAA[i] - ma * ma;
+        double vbb = sigmaBB[i] - mb * mb;
+        double vab = sigmaAB[i] - ma * mb;
+
+        auto numer = (2.0 * ma * mb + kSsimC1) * (2.0 * vab + kSsimC2);
+        auto denom = (ma * ma + mb * mb + kSsimC1) * (vaa + vbb + kSsimC2);
+        sum += numer / denom;
+    }
+
+    return sum / double(count);
+}
+
+//-----------------------------------------------------------------------------
+//      平均二乗誤差から PSNR を求めます (ピークは 1).
+//-----------------------------------------------------------------------------
+inline double ToPsnr(double mse)
+{ return (mse > 0.0) ? std::min(-10.0 * log10(mse), rtc::ImageQuality::kMaxPsnr) : rtc::ImageQuality::kMaxPsnr; }
+
+//-----------------------------------------------------------------------------
+//      空白区切りのトークンを読み込みます. 区切りの空白 1 文字も消費します.
+//-----------------------------------------------------------------------------
+bool ReadToken(FILE* pFile, char* buffer, size_t size)
+{
+    auto c = fgetc(pFile);
+    while (c != EOF && isspace(c))
+    { c = fgetc(pFile); }
+
+    size_t count = 0;
+    while (c != EOF && !isspace(c))
+    {
+        if (count + 1 >= size)
+        { return false; }
+        buffer[count++] = char(c);
+        c = fgetc(pFile);
+    }
+    buffer[count] = '\0';
+    return count > 0 && c != EOF;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+//      参照画像と比較します.
+//-----------------------------------------------------------------------------
+ImageQuality CalcImageQuality(const ImageQualityDesc& desc, const float3* pImage, const float3* pReference)
+{
+    ImageQuality result;
+    if (pImage == nullptr || pReference == nullptr || desc.Width == 0 || desc.Height == 0)
+    { return result; }
+
+    auto count = size_t(desc.Width) * desc.Height;
+
+    std::vector<float> lumaA(count);
+    std::vector<float> lumaB(count);
+    std::vector<float> deltaE(count);
+
+    double squaredError = 0.0;
+    double deltaESum    = 0.0;
+    for(size_t i=0; i<count; ++i)
+    {
+        auto a = TonemapPixel(pImage    [i], desc.Exposure);
+        auto b = TonemapPixel(pReference[i], desc.Exposure);
+
+        auto d = a - b;
+        squaredError += double(Dot(d, d));
+
+        lumaA[i] = Luminance(a);
+        lumaB[i] = Luminance(b);
+
+        deltaE[i] = Length(ToLab(a) - ToLab(b));
+        deltaESum += deltaE[i];
+    }
+
+    result.Mse    = squaredError / double(count * 3);
+    result.Psnr   = ToPsnr(result.Mse);
+    result.DeltaE = deltaESum / double(count);
+
+    auto p99 = deltaE.begin() + std::min(count - 1, size_t(double(count) * 0.99));
+    std::nth_element(deltaE.begin(), p99, deltaE.end());
+    result.DeltaEP99 = *p99;
+
+    result.Ssim = CalcSsim(lumaA, lumaB, desc.Width, desc.Height);
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      PSNR だけを求めます.
+//-----------------------------------------------------------------------------
+double CalcImagePsnr(const ImageQualityDesc& desc, const float3* pImage, const float3* pReference)
+{
+    if (pImage == nullptr || pReference == nullptr || desc.Width == 0 || desc.Height == 0)
+    { return 0.0; }
+
+    auto count = size_t(desc.Width) * desc.Height;
+
+    double squaredError = 0.0;
+    for(size_t i=0; i<count; ++i)
+    {
+        auto d = TonemapPixel(pImage[i], desc.Exposure) - TonemapPixel(pReference[i], desc.Exposure);
+        squaredError += double(Dot(d, d));
+    }
+
+    return ToPsnr(squaredError / double(count * 3));
+}
+
+//-----------------------------------------------------------------------------
+//      PFM 形式で保存します.
+//-----------------------------------------------------------------------------
+bool SaveImagePfm(const char* path, const float3* pImage, uint32_t width, uint32_t height)
+{
+    if (path == nullptr || pImage == nullptr || width == 0 || height == 0)
+    { return false; }
+
+    FILE* pFile = nullptr;
+    auto err = fopen_s(&pFile, path, "wb");
+    if (err != 0 || pFile == nullptr)
+    {
+        RTC_ELOG("Error : File Open Failed. path = %s", path);
+        return false;
+    }
+
+    // 負のスケールはリトルエンディアンを表す.
+    fprintf(pFile, "PF\n%u %u\n-1.0\n", width, height);
+
+    // PFM は下の行から格納する.
+    auto ret = true;
+    for(auto y=0u; y<height && ret; ++y)
+    {
+        auto pRow = pImage + size_t(height - 1 - y) * width;
+        ret = (fwrite(pRow, sizeof(float3), width, pFile) == width);
+    }
+
+    fclose(pFile);
+
+    if (!ret)
+    { RTC_ELOG("Error : File Write Failed. path = %s", path); }
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+//      PFM 形式の RGB 画像を読み込みます.
+//-----------------------------------------------------------------------------
+bool LoadImagePfm(const char* path, std::vector<float3>& image, uint32_t& width, uint32_t& height)
+{
+    if (path == nullptr)
+    { return false; }
+
+    FILE* pFile = nullptr;
+    auto err = fopen_s(&pFile, path, "rb");
+    if (err != 0 || pFile == nullptr)
+    { return false; }
+
+    // ヘッダは空白区切りの 4 トークンで, 最後の空白 1 文字の直後からデータが始まる.
+    char magic[8], sw[16], sh[16], ss[16];
+    auto valid = ReadToken(pFile, magic, sizeof(magic))
+              && ReadToken(pFile, sw,    sizeof(sw))
+              && ReadToken(pFile, sh,    sizeof(sh))
+              && ReadToken(pFile, ss,    sizeof(ss));
+
+    auto w     = valid ? uint32_t(strtoul(sw, nullptr, 10)) : 0u;
+    auto h     = valid ? uint32_t(strtoul(sh, nullptr, 10)) : 0u;
+    auto scale = valid ? strtof(ss, nullptr) : 0.0f;
+    if (!valid || strcmp(magic, "PF") != 0 || w == 0 || h == 0 || scale >= 0.0f)
+    {
+        RTC_ELOG("Error : Unsupported PFM. path = %s", path);
+        fclose(pFile);
+        return false;
+    }
+
+    image.resize(size_t(w) * h);
+    auto ret = true;
+    for(auto y=0u; y<h && ret; ++y)
+    {
+        auto pRow = image.data() + size_t(h - 1 - y) * w;
+        ret = (fread(pRow, sizeof(float3), w, pFile) == w);
+    }
+
+    fclose(pFile);
+
+    if (!ret)
+    {
+        RTC_ELOG("Error : File Read Failed. path = %s", path);
+        image.clear();
+        return false;
+    }
+
+    width  = w;
+    height = h;
+    return true;
+}
+
+} // namespace rtc
@@ -0,0 +1,618 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcLightBvh.cpp
+// Desc : Light Bounding Volume Hierarchy.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcLightBvh.h>
+#include <rtcLog.h>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t  kBucketCount    = 12;
+constexpr float     kOneMinusEps    = 0x1.fffffep-1f;
+
+//-----------------------------------------------------------------------------
+//      任意軸周りにベクトルを回転させます.
+//-----------------------------------------------------------------------------
+rtc::float3 Rotate(const rtc::float3& v, const rtc::float3& axis, float theta)
+{
+    // Rodrigues の回転公式.
+    auto c = cosf(theta);
+    auto s = sinf(theta);
+    return v * c + rtc::Cross(axis, v) * s + axis * (rtc::Dot(axis, v) * (1.0f - c));
+}
+
+//-----------------------------------------------------------------------------
+//      2つの法線コーンを包含するコーンを求めます.
+//-----------------------------------------------------------------------------
+void UnionCone
+(
+    const rtc::float3&  wa,
+    float               cosA,
+    const rtc::float3&  wb,
+    float               cosB,
+    rtc::float3&        w,
+    float&              cosTheta
+)
+{
+    // PBRT-v4, DirectionCone の Union.
+    auto thetaA = rtc::SafeAcos(cosA);
+    auto thetaB = rtc::SafeAcos(cosB);
+    auto thetaD = rtc::SafeAcos(rtc::Dot(wa, wb));
+
+    if (std::min(thetaD + thetaB, rtc::F_PI) <= thetaA)
+    {
+        w = wa;
+        cosTheta = cosA;
+        return;
+    }
+
+    if (std::min(thetaD + thetaA, rtc::F_PI) <= thetaB)
+    {
+        w = wb;
+        cosTheta = cosB;
+        return;
+    }
+
+    auto thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+    auto wr     = rtc::Cross(wa, wb);
+    if (thetaO >= rtc::F_PI || rtc::Dot(wr, wr) == 0.0f)
+    {
+        // 全方向.
+        w = wa;
+        cosTheta = -1.0f;
+        return;
+    }
+
+    w = rtc::Normalize(Rotate(wa, rtc::Normalize(wr), thetaO - thetaA));
+    cosTheta = cosf(thetaO);
+}
+
+//-----------------------------------------------------------------------------
+//      ライトバウンドを結合します.
+//-----------------------------------------------------------------------------
+rtc::LightBounds Union(const rtc::LightBounds& a, const rtc::LightBounds& b)
+{
+    if (a.Phi == 0.0f)
+    { return b; }
+    if (b.Phi == 0.0f)
+    { return a; }
+
+    rtc::LightBounds result;
+    result.Bounds    = rtc::Merge(a.Bounds, b.Bounds);
+    result.Phi       = a.Phi + b.Phi;
+    result.CosThetaE = std::min(a.CosThetaE, b.CosThetaE);
+    result.TwoSided  = a.TwoSided || b.TwoSided;
+    UnionCone(a.Axis, a.CosThetaO, b.Axis, b.CosThetaO, result.Axis, result.CosThetaO);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      三角形ライトのバウンドを求めます.
+//-----------------------------------------------------------------------------
+rtc::LightBounds MakeBounds(const rtc::EmissiveTriangle& light)
+{
+    auto n    = rtc::Cross(light.Position[1] - light.Position[0], light.Position[2] - light.Position[0]);
+    auto area = rtc::Length(n) * 0.5f;
+
+    rtc::LightBounds result;
+    result.Bounds.Merge(light.Position[0]);
+    result.Bounds.Merge(light.Position[1]);
+    result.Bounds.Merge(light.Position[2]);
+    result.Axis      = rtc::Normalize(n);
+    result.Phi       = rtc::Luminance(light.Emission) * area * rtc::F_PI * (light.TwoSided ? 2.0f : 1.0f);
+    result.CosThetaO = 1.0f;
+    result.CosThetaE = 0.0f;    // cos(π/2).
+    result.TwoSided  = light.TwoSided;
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      点からバウンディングボックスを見込む角の余弦を求めます.
+//-----------------------------------------------------------------------------
+float BoundSubtendedCos(const rtc::Bounds3& bounds, const rtc::float3& p)
+{
+    if (bounds.Contains(p))
+    { return -1.0f; }
+
+    auto center = bounds.Center();
+    auto r2     = rtc::Dot(bounds.Diagonal(), bounds.Diagonal()) * 0.25f;
+    auto d2     = rtc::Dot(p - center, p - center);
+    if (d2 < r2)
+    { return -1.0f; }
+
+    return rtc::SafeSqrt(1.0f - r2 / d2);
+}
+
+//-----------------------------------------------------------------------------
+//      SAOH のコストを評価します.
+//-----------------------------------------------------------------------------
+float EvaluateCost(const rtc::LightBounds& b, const rtc::Bounds3& bounds, int dim)
+{
+    // Kulla and Conty 2018, Importance Sampling of Many Lights with Adaptive Tree Splitting.
+    auto thetaO    = rtc::SafeAcos(b.CosThetaO);
+    auto thetaE    = rtc::SafeAcos(b.CosThetaE);
+    auto thetaW    = std::min(thetaO + thetaE, rtc::F_PI);
+    auto sinThetaO = rtc::SafeSqrt(1.0f - b.CosThetaO * b.CosThetaO);
+
+    auto omega = rtc::F_2PI * (1.0f - b.CosThetaO)
+               + rtc::F_PI * 0.5f * (2.0f * thetaW * sinThetaO - cosf(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + b.CosThetaO);
+
+    auto d  = bounds.Diagonal();
+    auto kr = rtc::MaxComponent(d) / d[dim];
+
+    return b.Phi * omega * kr * b.Bounds.SurfaceArea();
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// LightBounds structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      点 p から見た重要度を求めます. 法線 n がゼロなら表面のコサイン項は考慮しません.
+//-----------------------------------------------------------------------------
+float LightBounds::Importance(const float3& p, const float3& n) const
+{
+    auto center = Bounds.Center();
+    auto d2     = Dot(p - center, p - center);
+    d2 = std::max(d2, Length(Bounds.Diagonal()) * 0.5f);
+
+    auto CosSubClamped = [](float sinA, float cosA, float sinB, float cosB)
+    { return (cosA > cosB) ? 1.0f : cosA * cosB + sinA * sinB; };
+
+    auto SinSubClamped = [](float sinA, float cosA, float sinB, float cosB)
+    { return (cosA > cosB) ? 0.0f : sinA * cosB - cosA * sinB; };
+
+    auto wi = Normalize(p - center);
+    auto cosThetaW = Dot(Axis, wi);
+    if (TwoSided)
+    { cosThetaW = fabsf(cosThetaW); }
+    auto sinThetaW = SafeSqrt(1.0f - cosThetaW * cosThetaW);
+
+    auto cosThetaB = BoundSubtendedCos(Bounds, p);
+    auto sinThetaB = SafeSqrt(1.0f - cosThetaB * cosThetaB);
+    auto sinThetaO = SafeSqrt(1.0f - CosThetaO * CosThetaO);
+
+    auto cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, CosThetaO);
+    auto sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, CosThetaO);
+    auto cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= CosThetaE)
+    { return 0.0f; }
+
+    auto importance = Phi * cosThetaP / d2;
+
+    if (n.x != 0.0f || n.y != 0.0f || n.z != 0.0f)
+    {
+        auto cosThetaI  = fabsf(Dot(wi, n));
+        auto sinThetaI  = SafeSqrt(1.0f - cosThetaI * cosThetaI);
+        importance *= CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    }
+
+    return std::max(importance, 0.0f);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// LightBvh class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      構築処理を行います.
+//-----------------------------------------------------------------------------
+bool LightBvh::Build(const EmissiveTriangle* pLights, uint32_t count)
+{
+    Clear();
+
+    if (pLights == nullptr || count == 0)
+    { return false; }
+
+    std::vector<BuildItem> items;
+    items.reserve(count);
+
+    m_Lights.reserve(count);
+    for(auto i=0u; i<count; ++i)
+    {
+        // 放射束を持たないライトは除外.
+        auto bounds = MakeBounds(pLights[i]);
+        if (bounds.Phi <= 0.0f)
+        { continue; }
+
+        items.push_back({ bounds, uint32_t(m_Lights.size()) });
+        m_Lights.push_back(pLights[i]);
+    }
+
+    if (items.empty())
+    { return false; }
+
+    m_BitTrails.resize(m_Lights.size(), 0);
+    m_Nodes.reserve(items.size() * 2 - 1);
+    BuildRecursive(items.data(), uint32_t(items.size()), 0, 0);
+
+    RTC_DLOG("LightBvh : lights = %zu, nodes = %zu", m_Lights.size(), m_Nodes.size());
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      破棄します.
+//-----------------------------------------------------------------------------
+void LightBvh::Clear()
+{
+    m_Lights   .clear();
+    m_Nodes    .clear();
+    m_BitTrails.clear();
+    m_LeafItems.clear();
+}
+
+//-----------------------------------------------------------------------------
+//      再帰的に構築します.
+//-----------------------------------------------------------------------------
+uint32_t LightBvh::BuildRecursive(BuildItem* pItems, uint32_t count, uint64_t bitTrail, uint32_t depth)
+{
+    auto nodeIndex = uint32_t(m_Nodes.size());
+    m_Nodes.push_back({});
+
+    if (count == 1)
+    {
+        auto& node = m_Nodes[nodeIndex];
+        node.Bounds     = pItems[0].Bounds;
+        node.Index      = pItems[0].LightIndex;
+        node.IsLeaf     = 1;
+        node.LightCount = 1;
+        m_BitTrails[pItems[0].LightIndex] = bitTrail;
+        return nodeIndex;
+    }
+
+    // ビットトレイルに収まらない深さでは分割せず, 複数ライトを持つ葉にする.
+    if (depth >= kMaxDepth)
+    {
+        LightBounds bounds = {};
+        for(auto i=0u; i<count; ++i)
+        {
+            bounds = Union(bounds, pItems[i].Bounds);
+            m_BitTrails[pItems[i].LightIndex] = bitTrail;
+        }
+
+        auto& node = m_Nodes[nodeIndex];
+        node.Bounds     = bounds;
+        node.Index      = uint32_t(m_LeafItems.size());
+        node.IsLeaf     = 1;
+        node.LightCount = count;
+        m_LeafItems.insert(m_LeafItems.end(), pItems, pItems + count);
+        return nodeIndex;
+    }
+
+    Bounds3 bounds;
+    Bounds3 centroidBounds;
+    for(auto i=0u; i<count; ++i)
+    {
+        bounds.Merge(pItems[i].Bounds.Bounds);
+        centroidBounds.Merge(pItems[i].Bounds.Bounds.Center());
+    }
+
+    // SAOH が最小となる分割を探す.
+    auto minCost   = FLT_MAX;
+    auto minBucket = -1;
+    auto minDim    = -1;
+
+    for(auto dim=0; dim<3; ++dim)
+    {
+        auto cmin = centroidBounds.Min[dim];
+        auto cmax = centroidBounds.Max[dim];
+        if (cmax == cmin)
+        { continue; }
+
+        auto BucketIndex = [&](const BuildItem& item)
+        {
+            auto b = int(kBucketCount * (item.Bounds.Bounds.Center()[dim] - cmin) / (cmax - cmin));
+            return std::min(std::max(b, 0), int(kBucketCount - 1));
+        };
+
+        LightBounds buckets[kBucketCount] = {};
+        for(auto i=0u; i<count; ++i)
+        {
+            auto b = BucketIndex(pItems[i]);
+            buckets[b] = Union(buckets[b], pItems[i].Bounds);
+        }
+
+        for(auto i=0u; i<kBucketCount - 1; ++i)
+        {
+            LightBounds b0 = {};
+            LightBounds b1 = {};
+            for(auto j=0u; j<=i; ++j)
+            { b0 = Union(b0, buckets[j]); }
+            for(auto j=i+1; j<kBucketCount; ++j)
+            { b1 = Union(b1, buckets[j]); }
+
+            auto cost = EvaluateCost(b0, bounds, dim) + EvaluateCost(b1, bounds, dim);
+            if (cost > 0.0f && cost < minCost)
+            {
+                minCost   = cost;
+                minBucket = int(i);
+                minDim    = dim;
+            }
+        }
+    }
+
+    uint32_t mid = 0;
+    if (minDim >= 0)
+    {
+        auto cmin = centroidBounds.Min[minDim];
+        auto cmax = centroidBounds.Max[minDim];
+        auto pMid = std::partition(pItems, pItems + count, [&](const BuildItem& item)
+        {
+            auto b = int(kBucketCount * (item.Bounds.Bounds.Center()[minDim] - cmin) / (cmax - cmin));
+            b = std::min(std::max(b, 0), int(kBucketCount - 1));
+            return b <= minBucket;
+        });
+        mid = uint32_t(pMid - pItems);
+    }
+
+    // 分割できなかった場合は個数で半分にする.
+    if (mid == 0 || mid == count)
+    {
+        auto dim = centroidBounds.MaxExtent();
+        mid = count / 2;
+        std::nth_element(pItems, pItems + mid, pItems + count, [dim](const BuildItem& a, const BuildItem& b)
+        { return a.Bounds.Bounds.Center()[dim] < b.Bounds.Bounds.Center()[dim]; });
+    }
+
+    auto child0 = BuildRecursive(pItems,       mid,         bitTrail,                     depth + 1);
+    auto child1 = BuildRecursive(pItems + mid, count - mid, bitTrail | (1ull << depth),   depth + 1);
+    assert(child0 == nodeIndex + 1);
+    RTC_UNUSED(child0);
+
+    auto& node = m_Nodes[nodeIndex];
+    node.Bounds     = Union(m_Nodes[nodeIndex + 1].Bounds, m_Nodes[child1].Bounds);
+    node.Index      = child1;
+    node.IsLeaf     = 0;
+    node.LightCount = 0;
+    return nodeIndex;
+}
+
+//-----------------------------------------------------------------------------
+//      葉の中から重要度に比例した確率でライトを1つ選択します.
+//-----------------------------------------------------------------------------
+bool LightBvh::SampleLeaf(const LightBvhNode& node, const float3& p, const float3& n, float u, uint32_t& lightIndex, float& pmf) const
+{
+    if (node.LightCount == 1)
+    {
+        lightIndex = node.Index;
+        return true;
+    }
+
+    auto pItems = m_LeafItems.data() + node.Index;
+
+    auto total = 0.0f;
+    for(auto i=0u; i<node.LightCount; ++i)
+    { total += pItems[i].Bounds.Importance(p, n); }
+
+    if (total <= 0.0f)
+    { return false; }
+
+    // 累積重要度が u * total を超えた最初のライトを選ぶ. 丸め誤差で抜けた場合は最後の有効なライト.
+    auto target   = u * total;
+    auto sum      = 0.0f;
+    auto selected = 0.0f;
+    for(auto i=0u; i<node.LightCount; ++i)
+    {
+        auto importance = pItems[i].Bounds.Importance(p, n);
+        if (importance <= 0.0f)
+        { continue; }
+
+        lightIndex = pItems[i].LightIndex;
+        selected   = importance;
+        sum       += importance;
+        if (target < sum)
+        { break; }
+    }
+
+    pmf *= selected / total;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      葉の中で指定ライトが選択される確率を求めます.
+//-----------------------------------------------------------------------------
+float LightBvh::LeafPmf(const LightBvhNode& node, const float3& p, const float3& n, uint32_t lightIndex) const
+{
+    if (node.LightCount == 1)
+    {
+        assert(node.Index == lightIndex);
+        return 1.0f;
+    }
+
+    auto pItems = m_LeafItems.data() + node.Index;
+
+    auto total    = 0.0f;
+    auto selected = 0.0f;
+    for(auto i=0u; i<node.LightCount; ++i)
+    {
+        auto importance = pItems[i].Bounds.Importance(p, n);
+        total += importance;
+        if (pItems[i].LightIndex == lightIndex)
+        { selected = importance; }
+    }
+
+    return (total > 0.0f) ? selected / total : 0.0f;
+}
+
+//-----------------------------------------------------------------------------
+//      重要度に比例した確率でライトを1つ選択します.
+//-----------------------------------------------------------------------------
+bool LightBvh::Sample(const float3& p, const float3& n, float u, LightSample& result) const
+{
+    if (m_Nodes.empty())
+    { return false; }
+
+    uint32_t nodeIndex = 0;
+    float    pmf       = 1.0f;
+
+    for(;;)
+    {
+        const auto& node = m_Nodes[nodeIndex];
+        if (node.IsLeaf)
+        {
+            if (nodeIndex > 0 || node.Bounds.Importance(p, n) > 0.0f)
+            {
+                uint32_t lightIndex = UINT32_MAX;
+                if (!SampleLeaf(node, p, n, u, lightIndex, pmf))
+                { return false; }
+
+                result.LightIndex = lightIndex;
+                result.Pmf        = pmf;
+                return true;
+            }
+            return false;
+        }
+
+        auto c0 = nodeIndex + 1;
+        auto c1 = uint32_t(node.Index);
+        auto i0 = m_Nodes[c0].Bounds.Importance(p, n);
+        auto i1 = m_Nodes[c1].Bounds.Importance(p, n);
+        if (i0 == 0.0f && i1 == 0.0f)
+        { return false; }
+
+        // 乱数を再利用して子ノードを選択.
+        auto p0 = i0 / (i0 + i1);
+        if (u < p0)
+        {
+            nodeIndex = c0;
+            u   = std::min(u / p0, kOneMinusEps);
+            pmf *= p0;
+        }
+        else
+        {
+            nodeIndex = c1;
+            u   = std::min((u - p0) / (1.0f - p0), kOneMinusEps);
+            pmf *= 1.0f - p0;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      指定ライトが選択される確率を求めます. MIS の重み計算に使用します.
+//-----------------------------------------------------------------------------
+float LightBvh::Pmf(const float3& p, const float3& n, uint32_t lightIndex) const
+{
+    if (lightIndex >= uint32_t(m_BitTrails.size()))
+    { return 0.0f; }
+
+    auto     bitTrail  = m_BitTrails[lightIndex];
+    uint32_t nodeIndex = 0;
+    float    pmf       = 1.0f;
+
+    for(;;)
+    {
+        const auto& node = m_Nodes[nodeIndex];
+        if (node.IsLeaf)
+        {
+            if (nodeIndex == 0 && node.Bounds.Importance(p, n) <= 0.0f)
+            { return 0.0f; }
+            return pmf * LeafPmf(node, p, n, lightIndex);
+        }
+
+        auto c0 = nodeIndex + 1;
+        auto c1 = uint32_t(node.Index);
+        auto i0 = m_Nodes[c0].Bounds.Importance(p, n);
+        auto i1 = m_Nodes[c1].Bounds.Importance(p, n);
+        if (i0 == 0.0f && i1 == 0.0f)
+        { return 0.0f; }
+
+        if (bitTrail & 1)
+        {
+            pmf *= i1 / (i0 + i1);
+            nodeIndex = c1;
+        }
+        else
+        {
+            pmf *= i0 / (i0 + i1);
+            nodeIndex = c0;
+        }
+
+        bitTrail >>= 1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      一様選択と比較した推定量の分散を評価します.
+//-----------------------------------------------------------------------------
+LightSelectionStats LightBvh::Evaluate(const float3* pPositions, const float3* pNormals, size_t count) const
+{
+    LightSelectionStats result;
+    if (pPositions == nullptr || pNormals == nullptr || m_Lights.empty())
+    { return result; }
+
+    auto uniformPmf = 1.0 / double(m_Lights.size());
+
+    for(size_t i=0; i<count; ++i)
+    {
+        const auto& p = pPositions[i];
+        const auto& n = pNormals[i];
+
+        // ライト重心を点光源とみなした遮蔽なしの寄与 c で, 分散 = Σ c^2 / pmf - (Σ c)^2.
+        double sum      = 0.0;
+        double sum2Bvh  = 0.0;
+        double sum2Uni  = 0.0;
+
+        for(auto j=0u; j<uint32_t(m_Lights.size()); ++j)
+        {
+            const auto& light = m_Lights[j];
+            auto center = (light.Position[0] + light.Position[1] + light.Position[2]) / 3.0f;
+            auto nl     = Cross(light.Position[1] - light.Position[0], light.Position[2] - light.Position[0]);
+            auto area   = Length(nl) * 0.5f;
+            auto wi     = center - p;
+            auto d2     = Dot(wi, wi);
+            if (d2 <= 0.0f)
+            { continue; }
+
+            wi = wi / sqrtf(d2);
+            auto cosL = -Dot(Normalize(nl), wi);
+            if (light.TwoSided)
+            { cosL = fabsf(cosL); }
+            auto cosS = Dot(n, wi);
+
+            auto c = double(Luminance(light.Emission)) * area * std::max(cosL, 0.0f) * std::max(cosS, 0.0f) / d2;
+            if (c <= 0.0)
+            { continue; }
+
+            sum     += c;
+            sum2Uni += c * c / uniformPmf;
+
+            auto pmf = Pmf(p, n, j);
+            if (pmf > 0.0f)
+            { sum2Bvh += c * c / pmf; }
+        }
+
+        result.VarianceBvh     += sum2Bvh - sum * sum;
+        result.VarianceUniform += sum2Uni - sum * sum;
+    }
+
+    if (count > 0)
+    {
+        result.VarianceBvh     /= double(count);
+        result.VarianceUniform /= double(count);
+    }
+    result.PointCount = count;
+
+    RTC_DLOG("LightBvh : variance bvh = %e, uniform = %e (%.2lfx)",
+        result.VarianceBvh,
+        result.VarianceUniform,
+        (result.VarianceBvh > 0.0) ? result.VarianceUniform / result.VarianceBvh : 0.0);
+
+    return result;
+}
+
+} // namespace rtc
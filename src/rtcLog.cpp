@@ -0,0 +1,583 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcLog.cpp
+// Desc : Logger.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcLog.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <Windows.h>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t  kRingSize       = 256;     // スレッドあたりのレコード数 (64 KB).
+constexpr uint32_t  kRingMask       = kRingSize - 1;
+constexpr size_t    kLineSize       = 2048;
+constexpr auto      kFlushInterval  = std::chrono::milliseconds(2);
+
+static_assert((kRingSize & kRingMask) == 0, "kRingSize must be power of 2.");
+
+///////////////////////////////////////////////////////////////////////////////
+// LogRing structure (単一生産者・単一消費者のリングバッファ)
+///////////////////////////////////////////////////////////////////////////////
+struct LogRing
+{
+    rtc::LogRecord                      Records[kRingSize];
+    alignas(64) std::atomic<uint32_t>   Head    = {};       // 生産者だけが書き込みます.
+    std::atomic<uint32_t>               Busy    = {};       // Acquire() から Commit() までの間 1 です. 生産者だけが書き込みます.
+    alignas(64) std::atomic<uint32_t>   Tail    = {};       // 消費者だけが書き込みます.
+    std::atomic<bool>                   Retired = {};       // 所有スレッドが終了したら true.
+    uint32_t                            ThreadId = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// LoggerState structure
+///////////////////////////////////////////////////////////////////////////////
+struct LoggerState
+{
+    std::mutex                  Mutex;
+    std::condition_variable     Wake;
+    std::condition_variable     Flushed;
+    std::vector<LogRing*>       Rings;
+    std::thread                 Thread;
+    std::atomic<bool>           Running     = {};
+    std::atomic<bool>           RingFull    = {};   // 生産者が空きを待っています.
+    bool                        StopRequest = false;
+    bool                        WriterAlive = false;    // true の間は終了したスレッドのリングを書き出しスレッドが破棄します.
+    uint64_t                    FlushRequest = 0;
+    uint64_t                    FlushDone    = 0;
+
+    ~LoggerState();
+};
+
+//-----------------------------------------------------------------------------
+//      ロガーの状態を取得します.
+//-----------------------------------------------------------------------------
+LoggerState& GetState()
+{
+    static LoggerState s_State;
+    return s_State;
+}
+
+//-----------------------------------------------------------------------------
+//      書き出しスレッドを止めます. 呼び出し前に Running を false にしてください.
+//-----------------------------------------------------------------------------
+void StopWriter(LoggerState& state)
+{
+    std::unique_lock<std::mutex> locker(state.Mutex);
+
+    // Running を確認済みの生産者が Commit() するまで待つ. 以降リングにレコードは増えない.
+    for(auto pRing : state.Rings)
+    {
+        while (pRing->Busy.load(std::memory_order_seq_cst) != 0)
+        { std::this_thread::yield(); }
+    }
+
+    state.StopRequest = true;
+    locker.unlock();
+    state.Wake.notify_one();
+
+    // 書き出しスレッドは最後の Drain() で残りを全て書き出してから終わる.
+    state.Thread.join();
+
+    // 最後の Drain() の後に終了したスレッドのリングは空なので, ここで破棄する.
+    locker.lock();
+    state.WriterAlive = false;
+    for(auto itr = state.Rings.begin(); itr != state.Rings.end();)
+    {
+        if ((*itr)->Retired.load(std::memory_order_acquire))
+        {
+            delete *itr;
+            itr = state.Rings.erase(itr);
+        }
+        else
+        { ++itr; }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      破棄処理を行います.
+//-----------------------------------------------------------------------------
+LoggerState::~LoggerState()
+{
+    // Logger::Term() を呼ばずに終了した場合.
+    if (Thread.joinable())
+    {
+        Running.store(false, std::memory_order_seq_cst);
+        StopWriter(*this);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Thread Local Variables
+//-----------------------------------------------------------------------------
+thread_local LogRing*   t_pRing     = nullptr;
+thread_local uint32_t   t_Head      = 0;
+thread_local bool       t_Exited    = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// RingOwner class (スレッド終了時にリングを消費者へ引き渡します)
+///////////////////////////////////////////////////////////////////////////////
+class RingOwner
+{
+public:
+    RingOwner()
+    {
+        m_pRing = new LogRing();
+        m_pRing->ThreadId = GetCurrentThreadId();
+
+        auto& state = GetState();
+        std::lock_guard<std::mutex> locker(state.Mutex);
+        state.Rings.push_back(m_pRing);
+        t_pRing = m_pRing;
+    }
+
+    ~RingOwner()
+    {
+        auto& state = GetState();
+        {
+            std::lock_guard<std::mutex> locker(state.Mutex);
+            if (state.WriterAlive)
+            {
+                // 書き出しスレッドが読んでいる可能性があるので, 残りを書き出してから破棄してもらう.
+                m_pRing->Retired.store(true, std::memory_order_release);
+                m_pRing = nullptr;
+            }
+            else
+            {
+                auto itr = std::find(state.Rings.begin(), state.Rings.end(), m_pRing);
+                if (itr != state.Rings.end())
+                { state.Rings.erase(itr); }
+            }
+        }
+
+        delete m_pRing;
+        t_pRing  = nullptr;
+        t_Exited = true;
+    }
+
+private:
+    LogRing* m_pRing = nullptr;
+};
+
+//-----------------------------------------------------------------------------
+//      呼び出したスレッドのリングを取得します.
+//-----------------------------------------------------------------------------
+inline LogRing* GetRing()
+{
+    if (t_pRing != nullptr)
+    { return t_pRing; }
+
+    if (t_Exited)
+    { return nullptr; }
+
+    thread_local RingOwner owner;
+    return t_pRing;
+}
+
+//-----------------------------------------------------------------------------
+//      書式指定1つ分の引数を整形します.
+//-----------------------------------------------------------------------------
+int FormatArg(char* pDst, size_t size, const char* spec, char conversion, const rtc::LogRecord& record, uint32_t index)
+{
+    if (index >= record.ArgCount)
+    { return snprintf(pDst, size, "<missing>"); }
+
+    auto type  = record.Types[index];
+    auto value = record.Args [index];
+
+    double d = 0.0;
+    if (type == rtc::LOG_ARG_DOUBLE)
+    { memcpy(&d, &value, sizeof(d)); }
+
+    switch (conversion)
+    {
+    case 'd': case 'i':
+        return snprintf(pDst, size, spec, (type == rtc::LOG_ARG_DOUBLE) ? (long long)d : (long long)value);
+
+    case 'u': case 'o': case 'x': case 'X':
+        return snprintf(pDst, size, spec, (type == rtc::LOG_ARG_DOUBLE) ? (unsigned long long)d : (unsigned long long)value);
+
+    case 'c':
+        return snprintf(pDst, size, spec, int(value));
+
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        if (type == rtc::LOG_ARG_INT)
+        { d = double(int64_t(value)); }
+        else if (type == rtc::LOG_ARG_UINT)
+        { d = double(value); }
+        return snprintf(pDst, size, spec, d);
+
+    case 's':
+        return snprintf(pDst, size, spec, (type == rtc::LOG_ARG_STRING) ? &record.Strings[value] : "<?>");
+
+    case 'p':
+        return snprintf(pDst, size, spec, reinterpret_cast<void*>(uintptr_t(value)));
+
+    default:
+        return snprintf(pDst, size, "%s", spec);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      行頭のファイル名などを整形します. 書き込んだ文字数を返します.
+//-----------------------------------------------------------------------------
+size_t FormatPrefix(const rtc::LogRecord& record, char* pDst, size_t size)
+{
+    auto count = snprintf(pDst, size, "[File:%s, Line:%u, Thread:%u] ", record.pFile, record.Line, record.ThreadId);
+    return (count > 0) ? (std::min)(size_t(count), size - 2) : 0;
+}
+
+//-----------------------------------------------------------------------------
+//      レコードを1行に整形します. 書き込んだ文字数を返します.
+//-----------------------------------------------------------------------------
+size_t FormatRecord(const rtc::LogRecord& record, char* pDst, size_t size)
+{
+    size_t   pos   = FormatPrefix(record, pDst, size);
+    uint32_t index = 0;
+
+    auto append = [&](int count)
+    {
+        if (count > 0)
+        { pos = (std::min)(pos + size_t(count), size - 2); }
+    };
+
+    for(auto p = record.pFormat; *p != '\0' && pos < size - 2;)
+    {
+        if (*p != '%')
+        {
+            pDst[pos++] = *p++;
+            continue;
+        }
+
+        if (p[1] == '%')
+        {
+            pDst[pos++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // 長さ修飾子は取り除き, 記録した型に合わせて付け直す.
+        char spec[32] = "%";
+        size_t specLen = 1;
+        auto push = [&](char c)
+        {
+            if (specLen + 1 < sizeof(spec))
+            { spec[specLen++] = c; spec[specLen] = '\0'; }
+        };
+
+        p++;
+        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+        { push(*p++); }
+
+        for(auto field=0; field<2; ++field)
+        {
+            if (field == 1)
+            {
+                if (*p != '.')
+                { break; }
+                push(*p++);
+            }
+
+            if (*p == '*')
+            {
+                char digits[16];
+                auto value = (index < record.ArgCount) ? int(int64_t(record.Args[index])) : 0;
+                index++;
+                snprintf(digits, sizeof(digits), "%d", value);
+                for(auto c = digits; *c != '\0'; ++c)
+                { push(*c); }
+                p++;
+            }
+            else
+            {
+                while ('0' <= *p && *p <= '9')
+                { push(*p++); }
+            }
+        }
+
+        while (*p == 'h' || *p == 'l' || *p == 'L' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'q')
+        { p++; }
+
+        auto conversion = *p;
+        if (conversion == '\0')
+        { break; }
+        p++;
+
+        if (conversion == 'd' || conversion == 'i' || conversion == 'u' || conversion == 'o' || conversion == 'x' || conversion == 'X')
+        { push('l'); push('l'); }
+        push(conversion);
+
+        if (conversion == 'n')
+        { continue; }
+
+        append(FormatArg(pDst + pos, size - pos, spec, conversion, record, index++));
+    }
+
+    pDst[pos++] = '\n';
+    pDst[pos]   = '\0';
+    return pos;
+}
+
+//-----------------------------------------------------------------------------
+//      レコードを出力先へ書き出します.
+//-----------------------------------------------------------------------------
+void Output(const rtc::LogRecord& record)
+{
+    auto pStream = (record.Level >= RTC_LOG_LEVEL_ERROR) ? stderr : stdout;
+
+    char line[kLineSize];
+    if (record.pText != nullptr)
+    {
+        // 呼び出し側で整形済みの本文は長さを制限せずに書き出す.
+        auto length = FormatPrefix(record, line, sizeof(line));
+        fwrite(line, 1, length, pStream);
+        fputs(record.pText, pStream);
+        fputc('\n', pStream);
+        return;
+    }
+
+    auto length = FormatRecord(record, line, sizeof(line));
+    fwrite(line, 1, length, pStream);
+}
+
+//-----------------------------------------------------------------------------
+//      レコードを書き出して, 整形済みの本文を解放します.
+//-----------------------------------------------------------------------------
+void OutputAndRelease(rtc::LogRecord& record)
+{
+    Output(record);
+    if (record.pText != nullptr)
+    {
+        rtc::CountHeapCall();
+        free(record.pText);
+        record.pText = nullptr;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      全スレッドのリングを時刻順に書き出します. 書き出したレコード数を返します.
+//-----------------------------------------------------------------------------
+size_t Drain(LoggerState& state, std::vector<LogRing*>& rings, std::vector<rtc::LogRecord*>& records, std::vector<uint32_t>& heads)
+{
+    {
+        std::lock_guard<std::mutex> locker(state.Mutex);
+        rings = state.Rings;
+    }
+
+    // 終了フラグは Head より先に読む. 読んだ後の Head が最後の書き込みを含む.
+    std::vector<bool> retired(rings.size());
+    heads.resize(rings.size());
+    records.clear();
+    for(size_t i=0; i<rings.size(); ++i)
+    {
+        auto pRing = rings[i];
+        retired[i] = pRing->Retired.load(std::memory_order_acquire);
+        heads  [i] = pRing->Head   .load(std::memory_order_acquire);
+        for(auto t = pRing->Tail.load(std::memory_order_relaxed); t != heads[i]; ++t)
+        { records.push_back(&pRing->Records[t & kRingMask]); }
+    }
+
+    std::stable_sort(records.begin(), records.end(), [](const rtc::LogRecord* a, const rtc::LogRecord* b)
+    { return a->Ticks < b->Ticks; });
+
+    for(auto pRecord : records)
+    { OutputAndRelease(*pRecord); }
+
+    if (!records.empty())
+    {
+        fflush(stdout);
+        fflush(stderr);
+    }
+
+    for(size_t i=0; i<rings.size(); ++i)
+    { rings[i]->Tail.store(heads[i], std::memory_order_release); }
+
+    // 所有スレッドが終了したリングを破棄する.
+    for(size_t i=0; i<rings.size(); ++i)
+    {
+        if (!retired[i])
+        { continue; }
+
+        std::lock_guard<std::mutex> locker(state.Mutex);
+        auto itr = std::find(state.Rings.begin(), state.Rings.end(), rings[i]);
+        if (itr != state.Rings.end())
+        { state.Rings.erase(itr); }
+        delete rings[i];
+    }
+
+    return records.size();
+}
+
+//-----------------------------------------------------------------------------
+//      書き出しスレッドです.
+//-----------------------------------------------------------------------------
+void WriterThread()
+{
+    auto& state = GetState();
+
+    std::vector<LogRing*>               rings;
+    std::vector<rtc::LogRecord*>        records;
+    std::vector<uint32_t>               heads;
+
+    for(;;)
+    {
+        uint64_t flushRequest = 0;
+        bool     stop         = false;
+        {
+            std::unique_lock<std::mutex> locker(state.Mutex);
+            state.Wake.wait_for(locker, kFlushInterval, [&]()
+            { return state.StopRequest || state.FlushRequest != state.FlushDone || state.RingFull.load(std::memory_order_relaxed); });
+            flushRequest = state.FlushRequest;
+            stop         = state.StopRequest;
+        }
+
+        state.RingFull.store(false, std::memory_order_relaxed);
+        Drain(state, rings, records, heads);
+
+        {
+            std::lock_guard<std::mutex> locker(state.Mutex);
+            state.FlushDone = flushRequest;
+        }
+        state.Flushed.notify_all();
+
+        if (stop)
+        { break; }
+    }
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// Logger class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      初期化処理を行います.
+//-----------------------------------------------------------------------------
+bool Logger::Init()
+{
+    auto& state = GetState();
+    std::lock_guard<std::mutex> locker(state.Mutex);
+    if (state.Running.load(std::memory_order_relaxed))
+    { return true; }
+
+    state.StopRequest  = false;
+    state.WriterAlive  = true;
+    state.FlushRequest = 0;
+    state.FlushDone    = 0;
+    state.Thread = std::thread(WriterThread);
+    state.Running.store(true, std::memory_order_release);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      終了処理を行います.
+//-----------------------------------------------------------------------------
+void Logger::Term()
+{
+    auto& state = GetState();
+    {
+        std::lock_guard<std::mutex> locker(state.Mutex);
+        if (!state.Running.load(std::memory_order_relaxed))
+        { return; }
+
+        // 以降のログは同期書き出しになる.
+        state.Running.store(false, std::memory_order_seq_cst);
+    }
+
+    StopWriter(state);
+}
+
+//-----------------------------------------------------------------------------
+//      記録済みのログを書き出すまで待ちます.
+//-----------------------------------------------------------------------------
+void Logger::Flush()
+{
+    auto& state = GetState();
+    std::unique_lock<std::mutex> locker(state.Mutex);
+    if (!state.Running.load(std::memory_order_relaxed))
+    { return; }
+
+    auto request = ++state.FlushRequest;
+    state.Wake.notify_one();
+    state.Flushed.wait(locker, [&]() { return state.FlushDone >= request || !state.Running.load(std::memory_order_relaxed); });
+}
+
+//-----------------------------------------------------------------------------
+//      呼び出したスレッドのリングからレコードを確保します.
+//-----------------------------------------------------------------------------
+LogRecord* Logger::Acquire()
+{
+    auto& state = GetState();
+    if (!state.Running.load(std::memory_order_acquire))
+    { return nullptr; }
+
+    auto pRing = GetRing();
+    if (pRing == nullptr)
+    { return nullptr; }
+
+    // Term() は Running を下ろしてから Busy が 0 になるのを待つので,
+    // ここで Running を確認できれば Commit() したレコードは必ず書き出される.
+    pRing->Busy.store(1, std::memory_order_seq_cst);
+    if (!state.Running.load(std::memory_order_seq_cst))
+    {
+        pRing->Busy.store(0, std::memory_order_release);
+        return nullptr;
+    }
+
+    // 満杯なら書き出しを待つ. 通常はフラッシュ間隔内に空く.
+    auto head = pRing->Head.load(std::memory_order_relaxed);
+    while (head - pRing->Tail.load(std::memory_order_acquire) >= kRingSize)
+    {
+        if (!state.Running.load(std::memory_order_acquire))
+        {
+            pRing->Busy.store(0, std::memory_order_release);
+            return nullptr;
+        }
+        if (!state.RingFull.exchange(true, std::memory_order_relaxed))
+        { state.Wake.notify_one(); }
+        std::this_thread::yield();
+    }
+
+    t_Head = head;
+
+    auto pRecord = &pRing->Records[head & kRingMask];
+    pRecord->ThreadId = pRing->ThreadId;
+    return pRecord;
+}
+
+//-----------------------------------------------------------------------------
+//      確保したレコードを公開します.
+//-----------------------------------------------------------------------------
+void Logger::Commit()
+{
+    t_pRing->Head.store(t_Head + 1, std::memory_order_release);
+    t_pRing->Busy.store(0, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+//      呼び出しスレッドで同期的に書き出します.
+//-----------------------------------------------------------------------------
+void Logger::WriteSync(LogRecord& record)
+{
+    record.ThreadId = GetCurrentThreadId();
+    OutputAndRelease(record);
+}
+
+} // namespace rtc
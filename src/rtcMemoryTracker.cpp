@@ -0,0 +1,406 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcMemoryTracker.cpp
+// Desc : Tagged Memory Accounting.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcMemoryTracker.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr double kMegaBytes = 1.0 / (1024.0 * 1024.0);
+
+const char* kTagNames[rtc::MEMORY_TAG_COUNT] = {
+    "BVH",
+    "Texture",
+    "FrameBuffer",
+    "D3D12MA",
+    "Encode",
+    "FrameArena",
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// TagCounters structure
+///////////////////////////////////////////////////////////////////////////////
+struct TagCounters
+{
+    std::atomic<int64_t>    LiveBytes   = {};   // 別スレッドでの解放により負になり得ます.
+    std::atomic<uint64_t>   AllocCount  = {};
+    std::atomic<uint64_t>   FreeCount   = {};
+    std::atomic<uint64_t>   AllocBytes  = {};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ThreadCounters structure
+///////////////////////////////////////////////////////////////////////////////
+struct alignas(64) ThreadCounters
+{
+    TagCounters Tags[rtc::MEMORY_TAG_COUNT];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Registry structure
+///////////////////////////////////////////////////////////////////////////////
+struct Registry
+{
+    std::mutex                      Mutex;
+    std::vector<ThreadCounters*>    Threads;
+    ThreadCounters                  Retired;    // 終了したスレッドの値です. 終了後の記録もここに加算します.
+    rtc::MemoryReport               Report;
+    uint64_t                        PrevAllocCount[rtc::MEMORY_TAG_COUNT] = {};
+    uint64_t                        PrevAllocBytes[rtc::MEMORY_TAG_COUNT] = {};
+    rtc::Timer                      Timer;
+    bool                            TimerStarted = false;
+};
+
+//-----------------------------------------------------------------------------
+//      レジストリを取得します.
+//-----------------------------------------------------------------------------
+Registry& GetRegistry()
+{
+    static Registry s_Registry;
+    return s_Registry;
+}
+
+//-----------------------------------------------------------------------------
+//      所有スレッドだけが書き込むカウンタを加算します. RMW 命令は使いません.
+//-----------------------------------------------------------------------------
+template<typename T>
+inline void AddLocal(std::atomic<T>& counter, T value)
+{ counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed); }
+
+//-----------------------------------------------------------------------------
+// Thread Local Variables
+//-----------------------------------------------------------------------------
+thread_local ThreadCounters*    t_pCounters = nullptr;
+thread_local bool               t_Exited    = false;
+thread_local uint64_t           t_HeapCalls = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// ThreadSlot class (スレッド終了時にカウンタを Retired へ畳み込みます)
+///////////////////////////////////////////////////////////////////////////////
+class ThreadSlot
+{
+public:
+    ThreadSlot()
+    {
+        m_pCounters = new ThreadCounters();
+
+        auto& registry = GetRegistry();
+        std::lock_guard<std::mutex> locker(registry.Mutex);
+        registry.Threads.push_back(m_pCounters);
+        t_pCounters = m_pCounters;
+    }
+
+    ~ThreadSlot()
+    {
+        auto& registry = GetRegistry();
+        {
+            std::lock_guard<std::mutex> locker(registry.Mutex);
+            for(auto i=0; i<rtc::MEMORY_TAG_COUNT; ++i)
+            {
+                auto& src = m_pCounters->Tags[i];
+                auto& dst = registry.Retired.Tags[i];
+                dst.LiveBytes .fetch_add(src.LiveBytes .load(std::memory_order_relaxed), std::memory_order_relaxed);
+                dst.AllocCount.fetch_add(src.AllocCount.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                dst.FreeCount .fetch_add(src.FreeCount .load(std::memory_order_relaxed), std::memory_order_relaxed);
+                dst.AllocBytes.fetch_add(src.AllocBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+
+            auto itr = std::find(registry.Threads.begin(), registry.Threads.end(), m_pCounters);
+            if (itr != registry.Threads.end())
+            { registry.Threads.erase(itr); }
+        }
+
+        delete m_pCounters;
+        t_pCounters = nullptr;
+        t_Exited    = true;
+    }
+
+private:
+    ThreadCounters* m_pCounters = nullptr;
+};
+
+//-----------------------------------------------------------------------------
+//      呼び出したスレッドのカウンタを取得します.
+//      スレッド終了処理中 (thread_local の破棄後) は nullptr を返します.
+//-----------------------------------------------------------------------------
+inline ThreadCounters* GetThreadCounters()
+{
+    if (t_pCounters != nullptr)
+    { return t_pCounters; }
+
+    if (t_Exited)
+    { return nullptr; }
+
+    thread_local ThreadSlot slot;
+    return t_pCounters;
+}
+
+//-----------------------------------------------------------------------------
+//      全スレッドのカウンタを集計します. レジストリをロックしてから呼んでください.
+//-----------------------------------------------------------------------------
+void Merge(Registry& registry, rtc::MemoryReport& report)
+{
+    int64_t live[rtc::MEMORY_TAG_COUNT] = {};
+    for(auto i=0; i<rtc::MEMORY_TAG_COUNT; ++i)
+    {
+        auto& dst = report.Tags[i];
+        auto& src = registry.Retired.Tags[i];
+        live[i]        = src.LiveBytes .load(std::memory_order_relaxed);
+        dst.AllocCount = src.AllocCount.load(std::memory_order_relaxed);
+        dst.FreeCount  = src.FreeCount .load(std::memory_order_relaxed);
+        dst.AllocBytes = src.AllocBytes.load(std::memory_order_relaxed);
+    }
+
+    for(auto pCounters : registry.Threads)
+    {
+        for(auto i=0; i<rtc::MEMORY_TAG_COUNT; ++i)
+        {
+            auto& dst = report.Tags[i];
+            auto& src = pCounters->Tags[i];
+            live[i]        += src.LiveBytes .load(std::memory_order_relaxed);
+            dst.AllocCount += src.AllocCount.load(std::memory_order_relaxed);
+            dst.FreeCount  += src.FreeCount .load(std::memory_order_relaxed);
+            dst.AllocBytes += src.AllocBytes.load(std::memory_order_relaxed);
+        }
+    }
+
+    report.TrackedBytes = 0;
+    for(auto i=0; i<rtc::MEMORY_TAG_COUNT; ++i)
+    {
+        // 集計中に別スレッドで解放が進むと一時的に負になるので丸める.
+        auto& dst = report.Tags[i];
+        dst.LiveBytes = size_t(std::max<int64_t>(live[i], 0));
+        dst.PeakBytes = std::max(dst.PeakBytes, dst.LiveBytes);
+        report.TrackedBytes += dst.LiveBytes;
+    }
+    report.PeakTrackedBytes = std::max(report.PeakTrackedBytes, report.TrackedBytes);
+
+    mi_process_info(nullptr, nullptr, nullptr, nullptr, nullptr, &report.CommitBytes, &report.PeakCommitBytes, nullptr);
+}
+
+} // namespace
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+//      割り当てを記録します.
+//-----------------------------------------------------------------------------
+void TrackAlloc(MEMORY_TAG tag, size_t size)
+{
+    assert(0 <= tag && tag < MEMORY_TAG_COUNT);
+
+    auto pCounters = GetThreadCounters();
+    if (pCounters == nullptr)
+    {
+        auto& dst = GetRegistry().Retired.Tags[tag];
+        dst.LiveBytes .fetch_add(int64_t(size), std::memory_order_relaxed);
+        dst.AllocCount.fetch_add(1,             std::memory_order_relaxed);
+        dst.AllocBytes.fetch_add(size,          std::memory_order_relaxed);
+        return;
+    }
+
+    auto& dst = pCounters->Tags[tag];
+    AddLocal<int64_t> (dst.LiveBytes,  int64_t(size));
+    AddLocal<uint64_t>(dst.AllocCount, 1);
+    AddLocal<uint64_t>(dst.AllocBytes, size);
+}
+
+//-----------------------------------------------------------------------------
+//      解放を記録します.
+//-----------------------------------------------------------------------------
+void TrackFree(MEMORY_TAG tag, size_t size)
+{
+    assert(0 <= tag && tag < MEMORY_TAG_COUNT);
+
+    auto pCounters = GetThreadCounters();
+    if (pCounters == nullptr)
+    {
+        auto& dst = GetRegistry().Retired.Tags[tag];
+        dst.LiveBytes.fetch_sub(int64_t(size), std::memory_order_relaxed);
+        dst.FreeCount.fetch_add(1,             std::memory_order_relaxed);
+        return;
+    }
+
+    auto& dst = pCounters->Tags[tag];
+    AddLocal<int64_t> (dst.LiveBytes, -int64_t(size));
+    AddLocal<uint64_t>(dst.FreeCount, 1);
+}
+
+//-----------------------------------------------------------------------------
+//      タグ付きでメモリを割り当てます.
+//-----------------------------------------------------------------------------
+void* TaggedAlloc(MEMORY_TAG tag, size_t size, size_t alignment)
+{
+    CountHeapCall();
+    auto ptr = mi_malloc_aligned(size, alignment);
+    if (ptr != nullptr)
+    { TrackAlloc(tag, mi_usable_size(ptr)); }
+    return ptr;
+}
+
+//-----------------------------------------------------------------------------
+//      タグ付きで割り当てたメモリを解放します.
+//-----------------------------------------------------------------------------
+void TaggedFree(MEMORY_TAG tag, void* ptr)
+{
+    if (ptr == nullptr)
+    { return; }
+
+    CountHeapCall();
+    TrackFree(tag, mi_usable_size(ptr));
+    mi_free(ptr);
+}
+
+//-----------------------------------------------------------------------------
+//      汎用ヒープの呼び出しを数えます.
+//-----------------------------------------------------------------------------
+void CountHeapCall()
+{ t_HeapCalls++; }
+
+//-----------------------------------------------------------------------------
+//      呼び出したスレッドの汎用ヒープ呼び出し回数を取得します.
+//-----------------------------------------------------------------------------
+uint64_t GetThreadHeapCalls()
+{ return t_HeapCalls; }
+
+//-----------------------------------------------------------------------------
+//      タグ名を取得します.
+//-----------------------------------------------------------------------------
+const char* GetMemoryTagName(MEMORY_TAG tag)
+{
+    if (tag < 0 || tag >= MEMORY_TAG_COUNT)
+    { return "Unknown"; }
+
+    return kTagNames[tag];
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// MemoryReport structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      ログに出力します.
+//-----------------------------------------------------------------------------
+void MemoryReport::Print() const
+{
+    RTC_ILOG("Memory : frame %llu, tracked = %.2lf MB (peak %.2lf MB), commit = %.2lf MB (peak %.2lf MB)",
+        static_cast<unsigned long long>(FrameIndex),
+        TrackedBytes     * kMegaBytes,
+        PeakTrackedBytes * kMegaBytes,
+        CommitBytes      * kMegaBytes,
+        PeakCommitBytes  * kMegaBytes);
+
+    for(auto i=0; i<MEMORY_TAG_COUNT; ++i)
+    {
+        auto& item = Tags[i];
+        if (item.AllocCount == 0)
+        { continue; }
+
+        RTC_ILOG("  %-12s : live = %9.2lf MB, peak = %9.2lf MB, allocs = %10llu (%llu this frame, %.1lf /sec)",
+            GetMemoryTagName(MEMORY_TAG(i)),
+            item.LiveBytes * kMegaBytes,
+            item.PeakBytes * kMegaBytes,
+            static_cast<unsigned long long>(item.AllocCount),
+            static_cast<unsigned long long>(item.FrameAllocCount),
+            item.AllocPerSec);
+        RTC_UNUSED(item);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// MemoryTracker class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      全スレッドのカウンタを集計します.
+//-----------------------------------------------------------------------------
+void MemoryTracker::Query(MemoryReport& report)
+{
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> locker(registry.Mutex);
+
+    Merge(registry, registry.Report);
+    report = registry.Report;
+}
+
+//-----------------------------------------------------------------------------
+//      フレーム終端の集計を行います.
+//-----------------------------------------------------------------------------
+const MemoryReport& MemoryTracker::EndFrame()
+{
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> locker(registry.Mutex);
+
+    auto& report = registry.Report;
+    Merge(registry, report);
+
+    double msec = 0.0;
+    if (registry.TimerStarted)
+    {
+        registry.Timer.End();
+        msec = registry.Timer.GetElapsedMsec();
+    }
+    registry.Timer.Start();
+    registry.TimerStarted = true;
+
+    for(auto i=0; i<MEMORY_TAG_COUNT; ++i)
+    {
+        auto& item = report.Tags[i];
+        item.FrameAllocCount = item.AllocCount - registry.PrevAllocCount[i];
+        item.FrameAllocBytes = item.AllocBytes - registry.PrevAllocBytes[i];
+        item.AllocPerSec     = (msec > 0.0) ? double(item.FrameAllocCount) * 1000.0 / msec : 0.0;
+
+        registry.PrevAllocCount[i] = item.AllocCount;
+        registry.PrevAllocBytes[i] = item.AllocBytes;
+    }
+
+    report.FrameMsec = msec;
+    report.FrameIndex++;
+    return report;
+}
+
+//-----------------------------------------------------------------------------
+//      終了時の集計を出力します.
+//-----------------------------------------------------------------------------
+void MemoryTracker::PrintSummary()
+{
+    MemoryReport report;
+    Query(report);
+    report.Print();
+
+    // 終了時に残っているタグは解放漏れの候補.
+    for(auto i=0; i<MEMORY_TAG_COUNT; ++i)
+    {
+        auto& item = report.Tags[i];
+        if (item.AllocCount != item.FreeCount)
+        {
+            RTC_ILOG("Warning : %s has %llu live allocations (%zu bytes) at exit.",
+                GetMemoryTagName(MEMORY_TAG(i)),
+                static_cast<unsigned long long>(item.AllocCount - item.FreeCount),
+                item.LiveBytes);
+        }
+        RTC_UNUSED(item);
+    }
+
+    mi_stats_print_out(nullptr, nullptr);
+}
+
+} // namespace rtc
@@ -0,0 +1,420 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcOpacityMask.cpp
+// Desc : Opacity Micro-Map (2bit Mask).
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcOpacityMask.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t kMaxSubdivisionLevel = 8;            // 最大分割レベル (65536 分割).
+constexpr uint64_t kMaxFootprintTexels  = 1ull << 22;   // 分類を諦めるテクセル数.
+constexpr uint32_t kEntriesPerWord      = 16;           // uint32_t あたりのエントリ数.
+
+//-----------------------------------------------------------------------------
+//      区間 [min, max] に三角形を射影します.
+//-----------------------------------------------------------------------------
+inline void Project(const rtc::float2 v[3], const rtc::float2& axis, float& minValue, float& maxValue)
+{
+    minValue = maxValue = v[0].x * axis.x + v[0].y * axis.y;
+    for(auto i=1; i<3; ++i)
+    {
+        auto d = v[i].x * axis.x + v[i].y * axis.y;
+        minValue = std::min(minValue, d);
+        maxValue = std::max(maxValue, d);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      三角形と軸平行矩形が重なるかどうか分離軸判定します.
+//-----------------------------------------------------------------------------
+bool Overlap(const rtc::float2 v[3], const rtc::float2& boxMin, const rtc::float2& boxMax)
+{
+    for(auto i=0; i<3; ++i)
+    {
+        auto e    = v[(i + 1) % 3] - v[i];
+        auto axis = rtc::float2(-e.y, e.x);
+
+        float triMin, triMax;
+        Project(v, axis, triMin, triMax);
+
+        rtc::float2 corners[4] = {
+            rtc::float2(boxMin.x, boxMin.y),
+            rtc::float2(boxMax.x, boxMin.y),
+            rtc::float2(boxMin.x, boxMax.y),
+            rtc::float2(boxMax.x, boxMax.y),
+        };
+
+        auto boxMinD = FLT_MAX;
+        auto boxMaxD = -FLT_MAX;
+        for(auto& c : corners)
+        {
+            auto d = c.x * axis.x + c.y * axis.y;
+            boxMinD = std::min(boxMinD, d);
+            boxMaxD = std::max(boxMaxD, d);
+        }
+
+        if (boxMaxD < triMin || boxMinD > triMax)
+        { return false; }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      テクスチャ空間の三角形が覆うテクセルから状態を分類します.
+//-----------------------------------------------------------------------------
+rtc::OPACITY_STATE Classify(const rtc::AlphaImage& image, const rtc::float2 uv[3])
+{
+    // テクセル座標に変換.
+    rtc::float2 v[3];
+    for(auto i=0; i<3; ++i)
+    { v[i] = rtc::float2(uv[i].x * float(image.Width), uv[i].y * float(image.Height)); }
+
+    auto minX = std::min(v[0].x, std::min(v[1].x, v[2].x));
+    auto minY = std::min(v[0].y, std::min(v[1].y, v[2].y));
+    auto maxX = std::max(v[0].x, std::max(v[1].x, v[2].x));
+    auto maxY = std::max(v[0].y, std::max(v[1].y, v[2].y));
+
+    // バイリニアフィルタで参照される範囲まで半テクセル広げる.
+    auto x0 = int(floorf(minX - 0.5f));
+    auto y0 = int(floorf(minY - 0.5f));
+    auto x1 = int(floorf(maxX + 0.5f));
+    auto y1 = int(floorf(maxY + 0.5f));
+
+    if (uint64_t(x1 - x0 + 1) * uint64_t(y1 - y0 + 1) > kMaxFootprintTexels)
+    { return rtc::OPACITY_STATE_UNKNOWN; }
+
+    bool opaque      = false;
+    bool transparent = false;
+    for(auto y=y0; y<=y1; ++y)
+    {
+        for(auto x=x0; x<=x1; ++x)
+        {
+            // テクセル (x, y) が寄与する範囲.
+            auto boxMin = rtc::float2(float(x) - 0.5f, float(y) - 0.5f);
+            auto boxMax = rtc::float2(float(x) + 1.5f, float(y) + 1.5f);
+            if (!Overlap(v, boxMin, boxMax))
+            { continue; }
+
+            if (image.Fetch(x, y) >= image.Cutoff)
+            { opaque = true; }
+            else
+            { transparent = true; }
+
+            if (opaque && transparent)
+            { return rtc::OPACITY_STATE_UNKNOWN; }
+        }
+    }
+
+    return opaque ? rtc::OPACITY_STATE_OPAQUE : rtc::OPACITY_STATE_TRANSPARENT;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// AlphaImage structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      ラップアドレッシングでアルファ値を取得します.
+//-----------------------------------------------------------------------------
+uint8_t AlphaImage::Fetch(int x, int y) const
+{
+    auto w = int(Width);
+    auto h = int(Height);
+    x %= w; if (x < 0) { x += w; }
+    y %= h; if (y < 0) { y += h; }
+
+    auto pitch = (RowPitch != 0) ? RowPitch : Width * PixelStride;
+    return pPixels[size_t(y) * pitch + size_t(x) * PixelStride];
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// AnyHitStats structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      シェーダの AnyHitCounters を読み戻した値から統計を作ります.
+//      (呼び出し数, 省略数, テクスチャ参照数) の順に kCounterCount 個並びます.
+//-----------------------------------------------------------------------------
+AnyHitStats AnyHitStats::FromCounters(const uint32_t* pCounters)
+{
+    AnyHitStats result;
+    if (pCounters == nullptr)
+    { return result; }
+
+    result.Invocations    = pCounters[0];
+    result.Avoided        = pCounters[1];
+    result.TextureFetches = pCounters[2];
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      統計を加算します.
+//-----------------------------------------------------------------------------
+AnyHitStats& AnyHitStats::operator += (const AnyHitStats& value)
+{
+    Invocations    += value.Invocations;
+    Avoided        += value.Avoided;
+    TextureFetches += value.TextureFetches;
+    return *this;
+}
+
+//-----------------------------------------------------------------------------
+//      統計をログに出力します.
+//-----------------------------------------------------------------------------
+void AnyHitStats::Print(const char* name) const
+{
+    auto ratio = (Invocations > 0) ? double(Avoided) * 100.0 / double(Invocations) : 0.0;
+    RTC_ILOG("AnyHit : %s, invocations = %llu, avoided = %llu (%.1lf%%), texture fetches = %llu",
+        name,
+        static_cast<unsigned long long>(Invocations),
+        static_cast<unsigned long long>(Avoided),
+        ratio,
+        static_cast<unsigned long long>(TextureFetches));
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// OpacityMask class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      重心座標からマイクロ三角形番号を求めます.
+//-----------------------------------------------------------------------------
+uint32_t OpacityMask::CalcMicroTriangleIndex(const float2& barycentrics, uint32_t level)
+{
+    // 三角形を S x S の格子に分割し, 行ごとに下向き・上向きの三角形を交互に並べる.
+    // 行 j には 2(S - j) - 1 個の三角形があり, 行 j の先頭は j(2S - j) となる.
+    auto S  = 1u << level;
+    auto fu = Saturate(barycentrics.x) * float(S);
+    auto fv = Saturate(barycentrics.y) * float(S);
+
+    auto j = std::min(uint32_t(fv), S - 1);
+    auto i = std::min(uint32_t(fu), S - 1 - j);
+
+    auto a = fu - float(i);
+    auto b = fv - float(j);
+    auto upper = (a + b > 1.0f) && (i + j < S - 1);
+
+    return j * (2 * S - j) + 2 * i + (upper ? 1 : 0);
+}
+
+//-----------------------------------------------------------------------------
+//      マスクを構築します.
+//-----------------------------------------------------------------------------
+bool OpacityMask::Build(const OpacityMaskDesc& desc)
+{
+    Clear();
+
+    if (desc.pTexCoords == nullptr || desc.pIndices == nullptr || desc.TriangleCount == 0)
+    { return false; }
+
+    if (desc.Alpha.pPixels == nullptr || desc.Alpha.Width == 0 || desc.Alpha.Height == 0)
+    { return false; }
+
+    Timer timer;
+    timer.Start();
+
+    m_Level = std::min(desc.SubdivisionLevel, kMaxSubdivisionLevel);
+
+    auto S     = 1u << m_Level;
+    auto count = S * S;     // 三角形あたりのマイクロ三角形数.
+
+    std::vector<uint8_t> states(count);
+    m_Descs.resize(desc.TriangleCount);
+
+    uint32_t entryCount = 0;
+    for(auto t=0u; t<desc.TriangleCount; ++t)
+    {
+        float2 uv[3] = {
+            desc.pTexCoords[desc.pIndices[t * 3 + 0]],
+            desc.pTexCoords[desc.pIndices[t * 3 + 1]],
+            desc.pTexCoords[desc.pIndices[t * 3 + 2]],
+        };
+
+        auto toUV = [&](float u, float v)
+        { return uv[0] * (1.0f - u - v) + uv[1] * u + uv[2] * v; };
+
+        uint32_t histogram[3] = {};
+        auto invS = 1.0f / float(S);
+        for(auto j=0u; j<S; ++j)
+        {
+            for(auto i=0u; i+j<S; ++i)
+            {
+                auto base = j * (2 * S - j) + 2 * i;
+
+                float2 lower[3] = {
+                    toUV(float(i    ) * invS, float(j    ) * invS),
+                    toUV(float(i + 1) * invS, float(j    ) * invS),
+                    toUV(float(i    ) * invS, float(j + 1) * invS),
+                };
+                states[base] = Classify(desc.Alpha, lower);
+                histogram[states[base]]++;
+
+                if (i + j < S - 1)
+                {
+                    float2 upper[3] = {
+                        toUV(float(i + 1) * invS, float(j    ) * invS),
+                        toUV(float(i + 1) * invS, float(j + 1) * invS),
+                        toUV(float(i    ) * invS, float(j + 1) * invS),
+                    };
+                    states[base + 1] = Classify(desc.Alpha, upper);
+                    histogram[states[base + 1]]++;
+                }
+            }
+        }
+
+        m_Stats.TransparentCount += histogram[OPACITY_STATE_TRANSPARENT];
+        m_Stats.OpaqueCount      += histogram[OPACITY_STATE_OPAQUE];
+        m_Stats.UnknownCount     += histogram[OPACITY_STATE_UNKNOWN];
+
+        // 全体が同じ状態ならマスクを持たない.
+        auto uniform = false;
+        for(auto s=0u; s<3; ++s)
+        {
+            if (histogram[s] == count)
+            {
+                m_Descs[t] = kUniformIndex + s;
+                m_Stats.UniformTriangles++;
+                uniform = true;
+                break;
+            }
+        }
+
+        if (uniform)
+        { continue; }
+
+        // 2bit ずつ詰める. 三角形の先頭はワード境界に揃えない.
+        m_Descs[t] = entryCount;
+        m_Bits.resize((size_t(entryCount) + count + kEntriesPerWord - 1) / kEntriesPerWord, 0);
+        for(auto k=0u; k<count; ++k)
+        {
+            auto entry = entryCount + k;
+            m_Bits[entry / kEntriesPerWord] |= uint32_t(states[k]) << ((entry % kEntriesPerWord) * 2);
+        }
+        entryCount += count;
+    }
+
+    timer.End();
+
+    m_Stats.Triangles   = desc.TriangleCount;
+    m_Stats.MemoryBytes = m_Descs.size() * sizeof(uint32_t) + m_Bits.size() * sizeof(uint32_t);
+    m_Stats.ElapsedMsec = timer.GetElapsedMsec();
+
+    RTC_DLOG("OpacityMask : triangles = %u (uniform %u), opaque = %llu, transparent = %llu, unknown = %llu, %zu bytes, %.3lf msec",
+        m_Stats.Triangles,
+        m_Stats.UniformTriangles,
+        static_cast<unsigned long long>(m_Stats.OpaqueCount),
+        static_cast<unsigned long long>(m_Stats.TransparentCount),
+        static_cast<unsigned long long>(m_Stats.UnknownCount),
+        m_Stats.MemoryBytes,
+        m_Stats.ElapsedMsec);
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      マスクを破棄します.
+//-----------------------------------------------------------------------------
+void OpacityMask::Clear()
+{
+    m_Descs.clear();
+    m_Bits .clear();
+    m_Level = 0;
+    m_Stats = OpacityMaskStats();
+    ResetAnyHitStats();
+}
+
+//-----------------------------------------------------------------------------
+//      ヒット位置の状態を取得します.
+//-----------------------------------------------------------------------------
+OPACITY_STATE OpacityMask::GetState(uint32_t triangleIndex, const float2& barycentrics) const
+{
+    if (triangleIndex >= m_Descs.size())
+    { return OPACITY_STATE_UNKNOWN; }
+
+    auto desc = m_Descs[triangleIndex];
+    if (desc >= kUniformIndex)
+    { return OPACITY_STATE(desc - kUniformIndex); }
+
+    auto entry = desc + CalcMicroTriangleIndex(barycentrics, m_Level);
+    auto bits  = m_Bits[entry / kEntriesPerWord] >> ((entry % kEntriesPerWord) * 2);
+    return OPACITY_STATE(bits & 0x3);
+}
+
+//-----------------------------------------------------------------------------
+//      任意ヒット処理を行います. 未確定の場合だけアルファテスト関数を呼び出します.
+//-----------------------------------------------------------------------------
+bool OpacityMask::AnyHit(uint32_t triangleIndex, const float2& barycentrics, AlphaTestFunc func, void* pUser)
+{
+    m_Invocations.fetch_add(1, std::memory_order_relaxed);
+
+    auto state = GetState(triangleIndex, barycentrics);
+    if (state != OPACITY_STATE_UNKNOWN || func == nullptr)
+    {
+        m_Avoided.fetch_add(1, std::memory_order_relaxed);
+        return state != OPACITY_STATE_TRANSPARENT;
+    }
+
+    m_TextureFetches.fetch_add(1, std::memory_order_relaxed);
+    return func(pUser, triangleIndex, barycentrics);
+}
+
+//-----------------------------------------------------------------------------
+//      任意ヒットの統計を取得し, リセットします. フレームの終わりに呼び出します.
+//-----------------------------------------------------------------------------
+AnyHitStats OpacityMask::ResetAnyHitStats()
+{
+    AnyHitStats result;
+    result.Invocations    = m_Invocations   .exchange(0, std::memory_order_relaxed);
+    result.Avoided        = m_Avoided       .exchange(0, std::memory_order_relaxed);
+    result.TextureFetches = m_TextureFetches.exchange(0, std::memory_order_relaxed);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      GPU 用に複数のマスクを1つのバッファに詰めます.
+//      インスタンスごとに uint4(記述子の先頭, マスクの先頭, 分割レベル, 三角形数) が並びます.
+//      オフセットは全て uint32_t 単位です.
+//-----------------------------------------------------------------------------
+void OpacityMask::Pack(const OpacityMask* const* ppMasks, uint32_t count, std::vector<uint32_t>& result)
+{
+    result.clear();
+    result.resize(size_t(count) * 4, 0);
+
+    for(auto i=0u; i<count; ++i)
+    {
+        auto pMask = ppMasks[i];
+        if (pMask == nullptr)
+        { continue; }
+
+        auto descOffset = uint32_t(result.size());
+        result.insert(result.end(), pMask->m_Descs.begin(), pMask->m_Descs.end());
+
+        auto bitsOffset = uint32_t(result.size());
+        result.insert(result.end(), pMask->m_Bits.begin(), pMask->m_Bits.end());
+
+        result[i * 4 + 0] = descOffset;
+        result[i * 4 + 1] = bitsOffset;
+        result[i * 4 + 2] = pMask->m_Level;
+        result[i * 4 + 3] = uint32_t(pMask->m_Descs.size());
+    }
+}
+
+} // namespace rtc
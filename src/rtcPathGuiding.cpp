@@ -0,0 +1,564 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcPathGuiding.cpp
+// Desc : Path Guiding (Spatial-Directional Tree).
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcPathGuiding.h>
+#include <rtcLog.h>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+//      アトミックに加算します.
+//-----------------------------------------------------------------------------
+inline void AtomicAdd(std::atomic<float>& dst, float value)
+{
+    auto current = dst.load(std::memory_order_relaxed);
+    while(!dst.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+    { /* DO_NOTHING */ }
+}
+
+//-----------------------------------------------------------------------------
+//      方向ベクトルを正規化円柱座標 [0, 1]^2 に変換します.
+//-----------------------------------------------------------------------------
+inline rtc::float2 DirToCanonical(const rtc::float3& dir)
+{
+    auto cosTheta = std::min(std::max(dir.z, -1.0f), 1.0f);
+    auto phi      = atan2f(dir.y, dir.x);
+    if (phi < 0.0f)
+    { phi += rtc::F_2PI; }
+
+    return rtc::float2(
+        std::min((cosTheta + 1.0f) * 0.5f, 0x1.fffffep-1f),
+        std::min(phi / rtc::F_2PI,         0x1.fffffep-1f));
+}
+
+//-----------------------------------------------------------------------------
+//      正規化円柱座標を方向ベクトルに変換します.
+//-----------------------------------------------------------------------------
+inline rtc::float3 CanonicalToDir(const rtc::float2& p)
+{
+    auto cosTheta = 2.0f * p.x - 1.0f;
+    auto sinTheta = rtc::SafeSqrt(1.0f - cosTheta * cosTheta);
+    auto phi      = rtc::F_2PI * p.y;
+    return rtc::float3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+}
+
+//-----------------------------------------------------------------------------
+//      象限番号を求め, 座標を子ノードの空間に変換します.
+//-----------------------------------------------------------------------------
+inline uint32_t ChildIndex(rtc::float2& p)
+{
+    uint32_t result = 0;
+    if (p.x >= 0.5f) { result |= 1; p.x = p.x * 2.0f - 1.0f; } else { p.x *= 2.0f; }
+    if (p.y >= 0.5f) { result |= 2; p.y = p.y * 2.0f - 1.0f; } else { p.y *= 2.0f; }
+    return result;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// DirectionalTree::Node structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      コンストラクタです.
+//-----------------------------------------------------------------------------
+DirectionalTree::Node::Node()
+{
+    for(auto i=0; i<4; ++i)
+    {
+        Sum[i].store(0.0f, std::memory_order_relaxed);
+        Child[i] = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      コピーコンストラクタです.
+//-----------------------------------------------------------------------------
+DirectionalTree::Node::Node(const Node& value)
+{ *this = value; }
+
+//-----------------------------------------------------------------------------
+//      代入演算子です.
+//-----------------------------------------------------------------------------
+DirectionalTree::Node& DirectionalTree::Node::operator = (const Node& value)
+{
+    for(auto i=0; i<4; ++i)
+    {
+        Sum[i].store(value.Sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        Child[i] = value.Child[i];
+    }
+    return *this;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// DirectionalTree class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      コンストラクタです.
+//-----------------------------------------------------------------------------
+DirectionalTree::DirectionalTree()
+{ m_Nodes.resize(1); }
+
+//-----------------------------------------------------------------------------
+//      コピーコンストラクタです.
+//-----------------------------------------------------------------------------
+DirectionalTree::DirectionalTree(const DirectionalTree& value)
+{ *this = value; }
+
+//-----------------------------------------------------------------------------
+//      代入演算子です.
+//-----------------------------------------------------------------------------
+DirectionalTree& DirectionalTree::operator = (const DirectionalTree& value)
+{
+    m_Nodes = value.m_Nodes;
+    m_SampleCount.store(value.m_SampleCount.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+}
+
+//-----------------------------------------------------------------------------
+//      放射照度を記録します. 複数スレッドから同時に呼び出せます.
+//-----------------------------------------------------------------------------
+void DirectionalTree::Record(const float2& p, float value)
+{
+    m_SampleCount.fetch_add(1, std::memory_order_relaxed);
+    if (!(value > 0.0f) || !std::isfinite(value))
+    { return; }
+
+    auto q = p;
+    uint32_t index = 0;
+    for(;;)
+    {
+        auto& node  = m_Nodes[index];
+        auto  child = ChildIndex(q);
+        AtomicAdd(node.Sum[child], value);
+
+        if (node.Child[child] == 0)
+        { break; }
+
+        index = node.Child[child];
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      合計値を取得します.
+//-----------------------------------------------------------------------------
+float DirectionalTree::GetTotal() const
+{
+    auto& root = m_Nodes[0];
+    return root.Sum[0].load(std::memory_order_relaxed)
+         + root.Sum[1].load(std::memory_order_relaxed)
+         + root.Sum[2].load(std::memory_order_relaxed)
+         + root.Sum[3].load(std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+//      エネルギーに比例した点 [0, 1]^2 をサンプリングします.
+//-----------------------------------------------------------------------------
+float2 DirectionalTree::Sample(float u0, float u1) const
+{
+    float2   origin(0.0f);
+    float    size  = 1.0f;
+    uint32_t index = 0;
+
+    for(;;)
+    {
+        auto& node = m_Nodes[index];
+        float sum[4];
+        for(auto i=0; i<4; ++i)
+        { sum[i] = node.Sum[i].load(std::memory_order_relaxed); }
+
+        // x 方向 -> y 方向の順に二分して選択する.
+        auto left  = sum[0] + sum[2];
+        auto total = left + sum[1] + sum[3];
+        if (!(total > 0.0f))
+        { break; }
+
+        uint32_t child = 0;
+        auto px = left / total;
+        if (u0 < px)
+        { u0 /= px; }
+        else
+        {
+            u0 = (u0 - px) / (1.0f - px);
+            child |= 1;
+        }
+
+        auto bottom = sum[child];
+        auto top    = sum[child | 2];
+        auto py     = bottom / (bottom + top);
+        if (u1 < py)
+        { u1 /= py; }
+        else
+        {
+            u1 = (u1 - py) / (1.0f - py);
+            child |= 2;
+        }
+
+        size *= 0.5f;
+        origin.x += (child & 1) ? size : 0.0f;
+        origin.y += (child & 2) ? size : 0.0f;
+
+        if (node.Child[child] == 0)
+        { break; }
+
+        index = node.Child[child];
+    }
+
+    // 葉の中では一様.
+    return float2(
+        std::min(origin.x + u0 * size, 0x1.fffffep-1f),
+        std::min(origin.y + u1 * size, 0x1.fffffep-1f));
+}
+
+//-----------------------------------------------------------------------------
+//      [0, 1]^2 上の確率密度を求めます.
+//-----------------------------------------------------------------------------
+float DirectionalTree::Pdf(const float2& p) const
+{
+    // 合計がゼロの節点以下は Sample() と同じく一様分布とみなす.
+    auto     q      = p;
+    float    result = 1.0f;
+    uint32_t index  = 0;
+
+    for(;;)
+    {
+        auto& node  = m_Nodes[index];
+        auto  child = ChildIndex(q);
+
+        float sum = 0.0f;
+        for(auto i=0; i<4; ++i)
+        { sum += node.Sum[i].load(std::memory_order_relaxed); }
+
+        if (!(sum > 0.0f))
+        { break; }
+
+        result *= 4.0f * node.Sum[child].load(std::memory_order_relaxed) / sum;
+        if (node.Child[child] == 0)
+        { break; }
+
+        index = node.Child[child];
+    }
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      前回のイテレーションの分布から構造を作り直します. 合計値はゼロクリアされます.
+//-----------------------------------------------------------------------------
+void DirectionalTree::Refine(const DirectionalTree& prev, float rho, uint32_t maxDepth, uint32_t maxNodes)
+{
+    m_Nodes.clear();
+    m_Nodes.resize(1);
+    m_SampleCount.store(0, std::memory_order_relaxed);
+
+    auto total = prev.GetTotal();
+    if (!(total > 0.0f))
+    { return; }
+
+    struct Item
+    {
+        uint32_t    Dst;
+        uint32_t    Src;    // UINT32_MAX なら前回に対応するノードが無い.
+        uint32_t    Depth;
+        float       Energy[4];
+    };
+
+    std::vector<Item> stack;
+    {
+        Item root = { 0, 0, 1, {} };
+        for(auto i=0; i<4; ++i)
+        { root.Energy[i] = prev.m_Nodes[0].Sum[i].load(std::memory_order_relaxed); }
+        stack.push_back(root);
+    }
+
+    while(!stack.empty())
+    {
+        auto item = stack.back();
+        stack.pop_back();
+
+        for(auto i=0u; i<4; ++i)
+        {
+            // エネルギーが閾値を超える象限だけ細分化する.
+            if (item.Energy[i] <= rho * total || item.Depth >= maxDepth)
+            { continue; }
+
+            if (uint32_t(m_Nodes.size()) >= maxNodes)
+            { return; }
+
+            auto childIndex = uint32_t(m_Nodes.size());
+            m_Nodes.emplace_back();
+            m_Nodes[item.Dst].Child[i] = childIndex;
+
+            Item child = { childIndex, UINT32_MAX, item.Depth + 1, {} };
+
+            auto srcChild = (item.Src != UINT32_MAX) ? prev.m_Nodes[item.Src].Child[i] : 0;
+            if (srcChild != 0)
+            {
+                child.Src = srcChild;
+                for(auto j=0; j<4; ++j)
+                { child.Energy[j] = prev.m_Nodes[srcChild].Sum[j].load(std::memory_order_relaxed); }
+            }
+            else
+            {
+                // 前回の葉を分割する場合は均等に配分したとみなす.
+                for(auto j=0; j<4; ++j)
+                { child.Energy[j] = item.Energy[i] * 0.25f; }
+            }
+
+            stack.push_back(child);
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// PathGuiding class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      初期化処理を行います.
+//-----------------------------------------------------------------------------
+bool PathGuiding::Init(const PathGuidingDesc& desc)
+{
+    if (!desc.SceneBounds.IsValid())
+    { return false; }
+
+    m_Desc = desc;
+    m_Spatial.clear();
+    m_Leaves .clear();
+
+    m_Spatial.push_back({ { 0, 0 }, 0, 0 });
+    m_Leaves .emplace_back();
+
+    m_Iteration = 0;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      終了処理を行います.
+//-----------------------------------------------------------------------------
+void PathGuiding::Term()
+{
+    m_Spatial.clear();
+    m_Leaves .clear();
+    m_Iteration = 0;
+}
+
+//-----------------------------------------------------------------------------
+//      位置に対応する葉を探します.
+//-----------------------------------------------------------------------------
+uint32_t PathGuiding::FindLeaf(const float3& position) const
+{
+    // シーンのバウンディングボックスで正規化.
+    auto d = m_Desc.SceneBounds.Diagonal();
+    auto p = (position - m_Desc.SceneBounds.Min) / Max(d, float3(1e-6f));
+    p = Min(Max(p, float3(0.0f)), float3(1.0f));
+
+    uint32_t index = 0;
+    for(;;)
+    {
+        auto& node = m_Spatial[index];
+        if (node.Leaf != UINT32_MAX)
+        { return node.Leaf; }
+
+        auto& v = p[node.Axis];
+        if (v < 0.5f)
+        {
+            v *= 2.0f;
+            index = node.Child[0];
+        }
+        else
+        {
+            v = v * 2.0f - 1.0f;
+            index = node.Child[1];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      パス頂点での入射放射輝度を記録します. 複数スレッドから同時に呼び出せます.
+//-----------------------------------------------------------------------------
+void PathGuiding::Record(const float3& position, const float3& dir, const float3& radiance, float pdf)
+{
+    if (!IsTraining() || !(pdf > 0.0f))
+    { return; }
+
+    auto leaf = FindLeaf(position);
+    m_Leaves[leaf].Building.Record(DirToCanonical(dir), Luminance(radiance) / pdf);
+}
+
+//-----------------------------------------------------------------------------
+//      学習済みの分布から方向をサンプリングします. pdf は立体角測度です.
+//-----------------------------------------------------------------------------
+bool PathGuiding::Sample(const float3& position, float u0, float u1, float3& dir, float& pdf) const
+{
+    if (!IsReady())
+    { return false; }
+
+    // 未学習の葉では一様にサンプリングする. Pdf() も一様分布を返すので MixturePdf() と一致する.
+    auto& tree = m_Leaves[FindLeaf(position)].Sampling;
+    auto p = tree.Sample(u0, u1);
+    dir = CanonicalToDir(p);
+    pdf = tree.Pdf(p) / (4.0f * F_PI);
+    return pdf > 0.0f;
+}
+
+//-----------------------------------------------------------------------------
+//      学習済みの分布の確率密度を求めます. pdf は立体角測度です.
+//-----------------------------------------------------------------------------
+float PathGuiding::Pdf(const float3& position, const float3& dir) const
+{
+    if (!IsReady())
+    { return 0.0f; }
+
+    auto& tree = m_Leaves[FindLeaf(position)].Sampling;
+    return tree.Pdf(DirToCanonical(dir)) / (4.0f * F_PI);
+}
+
+//-----------------------------------------------------------------------------
+//      BSDF サンプリングとガイドサンプリングのどちらかを選択します.
+//      useBsdf が true の場合は呼び出し側で BSDF をサンプリングし,
+//      いずれの場合も MixturePdf() で一標本 MIS の確率密度を求めます.
+//-----------------------------------------------------------------------------
+bool PathGuiding::SampleMIS
+(
+    const float3&   position,
+    float           uSelect,
+    float           u0,
+    float           u1,
+    bool&           useBsdf,
+    float3&         dir
+) const
+{
+    useBsdf = true;
+    if (!IsReady() || uSelect < m_Desc.BsdfSamplingFraction)
+    { return true; }
+
+    float pdf = 0.0f;
+    if (!Sample(position, u0, u1, dir, pdf))
+    { return true; }
+
+    useBsdf = false;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      一標本 MIS の混合確率密度を求めます.
+//-----------------------------------------------------------------------------
+float PathGuiding::MixturePdf(float bsdfPdf, float guidePdf) const
+{
+    if (!IsReady())
+    { return bsdfPdf; }
+
+    auto alpha = m_Desc.BsdfSamplingFraction;
+    return alpha * bsdfPdf + (1.0f - alpha) * guidePdf;
+}
+
+//-----------------------------------------------------------------------------
+//      イテレーションを終了し, 分布を更新します. 記録中のスレッドが無い状態で呼び出してください.
+//-----------------------------------------------------------------------------
+void PathGuiding::EndIteration()
+{
+    if (!IsTraining())
+    { return; }
+
+    auto nodeBytes = 2 * sizeof(SpatialNode) + sizeof(DTreePair);
+    auto memory    = CalcMemoryBytes();
+
+    // サンプル数が閾値を超えた葉を空間分割する. 分割は1イテレーションにつき1段までとする.
+    auto threshold = m_Desc.SpatialThreshold * sqrtf(float(1u << std::min(m_Iteration, 30u)));
+    auto count     = uint32_t(m_Spatial.size());
+    for(auto i=0u; i<count; ++i)
+    {
+        auto leaf = m_Spatial[i].Leaf;
+        if (leaf == UINT32_MAX)
+        { continue; }
+
+        if (float(m_Leaves[leaf].Building.GetSampleCount()) <= threshold)
+        { continue; }
+
+        auto treeBytes = size_t(m_Leaves[leaf].Building.GetNodeCount()) * 2 * 32;
+        if (memory + nodeBytes + treeBytes > m_Desc.MaxMemoryBytes)
+        { break; }
+        memory += nodeBytes + treeBytes;
+
+        auto axis  = uint8_t((m_Spatial[i].Axis + 1) % 3);
+        auto c0    = uint32_t(m_Spatial.size());
+        auto c1    = c0 + 1;
+        auto leaf1 = uint32_t(m_Leaves.size());
+
+        // 子は親の分布を引き継ぐ.
+        m_Leaves.push_back(m_Leaves[leaf]);
+
+        m_Spatial.push_back({ { 0, 0 }, leaf,  axis });
+        m_Spatial.push_back({ { 0, 0 }, leaf1, axis });
+
+        m_Spatial[i].Child[0] = c0;
+        m_Spatial[i].Child[1] = c1;
+        m_Spatial[i].Leaf     = UINT32_MAX;
+    }
+
+    // 今回の分布をサンプリング用にして, 次のイテレーション用の構造を作る.
+    auto budget   = m_Desc.MaxMemoryBytes / std::max<size_t>(m_Leaves.size() * 2, 1);
+    auto maxNodes = uint32_t(std::max<size_t>(budget / 32, 1));
+    for(auto& pair : m_Leaves)
+    {
+        pair.Sampling = pair.Building;
+        pair.Building.Refine(pair.Sampling, m_Desc.DirectionalRho, m_Desc.MaxDirectionalDepth, maxNodes);
+    }
+
+    m_Iteration++;
+
+    auto stats = GetStats();
+    RTC_DLOG("PathGuiding : iteration = %u, spatial nodes = %u, directional nodes = %u, memory = %zu KB",
+        stats.Iteration,
+        stats.SpatialNodes,
+        stats.DirectionalNodes,
+        stats.MemoryBytes / 1024);
+    RTC_UNUSED(stats);
+}
+
+//-----------------------------------------------------------------------------
+//      使用メモリを求めます.
+//-----------------------------------------------------------------------------
+size_t PathGuiding::CalcMemoryBytes() const
+{
+    size_t result = m_Spatial.capacity() * sizeof(SpatialNode) + m_Leaves.capacity() * sizeof(DTreePair);
+    for(auto& pair : m_Leaves)
+    {
+        // Node は float x4 + uint32_t x4.
+        result += (pair.Sampling.GetNodeCount() + pair.Building.GetNodeCount()) * 32;
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      統計情報を取得します.
+//-----------------------------------------------------------------------------
+PathGuidingStats PathGuiding::GetStats() const
+{
+    PathGuidingStats result;
+    result.Iteration    = m_Iteration;
+    result.SpatialNodes = uint32_t(m_Spatial.size());
+    for(auto& pair : m_Leaves)
+    {
+        result.DirectionalNodes += pair.Sampling.GetNodeCount();
+        result.RecordedSamples  += pair.Building.GetSampleCount();
+    }
+    result.MemoryBytes = CalcMemoryBytes();
+    return result;
+}
+
+} // namespace rtc
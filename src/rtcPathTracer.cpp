@@ -0,0 +1,477 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcPathTracer.cpp
+// Desc : Reference Path Tracer.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcPathTracer.h>
+#include <rtcFrameArena.h>
+#include <rtcPathGuiding.h>
+#include <rtcRandom.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <atomic>
+#include <thread>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr float    kRayOffset           = 1e-4f;    // 自己交差を避けるためのオフセット.
+constexpr uint32_t kMaxGuidingVertices  = 32;       // パスガイドの学習で 1 パスあたりに記録する頂点数の上限.
+
+// OptimizeRoulette() で候補が指定されなかった場合の閾値です.
+constexpr float kDefaultThresholds[] = { 0.05f, 0.1f, 0.25f, 0.5f, 1.0f, 2.0f };
+
+//-----------------------------------------------------------------------------
+//      自己交差しないようにレイの原点をずらします.
+//-----------------------------------------------------------------------------
+inline rtc::float3 OffsetRay(const rtc::float3& p, const rtc::float3& n)
+{
+    auto scale = std::max(std::max(fabsf(p.x), fabsf(p.y)), std::max(fabsf(p.z), 1.0f));
+    return p + n * (kRayOffset * scale);
+}
+
+//-----------------------------------------------------------------------------
+//      コサイン重点的サンプリングを行います. 拡散面では BSDF * cos / pdf = albedo となります.
+//-----------------------------------------------------------------------------
+inline rtc::float3 SampleCosineHemisphere(const rtc::float3& n, float u0, float u1)
+{
+    auto r   = sqrtf(u0);
+    auto phi = rtc::F_2PI * u1;
+    auto x   = r * cosf(phi);
+    auto y   = r * sinf(phi);
+    auto z   = rtc::SafeSqrt(1.0f - u0);
+
+    // Duff et al., "Building an Orthonormal Basis, Revisited".
+    auto sign = copysignf(1.0f, n.z);
+    auto a    = -1.0f / (sign + n.z);
+    auto b    = n.x * n.y * a;
+    rtc::float3 t(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    rtc::float3 s(b, sign + n.y * n.y * a, -n.y);
+
+    return rtc::Normalize(t * x + s * y + n * z);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GuidingVertex structure
+///////////////////////////////////////////////////////////////////////////////
+struct GuidingVertex
+{
+    rtc::float3     Position;       // 頂点の位置です.
+    rtc::float3     Direction;      // サンプリングした方向です.
+    rtc::float3     Throughput;     // 方向をサンプリングした直後のスループットです. 以降の寄与をこれで割ると入射放射輝度になります.
+    rtc::float3     Radiance;       // 入射放射輝度の推定値です.
+    float           Pdf;            // 方向をサンプリングした確率密度(立体角測度)です.
+};
+
+//-----------------------------------------------------------------------------
+//      記録中の頂点に寄与を加算します.
+//-----------------------------------------------------------------------------
+inline void AddGuidingRadiance(GuidingVertex* pVertices, uint32_t count, const rtc::float3& L)
+{
+    for(auto i=0u; i<count; ++i)
+    {
+        auto& vertex = pVertices[i];
+        vertex.Radiance += L / rtc::Max(vertex.Throughput, rtc::float3(1e-8f));
+    }
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// PathTracerStats structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      最終画像に対するバウンスの寄与率を求めます.
+//-----------------------------------------------------------------------------
+double PathTracerStats::GetContributionRatio(size_t bounce) const
+{
+    if (bounce >= Bounces.size())
+    { return 0.0; }
+
+    double total = 0.0;
+    for(auto& item : Bounces)
+    { total += item.Contribution; }
+
+    return (total > 0.0) ? Bounces[bounce].Contribution / total : 0.0;
+}
+
+//-----------------------------------------------------------------------------
+//      バウンスごとの統計をログに出力します.
+//-----------------------------------------------------------------------------
+void PathTracerStats::Print() const
+{
+    RTC_DLOG("PathTracer : %.3lf msec, %llu rays", ElapsedMsec, static_cast<unsigned long long>(TotalRays));
+    for(size_t i=0; i<Bounces.size(); ++i)
+    {
+        auto& item = Bounces[i];
+        RTC_DLOG("  bounce %2zu : rays = %10llu, terminated = %10llu, mean throughput = %.5lf, contribution = %6.2lf%%",
+            i,
+            static_cast<unsigned long long>(item.Rays),
+            static_cast<unsigned long long>(item.Terminated),
+            item.GetMeanThroughput(),
+            GetContributionRatio(i) * 100.0);
+        RTC_UNUSED(item);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// PathTracer class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      初期化処理を行います.
+//-----------------------------------------------------------------------------
+bool PathTracer::Init(const PathTracerDesc& desc)
+{
+    if (desc.Width == 0 || desc.Height == 0 || desc.MaxBounce == 0)
+    { return false; }
+
+    m_Desc = desc;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      終了処理を行います.
+//-----------------------------------------------------------------------------
+void PathTracer::Term()
+{ m_Desc = PathTracerDesc(); }
+
+//-----------------------------------------------------------------------------
+//      行単位で並列実行します. func にはスレッド番号とピクセル座標が渡されます.
+//-----------------------------------------------------------------------------
+template<typename Func>
+void PathTracer::ParallelRows(Func func) const
+{
+    auto threadCount = (m_Desc.ThreadCount > 0) ? m_Desc.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = std::min(threadCount, m_Desc.Height);
+
+    std::atomic<uint32_t> nextRow = {};
+    auto worker = [&](uint32_t threadIndex)
+    {
+        for(;;)
+        {
+            auto y = nextRow.fetch_add(1, std::memory_order_relaxed);
+            if (y >= m_Desc.Height)
+            { break; }
+
+            for(auto x=0u; x<m_Desc.Width; ++x)
+            { func(threadIndex, x, y); }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for(auto i=1u; i<threadCount; ++i)
+    { threads.emplace_back(worker, i); }
+
+    worker(0);
+
+    for(auto& thread : threads)
+    { thread.join(); }
+}
+
+//-----------------------------------------------------------------------------
+//      ロシアンルーレットの生存確率を求めます.
+//-----------------------------------------------------------------------------
+float PathTracer::CalcSurvivalProbability(const PathTracerDesc& desc, const float3& throughput, uint32_t bounce)
+{
+    // 最低バウンス数までは必ず継続する.
+    if (bounce < desc.MinBounce)
+    { return 1.0f; }
+
+    switch(desc.Roulette)
+    {
+    case RouletteMode::Throughput:
+        return std::min(MaxComponent(throughput), 1.0f);
+
+    case RouletteMode::Efficiency:
+        {
+            // 輝度が閾値を下回るパスだけを確率的に打ち切る. 閾値は OptimizeRoulette() で効率が最大となるものを選ぶ.
+            // 生存したパスの重みは高々 threshold / MinSurvival に抑えられる.
+            auto threshold = std::max(desc.RouletteThreshold, 1e-6f);
+            auto q = Luminance(throughput) / threshold;
+            return std::min(std::max(q, desc.MinSurvival), 1.0f);
+        }
+
+    default:
+        return 1.0f;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      効率(1 / (誤差 x 時間))を求めます. 設定の比較に使用します.
+//-----------------------------------------------------------------------------
+double PathTracer::CalcEfficiency(double meanSquaredError, double elapsedMsec)
+{
+    auto cost = meanSquaredError * elapsedMsec;
+    return (cost > 0.0) ? 1.0 / cost : 0.0;
+}
+
+//-----------------------------------------------------------------------------
+//      1 パスを追跡します.
+//-----------------------------------------------------------------------------
+float3 PathTracer::TracePath
+(
+    const PathTracerFrame&  frame,
+    uint32_t                x,
+    uint32_t                y,
+    uint32_t                sampleIndex,
+    BounceStats*            pStats
+) const
+{
+    Random rng(x, y, frame.FrameIndex * frame.SamplesPerPixel + sampleIndex);
+
+    // GeneratePinholeCameraRay() と同じ規約でレイを生成.
+    auto px = (float(x) + rng.GetAsF32()) / float(m_Desc.Width);
+    auto py = (float(y) + rng.GetAsF32()) / float(m_Desc.Height);
+    auto clip = float4(px * 2.0f - 1.0f, (1.0f - py) * 2.0f - 1.0f, 1.0f, 1.0f);
+
+    auto target = Mul(frame.InvProj, clip);
+    auto viewDir = Normalize(float3(target.x, target.y, target.z) / target.w);
+    auto worldDir = Mul(frame.InvView, float4(viewDir, 0.0f));
+    auto worldPos = Mul(frame.InvView, float4(0.0f, 0.0f, 0.0f, 1.0f));
+
+    float3 origin(worldPos.x, worldPos.y, worldPos.z);
+    float3 dir = Normalize(float3(worldDir.x, worldDir.y, worldDir.z));
+
+    float3 W (1.0f);
+    float3 Lo(0.0f);
+
+    // 学習中はパス頂点を記録し, パスの終了後に入射放射輝度をガイドに渡す.
+    auto pGuiding = frame.pGuiding;
+    auto guided   = (pGuiding != nullptr) && pGuiding->IsReady();
+    auto training = (pGuiding != nullptr) && pGuiding->IsTraining();
+
+    GuidingVertex vertices[kMaxGuidingVertices];
+    uint32_t      vertexCount = 0;
+
+    for(auto bounce=0u; bounce<m_Desc.MaxBounce; ++bounce)
+    {
+        auto& stats = pStats[bounce];
+        stats.Rays++;
+        stats.ThroughputSum += Luminance(W);
+
+        PathVertex hit;
+        if (!frame.Intersect(frame.pUser, origin, dir, hit))
+        {
+            if (frame.Environment != nullptr)
+            {
+                auto L = W * frame.Environment(frame.pUser, dir);
+                stats.Contribution += Luminance(L);
+                Lo += L;
+
+                if (training)
+                { AddGuidingRadiance(vertices, vertexCount, L); }
+            }
+            break;
+        }
+
+        // 裏面からのヒットに対応.
+        auto normal = (Dot(hit.Normal, dir) > 0.0f) ? -hit.Normal : hit.Normal;
+
+        if (MaxComponent(hit.Emission) > 0.0f)
+        {
+            auto L = W * hit.Emission;
+            stats.Contribution += Luminance(L);
+            Lo += L;
+
+            if (training)
+            { AddGuidingRadiance(vertices, vertexCount, L); }
+        }
+
+        // 拡散反射として次の方向を決める.
+        W = W * hit.Albedo;
+        if (!(MaxComponent(W) > 0.0f))
+        { break; }
+
+        // ロシアンルーレット.
+        auto q = CalcSurvivalProbability(m_Desc, W, bounce + 1);
+        if (q < 1.0f)
+        {
+            if (rng.GetAsF32() >= q)
+            {
+                stats.Terminated++;
+                break;
+            }
+            W = W / q;
+        }
+
+        auto u0 = rng.GetAsF32();
+        auto u1 = rng.GetAsF32();
+        origin = OffsetRay(hit.Position, normal);
+
+        auto pdf = 0.0f;
+        if (guided)
+        {
+            // BSDF とガイドのどちらかで方向を選び, 混合確率密度で重み付けする (一標本 MIS).
+            auto useBsdf = true;
+            pGuiding->SampleMIS(hit.Position, rng.GetAsF32(), u0, u1, useBsdf, dir);
+            if (useBsdf)
+            { dir = SampleCosineHemisphere(normal, u0, u1); }
+
+            // 拡散面の BSDF * cos は albedo * cos / π. albedo は乗算済み.
+            auto cosTheta = Dot(normal, dir);
+            if (!(cosTheta > 0.0f))
+            { break; }
+
+            pdf = pGuiding->MixturePdf(cosTheta * F_1DIVPI, pGuiding->Pdf(hit.Position, dir));
+            if (!(pdf > 0.0f))
+            { break; }
+
+            W = W * (cosTheta * F_1DIVPI / pdf);
+        }
+        else
+        {
+            dir = SampleCosineHemisphere(normal, u0, u1);
+            pdf = std::max(Dot(normal, dir), 0.0f) * F_1DIVPI;
+        }
+
+        if (training && vertexCount < kMaxGuidingVertices)
+        { vertices[vertexCount++] = { hit.Position, dir, W, float3(0.0f), pdf }; }
+    }
+
+    for(auto i=0u; i<vertexCount; ++i)
+    {
+        auto& vertex = vertices[i];
+        pGuiding->Record(vertex.Position, vertex.Direction, vertex.Radiance, vertex.Pdf);
+    }
+
+    return Lo;
+}
+
+//-----------------------------------------------------------------------------
+//      描画処理を行います.
+//-----------------------------------------------------------------------------
+PathTracerStats PathTracer::Render(const PathTracerFrame& frame, float3* pOutput)
+{
+    PathTracerStats result;
+    if (frame.Intersect == nullptr || pOutput == nullptr || frame.SamplesPerPixel == 0 || m_Desc.MaxBounce == 0)
+    { return result; }
+
+    Timer timer;
+    timer.Start();
+
+    FrameArena::ThreadFrame threadFrame;
+    FrameArena::Scope       scope(threadFrame.GetArena());
+
+    // スレッドごとに統計を集計して最後にまとめる.
+    auto threadCount = (m_Desc.ThreadCount > 0) ? m_Desc.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<BounceStats, ArenaAllocator<BounceStats>> stats(
+        size_t(threadCount) * m_Desc.MaxBounce, BounceStats(), ArenaAllocator<BounceStats>(threadFrame.GetArena()));
+
+    auto invSpp = 1.0f / float(frame.SamplesPerPixel);
+    ParallelRows([&](uint32_t threadIndex, uint32_t x, uint32_t y)
+    {
+        auto pStats = &stats[size_t(threadIndex) * m_Desc.MaxBounce];
+
+        float3 radiance(0.0f);
+        for(auto i=0u; i<frame.SamplesPerPixel; ++i)
+        { radiance += TracePath(frame, x, y, i, pStats); }
+
+        pOutput[size_t(y) * m_Desc.Width + x] = radiance * invSpp;
+    });
+
+    timer.End();
+
+    result.ElapsedMsec = timer.GetElapsedMsec();
+    result.Bounces.resize(m_Desc.MaxBounce);
+    for(auto t=0u; t<threadCount; ++t)
+    {
+        for(auto i=0u; i<m_Desc.MaxBounce; ++i)
+        {
+            auto& src = stats[size_t(t) * m_Desc.MaxBounce + i];
+            auto& dst = result.Bounces[i];
+            dst.Rays          += src.Rays;
+            dst.Terminated    += src.Terminated;
+            dst.ThroughputSum += src.ThroughputSum;
+            dst.Contribution  += src.Contribution;
+        }
+    }
+
+    for(auto& item : result.Bounces)
+    { result.TotalRays += item.Rays; }
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      効率が最大となるロシアンルーレットの閾値を選び, RouletteThreshold に設定します.
+//      候補ごとに独立な2フレームを描画し, 差分から参照画像なしで分散を推定します.
+//-----------------------------------------------------------------------------
+float PathTracer::OptimizeRoulette
+(
+    const PathTracerFrame&          frame,
+    const float*                    pThresholds,
+    uint32_t                        count,
+    std::vector<RouletteCandidate>* pCandidates
+)
+{
+    if (pThresholds == nullptr || count == 0)
+    {
+        pThresholds = kDefaultThresholds;
+        count       = uint32_t(sizeof(kDefaultThresholds) / sizeof(kDefaultThresholds[0]));
+    }
+
+    if (pCandidates != nullptr)
+    { pCandidates->clear(); }
+
+    if (frame.Intersect == nullptr || m_Desc.Roulette == RouletteMode::None)
+    { return m_Desc.RouletteThreshold; }
+
+    auto pixelCount = size_t(m_Desc.Width) * m_Desc.Height;
+    std::vector<float3> image0(pixelCount);
+    std::vector<float3> image1(pixelCount);
+
+    auto frame0 = frame;
+    auto frame1 = frame;
+    frame1.FrameIndex = frame.FrameIndex + 1;
+
+    RouletteCandidate best = {};
+    for(auto i=0u; i<count; ++i)
+    {
+        m_Desc.RouletteThreshold = pThresholds[i];
+
+        auto stats0 = Render(frame0, image0.data());
+        auto stats1 = Render(frame1, image1.data());
+
+        // 独立な2推定の差の二乗の期待値は分散の2倍.
+        double sum = 0.0;
+        for(size_t j=0; j<pixelCount; ++j)
+        {
+            auto d = double(Luminance(image0[j])) - double(Luminance(image1[j]));
+            sum += d * d;
+        }
+
+        RouletteCandidate candidate;
+        candidate.Threshold   = pThresholds[i];
+        candidate.Variance    = sum / (2.0 * double(pixelCount));
+        candidate.ElapsedMsec = (stats0.ElapsedMsec + stats1.ElapsedMsec) * 0.5;
+        candidate.Efficiency  = CalcEfficiency(candidate.Variance, candidate.ElapsedMsec);
+
+        RTC_DLOG("PathTracer : roulette threshold = %.3f, variance = %e, %.3lf msec, efficiency = %e",
+            candidate.Threshold, candidate.Variance, candidate.ElapsedMsec, candidate.Efficiency);
+
+        if (i == 0 || candidate.Efficiency > best.Efficiency)
+        { best = candidate; }
+
+        if (pCandidates != nullptr)
+        { pCandidates->push_back(candidate); }
+    }
+
+    m_Desc.RouletteThreshold = best.Threshold;
+    return best.Threshold;
+}
+
+} // namespace rtc
@@ -0,0 +1,1416 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcPngLoader.cpp
+// Desc : Parallel PNG Loader.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcPngLoader.h>
+#include <rtcMemoryTracker.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <fpng.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint8_t  kPngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+constexpr uint32_t kMaxDimension    = 1u << 24;     // 1 辺の上限です.
+constexpr uint32_t kFastBits        = 10;           // ハフマン復号の高速テーブルのビット数です.
+constexpr uint32_t kFastMask        = (1u << kFastBits) - 1;
+constexpr size_t   kCopySlack       = 16;           // 一致コピーのはみ出し分です.
+
+constexpr uint32_t kColorGray       = 0;
+constexpr uint32_t kColorRgb        = 2;
+constexpr uint32_t kColorPalette    = 3;
+constexpr uint32_t kColorGrayAlpha  = 4;
+constexpr uint32_t kColorRgba       = 6;
+
+constexpr uint16_t kLengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+constexpr uint8_t kLengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+constexpr uint16_t kDistBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+constexpr uint8_t kDistExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+constexpr uint8_t kCodeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Adam7 の各パスの開始位置と間隔です (x, y, dx, dy).
+constexpr uint8_t kAdam7[7][4] = {
+    { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+    { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+
+//-----------------------------------------------------------------------------
+//      ビッグエンディアンの 32bit 値を読み取ります.
+//-----------------------------------------------------------------------------
+inline uint32_t ReadBE32(const uint8_t* p)
+{ return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]); }
+
+//-----------------------------------------------------------------------------
+//      ビッグエンディアンの 16bit 値を読み取ります.
+//-----------------------------------------------------------------------------
+inline uint32_t ReadBE16(const uint8_t* p)
+{ return (uint32_t(p[0]) << 8) | uint32_t(p[1]); }
+
+//-----------------------------------------------------------------------------
+//      ビット列を反転します.
+//-----------------------------------------------------------------------------
+inline uint32_t ReverseBits(uint32_t code, uint32_t bits)
+{
+    uint32_t result = 0;
+    for(auto i=0u; i<bits; ++i)
+    {
+        result = (result << 1) | (code & 1);
+        code >>= 1;
+    }
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PngHeader structure
+///////////////////////////////////////////////////////////////////////////////
+struct PngHeader
+{
+    rtc::PngInfo    Info;
+    uint32_t        BitsPerPixel    = 0;
+    uint32_t        PaletteCount    = 0;
+    uint8_t         Palette[256][4] = {};   // RGBA.
+    bool            HasKey          = false;
+    uint16_t        Key[3]          = {};   // tRNS のカラーキーです (グレーは Key[0]).
+    const uint8_t*  pIdat           = nullptr;  // IDAT が 1 つだけの場合のデータです.
+    size_t          IdatSize        = 0;        // IDAT の合計バイト数です.
+    uint32_t        IdatCount       = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Scratch structure (ワーカーごとの作業領域)
+///////////////////////////////////////////////////////////////////////////////
+struct Scratch
+{
+    std::vector<uint8_t>    Idat;       // 分割された IDAT の連結先です.
+    std::vector<uint8_t>    Raw;        // 展開後のフィルタ付きスキャンラインです.
+    std::vector<uint8_t>    Row;        // RGBA に変換した 1 行です.
+    rtc::TrackedMemory      Memory { rtc::MEMORY_TAG_TEXTURE };
+
+    void Track()
+    { Memory.Set(Idat.capacity() + Raw.capacity() + Row.capacity()); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Huffman structure
+///////////////////////////////////////////////////////////////////////////////
+struct Huffman
+{
+    uint16_t    Fast[1u << kFastBits];  // (シンボル << 4) | 符号長. 0 なら低速パス.
+    uint16_t    FirstCode  [16];
+    uint32_t    MaxCode    [17];        // 16bit に左詰めした各符号長の上限です.
+    uint16_t    FirstSymbol[16];
+    uint8_t     Size [288];
+    uint16_t    Value[288];
+
+    //-------------------------------------------------------------------------
+    //      符号長から正規ハフマン符号のテーブルを構築します.
+    //-------------------------------------------------------------------------
+    bool Build(const uint8_t* pLengths, uint32_t count)
+    {
+        uint32_t counts[16]   = {};
+        uint32_t nextCode[16] = {};
+        memset(Fast, 0, sizeof(Fast));
+
+        for(auto i=0u; i<count; ++i)
+        { counts[pLengths[i]]++; }
+        counts[0] = 0;
+
+        uint32_t code = 0;
+        uint32_t k    = 0;
+        for(auto i=1u; i<16; ++i)
+        {
+            nextCode   [i] = code;
+            FirstCode  [i] = uint16_t(code);
+            FirstSymbol[i] = uint16_t(k);
+            code += counts[i];
+            if (counts[i] != 0 && code - 1 >= (1u << i))
+            { return false; }   // 過剰に割り当てられた符号です.
+            MaxCode[i] = code << (16 - i);
+            code <<= 1;
+            k += counts[i];
+        }
+        MaxCode[16] = 0x10000;
+
+        for(auto i=0u; i<count; ++i)
+        {
+            auto len = pLengths[i];
+            if (len == 0)
+            { continue; }
+
+            auto index = nextCode[len] - FirstCode[len] + FirstSymbol[len];
+            Size [index] = len;
+            Value[index] = uint16_t(i);
+            if (len <= kFastBits)
+            {
+                auto entry = uint16_t((i << 4) | len);
+                for(auto j=ReverseBits(nextCode[len], len); j<(1u << kFastBits); j+=(1u << len))
+                { Fast[j] = entry; }
+            }
+            nextCode[len]++;
+        }
+        return true;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Inflater class
+///////////////////////////////////////////////////////////////////////////////
+class Inflater
+{
+public:
+    //-------------------------------------------------------------------------
+    //      zlib ストリームを展開します. 出力は dstSize と一致しなければなりません.
+    //      pDst には dstSize + kCopySlack バイトの領域が必要です.
+    //-------------------------------------------------------------------------
+    bool Run(const uint8_t* pSrc, size_t srcSize, uint8_t* pDst, size_t dstSize)
+    {
+        if (srcSize < 6)
+        { return false; }
+
+        auto cmf = pSrc[0];
+        auto flg = pSrc[1];
+        if ((cmf & 0xF) != 8 || (cmf >> 4) > 7 || ((uint32_t(cmf) << 8) | flg) % 31 != 0 || (flg & 0x20) != 0)
+        { return false; }
+
+        m_pSrc      = pSrc + 2;
+        m_pSrcEnd   = pSrc + srcSize;
+        m_BitBuf    = 0;
+        m_BitCount  = 0;
+        m_pOutBegin = pDst;
+        m_pOut      = pDst;
+        m_pOutEnd   = pDst + dstSize;
+
+        bool final;
+        do
+        {
+            Refill();
+            final = GetBits(1) != 0;
+            auto type = GetBits(2);
+            if (m_BitCount < 0)
+            { return false; }
+
+            bool ok = false;
+            switch(type)
+            {
+            case 0: ok = Stored(); break;
+            case 1: ok = Fixed(); break;
+            case 2: ok = Dynamic(); break;
+            default: break;
+            }
+            if (!ok)
+            { return false; }
+        }
+        while(!final);
+
+        if (m_pOut != m_pOutEnd)
+        { return false; }
+
+        // バイト境界に揃えて Adler-32 を照合します.
+        Rewind();
+        if (m_pSrcEnd - m_pSrc < 4)
+        { return false; }
+
+        return ReadBE32(m_pSrc) == fpng::fpng_adler32(pDst, dstSize);
+    }
+
+private:
+    const uint8_t*  m_pSrc      = nullptr;
+    const uint8_t*  m_pSrcEnd   = nullptr;
+    uint64_t        m_BitBuf    = 0;
+    int             m_BitCount  = 0;    // 負になったら入力の終端を越えています.
+    uint8_t*        m_pOutBegin = nullptr;
+    uint8_t*        m_pOut      = nullptr;
+    uint8_t*        m_pOutEnd   = nullptr;
+
+    //-------------------------------------------------------------------------
+    //      ビットバッファを 56bit 以上まで補充します.
+    //-------------------------------------------------------------------------
+    void Refill()
+    {
+        if (m_pSrcEnd - m_pSrc >= 8)
+        {
+            uint64_t value;
+            memcpy(&value, m_pSrc, sizeof(value));
+            m_BitBuf   |= value << m_BitCount;
+            m_pSrc     += (63 - m_BitCount) >> 3;
+            m_BitCount |= 56;
+        }
+        else
+        {
+            while(m_BitCount <= 56 && m_pSrc < m_pSrcEnd)
+            {
+                m_BitBuf   |= uint64_t(*m_pSrc++) << m_BitCount;
+                m_BitCount += 8;
+            }
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    //      ビットを取り出します (count <= 16).
+    //-------------------------------------------------------------------------
+    uint32_t GetBits(uint32_t count)
+    {
+        auto result = uint32_t(m_BitBuf & ((1ull << count) - 1));
+        m_BitBuf  >>= count;
+        m_BitCount -= int(count);
+        return result;
+    }
+
+    //-------------------------------------------------------------------------
+    //      ビットバッファの未使用バイトを入力に戻し, バイト境界に揃えます.
+    //-------------------------------------------------------------------------
+    void Rewind()
+    {
+        m_pSrc    -= m_BitCount >> 3;
+        m_BitBuf   = 0;
+        m_BitCount = 0;
+    }
+
+    //-------------------------------------------------------------------------
+    //      シンボルを 1 つ復号します. 不正な符号なら UINT32_MAX を返却します.
+    //-------------------------------------------------------------------------
+    uint32_t Decode(const Huffman& table)
+    {
+        auto entry = table.Fast[m_BitBuf & kFastMask];
+        if (entry != 0)
+        {
+            GetBits(entry & 0xF);
+            return entry >> 4;
+        }
+
+        auto code = ReverseBits(uint32_t(m_BitBuf & 0xFFFF), 16);
+        auto len  = kFastBits + 1;
+        while(code >= table.MaxCode[len])
+        { len++; }
+        if (len >= 16)
+        { return UINT32_MAX; }
+
+        auto index = (code >> (16 - len)) - table.FirstCode[len] + table.FirstSymbol[len];
+        if (index >= 288 || table.Size[index] != len)
+        { return UINT32_MAX; }
+
+        GetBits(len);
+        return table.Value[index];
+    }
+
+    //-------------------------------------------------------------------------
+    //      非圧縮ブロックを処理します.
+    //-------------------------------------------------------------------------
+    bool Stored()
+    {
+        GetBits(m_BitCount & 7);
+        Rewind();
+        if (m_pSrcEnd - m_pSrc < 4)
+        { return false; }
+
+        auto len  = m_pSrc[0] | (uint32_t(m_pSrc[1]) << 8);
+        auto nlen = m_pSrc[2] | (uint32_t(m_pSrc[3]) << 8);
+        m_pSrc += 4;
+        if (len != (~nlen & 0xFFFF) || size_t(m_pSrcEnd - m_pSrc) < len || size_t(m_pOutEnd - m_pOut) < len)
+        { return false; }
+
+        memcpy(m_pOut, m_pSrc, len);
+        m_pOut += len;
+        m_pSrc += len;
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    //      固定ハフマンブロックを処理します.
+    //-------------------------------------------------------------------------
+    bool Fixed()
+    {
+        struct FixedTables
+        {
+            Huffman Literal;
+            Huffman Distance;
+
+            FixedTables()
+            {
+                uint8_t lengths[288];
+                memset(lengths +   0, 8, 144);
+                memset(lengths + 144, 9, 112);
+                memset(lengths + 256, 7,  24);
+                memset(lengths + 280, 8,   8);
+                Literal.Build(lengths, 288);
+
+                memset(lengths, 5, 30);
+                Distance.Build(lengths, 30);
+            }
+        };
+        static const FixedTables tables;
+        return Codes(tables.Literal, tables.Distance);
+    }
+
+    //-------------------------------------------------------------------------
+    //      動的ハフマンブロックを処理します.
+    //-------------------------------------------------------------------------
+    bool Dynamic()
+    {
+        Refill();
+        auto literalCount  = GetBits(5) + 257;
+        auto distanceCount = GetBits(5) + 1;
+        auto codeLenCount  = GetBits(4) + 4;
+        if (literalCount > 286 || distanceCount > 30)
+        { return false; }
+
+        uint8_t codeLengths[19] = {};
+        for(auto i=0u; i<codeLenCount; ++i)
+        {
+            Refill();
+            codeLengths[kCodeLengthOrder[i]] = uint8_t(GetBits(3));
+        }
+        if (m_BitCount < 0)
+        { return false; }
+
+        Huffman codeLenTable;
+        if (!codeLenTable.Build(codeLengths, 19))
+        { return false; }
+
+        uint8_t lengths[286 + 30] = {};
+        auto total = literalCount + distanceCount;
+        auto n = 0u;
+        while(n < total)
+        {
+            Refill();
+            auto symbol = Decode(codeLenTable);
+            if (symbol == UINT32_MAX || m_BitCount < 0)
+            { return false; }
+
+            if (symbol < 16)
+            {
+                lengths[n++] = uint8_t(symbol);
+                continue;
+            }
+
+            uint8_t  fill   = 0;
+            uint32_t repeat = 0;
+            if (symbol == 16)
+            {
+                if (n == 0)
+                { return false; }
+                fill   = lengths[n - 1];
+                repeat = GetBits(2) + 3;
+            }
+            else if (symbol == 17)
+            { repeat = GetBits(3) + 3; }
+            else
+            { repeat = GetBits(7) + 11; }
+
+            if (m_BitCount < 0 || n + repeat > total)
+            { return false; }
+            memset(lengths + n, fill, repeat);
+            n += repeat;
+        }
+
+        // 終端シンボルが無いと展開できません.
+        if (lengths[256] == 0)
+        { return false; }
+
+        Huffman literal;
+        Huffman distance;
+        if (!literal.Build(lengths, literalCount) || !distance.Build(lengths + literalCount, distanceCount))
+        { return false; }
+
+        return Codes(literal, distance);
+    }
+
+    //-------------------------------------------------------------------------
+    //      リテラル/長さと距離の符号列を展開します.
+    //-------------------------------------------------------------------------
+    bool Codes(const Huffman& literal, const Huffman& distance)
+    {
+        for(;;)
+        {
+            // 1 シンボル分 (最大 15 + 5 + 15 + 13 bit) を補充します.
+            Refill();
+            auto symbol = Decode(literal);
+            if (m_BitCount < 0)
+            { return false; }
+
+            if (symbol < 256)
+            {
+                if (m_pOut == m_pOutEnd)
+                { return false; }
+                *m_pOut++ = uint8_t(symbol);
+                continue;
+            }
+            if (symbol == 256)
+            { return true; }
+
+            symbol -= 257;
+            if (symbol >= 29)
+            { return false; }
+            auto len = kLengthBase[symbol] + GetBits(kLengthExtra[symbol]);
+
+            auto distSymbol = Decode(distance);
+            if (distSymbol >= 30)
+            { return false; }
+            auto dist = kDistBase[distSymbol] + GetBits(kDistExtra[distSymbol]);
+
+            if (m_BitCount < 0 || dist > size_t(m_pOut - m_pOutBegin) || len > size_t(m_pOutEnd - m_pOut))
+            { return false; }
+
+            auto pSrc = m_pOut - dist;
+            auto pEnd = m_pOut + len;
+            if (dist >= 8)
+            {
+                // 8 バイト単位でコピーします. はみ出しは kCopySlack に収まります.
+                auto pDst = m_pOut;
+                do
+                {
+                    memcpy(pDst, pSrc, 8);
+                    pDst += 8;
+                    pSrc += 8;
+                }
+                while(pDst < pEnd);
+            }
+            else if (dist == 1)
+            { memset(m_pOut, *pSrc, len); }
+            else
+            {
+                for(auto pDst = m_pOut; pDst < pEnd; ++pDst, ++pSrc)
+                { *pDst = *pSrc; }
+            }
+            m_pOut = pEnd;
+        }
+    }
+};
+
+//-----------------------------------------------------------------------------
+//      SSE2 の選択です (mask ? a : b).
+//-----------------------------------------------------------------------------
+inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+{ return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+
+//-----------------------------------------------------------------------------
+//      16bit の絶対値です.
+//-----------------------------------------------------------------------------
+inline __m128i Abs16(__m128i x)
+{ return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x)); }
+
+//-----------------------------------------------------------------------------
+//      1 画素 (3 or 4 バイト) を読み書きします.
+//-----------------------------------------------------------------------------
+template<uint32_t Bpp>
+inline __m128i LoadPixel(const uint8_t* p)
+{
+    int value = 0;
+    memcpy(&value, p, Bpp);
+    return _mm_cvtsi32_si128(value);
+}
+
+template<uint32_t Bpp>
+inline void StorePixel(uint8_t* p, __m128i v)
+{
+    int value = _mm_cvtsi128_si32(v);
+    memcpy(p, &value, Bpp);
+}
+
+//-----------------------------------------------------------------------------
+//      3, 4 バイト/画素のフィルタを SSE2 で解除します.
+//      前の画素に依存するため画素単位ですが, チャンネルはまとめて処理します.
+//-----------------------------------------------------------------------------
+template<uint32_t Bpp>
+void UnfilterSimd(uint32_t filter, uint8_t* pRow, const uint8_t* pPrev, size_t size)
+{
+    const auto zero = _mm_setzero_si128();
+    auto a = zero;  // 左の画素.
+    auto c = zero;  // 左上の画素.
+
+    switch(filter)
+    {
+    case 1: // Sub
+        for(size_t i=0; i<size; i+=Bpp)
+        {
+            a = _mm_add_epi8(a, LoadPixel<Bpp>(pRow + i));
+            StorePixel<Bpp>(pRow + i, a);
+        }
+        break;
+
+    case 3: // Average
+        {
+            const auto one = _mm_set1_epi8(1);
+            for(size_t i=0; i<size; i+=Bpp)
+            {
+                auto b   = LoadPixel<Bpp>(pPrev + i);
+                auto avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+                a = _mm_add_epi8(LoadPixel<Bpp>(pRow + i), avg);
+                StorePixel<Bpp>(pRow + i, a);
+            }
+        }
+        break;
+
+    case 4: // Paeth
+        for(size_t i=0; i<size; i+=Bpp)
+        {
+            auto b = _mm_unpacklo_epi8(LoadPixel<Bpp>(pPrev + i), zero);
+            auto d = _mm_unpacklo_epi8(LoadPixel<Bpp>(pRow  + i), zero);
+
+            auto pa = _mm_sub_epi16(b, c);
+            auto pb = _mm_sub_epi16(a, c);
+            auto pc = _mm_add_epi16(pa, pb);
+            pa = Abs16(pa);
+            pb = Abs16(pb);
+            pc = Abs16(pc);
+
+            auto smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            auto nearest  = Select(_mm_cmpeq_epi16(smallest, pa), a,
+                            Select(_mm_cmpeq_epi16(smallest, pb), b, c));
+
+            d = _mm_add_epi8(d, nearest);
+            StorePixel<Bpp>(pRow + i, _mm_packus_epi16(d, d));
+
+            c = b;
+            a = d;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      1 行のフィルタを解除します.
+//-----------------------------------------------------------------------------
+bool Unfilter(uint32_t filter, uint8_t* pRow, const uint8_t* pPrev, size_t size, uint32_t bpp)
+{
+    switch(filter)
+    {
+    case 0: // None
+        return true;
+
+    case 2: // Up
+        for(size_t i=0; i<size; ++i)
+        { pRow[i] = uint8_t(pRow[i] + pPrev[i]); }
+        return true;
+
+    case 1:
+    case 3:
+    case 4:
+        if (bpp == 4)
+        {
+            UnfilterSimd<4>(filter, pRow, pPrev, size);
+            return true;
+        }
+        if (bpp == 3)
+        {
+            UnfilterSimd<3>(filter, pRow, pPrev, size);
+            return true;
+        }
+        break;
+
+    default:
+        return false;
+    }
+
+    if (filter == 1)
+    {
+        for(size_t i=bpp; i<size; ++i)
+        { pRow[i] = uint8_t(pRow[i] + pRow[i - bpp]); }
+    }
+    else if (filter == 3)
+    {
+        for(size_t i=0; i<bpp; ++i)
+        { pRow[i] = uint8_t(pRow[i] + (pPrev[i] >> 1)); }
+        for(size_t i=bpp; i<size; ++i)
+        { pRow[i] = uint8_t(pRow[i] + ((pRow[i - bpp] + pPrev[i]) >> 1)); }
+    }
+    else
+    {
+        for(size_t i=0; i<bpp; ++i)
+        { pRow[i] = uint8_t(pRow[i] + pPrev[i]); }
+        for(size_t i=bpp; i<size; ++i)
+        {
+            int a = pRow[i - bpp];
+            int b = pPrev[i];
+            int c = pPrev[i - bpp];
+            int p  = a + b - c;
+            int pa = abs(p - a);
+            int pb = abs(p - b);
+            int pc = abs(p - c);
+            int predictor = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+            pRow[i] = uint8_t(pRow[i] + predictor);
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      チャンクを走査してヘッダを読み取ります.
+//-----------------------------------------------------------------------------
+rtc::PNG_RESULT ParsePng(const uint8_t* pData, size_t size, PngHeader& header, bool verifyCrc)
+{
+    if (pData == nullptr || size < sizeof(kPngSignature) + 25)
+    { return rtc::PNG_NOT_PNG; }
+    if (memcmp(pData, kPngSignature, sizeof(kPngSignature)) != 0)
+    { return rtc::PNG_NOT_PNG; }
+
+    auto& info = header.Info;
+    auto pos = sizeof(kPngSignature);
+    auto foundHeader = false;
+    auto foundEnd    = false;
+    auto trnsCount   = 0u;
+
+    while(!foundEnd)
+    {
+        if (size - pos < 12)
+        { return rtc::PNG_CORRUPT; }
+
+        auto length = ReadBE32(pData + pos);
+        auto pType  = pData + pos + 4;
+        auto pChunk = pData + pos + 8;
+        if (length > 0x7FFFFFFF || size - pos - 12 < length)
+        { return rtc::PNG_CORRUPT; }
+
+        if (verifyCrc && fpng::fpng_crc32(pType, size_t(length) + 4) != ReadBE32(pChunk + length))
+        { return rtc::PNG_CORRUPT; }
+
+        if (!foundHeader)
+        {
+            // 先頭は必ず IHDR です.
+            if (memcmp(pType, "IHDR", 4) != 0 || length != 13)
+            { return rtc::PNG_CORRUPT; }
+
+            info.Width      = ReadBE32(pChunk + 0);
+            info.Height     = ReadBE32(pChunk + 4);
+            info.BitDepth   = pChunk[8];
+            info.ColorType  = pChunk[9];
+            info.Interlaced = pChunk[12] != 0;
+            if (info.Width == 0 || info.Height == 0 || pChunk[10] != 0 || pChunk[11] != 0 || pChunk[12] > 1)
+            { return rtc::PNG_CORRUPT; }
+            if (info.Width > kMaxDimension || info.Height > kMaxDimension)
+            { return rtc::PNG_UNSUPPORTED; }
+
+            uint32_t samples = 0;
+            auto depth = info.BitDepth;
+            switch(info.ColorType)
+            {
+            case kColorGray:      samples = 1; break;
+            case kColorRgb:       samples = 3; break;
+            case kColorPalette:   samples = 1; break;
+            case kColorGrayAlpha: samples = 2; break;
+            case kColorRgba:      samples = 4; break;
+            default:
+                return rtc::PNG_CORRUPT;
+            }
+
+            auto validDepth = (depth == 8 || depth == 16)
+                || (info.ColorType == kColorGray    && (depth == 1 || depth == 2 || depth == 4))
+                || (info.ColorType == kColorPalette && (depth == 1 || depth == 2 || depth == 4));
+            if (!validDepth || (info.ColorType == kColorPalette && depth == 16))
+            { return rtc::PNG_CORRUPT; }
+
+            header.BitsPerPixel = samples * depth;
+            info.Channels = (info.ColorType == kColorPalette) ? 3 : samples;
+            foundHeader = true;
+        }
+        else if (memcmp(pType, "PLTE", 4) == 0)
+        {
+            if (length % 3 != 0 || length > 768 || header.IdatCount > 0)
+            { return rtc::PNG_CORRUPT; }
+
+            header.PaletteCount = length / 3;
+            for(auto i=0u; i<header.PaletteCount; ++i)
+            {
+                header.Palette[i][0] = pChunk[i * 3 + 0];
+                header.Palette[i][1] = pChunk[i * 3 + 1];
+                header.Palette[i][2] = pChunk[i * 3 + 2];
+                header.Palette[i][3] = 0xFF;
+            }
+        }
+        else if (memcmp(pType, "tRNS", 4) == 0)
+        {
+            if (header.IdatCount > 0)
+            { return rtc::PNG_CORRUPT; }
+
+            if (info.ColorType == kColorPalette)
+            { trnsCount = std::min(length, 256u); }
+            else if (info.ColorType == kColorGray && length >= 2)
+            {
+                header.HasKey = true;
+                header.Key[0] = uint16_t(ReadBE16(pChunk));
+            }
+            else if (info.ColorType == kColorRgb && length >= 6)
+            {
+                header.HasKey = true;
+                header.Key[0] = uint16_t(ReadBE16(pChunk + 0));
+                header.Key[1] = uint16_t(ReadBE16(pChunk + 2));
+                header.Key[2] = uint16_t(ReadBE16(pChunk + 4));
+            }
+
+            // パレットのアルファは PLTE の後に適用します.
+            for(auto i=0u; i<trnsCount; ++i)
+            { header.Palette[i][3] = pChunk[i]; }
+        }
+        else if (memcmp(pType, "IDAT", 4) == 0)
+        {
+            if (header.IdatCount == 0)
+            { header.pIdat = pChunk; }
+            header.IdatSize += length;
+            header.IdatCount++;
+        }
+        else if (memcmp(pType, "IEND", 4) == 0)
+        { foundEnd = true; }
+        else if ((pType[0] & 0x20) == 0)
+        { return rtc::PNG_UNSUPPORTED; }   // 未知の必須チャンクです.
+
+        pos += size_t(length) + 12;
+    }
+
+    if (header.IdatCount == 0)
+    { return rtc::PNG_CORRUPT; }
+    if (info.ColorType == kColorPalette)
+    {
+        if (header.PaletteCount == 0)
+        { return rtc::PNG_CORRUPT; }
+        if (trnsCount > 0)
+        { info.Channels = 4; }
+    }
+    else if (header.HasKey)
+    { info.Channels++; }
+
+    return rtc::PNG_OK;
+}
+
+//-----------------------------------------------------------------------------
+//      分割された IDAT を連結します.
+//-----------------------------------------------------------------------------
+void GatherIdat(const uint8_t* pData, size_t size, std::vector<uint8_t>& dst)
+{
+    dst.resize(0);
+    auto pos = sizeof(kPngSignature);
+    while(pos + 12 <= size)
+    {
+        auto length = ReadBE32(pData + pos);
+        auto pType  = pData + pos + 4;
+        if (memcmp(pType, "IDAT", 4) == 0)
+        { dst.insert(dst.end(), pType + 4, pType + 4 + length); }
+        else if (memcmp(pType, "IEND", 4) == 0)
+        { break; }
+        pos += size_t(length) + 12;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      フィルタを解除した 1 行を RGBA8 に変換します.
+//-----------------------------------------------------------------------------
+void ExpandRow(const PngHeader& header, const uint8_t* pSrc, uint32_t width, uint8_t* pRgba)
+{
+    const auto& info  = header.Info;
+    const auto  depth = info.BitDepth;
+
+    if (depth < 8)
+    {
+        // 1, 2, 4bit のグレースケールとパレットです.
+        const auto mask  = (1u << depth) - 1;
+        const auto scale = 255u / mask;
+        for(auto x=0u; x<width; ++x)
+        {
+            auto bit   = x * depth;
+            auto value = (pSrc[bit >> 3] >> (8 - depth - (bit & 7))) & mask;
+            auto pDst  = pRgba + x * 4;
+            if (info.ColorType == kColorPalette)
+            { memcpy(pDst, header.Palette[value], 4); }
+            else
+            {
+                auto gray = uint8_t(value * scale);
+                pDst[0] = pDst[1] = pDst[2] = gray;
+                pDst[3] = (header.HasKey && value == header.Key[0]) ? 0 : 0xFF;
+            }
+        }
+        return;
+    }
+
+    // 16bit は上位バイトを使い, カラーキーは 16bit 値で比較します.
+    const auto step = depth / 8;
+    auto sample = [&](const uint8_t* p) -> uint32_t
+    { return (step == 2) ? ReadBE16(p) : p[0]; };
+
+    for(auto x=0u; x<width; ++x)
+    {
+        auto pDst = pRgba + x * 4;
+        switch(info.ColorType)
+        {
+        case kColorGray:
+            {
+                auto p = pSrc + x * step;
+                pDst[0] = pDst[1] = pDst[2] = p[0];
+                pDst[3] = (header.HasKey && sample(p) == header.Key[0]) ? 0 : 0xFF;
+            }
+            break;
+
+        case kColorRgb:
+            {
+                auto p = pSrc + x * step * 3;
+                pDst[0] = p[0];
+                pDst[1] = p[step];
+                pDst[2] = p[step * 2];
+                pDst[3] = (header.HasKey
+                        && sample(p) == header.Key[0]
+                        && sample(p + step) == header.Key[1]
+                        && sample(p + step * 2) == header.Key[2]) ? 0 : 0xFF;
+            }
+            break;
+
+        case kColorPalette:
+            memcpy(pDst, header.Palette[pSrc[x]], 4);
+            break;
+
+        case kColorGrayAlpha:
+            {
+                auto p = pSrc + x * step * 2;
+                pDst[0] = pDst[1] = pDst[2] = p[0];
+                pDst[3] = p[step];
+            }
+            break;
+
+        default:
+            {
+                auto p = pSrc + x * step * 4;
+                pDst[0] = p[0];
+                pDst[1] = p[step];
+                pDst[2] = p[step * 2];
+                pDst[3] = p[step * 3];
+            }
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      RGBA8 の 1 行を出力チャンネル数に合わせて書き込みます.
+//-----------------------------------------------------------------------------
+void StoreRow(const uint8_t* pRgba, uint32_t width, uint32_t channels, uint8_t* pDst, uint32_t pixelStep)
+{
+    const auto stride = size_t(pixelStep) * channels;
+    switch(channels)
+    {
+    case 1:
+        for(auto x=0u; x<width; ++x, pDst+=stride)
+        { pDst[0] = pRgba[x * 4]; }
+        break;
+
+    case 2:
+        for(auto x=0u; x<width; ++x, pDst+=stride)
+        {
+            pDst[0] = pRgba[x * 4 + 0];
+            pDst[1] = pRgba[x * 4 + 3];
+        }
+        break;
+
+    case 3:
+        for(auto x=0u; x<width; ++x, pDst+=stride)
+        { memcpy(pDst, pRgba + x * 4, 3); }
+        break;
+
+    default:
+        if (pixelStep == 1)
+        { memcpy(pDst, pRgba, size_t(width) * 4); }
+        else
+        {
+            for(auto x=0u; x<width; ++x, pDst+=stride)
+            { memcpy(pDst, pRgba + x * 4, 4); }
+        }
+        break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      変換せずに書き込める行かどうか.
+//-----------------------------------------------------------------------------
+bool IsDirectCopy(const PngHeader& header, uint32_t channels)
+{
+    auto& info = header.Info;
+    if (info.BitDepth != 8 || header.HasKey)
+    { return false; }
+
+    return (info.ColorType == kColorGray      && channels == 1)
+        || (info.ColorType == kColorGrayAlpha && channels == 2)
+        || (info.ColorType == kColorRgb       && channels == 3)
+        || (info.ColorType == kColorRgba      && channels == 4);
+}
+
+//-----------------------------------------------------------------------------
+//      汎用パスで展開します.
+//-----------------------------------------------------------------------------
+rtc::PNG_RESULT DecodeGeneral
+(
+    const uint8_t*      pData,
+    size_t              size,
+    const PngHeader&    header,
+    uint32_t            channels,
+    uint8_t*            pDst,
+    size_t              rowPitch,
+    Scratch&            scratch
+)
+{
+    const auto& info  = header.Info;
+    const auto  bpp   = std::max(header.BitsPerPixel / 8, 1u);
+    const auto  passCount = info.Interlaced ? 7u : 1u;
+
+    // フィルタ付きスキャンラインの合計サイズを求めます.
+    uint32_t passWidth [7] = {};
+    uint32_t passHeight[7] = {};
+    uint64_t rawSize  = 0;
+    uint64_t maxBytes = 0;
+    for(auto i=0u; i<passCount; ++i)
+    {
+        if (info.Interlaced)
+        {
+            auto& pass = kAdam7[i];
+            passWidth [i] = (info.Width  > pass[0]) ? (info.Width  - pass[0] + pass[2] - 1) / pass[2] : 0;
+            passHeight[i] = (info.Height > pass[1]) ? (info.Height - pass[1] + pass[3] - 1) / pass[3] : 0;
+        }
+        else
+        {
+            passWidth [i] = info.Width;
+            passHeight[i] = info.Height;
+        }
+        if (passWidth[i] == 0 || passHeight[i] == 0)
+        { continue; }
+
+        auto rowBytes = (uint64_t(passWidth[i]) * header.BitsPerPixel + 7) / 8;
+        rawSize += (rowBytes + 1) * passHeight[i];
+        maxBytes = std::max(maxBytes, rowBytes);
+    }
+    if (rawSize + kCopySlack + maxBytes > SIZE_MAX / 2)
+    { return rtc::PNG_UNSUPPORTED; }
+
+    // 先頭行の前に 0 の行を置き, 上の行として参照します.
+    const auto zeroBytes = size_t(maxBytes + 1);
+    scratch.Raw.resize(zeroBytes + size_t(rawSize) + kCopySlack);
+    memset(scratch.Raw.data(), 0, zeroBytes);
+    auto pRaw = scratch.Raw.data() + zeroBytes;
+
+    auto pIdat    = header.pIdat;
+    auto idatSize = header.IdatSize;
+    if (header.IdatCount > 1)
+    {
+        GatherIdat(pData, size, scratch.Idat);
+        pIdat    = scratch.Idat.data();
+        idatSize = scratch.Idat.size();
+    }
+
+    auto direct = IsDirectCopy(header, channels) && !info.Interlaced;
+    if (!direct)
+    { scratch.Row.resize(size_t(info.Width) * 4); }
+    scratch.Track();
+
+    Inflater inflater;
+    if (!inflater.Run(pIdat, idatSize, pRaw, size_t(rawSize)))
+    { return rtc::PNG_CORRUPT; }
+
+    auto pRow = pRaw;
+    for(auto i=0u; i<passCount; ++i)
+    {
+        if (passWidth[i] == 0 || passHeight[i] == 0)
+        { continue; }
+
+        auto rowBytes = (size_t(passWidth[i]) * header.BitsPerPixel + 7) / 8;
+        auto x0 = info.Interlaced ? kAdam7[i][0] : 0u;
+        auto y0 = info.Interlaced ? kAdam7[i][1] : 0u;
+        auto dx = info.Interlaced ? kAdam7[i][2] : 1u;
+        auto dy = info.Interlaced ? kAdam7[i][3] : 1u;
+
+        const uint8_t* pPrev = scratch.Raw.data() + 1;
+        for(auto y=0u; y<passHeight[i]; ++y)
+        {
+            if (!Unfilter(pRow[0], pRow + 1, pPrev, rowBytes, bpp))
+            { return rtc::PNG_CORRUPT; }
+
+            auto pOut = pDst + (size_t(y0) + size_t(y) * dy) * rowPitch + size_t(x0) * channels;
+            if (direct)
+            { memcpy(pOut, pRow + 1, rowBytes); }
+            else
+            {
+                ExpandRow(header, pRow + 1, passWidth[i], scratch.Row.data());
+                StoreRow(scratch.Row.data(), passWidth[i], channels, pOut, dx);
+            }
+
+            pPrev = pRow + 1;
+            pRow += rowBytes + 1;
+        }
+    }
+
+    return rtc::PNG_OK;
+}
+
+//-----------------------------------------------------------------------------
+//      作業領域を指定して展開します.
+//-----------------------------------------------------------------------------
+rtc::PNG_RESULT DecodePngInternal
+(
+    const void*     pData,
+    size_t          size,
+    uint32_t        channels,
+    void*           pDst,
+    size_t          rowPitch,
+    size_t          dstSize,
+    rtc::PngInfo*   pInfo,
+    Scratch&        scratch
+)
+{
+    if (pData == nullptr || channels == 0 || channels > 4)
+    { return rtc::PNG_INVALID_ARG; }
+
+    PngHeader header;
+    auto pSrc   = static_cast<const uint8_t*>(pData);
+    auto result = ParsePng(pSrc, size, header, true);
+    if (result != rtc::PNG_OK)
+    { return result; }
+
+    auto& info = header.Info;
+    auto rowBytes = size_t(info.Width) * channels;
+    if (rowPitch == 0)
+    { rowPitch = rowBytes; }
+
+    if (pDst == nullptr || rowPitch < rowBytes || uint64_t(rowPitch) * (info.Height - 1) + rowBytes > dstSize)
+    {
+        if (pInfo != nullptr)
+        { *pInfo = info; }
+        return rtc::PNG_NO_DESTINATION;
+    }
+
+    // fpng で書き出されたファイルは専用の展開パスを使います.
+    if ((channels == 3 || channels == 4) && size <= UINT32_MAX)
+    {
+        uint32_t w, h, c;
+        auto status = fpng::fpng_decode_memory_ptr(pData, uint32_t(size), pDst, dstSize, rowPitch, w, h, c, channels);
+        info.IsFpng = (status == fpng::FPNG_DECODE_SUCCESS);
+    }
+
+    if (!info.IsFpng)
+    { result = DecodeGeneral(pSrc, size, header, channels, static_cast<uint8_t*>(pDst), rowPitch, scratch); }
+
+    if (pInfo != nullptr)
+    { *pInfo = info; }
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MappedFile class
+///////////////////////////////////////////////////////////////////////////////
+class MappedFile
+{
+public:
+    ~MappedFile() { Close(); }
+
+    //-------------------------------------------------------------------------
+    //      ファイルを読み取り専用でマップし, 先読みを要求します.
+    //-------------------------------------------------------------------------
+    bool Open(const char* path)
+    {
+        m_hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_hFile == INVALID_HANDLE_VALUE)
+        {
+            m_hFile = nullptr;
+            return false;
+        }
+
+        LARGE_INTEGER fileSize = {};
+        if (!GetFileSizeEx(m_hFile, &fileSize) || fileSize.QuadPart == 0)
+        { return false; }
+        m_Size = size_t(fileSize.QuadPart);
+
+        m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_hMapping == nullptr)
+        { return false; }
+
+        m_pData = static_cast<const uint8_t*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_pData == nullptr)
+        { return false; }
+
+        WIN32_MEMORY_RANGE_ENTRY range = {};
+        range.VirtualAddress = const_cast<uint8_t*>(m_pData);
+        range.NumberOfBytes  = m_Size;
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    //      マップを解除します.
+    //-------------------------------------------------------------------------
+    void Close()
+    {
+        if (m_pData != nullptr)
+        {
+            UnmapViewOfFile(m_pData);
+            m_pData = nullptr;
+        }
+        if (m_hMapping != nullptr)
+        {
+            CloseHandle(m_hMapping);
+            m_hMapping = nullptr;
+        }
+        if (m_hFile != nullptr)
+        {
+            CloseHandle(m_hFile);
+            m_hFile = nullptr;
+        }
+        m_Size = 0;
+    }
+
+    const uint8_t* GetData() const { return m_pData; }
+    size_t         GetSize() const { return m_Size; }
+
+private:
+    HANDLE          m_hFile     = nullptr;
+    HANDLE          m_hMapping  = nullptr;
+    const uint8_t*  m_pData     = nullptr;
+    size_t          m_Size      = 0;
+};
+
+//-----------------------------------------------------------------------------
+//      バッチの 1 項目を展開します.
+//-----------------------------------------------------------------------------
+void DecodeItem(const rtc::PngBatchDesc& desc, uint32_t index, rtc::PngBatchItem& item, Scratch& scratch)
+{
+    rtc::Timer timer;
+    timer.Start();
+
+    MappedFile file;
+    auto pData = static_cast<const uint8_t*>(item.pData);
+    auto size  = item.DataSize;
+    if (item.pPath != nullptr)
+    {
+        if (!file.Open(item.pPath))
+        {
+            RTC_ELOG("Error : PNG file open failed. path = %s", item.pPath);
+            item.Result = rtc::PNG_FILE_ERROR;
+            return;
+        }
+        pData = file.GetData();
+        size  = file.GetSize();
+    }
+    item.FileBytes = size;
+
+    timer.End();
+    item.ReadMsec = timer.GetElapsedMsec();
+    timer.Start();
+
+    if (item.Channels == 0 || item.Channels > 4)
+    {
+        item.Result = rtc::PNG_INVALID_ARG;
+        return;
+    }
+
+    // 出力先が無ければヘッダを読んでから確保してもらいます.
+    if (item.pDst == nullptr && desc.Alloc != nullptr)
+    {
+        PngHeader header;
+        item.Result = ParsePng(pData, size, header, false);
+        if (item.Result != rtc::PNG_OK)
+        { return; }
+
+        item.Info     = header.Info;
+        item.RowPitch = size_t(item.Info.Width) * item.Channels;
+        item.DstSize  = item.RowPitch * item.Info.Height;
+        item.pDst     = desc.Alloc(desc.pUser, index, item.Info, item.Channels, item.RowPitch, item.DstSize);
+    }
+
+    item.Result = DecodePngInternal(pData, size, item.Channels, item.pDst, item.RowPitch, item.DstSize, &item.Info, scratch);
+
+    timer.End();
+    item.DecodeMsec = timer.GetElapsedMsec();
+    if (item.Result == rtc::PNG_OK)
+    { item.DecodedBytes = size_t(item.Info.Width) * item.Info.Height * item.Channels; }
+}
+
+} // namespace
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+//      PNG のヘッダを読み取ります.
+//-----------------------------------------------------------------------------
+PNG_RESULT GetPngInfo(const void* pData, size_t size, PngInfo& info)
+{
+    PngHeader header;
+    auto result = ParsePng(static_cast<const uint8_t*>(pData), size, header, false);
+    if (result != PNG_OK)
+    { return result; }
+
+    uint32_t w, h, c;
+    header.Info.IsFpng = (size <= UINT32_MAX)
+        && fpng::fpng_get_info(pData, uint32_t(size), w, h, c) == fpng::FPNG_DECODE_SUCCESS;
+
+    info = header.Info;
+    return PNG_OK;
+}
+
+//-----------------------------------------------------------------------------
+//      PNG を呼び出し側のメモリへ直接展開します.
+//-----------------------------------------------------------------------------
+PNG_RESULT DecodePng
+(
+    const void* pData,
+    size_t      size,
+    uint32_t    channels,
+    void*       pDst,
+    size_t      rowPitch,
+    size_t      dstSize,
+    PngInfo*    pInfo
+)
+{
+    Scratch scratch;
+    return DecodePngInternal(pData, size, channels, pDst, rowPitch, dstSize, pInfo, scratch);
+}
+
+//-----------------------------------------------------------------------------
+//      複数の PNG をスレッドプールで並列に展開します.
+//-----------------------------------------------------------------------------
+PngBatchStats DecodePngBatch(const PngBatchDesc& desc, PngBatchItem* pItems, uint32_t count)
+{
+    PngBatchStats stats;
+    if (pItems == nullptr || count == 0)
+    { return stats; }
+
+    auto threadCount = (desc.ThreadCount > 0) ? desc.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = std::min(threadCount, count);
+
+    Timer timer;
+    timer.Start();
+
+    // サイズの分かるメモリ上の項目は大きい順に取り出して, 末尾で 1 スレッドだけが残る時間を減らします.
+    std::vector<uint32_t> order(count);
+    for(auto i=0u; i<count; ++i)
+    {
+        order[i] = i;
+        if (pItems[i].pPath == nullptr)
+        { pItems[i].FileBytes = pItems[i].DataSize; }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t lhs, uint32_t rhs)
+    { return pItems[lhs].FileBytes > pItems[rhs].FileBytes; });
+
+    std::atomic<uint32_t> nextItem = {};
+    auto worker = [&]()
+    {
+        Scratch scratch;
+        for(;;)
+        {
+            auto index = nextItem.fetch_add(1, std::memory_order_relaxed);
+            if (index >= count)
+            { break; }
+
+            auto itemIndex = order[index];
+            DecodeItem(desc, itemIndex, pItems[itemIndex], scratch);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for(auto i=1u; i<threadCount; ++i)
+    { threads.emplace_back(worker); }
+
+    worker();
+
+    for(auto& thread : threads)
+    { thread.join(); }
+
+    timer.End();
+
+    stats.FileCount   = count;
+    stats.ThreadCount = threadCount;
+    stats.WallMsec    = timer.GetElapsedMsec();
+    for(auto i=0u; i<count; ++i)
+    {
+        auto& item = pItems[i];
+        if (item.Result != PNG_OK)
+        {
+            stats.FailedCount++;
+            continue;
+        }
+        if (item.Info.IsFpng)
+        { stats.FpngCount++; }
+        stats.FileBytes    += item.FileBytes;
+        stats.DecodedBytes += item.DecodedBytes;
+        stats.ReadMsec     += item.ReadMsec;
+        stats.DecodeMsec   += item.DecodeMsec;
+    }
+
+    return stats;
+}
+
+//-----------------------------------------------------------------------------
+//      結果の名前を取得します.
+//-----------------------------------------------------------------------------
+const char* GetPngResultName(PNG_RESULT result)
+{
+    switch(result)
+    {
+    case PNG_OK:                return "ok";
+    case PNG_INVALID_ARG:       return "invalid argument";
+    case PNG_FILE_ERROR:        return "file error";
+    case PNG_NOT_PNG:           return "not png";
+    case PNG_CORRUPT:           return "corrupt";
+    case PNG_UNSUPPORTED:       return "unsupported";
+    case PNG_NO_DESTINATION:    return "no destination";
+    default:                    return "unknown";
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PngBatchStats structure
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      デバッグログに出力します.
+//-----------------------------------------------------------------------------
+void PngBatchStats::Print(const PngBatchItem* pItems, uint32_t count) const
+{
+    RTC_DLOG("PngBatch : %u files (%u failed, %u fpng), %u threads, input = %.2lf MB, output = %.2lf MB, wall = %.3lf msec, %.1lf MB/sec",
+        FileCount, FailedCount, FpngCount, ThreadCount,
+        double(FileBytes)    / (1024.0 * 1024.0),
+        double(DecodedBytes) / (1024.0 * 1024.0),
+        WallMsec, GetMBytesPerSec());
+
+    if (pItems == nullptr)
+    { return; }
+
+    for(auto i=0u; i<count; ++i)
+    {
+        auto& item = pItems[i];
+        RTC_DLOG("  [%3u] %-40s : %5u x %-5u %ubit ct%u%s -> %uch (%s%s)",
+            i,
+            (item.pPath != nullptr) ? item.pPath : "<memory>",
+            item.Info.Width, item.Info.Height, item.Info.BitDepth, item.Info.ColorType,
+            item.Info.Interlaced ? " adam7" : "",
+            item.Channels,
+            GetPngResultName(item.Result),
+            item.Info.IsFpng ? ", fpng" : "");
+        RTC_DLOG("        read = %8.3lf msec, decode = %8.3lf msec, %8.1lf MB/sec",
+            item.ReadMsec,
+            item.DecodeMsec,
+            item.GetDecodeMBytesPerSec());
+        RTC_UNUSED(item);
+    }
+}
+
+} // namespace rtc
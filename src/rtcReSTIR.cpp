@@ -0,0 +1,494 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcReSTIR.cpp
+// Desc : Reservoir-based Spatio-Temporal Importance Resampling.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcReSTIR.h>
+#include <rtcRandom.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <thread>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr float kNormalThreshold    = 0.9f;     // 再利用を許す法線の類似度.
+constexpr float kDepthThreshold     = 0.1f;     // 再利用を許す深度の相対誤差.
+
+//-----------------------------------------------------------------------------
+//      候補を1つ追加します. 選択された場合は true を返します.
+//-----------------------------------------------------------------------------
+bool UpdateReservoir(rtc::Reservoir& r, const rtc::Reservoir& candidate, float weight, float m, float u)
+{
+    r.WeightSum += weight;
+    r.M         += m;
+
+    if (weight > 0.0f && u * r.WeightSum < weight)
+    {
+        r.LightIndex = candidate.LightIndex;
+        r.LightUV    = candidate.LightUV;
+        r.TargetPdf  = candidate.TargetPdf;
+        return true;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+//      寄与重み W を確定させます.
+//-----------------------------------------------------------------------------
+void FinalizeReservoir(rtc::Reservoir& r)
+{
+    r.W = (r.TargetPdf > 0.0f && r.M > 0.0f)
+        ? r.WeightSum / (r.M * r.TargetPdf)
+        : 0.0f;
+}
+
+//-----------------------------------------------------------------------------
+//      再利用可能なサーフェイスかどうかチェックします.
+//-----------------------------------------------------------------------------
+bool IsSimilar(const rtc::ReSTIRSurface& a, const rtc::ReSTIRSurface& b)
+{
+    if (!a.Valid || !b.Valid)
+    { return false; }
+
+    if (rtc::Dot(a.Normal, b.Normal) < kNormalThreshold)
+    { return false; }
+
+    return fabsf(a.ViewDepth - b.ViewDepth) <= kDepthThreshold * std::max(a.ViewDepth, 1e-4f);
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// ReSTIR class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      初期化処理を行います.
+//-----------------------------------------------------------------------------
+bool ReSTIR::Init(const ReSTIRDesc& desc, const LightBvh* pLights)
+{
+    if (pLights == nullptr || desc.Width == 0 || desc.Height == 0)
+    { return false; }
+
+    m_Desc    = desc;
+    m_pLights = pLights;
+
+    auto count = size_t(desc.Width) * desc.Height;
+    m_Reservoirs[0].assign(count, Reservoir());
+    m_Reservoirs[1].assign(count, Reservoir());
+    m_Spatial      .assign(count, Reservoir());
+    m_Memory.Set((m_Reservoirs[0].capacity() + m_Reservoirs[1].capacity() + m_Spatial.capacity()) * sizeof(Reservoir));
+
+    m_Current    = 0;
+    m_HasHistory = false;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      終了処理を行います.
+//-----------------------------------------------------------------------------
+void ReSTIR::Term()
+{
+    std::vector<Reservoir>().swap(m_Reservoirs[0]);
+    std::vector<Reservoir>().swap(m_Reservoirs[1]);
+    std::vector<Reservoir>().swap(m_Spatial);
+    m_Memory.Set(0);
+    m_pLights    = nullptr;
+    m_HasHistory = false;
+}
+
+//-----------------------------------------------------------------------------
+//      行単位で並列実行します.
+//-----------------------------------------------------------------------------
+template<typename Func>
+void ReSTIR::ParallelRows(Func func) const
+{
+    auto threadCount = (m_Desc.ThreadCount > 0) ? m_Desc.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = std::min(threadCount, m_Desc.Height);
+
+    std::atomic<uint32_t> nextRow = {};
+    auto worker = [&]()
+    {
+        for(;;)
+        {
+            auto y = nextRow.fetch_add(1, std::memory_order_relaxed);
+            if (y >= m_Desc.Height)
+            { break; }
+
+            for(auto x=0u; x<m_Desc.Width; ++x)
+            { func(x, y); }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for(auto i=1u; i<threadCount; ++i)
+    { threads.emplace_back(worker); }
+
+    worker();
+
+    for(auto& thread : threads)
+    { thread.join(); }
+}
+
+//-----------------------------------------------------------------------------
+//      ReSTIR による直接光計算を実行します.
+//-----------------------------------------------------------------------------
+ReSTIRStats ReSTIR::Execute(const ReSTIRFrame& frame, float3* pOutput)
+{
+    ReSTIRStats result;
+    if (frame.pSurfaces == nullptr || frame.Visibility == nullptr || pOutput == nullptr)
+    { return result; }
+
+    Timer timer;
+    timer.Start();
+
+    std::atomic<uint64_t> rays = {};
+    auto& current = m_Reservoirs[m_Current];
+
+    // 初期候補生成と時間方向の再利用.
+    auto enableTemporal = m_Desc.EnableTemporal && m_HasHistory && (frame.pPrevSurfaces != nullptr);
+    ParallelRows([&](uint32_t x, uint32_t y)
+    {
+        Reservoir r;
+        InitialSampling(frame, x, y, r);
+        if (enableTemporal)
+        { TemporalReuse(frame, x, y, r); }
+        current[size_t(y) * m_Desc.Width + x] = r;
+    });
+
+    // 空間方向の再利用.
+    if (m_Desc.EnableSpatial && m_Desc.SpatialNeighbors > 0)
+    {
+        ParallelRows([&](uint32_t x, uint32_t y)
+        {
+            auto r = current[size_t(y) * m_Desc.Width + x];
+            SpatialReuse(frame, x, y, r);
+            m_Spatial[size_t(y) * m_Desc.Width + x] = r;
+        });
+        current.swap(m_Spatial);
+    }
+
+    // 選択されたサンプルだけ遮蔽判定してシェーディング.
+    ParallelRows([&](uint32_t x, uint32_t y)
+    {
+        auto index = size_t(y) * m_Desc.Width + x;
+        pOutput[index] = Shade(frame, x, y, current[index], rays);
+    });
+
+    // 次フレームの履歴にする.
+    m_Current    ^= 1;
+    m_HasHistory  = true;
+
+    timer.End();
+    result.ElapsedMsec = timer.GetElapsedMsec();
+    result.ShadowRays  = rays.load();
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      比較用に通常の Next Event Estimation を実行します.
+//-----------------------------------------------------------------------------
+ReSTIRStats ReSTIR::ExecuteNEE(const ReSTIRFrame& frame, uint32_t samplesPerPixel, float3* pOutput)
+{
+    ReSTIRStats result;
+    if (frame.pSurfaces == nullptr || frame.Visibility == nullptr || pOutput == nullptr || samplesPerPixel == 0)
+    { return result; }
+
+    Timer timer;
+    timer.Start();
+
+    std::atomic<uint64_t> rays = {};
+    ParallelRows([&](uint32_t x, uint32_t y)
+    {
+        auto  index   = size_t(y) * m_Desc.Width + x;
+        auto& surface = frame.pSurfaces[index];
+
+        float3 radiance(0.0f);
+        if (surface.Valid)
+        {
+            Random rng(x, y, frame.FrameIndex);
+            uint64_t count = 0;
+            for(auto i=0u; i<samplesPerPixel; ++i)
+            {
+                auto u0 = rng.GetAsF32();
+                auto u1 = rng.GetAsF32();
+                auto u2 = rng.GetAsF32();
+
+                Reservoir sample;
+                float pdf = 0.0f;
+                if (!SampleLight(surface, u0, u1, u2, sample, pdf))
+                { continue; }
+
+                float3 contribution, lightPos;
+                if (EvaluateTarget(surface, sample, &contribution, &lightPos) <= 0.0f)
+                { continue; }
+
+                count++;
+                if (frame.Visibility(frame.pUser, surface.Position, surface.Normal, lightPos))
+                { radiance += contribution / pdf; }
+            }
+            rays.fetch_add(count, std::memory_order_relaxed);
+            radiance *= 1.0f / float(samplesPerPixel);
+        }
+
+        pOutput[index] = radiance;
+    });
+
+    timer.End();
+    result.ElapsedMsec = timer.GetElapsedMsec();
+    result.ShadowRays  = rays.load();
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      平均二乗誤差を求めます.
+//-----------------------------------------------------------------------------
+double ReSTIR::CalcMeanSquaredError(const float3* pImage, const float3* pReference, size_t count)
+{
+    if (pImage == nullptr || pReference == nullptr || count == 0)
+    { return 0.0; }
+
+    double sum = 0.0;
+    for(size_t i=0; i<count; ++i)
+    {
+        auto d = pImage[i] - pReference[i];
+        sum += double(Dot(d, d)) / 3.0;
+    }
+
+    return sum / double(count);
+}
+
+//-----------------------------------------------------------------------------
+//      目標分布 p^ (遮蔽なしの寄与の輝度) を評価します.
+//-----------------------------------------------------------------------------
+float ReSTIR::EvaluateTarget
+(
+    const ReSTIRSurface&    surface,
+    const Reservoir&        r,
+    float3*                 pRadiance,
+    float3*                 pLightPos
+) const
+{
+    if (r.LightIndex >= m_pLights->GetLightCount())
+    { return 0.0f; }
+
+    const auto& light = m_pLights->GetLight(r.LightIndex);
+    auto b0 = 1.0f - r.LightUV.x - r.LightUV.y;
+    auto lp = light.Position[0] * b0 + light.Position[1] * r.LightUV.x + light.Position[2] * r.LightUV.y;
+    auto nl = Normalize(Cross(light.Position[1] - light.Position[0], light.Position[2] - light.Position[0]));
+
+    auto wi = lp - surface.Position;
+    auto d2 = Dot(wi, wi);
+    if (d2 <= 0.0f)
+    { return 0.0f; }
+    wi = wi / sqrtf(d2);
+
+    auto cosS = Dot(surface.Normal, wi);
+    auto cosL = -Dot(nl, wi);
+    if (light.TwoSided)
+    { cosL = fabsf(cosL); }
+    if (cosS <= 0.0f || cosL <= 0.0f)
+    { return 0.0f; }
+
+    // Lambert BRDF と幾何項.
+    auto radiance = light.Emission * surface.Albedo * (F_1DIVPI * cosS * cosL / d2);
+
+    if (pRadiance != nullptr)
+    { *pRadiance = radiance; }
+    if (pLightPos != nullptr)
+    { *pLightPos = lp; }
+
+    return Luminance(radiance);
+}
+
+//-----------------------------------------------------------------------------
+//      ライト上の点をサンプリングします. sourcePdf は面積測度です.
+//-----------------------------------------------------------------------------
+bool ReSTIR::SampleLight
+(
+    const ReSTIRSurface&    surface,
+    float                   u0,
+    float                   u1,
+    float                   u2,
+    Reservoir&              sample,
+    float&                  sourcePdf
+) const
+{
+    LightSample ls;
+    if (!m_pLights->Sample(surface.Position, surface.Normal, u0, ls))
+    { return false; }
+
+    const auto& light = m_pLights->GetLight(ls.LightIndex);
+    auto area = Length(Cross(light.Position[1] - light.Position[0], light.Position[2] - light.Position[0])) * 0.5f;
+    if (area <= 0.0f)
+    { return false; }
+
+    // 三角形上の一様サンプリング.
+    auto su = sqrtf(u1);
+    sample.LightIndex = ls.LightIndex;
+    sample.LightUV    = float2(1.0f - su, u2 * su);
+
+    sourcePdf = ls.Pmf / area;
+    return sourcePdf > 0.0f;
+}
+
+//-----------------------------------------------------------------------------
+//      初期候補から RIS でサンプルを選びます.
+//-----------------------------------------------------------------------------
+void ReSTIR::InitialSampling
+(
+    const ReSTIRFrame&      frame,
+    uint32_t                x,
+    uint32_t                y,
+    Reservoir&              result
+) const
+{
+    result = Reservoir();
+    auto& surface = frame.pSurfaces[size_t(y) * m_Desc.Width + x];
+    if (!surface.Valid)
+    { return; }
+
+    Random rng(x, y, frame.FrameIndex);
+
+    for(auto i=0u; i<m_Desc.CandidateCount; ++i)
+    {
+        auto u0 = rng.GetAsF32();
+        auto u1 = rng.GetAsF32();
+        auto u2 = rng.GetAsF32();
+        auto us = rng.GetAsF32();
+
+        Reservoir candidate;
+        float sourcePdf = 0.0f;
+        if (!SampleLight(surface, u0, u1, u2, candidate, sourcePdf))
+        {
+            result.M += 1.0f;
+            continue;
+        }
+
+        candidate.TargetPdf = EvaluateTarget(surface, candidate, nullptr, nullptr);
+        UpdateReservoir(result, candidate, candidate.TargetPdf / sourcePdf, 1.0f, us);
+    }
+
+    FinalizeReservoir(result);
+}
+
+//-----------------------------------------------------------------------------
+//      前フレームの Prev* 行列で再投影して時間方向に再利用します.
+//-----------------------------------------------------------------------------
+void ReSTIR::TemporalReuse(const ReSTIRFrame& frame, uint32_t x, uint32_t y, Reservoir& result) const
+{
+    auto& surface = frame.pSurfaces[size_t(y) * m_Desc.Width + x];
+    if (!surface.Valid)
+    { return; }
+
+    // 前フレームのスクリーン座標を求める. GeneratePinholeCameraRay() と同じく v は反転.
+    auto clip = Mul(frame.PrevProj, Mul(frame.PrevView, float4(surface.Position, 1.0f)));
+    if (clip.w <= 0.0f)
+    { return; }
+
+    auto u = (clip.x / clip.w) *  0.5f + 0.5f;
+    auto v = (clip.y / clip.w) * -0.5f + 0.5f;
+    auto px = int(floorf(u * float(m_Desc.Width)));
+    auto py = int(floorf(v * float(m_Desc.Height)));
+    if (px < 0 || py < 0 || px >= int(m_Desc.Width) || py >= int(m_Desc.Height))
+    { return; }
+
+    auto prevIndex = size_t(py) * m_Desc.Width + size_t(px);
+    if (!IsSimilar(surface, frame.pPrevSurfaces[prevIndex]))
+    { return; }
+
+    auto prev = m_Reservoirs[m_Current ^ 1][prevIndex];
+    prev.M = std::min(prev.M, m_Desc.TemporalMaxM * std::max(result.M, 1.0f));
+
+    Random rng(x + m_Desc.Width, y, frame.FrameIndex);
+
+    Reservoir combined;
+    UpdateReservoir(combined, result, result.TargetPdf * result.W * result.M, result.M, rng.GetAsF32());
+
+    auto target = prev;
+    target.TargetPdf = EvaluateTarget(surface, prev, nullptr, nullptr);
+    UpdateReservoir(combined, target, target.TargetPdf * prev.W * prev.M, prev.M, rng.GetAsF32());
+
+    FinalizeReservoir(combined);
+    result = combined;
+}
+
+//-----------------------------------------------------------------------------
+//      近傍ピクセルから空間方向に再利用します.
+//-----------------------------------------------------------------------------
+void ReSTIR::SpatialReuse(const ReSTIRFrame& frame, uint32_t x, uint32_t y, Reservoir& result) const
+{
+    auto& surface = frame.pSurfaces[size_t(y) * m_Desc.Width + x];
+    if (!surface.Valid)
+    { return; }
+
+    const auto& current = m_Reservoirs[m_Current];
+    Random rng(x + m_Desc.Width * 2, y, frame.FrameIndex);
+
+    Reservoir combined;
+    UpdateReservoir(combined, result, result.TargetPdf * result.W * result.M, result.M, rng.GetAsF32());
+
+    for(auto i=0u; i<m_Desc.SpatialNeighbors; ++i)
+    {
+        // 円盤内の一様な点.
+        auto r   = m_Desc.SpatialRadius * sqrtf(rng.GetAsF32());
+        auto phi = F_2PI * rng.GetAsF32();
+        auto nx  = int(x) + int(r * cosf(phi));
+        auto ny  = int(y) + int(r * sinf(phi));
+        if (nx < 0 || ny < 0 || nx >= int(m_Desc.Width) || ny >= int(m_Desc.Height))
+        { continue; }
+
+        auto index = size_t(ny) * m_Desc.Width + size_t(nx);
+        if (!IsSimilar(surface, frame.pSurfaces[index]))
+        { continue; }
+
+        auto neighbor = current[index];
+        neighbor.TargetPdf = EvaluateTarget(surface, neighbor, nullptr, nullptr);
+        UpdateReservoir(combined, neighbor, neighbor.TargetPdf * current[index].W * neighbor.M, neighbor.M, rng.GetAsF32());
+    }
+
+    FinalizeReservoir(combined);
+    result = combined;
+}
+
+//-----------------------------------------------------------------------------
+//      選択されたサンプルでシェーディングします.
+//-----------------------------------------------------------------------------
+float3 ReSTIR::Shade
+(
+    const ReSTIRFrame&      frame,
+    uint32_t                x,
+    uint32_t                y,
+    const Reservoir&        r,
+    std::atomic<uint64_t>&  rays
+) const
+{
+    auto& surface = frame.pSurfaces[size_t(y) * m_Desc.Width + x];
+    if (!surface.Valid || r.W <= 0.0f)
+    { return float3(0.0f); }
+
+    float3 radiance, lightPos;
+    if (EvaluateTarget(surface, r, &radiance, &lightPos) <= 0.0f)
+    { return float3(0.0f); }
+
+    rays.fetch_add(1, std::memory_order_relaxed);
+    if (!frame.Visibility(frame.pUser, surface.Position, surface.Normal, lightPos))
+    { return float3(0.0f); }
+
+    return radiance * r.W;
+}
+
+} // namespace rtc
@@ -0,0 +1,278 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcSceneParams.cpp
+// Desc : Scene Parameters Generation.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcSceneParams.h>
+#include <rtcSimd.h>
+#include <rtcLog.h>
+
+
+namespace {
+
+///////////////////////////////////////////////////////////////////////////////
+// double4x4 structure
+///////////////////////////////////////////////////////////////////////////////
+struct double4x4
+{
+    double m[4][4];
+};
+
+//-----------------------------------------------------------------------------
+//      倍精度に変換します.
+//-----------------------------------------------------------------------------
+double4x4 ToDouble(const rtc::float4x4& value)
+{
+    double4x4 result;
+    for(auto r=0; r<4; ++r)
+    for(auto c=0; c<4; ++c)
+    { result.m[r][c] = value.row[r][c]; }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      倍精度の行列の積を求めます.
+//-----------------------------------------------------------------------------
+double4x4 Mul(const double4x4& a, const double4x4& b)
+{
+    double4x4 result = {};
+    for(auto r=0; r<4; ++r)
+    for(auto c=0; c<4; ++c)
+    for(auto k=0; k<4; ++k)
+    { result.m[r][c] += a.m[r][k] * b.m[k][c]; }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      部分ピボット選択付きガウス・ジョルダン法で逆行列を求めます.
+//-----------------------------------------------------------------------------
+double4x4 Inverse(const double4x4& value)
+{
+    double a[4][8];
+    for(auto r=0; r<4; ++r)
+    for(auto c=0; c<4; ++c)
+    {
+        a[r][c]     = value.m[r][c];
+        a[r][c + 4] = (r == c) ? 1.0 : 0.0;
+    }
+
+    for(auto c=0; c<4; ++c)
+    {
+        auto pivot = c;
+        for(auto r=c + 1; r<4; ++r)
+        {
+            if (fabs(a[r][c]) > fabs(a[pivot][c]))
+            { pivot = r; }
+        }
+        for(auto k=0; k<8; ++k)
+        { std::swap(a[c][k], a[pivot][k]); }
+
+        auto inv = 1.0 / a[c][c];
+        for(auto k=0; k<8; ++k)
+        { a[c][k] *= inv; }
+
+        for(auto r=0; r<4; ++r)
+        {
+            if (r == c)
+            { continue; }
+            auto s = a[r][c];
+            for(auto k=0; k<8; ++k)
+            { a[r][k] -= s * a[c][k]; }
+        }
+    }
+
+    double4x4 result;
+    for(auto r=0; r<4; ++r)
+    for(auto c=0; c<4; ++c)
+    { result.m[r][c] = a[r][c + 4]; }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      倍精度の透視投影行列を求めます.
+//-----------------------------------------------------------------------------
+double4x4 CreatePerspectiveFovRH(double fovY, double aspect, double nearClip, double farClip, const rtc::float2& jitter)
+{
+    auto yScale = 1.0 / tan(fovY * 0.5);
+    auto xScale = yScale / aspect;
+    auto range  = farClip / (nearClip - farClip);
+
+    double4x4 result = {};
+    result.m[0][0] = xScale;
+    result.m[0][2] = -jitter.x;
+    result.m[1][1] = yScale;
+    result.m[1][2] = -jitter.y;
+    result.m[2][2] = range;
+    result.m[2][3] = range * nearClip;
+    result.m[3][2] = -1.0;
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      最大相対誤差を求めます.
+//-----------------------------------------------------------------------------
+double CalcError(const rtc::float4x4& value, const double4x4& reference, bool transposed)
+{
+    auto scale = 1.0;
+    for(auto r=0; r<4; ++r)
+    for(auto c=0; c<4; ++c)
+    { scale = std::max(scale, fabs(reference.m[r][c])); }
+
+    auto result = 0.0;
+    for(auto r=0; r<4; ++r)
+    for(auto c=0; c<4; ++c)
+    {
+        auto v = transposed ? value.row[c][r] : value.row[r][c];
+        result = std::max(result, fabs(v - reference.m[r][c]) / scale);
+    }
+    return result;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+//      右手系の透視投影行列を求めます.
+//-----------------------------------------------------------------------------
+float4x4 CreatePerspectiveFovRH(float fovY, float aspect, float nearClip, float farClip, const float2& jitter)
+{
+    auto yScale = 1.0f / tanf(fovY * 0.5f);
+    auto xScale = yScale / aspect;
+    auto range  = farClip / (nearClip - farClip);
+
+    // w = -z なので, NDC を +jitter ずらすには z の係数に -jitter を入れる.
+    return float4x4(
+        float4(xScale, 0.0f,   -jitter.x, 0.0f),
+        float4(0.0f,   yScale, -jitter.y, 0.0f),
+        float4(0.0f,   0.0f,   range,     range * nearClip),
+        float4(0.0f,   0.0f,   -1.0f,     0.0f));
+}
+
+//-----------------------------------------------------------------------------
+//      全フレームの SceneParameters を生成します.
+//-----------------------------------------------------------------------------
+bool GenerateSceneParameters
+(
+    const SceneParamsDesc&  desc,
+    const CameraFrame*      pCameras,
+    uint32_t                frameCount,
+    SceneParameters*        pResult
+)
+{
+    if (pCameras == nullptr || pResult == nullptr || frameCount == 0 || desc.Width == 0 || desc.Height == 0)
+    { return false; }
+
+    auto aspect = float(desc.Width) / float(desc.Height);
+    auto screen = float4(float(desc.Width), float(desc.Height), 1.0f / float(desc.Width), 1.0f / float(desc.Height));
+
+    // 前フレームの値は直前に求めた行列を再利用する. 先頭フレームは自身を前フレームとする.
+    float4x4 prev[5] = {};
+
+    for(auto f=0u; f<frameCount; ++f)
+    {
+        auto& camera = pCameras[f];
+        auto  jitter = (desc.pJitters != nullptr) ? desc.pJitters[f] : float2(0.0f, 0.0f);
+
+        float4x4 curr[5];
+        auto& view        = curr[0];
+        auto& proj        = curr[1];
+        auto& invView     = curr[2];
+        auto& invProj     = curr[3];
+        auto& invViewProj = curr[4];
+
+        invView     = camera.InvView;
+        view        = InverseAffineSimd(invView);
+        proj        = CreatePerspectiveFovRH(camera.FovY, aspect, desc.NearClip, desc.FarClip, jitter);
+        invProj     = InverseProjectionSimd(proj);
+        invViewProj = MulSimd(invView, invProj);    // (P V)^-1 = V^-1 P^-1.
+
+        if (f == 0)
+        {
+            for(auto i=0; i<5; ++i)
+            { prev[i] = curr[i]; }
+        }
+
+        auto& dst = pResult[f];
+        float4x4* dstCurr[5] = { &dst.View,     &dst.Proj,     &dst.InvView,     &dst.InvProj,     &dst.InvViewProj };
+        float4x4* dstPrev[5] = { &dst.PrevView, &dst.PrevProj, &dst.PrevInvView, &dst.PrevInvProj, &dst.PrevInvViewProj };
+        for(auto i=0; i<5; ++i)
+        {
+            *dstCurr[i] = desc.TransposeForHlsl ? TransposeSimd(curr[i]) : curr[i];
+            *dstPrev[i] = desc.TransposeForHlsl ? TransposeSimd(prev[i]) : prev[i];
+            prev[i] = curr[i];
+        }
+
+        // カメラは -Z 方向を向く.
+        dst.ScreenSize          = screen;
+        dst.CameraDir           = Normalize(float3(-invView.row[0].z, -invView.row[1].z, -invView.row[2].z));
+        dst.MaxIteration        = desc.MaxIteration;
+        dst.FrameIndex          = f;
+        dst.AnimationTime       = float(f / desc.FPS);
+        dst.EnableAccumulation  = desc.EnableAccumulation ? 1 : 0;
+        dst.AccumulatedFrames   = 0;
+        dst.DebugRayIndex[0]    = -1;
+        dst.DebugRayIndex[1]    = -1;
+        dst.MinBounce           = desc.MinBounce;
+        dst.RouletteThreshold   = desc.RouletteThreshold;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      倍精度の参照値と比較します.
+//-----------------------------------------------------------------------------
+double ValidateSceneParameters
+(
+    const SceneParamsDesc&  desc,
+    const CameraFrame*      pCameras,
+    uint32_t                frameCount,
+    const SceneParameters*  pParams
+)
+{
+    if (pCameras == nullptr || pParams == nullptr)
+    { return 0.0; }
+
+    auto aspect = double(desc.Width) / double(desc.Height);
+    auto error  = 0.0;
+    auto t      = desc.TransposeForHlsl;
+
+    for(auto f=0u; f<frameCount; ++f)
+    {
+        auto& camera = pCameras[f];
+        auto  jitter = (desc.pJitters != nullptr) ? desc.pJitters[f] : float2(0.0f, 0.0f);
+
+        auto invView = ToDouble(camera.InvView);
+        auto view    = Inverse(invView);
+        auto proj    = ::CreatePerspectiveFovRH(camera.FovY, aspect, desc.NearClip, desc.FarClip, jitter);
+        auto invProj = Inverse(proj);
+        auto invVP   = Inverse(Mul(proj, view));
+
+        auto& params = pParams[f];
+        error = std::max(error, CalcError(params.View,        view,    t));
+        error = std::max(error, CalcError(params.Proj,        proj,    t));
+        error = std::max(error, CalcError(params.InvView,     invView, t));
+        error = std::max(error, CalcError(params.InvProj,     invProj, t));
+        error = std::max(error, CalcError(params.InvViewProj, invVP,   t));
+
+        if (f > 0)
+        {
+            auto& prev = pParams[f - 1];
+            if (memcmp(&params.PrevView, &prev.View, sizeof(float4x4) * 5) != 0)
+            {
+                RTC_ELOG("Error : Prev matrices are not matched. frame = %u", f);
+                return DBL_MAX;
+            }
+        }
+    }
+
+    return error;
+}
+
+} // namespace rtc
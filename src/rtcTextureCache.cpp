@@ -0,0 +1,561 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcTextureCache.cpp
+// Desc : Tiled Texture Cache.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcTextureCache.h>
+#include <rtcTimer.h>
+#include <rtcLog.h>
+#include <rtcMemoryTracker.h>
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+//      キーを生成します.
+//-----------------------------------------------------------------------------
+inline uint64_t MakeKey(uint32_t textureId, uint32_t mipLevel, uint32_t tileX, uint32_t tileY)
+{
+    return (uint64_t(textureId & 0xFFFFF) << 44)
+         | (uint64_t(mipLevel  & 0xF)     << 40)
+         | (uint64_t(tileY     & 0xFFFFF) << 20)
+         | (uint64_t(tileX     & 0xFFFFF));
+}
+
+//-----------------------------------------------------------------------------
+//      キーをハッシュ値に変換します.
+//-----------------------------------------------------------------------------
+inline uint32_t HashKey(uint64_t key)
+{
+    // SplitMix64 の最終段.
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return uint32_t(key);
+}
+
+//-----------------------------------------------------------------------------
+//      2のべき乗に切り上げます.
+//-----------------------------------------------------------------------------
+inline uint32_t NextPow2(uint32_t value)
+{
+    uint32_t result = 1;
+    while (result < value)
+    { result <<= 1; }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      ミップレベル数を計算します.
+//-----------------------------------------------------------------------------
+inline uint32_t CalcMipLevels(uint32_t w, uint32_t h)
+{
+    uint32_t size   = std::max(w, h);
+    uint32_t result = 1;
+    while (size > 1)
+    {
+        size >>= 1;
+        result++;
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      呼び出したスレッドのカウンタ番号を取得します.
+//-----------------------------------------------------------------------------
+inline uint32_t GetCounterIndex()
+{
+    static std::atomic<uint32_t> s_NextIndex = {};
+    thread_local uint32_t index = s_NextIndex.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+} // namespace
+
+
+namespace rtc {
+
+///////////////////////////////////////////////////////////////////////////////
+// TextureCache class
+///////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+//      デストラクタです.
+//-----------------------------------------------------------------------------
+TextureCache::~TextureCache()
+{ Term(); }
+
+//-----------------------------------------------------------------------------
+//      初期化処理を行います.
+//-----------------------------------------------------------------------------
+bool TextureCache::Init(const TextureCacheDesc& desc)
+{
+    if (desc.TexelSize == 0)
+    { return false; }
+
+    m_TexelSize = desc.TexelSize;
+    m_TileBytes = kTileSize * kTileSize * m_TexelSize;
+
+    // 予算内に収まるタイル数を求める.
+    auto slotCount = uint32_t(std::max<size_t>(desc.BudgetBytes / m_TileBytes, 1));
+
+    m_pPool = static_cast<uint8_t*>(TaggedAlloc(MEMORY_TAG_TEXTURE, size_t(slotCount) * m_TileBytes, 64));
+    if (m_pPool == nullptr)
+    {
+        RTC_ELOG("Error : Out of memory.");
+        return false;
+    }
+
+    // タイルスロットを初期化.
+    {
+        std::vector<Slot> slots(slotCount);
+        m_Slots.swap(slots);
+        for(auto& slot : m_Slots)
+        {
+            slot.Key       .store(kEmptyKey, std::memory_order_relaxed);
+            slot.Generation.store(0,         std::memory_order_relaxed);
+            slot.Referenced.store(0,         std::memory_order_relaxed);
+        }
+    }
+
+    // 使用率が 50% を超えないようにテーブルサイズを決める.
+    {
+        auto tableSize = NextPow2(std::max(slotCount * 2, 1024u));
+        std::vector<Entry> table(tableSize);
+        m_Table.swap(table);
+        for(auto& entry : m_Table)
+        {
+            entry.Key .store(kEmptyKey, std::memory_order_relaxed);
+            entry.Slot.store(UINT32_MAX, std::memory_order_relaxed);
+        }
+        m_TableMask = tableSize - 1;
+    }
+
+    m_ClockHand = 0;
+    m_UsedSlots = 0;
+    m_TombCount = 0;
+
+    BeginFrame();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//      終了処理を行います.
+//-----------------------------------------------------------------------------
+void TextureCache::Term()
+{
+    if (m_pPool != nullptr)
+    {
+        TaggedFree(MEMORY_TAG_TEXTURE, m_pPool);
+        m_pPool = nullptr;
+    }
+
+    std::vector<Slot>().swap(m_Slots);
+    std::vector<Entry>().swap(m_Table);
+    m_Sources.clear();
+
+    m_TexelSize = 0;
+    m_TileBytes = 0;
+    m_TableMask = 0;
+    m_ClockHand = 0;
+    m_UsedSlots = 0;
+    m_TombCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+//      テクスチャを登録します.
+//-----------------------------------------------------------------------------
+uint32_t TextureCache::Register(const TextureSource& source)
+{
+    if (source.Width == 0 || source.Height == 0 || source.LoadTile == nullptr)
+    { return kInvalidTexture; }
+
+    // テクスチャ番号とタイル座標は 20bit ずつキーに詰めるので, 収まらないものは登録できない.
+    if (m_Sources.size() >= kMaxTextureCount)
+    {
+        RTC_ELOG("Error : TextureCache::Register() Failed. Too many textures (max = %u).", kMaxTextureCount);
+        return kInvalidTexture;
+    }
+
+    if ((source.Width - 1) / kTileSize >= kMaxTileCount || (source.Height - 1) / kTileSize >= kMaxTileCount)
+    {
+        RTC_ELOG("Error : TextureCache::Register() Failed. Texture is too large. size = %u x %u", source.Width, source.Height);
+        return kInvalidTexture;
+    }
+
+    auto desc = source;
+    auto maxLevels = CalcMipLevels(source.Width, source.Height);
+    desc.MipLevels = (source.MipLevels == 0) ? maxLevels : std::min(source.MipLevels, maxLevels);
+    desc.MipLevels = std::min(desc.MipLevels, 16u);
+
+    auto id = uint32_t(m_Sources.size());
+    m_Sources.push_back(desc);
+    return id;
+}
+
+//-----------------------------------------------------------------------------
+//      横幅を取得します.
+//-----------------------------------------------------------------------------
+uint32_t TextureCache::GetWidth(uint32_t textureId, uint32_t mipLevel) const
+{
+    assert(textureId < uint32_t(m_Sources.size()));
+    return std::max(m_Sources[textureId].Width >> mipLevel, 1u);
+}
+
+//-----------------------------------------------------------------------------
+//      縦幅を取得します.
+//-----------------------------------------------------------------------------
+uint32_t TextureCache::GetHeight(uint32_t textureId, uint32_t mipLevel) const
+{
+    assert(textureId < uint32_t(m_Sources.size()));
+    return std::max(m_Sources[textureId].Height >> mipLevel, 1u);
+}
+
+//-----------------------------------------------------------------------------
+//      ミップレベル数を取得します.
+//-----------------------------------------------------------------------------
+uint32_t TextureCache::GetMipLevels(uint32_t textureId) const
+{
+    assert(textureId < uint32_t(m_Sources.size()));
+    return m_Sources[textureId].MipLevels;
+}
+
+//-----------------------------------------------------------------------------
+//      テクセルを読み取ります.
+//-----------------------------------------------------------------------------
+bool TextureCache::Load(uint32_t textureId, uint32_t mipLevel, uint32_t x, uint32_t y, void* pTexel)
+{
+    if (textureId >= uint32_t(m_Sources.size()) || pTexel == nullptr)
+    { return false; }
+
+    mipLevel = std::min(mipLevel, m_Sources[textureId].MipLevels - 1);
+    if (x >= GetWidth(textureId, mipLevel) || y >= GetHeight(textureId, mipLevel))
+    { return false; }
+
+    auto key    = MakeKey(textureId, mipLevel, x / kTileSize, y / kTileSize);
+    auto offset = ((y % kTileSize) * kTileSize + (x % kTileSize)) * m_TexelSize;
+
+    // 自スレッドのカウンタにだけ書き込むので, 他スレッドとキャッシュラインを奪い合わない.
+    auto& counters = m_Counters[GetCounterIndex() % kCounterStripes];
+    counters.Lookups.fetch_add(1, std::memory_order_relaxed);
+
+    // ロックフリーで検索. シーケンスロックと同様に, 読み取りの前後で世代番号が一致した場合だけ採用する.
+    auto slot = Find(key);
+    if (slot != UINT32_MAX)
+    {
+        auto& s = m_Slots[slot];
+        auto gen = s.Generation.load(std::memory_order_acquire);
+        if ((gen & 0x1) == 0 && s.Key.load(std::memory_order_acquire) == key)
+        {
+            memcpy(pTexel, m_pPool + size_t(slot) * m_TileBytes + offset, m_TexelSize);
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (s.Generation.load(std::memory_order_relaxed) == gen)
+            {
+                s.Referenced.store(1, std::memory_order_relaxed);
+                counters.Hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+
+    // ミスした場合はロックを取って読み込む. ロック待ちもストールに含める.
+    Timer timer;
+    timer.Start();
+
+    bool result = false;
+    {
+        std::lock_guard<std::mutex> locker(m_Mutex);
+
+        slot = LoadTile(key);
+        if (slot != UINT32_MAX)
+        {
+            memcpy(pTexel, m_pPool + size_t(slot) * m_TileBytes + offset, m_TexelSize);
+            result = true;
+        }
+    }
+
+    timer.End();
+    m_StallTicks.fetch_add(uint64_t(timer.GetElapsedTicks()), std::memory_order_relaxed);
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      LODを指定してトライリニアサンプリングします(RGBA8のみ).
+//-----------------------------------------------------------------------------
+float4 TextureCache::SampleLevel(uint32_t textureId, const float2& uv, float lod)
+{
+    if (textureId >= uint32_t(m_Sources.size()) || m_TexelSize != 4)
+    { return float4(0.0f); }
+
+    auto maxLevel = float(m_Sources[textureId].MipLevels - 1);
+    lod = std::min(std::max(lod, 0.0f), maxLevel);
+
+    auto mip0 = uint32_t(lod);
+    auto frac = lod - float(mip0);
+
+    auto c0 = SampleBilinear(textureId, mip0, uv);
+    if (frac <= 0.0f || float(mip0) >= maxLevel)
+    { return c0; }
+
+    auto c1 = SampleBilinear(textureId, mip0 + 1, uv);
+    return Lerp(c0, c1, frac);
+}
+
+//-----------------------------------------------------------------------------
+//      指定ミップをバイリニアサンプリングします. アドレッシングはラップです.
+//-----------------------------------------------------------------------------
+float4 TextureCache::SampleBilinear(uint32_t textureId, uint32_t mipLevel, const float2& uv)
+{
+    auto w = GetWidth (textureId, mipLevel);
+    auto h = GetHeight(textureId, mipLevel);
+
+    auto fx = uv.x * float(w) - 0.5f;
+    auto fy = uv.y * float(h) - 0.5f;
+    auto ix = floorf(fx);
+    auto iy = floorf(fy);
+    auto tx = fx - ix;
+    auto ty = fy - iy;
+
+    auto Wrap = [](int64_t v, uint32_t size)
+    {
+        auto r = v % int64_t(size);
+        return uint32_t((r < 0) ? r + size : r);
+    };
+
+    auto x0 = Wrap(int64_t(ix),     w);
+    auto x1 = Wrap(int64_t(ix) + 1, w);
+    auto y0 = Wrap(int64_t(iy),     h);
+    auto y1 = Wrap(int64_t(iy) + 1, h);
+
+    auto Fetch = [&](uint32_t x, uint32_t y)
+    {
+        uint8_t texel[4] = {};
+        Load(textureId, mipLevel, x, y, texel);
+        return float4(texel[0], texel[1], texel[2], texel[3]) * (1.0f / 255.0f);
+    };
+
+    auto c0 = Lerp(Fetch(x0, y0), Fetch(x1, y0), tx);
+    auto c1 = Lerp(Fetch(x0, y1), Fetch(x1, y1), tx);
+    return Lerp(c0, c1, ty);
+}
+
+//-----------------------------------------------------------------------------
+//      フレーム統計をリセットします.
+//-----------------------------------------------------------------------------
+void TextureCache::BeginFrame()
+{
+    for(auto& counters : m_Counters)
+    {
+        counters.Lookups.store(0, std::memory_order_relaxed);
+        counters.Hits   .store(0, std::memory_order_relaxed);
+    }
+    m_TileLoads.store(0, std::memory_order_relaxed);
+    m_Evictions.store(0, std::memory_order_relaxed);
+    m_StallTicks.store(0, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+//      フレーム統計を取得します.
+//-----------------------------------------------------------------------------
+TextureCacheStats TextureCache::EndFrame()
+{
+    Timer             timer;
+    TextureCacheStats result;
+    for(auto& counters : m_Counters)
+    {
+        result.Lookups += counters.Lookups.load(std::memory_order_relaxed);
+        result.Hits    += counters.Hits   .load(std::memory_order_relaxed);
+    }
+    result.TileLoads     = m_TileLoads.load(std::memory_order_relaxed);
+    result.Evictions     = m_Evictions.load(std::memory_order_relaxed);
+    result.LoadedBytes   = result.TileLoads * m_TileBytes;
+    result.StallMsec     = double(m_StallTicks.load(std::memory_order_relaxed)) * timer.GetSecPerTick() * 1000.0;
+    result.ResidentBytes = size_t(m_UsedSlots) * m_TileBytes;
+
+    RTC_DLOG("TextureCache : hit rate = %.2lf%%, tile loads = %llu (%llu KB), evictions = %llu, stall = %.3lf msec, resident = %zu KB",
+        result.GetHitRate() * 100.0,
+        result.TileLoads,
+        result.LoadedBytes / 1024,
+        result.Evictions,
+        result.StallMsec,
+        result.ResidentBytes / 1024);
+
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+//      テーブルからスロット番号を検索します.
+//-----------------------------------------------------------------------------
+uint32_t TextureCache::Find(uint64_t key) const
+{
+    auto index = HashKey(key) & m_TableMask;
+    for(auto i=0u; i<=m_TableMask; ++i)
+    {
+        auto& entry = m_Table[index];
+        auto k = entry.Key.load(std::memory_order_acquire);
+        if (k == key)
+        { return entry.Slot.load(std::memory_order_relaxed); }
+
+        if (k == kEmptyKey)
+        { break; }
+
+        index = (index + 1) & m_TableMask;
+    }
+
+    return UINT32_MAX;
+}
+
+//-----------------------------------------------------------------------------
+//      タイルを読み込みます. 呼び出し側でロックを取っておく必要があります.
+//-----------------------------------------------------------------------------
+uint32_t TextureCache::LoadTile(uint64_t key)
+{
+    // 待っている間に他のスレッドが読み込んだかもしれない.
+    auto slot = Find(key);
+    if (slot != UINT32_MAX && m_Slots[slot].Key.load(std::memory_order_relaxed) == key)
+    { return slot; }
+
+    slot = (m_UsedSlots < uint32_t(m_Slots.size())) ? m_UsedSlots++ : EvictSlot();
+
+    // 世代番号を奇数にしてから書き込む. 読み取り中のスレッドは世代番号の変化で検出する.
+    auto& s = m_Slots[slot];
+    s.Generation.store(s.Generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    s.Key.store(kEmptyKey, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto textureId = uint32_t((key >> 44) & 0xFFFFF);
+    auto mipLevel  = uint32_t((key >> 40) & 0xF);
+    auto tileY     = uint32_t((key >> 20) & 0xFFFFF);
+    auto tileX     = uint32_t(key & 0xFFFFF);
+
+    auto& source = m_Sources[textureId];
+    auto  pDst   = m_pPool + size_t(slot) * m_TileBytes;
+
+    // 端のタイルは有効領域外をゼロで埋めておく.
+    memset(pDst, 0, m_TileBytes);
+    if (!source.LoadTile(source.pUser, mipLevel, tileX, tileY, pDst, kTileSize * m_TexelSize))
+    {
+        RTC_ELOG("Error : TextureSource::LoadTile() Failed. texture = %u, mip = %u, tile = (%u, %u)", textureId, mipLevel, tileX, tileY);
+        s.Generation.store(s.Generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return UINT32_MAX;
+    }
+
+    s.Referenced.store(1, std::memory_order_relaxed);
+    s.Key.store(key, std::memory_order_relaxed);
+    s.Generation.store(s.Generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    InsertEntry(key, slot);
+
+    m_TileLoads.fetch_add(1, std::memory_order_relaxed);
+
+    return slot;
+}
+
+//-----------------------------------------------------------------------------
+//      CLOCK法で追い出すスロットを決めます.
+//-----------------------------------------------------------------------------
+uint32_t TextureCache::EvictSlot()
+{
+    auto count = uint32_t(m_Slots.size());
+    for(;;)
+    {
+        auto  index = m_ClockHand;
+        auto& s     = m_Slots[index];
+        m_ClockHand = (m_ClockHand + 1) % count;
+
+        auto key = s.Key.load(std::memory_order_relaxed);
+        if (key == kEmptyKey)
+        { return index; }
+
+        // 最近参照されていれば猶予を与える.
+        if (s.Referenced.exchange(0, std::memory_order_relaxed) != 0)
+        { continue; }
+
+        s.Key.store(kEmptyKey, std::memory_order_release);
+        RemoveEntry(key);
+        m_Evictions.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      テーブルに追加します.
+//-----------------------------------------------------------------------------
+void TextureCache::InsertEntry(uint64_t key, uint32_t slot)
+{
+    auto index = HashKey(key) & m_TableMask;
+    for(auto i=0u; i<=m_TableMask; ++i)
+    {
+        auto& entry = m_Table[index];
+        auto k = entry.Key.load(std::memory_order_relaxed);
+        if (k == kEmptyKey || k == kTombKey)
+        {
+            if (k == kTombKey)
+            { m_TombCount--; }
+
+            entry.Slot.store(slot, std::memory_order_relaxed);
+            entry.Key .store(key,  std::memory_order_release);
+            return;
+        }
+
+        index = (index + 1) & m_TableMask;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      テーブルから削除します.
+//-----------------------------------------------------------------------------
+void TextureCache::RemoveEntry(uint64_t key)
+{
+    auto index = HashKey(key) & m_TableMask;
+    for(auto i=0u; i<=m_TableMask; ++i)
+    {
+        auto& entry = m_Table[index];
+        auto k = entry.Key.load(std::memory_order_relaxed);
+        if (k == key)
+        {
+            entry.Key.store(kTombKey, std::memory_order_release);
+            m_TombCount++;
+            break;
+        }
+
+        if (k == kEmptyKey)
+        { break; }
+
+        index = (index + 1) & m_TableMask;
+    }
+
+    // 墓標が増えすぎると探索が長くなるので作り直す.
+    if (m_TombCount > (m_TableMask + 1) / 4)
+    { RebuildTable(); }
+}
+
+//-----------------------------------------------------------------------------
+//      テーブルを再構築します.
+//-----------------------------------------------------------------------------
+void TextureCache::RebuildTable()
+{
+    // 再構築中の検索は取りこぼすが, ロック付きの再検索で拾われるので問題ない.
+    for(auto& entry : m_Table)
+    { entry.Key.store(kEmptyKey, std::memory_order_release); }
+
+    m_TombCount = 0;
+
+    for(auto i=0u; i<m_UsedSlots; ++i)
+    {
+        auto key = m_Slots[i].Key.load(std::memory_order_relaxed);
+        if (key != kEmptyKey)
+        { InsertEntry(key, i); }
+    }
+}
+
+} // namespace rtc
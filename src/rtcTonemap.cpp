@@ -0,0 +1,157 @@
+﻿//-----------------------------------------------------------------------------
+// File : rtcTonemap.cpp
+// Desc : HDR to LDR Conversion.
+// Copyright(c) Project Asura. All right reserved.
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Includes
+//-----------------------------------------------------------------------------
+#include <rtcTonemap.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Constant Values
+//-----------------------------------------------------------------------------
+constexpr uint32_t kLutBits = 12;
+constexpr uint32_t kLutSize = 1u << kLutBits;
+constexpr uint32_t kRowChunk = 16;     // スレッドが一度に取る行数.
+
+//-----------------------------------------------------------------------------
+//      [0, 1] のリニア値を sRGB に変換します.
+//-----------------------------------------------------------------------------
+inline float ToSrgb(float x)
+{ return (x <= 0.0031308f) ? x * 12.92f : 1.055f * powf(x, 1.0f / 2.4f) - 0.055f; }
+
+///////////////////////////////////////////////////////////////////////////////
+// SrgbLut structure (トーンマップ後の [0, 1] を sRGB 8bit に変換します)
+///////////////////////////////////////////////////////////////////////////////
+struct SrgbLut
+{
+    uint8_t Table[kLutSize];
+
+    SrgbLut()
+    {
+        for(auto i=0u; i<kLutSize; ++i)
+        {
+            auto x = (float(i) + 0.5f) / float(kLutSize);
+            auto s = ToSrgb(x);
+            Table[i] = uint8_t(std::min(std::max(s * 255.0f + 0.5f, 0.0f), 255.0f));
+        }
+    }
+};
+
+const SrgbLut g_SrgbLut;
+
+//-----------------------------------------------------------------------------
+//      ACES フィルミックカーブの近似です (Narkowicz 2015).
+//-----------------------------------------------------------------------------
+inline float Aces(float x)
+{
+    x = std::max(x, 0.0f);
+    return std::min((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 1.0f);
+}
+
+//-----------------------------------------------------------------------------
+//      [0, 1] を sRGB 8bit に変換します.
+//-----------------------------------------------------------------------------
+inline uint8_t ToSrgb8(float x)
+{
+    // NaN は 0 になる.
+    auto index = (x > 0.0f) ? uint32_t(std::min(x * float(kLutSize), float(kLutSize - 1))) : 0u;
+    return g_SrgbLut.Table[index];
+}
+
+} // namespace
+
+
+namespace rtc {
+
+//-----------------------------------------------------------------------------
+//      1画素をトーンマップします.
+//-----------------------------------------------------------------------------
+float3 TonemapPixel(const float3& color, float exposure)
+{
+    return float3(
+        Saturate(ToSrgb(Aces(color.x * exposure))),
+        Saturate(ToSrgb(Aces(color.y * exposure))),
+        Saturate(ToSrgb(Aces(color.z * exposure))));
+}
+
+//-----------------------------------------------------------------------------
+//      1行分をトーンマップします.
+//-----------------------------------------------------------------------------
+void TonemapRow(const TonemapDesc& desc, const float3* pSrc, uint32_t width, uint8_t* pDst)
+{
+    auto exposure = desc.Exposure;
+    if (desc.Channels == 4)
+    {
+        for(auto x=0u; x<width; ++x)
+        {
+            auto& c = pSrc[x];
+            pDst[x * 4 + 0] = ToSrgb8(Aces(c.x * exposure));
+            pDst[x * 4 + 1] = ToSrgb8(Aces(c.y * exposure));
+            pDst[x * 4 + 2] = ToSrgb8(Aces(c.z * exposure));
+            pDst[x * 4 + 3] = 255;
+        }
+    }
+    else
+    {
+        for(auto x=0u; x<width; ++x)
+        {
+            auto& c = pSrc[x];
+            pDst[x * 3 + 0] = ToSrgb8(Aces(c.x * exposure));
+            pDst[x * 3 + 1] = ToSrgb8(Aces(c.y * exposure));
+            pDst[x * 3 + 2] = ToSrgb8(Aces(c.z * exposure));
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//      画像全体をトーンマップします.
+//-----------------------------------------------------------------------------
+void Tonemap(const TonemapDesc& desc, const float3* pSrc, uint32_t width, uint32_t height, uint8_t* pDst)
+{
+    if (pSrc == nullptr || pDst == nullptr || width == 0 || height == 0)
+    { return; }
+
+    assert(desc.Channels == 3 || desc.Channels == 4);
+
+    auto chunkCount  = (height + kRowChunk - 1) / kRowChunk;
+    auto threadCount = (desc.ThreadCount > 0) ? desc.ThreadCount : std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = std::min(threadCount, chunkCount);
+
+    auto pitch = size_t(width) * desc.Channels;
+
+    std::atomic<uint32_t> nextChunk = {};
+    auto worker = [&]()
+    {
+        for(;;)
+        {
+            auto chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= chunkCount)
+            { break; }
+
+            auto end = std::min((chunk + 1) * kRowChunk, height);
+            for(auto y=chunk * kRowChunk; y<end; ++y)
+            { TonemapRow(desc, pSrc + size_t(y) * width, width, pDst + y * pitch); }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for(auto i=1u; i<threadCount; ++i)
+    { threads.emplace_back(worker); }
+
+    worker();
+
+    for(auto& thread : threads)
+    { thread.join(); }
+}
+
+} // namespace rtc